@@ -266,15 +266,98 @@ static void store_value(struct fdi_context *fdi_ctx, const char *value, size_t v
 	free(p);
 }
 
+/* reads back a string stored with store_key or store_value */
+static char *read_string(struct fdi_context *fdi_ctx, off_t offset, size_t len)
+{
+	char *p;
+
+	p = g_malloc0(len + 1);
+	if (pread(fdi_ctx->cache_fd, p, len, offset) != (ssize_t) len)
+		DIE(("Disk read error"));
+
+	return p;
+}
+
+/* stores a udi-property path split up into a struct rule_path, so the
+   daemon doesn't have to do it for every device; returns the size used */
+static size_t store_path(struct fdi_context *fdi_ctx, off_t offset, const char *path)
+{
+	struct rule_path rule_path;
+	GString *buf;
+	gchar **tokens;
+	size_t len;
+	int i;
+
+	tokens = g_strsplit(path, ":", 64);
+	for (i = 0; tokens[i] != NULL; i++)
+		;
+	rule_path.num_hops = i - 1;
+
+	buf = g_string_sized_new(sizeof(struct rule_path) + strlen(path) + 1);
+	g_string_append_len(buf, (const gchar *) &rule_path, sizeof(struct rule_path));
+	for (i = 0; tokens[i] != NULL; i++)
+		g_string_append_len(buf, tokens[i], strlen(tokens[i]) + 1);
+	len = buf->len;
+
+	pad32_write(fdi_ctx->cache_fd, offset, buf->str, len);
+
+	if (haldc_verbose)
+		HAL_INFO(("Storing path '%s' with %d hops at offset=%08lx",
+			path, rule_path.num_hops, offset));
+
+	g_string_free(buf, TRUE);
+	g_strfreev(tokens);
+	return ROUND32(len);
+}
+
 static void store_rule(struct fdi_context *fdi_ctx)
 {
+	off_t	path_position;
+	size_t	paths_len;
+	char	*str;
+
 	if (fdi_ctx->rule.rtype == RULE_UNKNOWN)
 		DIE(("I refuse to store garbage"));
 
+	/* keys and copy_property values like '@block.storage_device:storage.bus'
+	   are stored a second time, split up, after the value */
+	path_position = fdi_ctx->position + sizeof(struct rule) +
+		ROUND32(fdi_ctx->rule.key_len) + ROUND32(fdi_ctx->rule.value_len);
+	paths_len = 0;
+
+	if (fdi_ctx->rule.rtype == RULE_MATCH ||
+	    fdi_ctx->rule.rtype == RULE_MERGE ||
+	    fdi_ctx->rule.rtype == RULE_APPEND ||
+	    fdi_ctx->rule.rtype == RULE_PREPEND ||
+	    fdi_ctx->rule.rtype == RULE_ADDSET) {
+		str = read_string(fdi_ctx, fdi_ctx->position + sizeof(struct rule),
+			fdi_ctx->rule.key_len);
+		if (strchr(str, ':') != NULL) {
+			fdi_ctx->rule.key_path_offset = path_position + paths_len;
+			paths_len += store_path(fdi_ctx, fdi_ctx->rule.key_path_offset, str);
+		}
+		g_free(str);
+	}
+
+	if ((fdi_ctx->rule.rtype == RULE_MERGE ||
+	     fdi_ctx->rule.rtype == RULE_APPEND ||
+	     fdi_ctx->rule.rtype == RULE_PREPEND) &&
+	    fdi_ctx->rule.type_merge == MERGE_COPY_PROPERTY &&
+	    fdi_ctx->rule.value_len > 0) {
+		str = read_string(fdi_ctx, fdi_ctx->rule.value_offset,
+			fdi_ctx->rule.value_len);
+		if (strchr(str, ':') != NULL) {
+			fdi_ctx->rule.value_path_offset = path_position + paths_len;
+			paths_len += store_path(fdi_ctx, fdi_ctx->rule.value_path_offset, str);
+		}
+		g_free(str);
+	}
+
 	fdi_ctx->rule.rule_size =
 	  RULES_ROUND(sizeof(struct rule) +
 		      ROUND32(fdi_ctx->rule.key_len) +
-		      ROUND32(fdi_ctx->rule.value_len));
+		      ROUND32(fdi_ctx->rule.value_len) +
+		      paths_len);
 
 	pad32_write(fdi_ctx->cache_fd, fdi_ctx->position,
 		&fdi_ctx->rule, sizeof(struct rule));
@@ -691,6 +774,7 @@ di_rules_init (void)
 	}
 
 	header.all_rules_size = lseek(fd, 0, SEEK_END);
+	header.magic = HALD_CACHE_MAGIC;
 	pad32_write(fd, 0, &header, sizeof(struct cache_header));
 	close(fd);
 	if (rename (cachename_temp, cachename) != 0) {
@@ -37,22 +37,150 @@
 #include "logger.h"
 #include "hald_runner.h"
 
-static GSList *locked_devices = NULL;
+/* Lock registry
+ *
+ * locks_by_owner:  owner (D-Bus name) -> (HalDevice * -> number of locks held)
+ * locks_by_device: HalDevice *        -> (owner -> number of locks held)
+ *
+ * Devices are not referenced; hal_device_finalize() drops them from
+ * both indexes.
+ */
+static GHashTable *locks_by_owner = NULL;
+static GHashTable *locks_by_device = NULL;
+
+static HalDeviceLockStats lock_stats;
 
 static void
-add_to_locked_set (HalDevice *device)
+lock_registry_init (void)
 {
-        if (g_slist_find (locked_devices, device) != NULL)
-                return;
+	if (locks_by_owner != NULL)
+		return;
+
+	locks_by_owner = g_hash_table_new_full (g_str_hash,
+						g_str_equal,
+						g_free,
+						(GDestroyNotify) g_hash_table_destroy);
+	locks_by_device = g_hash_table_new_full (g_direct_hash,
+						 g_direct_equal,
+						 NULL,
+						 (GDestroyNotify) g_hash_table_destroy);
+}
+
+static void
+lock_registry_add (HalDevice *device, const char *owner)
+{
+	GHashTable *devices;
+	GHashTable *owners;
+	guint num;
+
+	lock_registry_init ();
+
+	devices = g_hash_table_lookup (locks_by_owner, owner);
+	if (devices == NULL) {
+		devices = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (locks_by_owner, g_strdup (owner), devices);
+		lock_stats.num_owners++;
+	}
+	num = GPOINTER_TO_UINT (g_hash_table_lookup (devices, device));
+	g_hash_table_insert (devices, device, GUINT_TO_POINTER (num + 1));
+
+	owners = g_hash_table_lookup (locks_by_device, device);
+	if (owners == NULL) {
+		owners = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert (locks_by_device, device, owners);
+		lock_stats.num_locked_devices++;
+	}
+	num = GPOINTER_TO_UINT (g_hash_table_lookup (owners, owner));
+	g_hash_table_insert (owners, g_strdup (owner), GUINT_TO_POINTER (num + 1));
+
+	lock_stats.num_locks++;
+	lock_stats.num_acquired++;
+}
+
+static void
+lock_registry_remove (HalDevice *device, const char *owner)
+{
+	GHashTable *devices;
+	GHashTable *owners;
+	guint num;
+
+	if (locks_by_owner == NULL)
+		return;
+
+	devices = g_hash_table_lookup (locks_by_owner, owner);
+	owners = g_hash_table_lookup (locks_by_device, device);
+	if (devices == NULL || owners == NULL)
+		return;
+
+	num = GPOINTER_TO_UINT (g_hash_table_lookup (devices, device));
+	if (num == 0)
+		return;
+
+	if (num == 1) {
+		g_hash_table_remove (devices, device);
+		g_hash_table_remove (owners, owner);
+	} else {
+		g_hash_table_insert (devices, device, GUINT_TO_POINTER (num - 1));
+		g_hash_table_insert (owners, g_strdup (owner), GUINT_TO_POINTER (num - 1));
+	}
+
+	if (g_hash_table_size (devices) == 0) {
+		g_hash_table_remove (locks_by_owner, owner);
+		lock_stats.num_owners--;
+	}
+	if (g_hash_table_size (owners) == 0) {
+		g_hash_table_remove (locks_by_device, device);
+		lock_stats.num_locked_devices--;
+	}
+
+	lock_stats.num_locks--;
+	lock_stats.num_released++;
+}
+
+static void
+lock_registry_remove_device_owner (gpointer key, gpointer value, gpointer user_data)
+{
+	const char *owner = key;
+	HalDevice *device = user_data;
+	GHashTable *devices;
+
+	lock_stats.num_locks -= GPOINTER_TO_UINT (value);
+
+	devices = g_hash_table_lookup (locks_by_owner, owner);
+	if (devices == NULL)
+		return;
 
-        locked_devices = g_slist_prepend (locked_devices, device);
+	g_hash_table_remove (devices, device);
+	if (g_hash_table_size (devices) == 0) {
+		g_hash_table_remove (locks_by_owner, owner);
+		lock_stats.num_owners--;
+	}
 }
 
+static void
+lock_registry_remove_device (HalDevice *device)
+{
+	GHashTable *owners;
+
+	if (locks_by_device == NULL)
+		return;
+
+	owners = g_hash_table_lookup (locks_by_device, device);
+	if (owners == NULL)
+		return;
+
+	g_hash_table_foreach (owners, lock_registry_remove_device_owner, device);
+
+	g_hash_table_remove (locks_by_device, device);
+	lock_stats.num_locked_devices--;
+}
 
 static void
-remove_from_locked_set (HalDevice *device)
+collect_device (gpointer key, gpointer value, gpointer user_data)
 {
-        locked_devices = g_slist_remove (locked_devices, device);
+	GSList **devices = user_data;
+
+	*devices = g_slist_prepend (*devices, g_object_ref (key));
 }
 
 struct _HalProperty {
@@ -387,7 +515,7 @@ hal_device_finalize (GObject *obj)
 
 	runner_device_finalized (device);
 
-        remove_from_locked_set (device);
+        lock_registry_remove_device (device);
 
 #ifdef HALD_MEMLEAK_DBG
 	dbg_hal_device_object_delta--;
@@ -1748,6 +1876,7 @@ hal_device_acquire_lock (HalDevice *device, const char *lock_name, gboolean excl
 	g_snprintf (buf, sizeof (buf), "info.named_locks.%s.exclusive", lock_name);
 	if (hal_device_property_get_bool (device, buf) == TRUE) {
             /* exclusively locked */
+            lock_stats.num_contended++;
             goto out;
         }
 	hal_device_property_set_bool (device, buf, exclusive);
@@ -1755,6 +1884,7 @@ hal_device_acquire_lock (HalDevice *device, const char *lock_name, gboolean excl
 	g_snprintf (buf, sizeof (buf), "info.named_locks.%s.dbus_name", lock_name);
         if (exclusive && hal_device_has_property (device, buf)) {
                 /* cannot obtain exclusive lock */
+                lock_stats.num_contended++;
                 goto out;
         }
 	if (hal_device_property_strlist_contains (device, buf, sender)) {
@@ -1768,7 +1898,7 @@ hal_device_acquire_lock (HalDevice *device, const char *lock_name, gboolean excl
 
 	hal_device_property_strlist_add (device, "info.named_locks", lock_name);
 
-        add_to_locked_set (device);
+        lock_registry_add (device, sender);
 
         g_signal_emit (device, signals[LOCK_ACQUIRED], 0, lock_name, sender);
 
@@ -1820,7 +1950,6 @@ hal_device_release_lock (HalDevice *device, const char *lock_name, const char *s
 
                 if (hal_device_property_get_strlist_length (device, "info.named_locks") == 1) {
                         hal_device_property_remove (device, "info.named_locks");
-                        remove_from_locked_set (device);
                 } else {
                         hal_device_property_strlist_remove (device, "info.named_locks", lock_name);
                 }
@@ -1829,6 +1958,8 @@ hal_device_release_lock (HalDevice *device, const char *lock_name, const char *s
 		hal_device_property_strlist_remove (device, buf, sender);
 	}
 
+        lock_registry_remove (device, sender);
+
         g_signal_emit (device, signals[LOCK_RELEASED], 0, lock_name, sender);
 
         ret = TRUE;
@@ -1890,17 +2021,31 @@ out:
  * @sender: the client that disconnected from the bus
  *
  * Will remove locks held by this client on locked devices. This is a
- * static class method that affects all devices that are locked.
+ * static class method that only looks at the devices the client
+ * holds locks on.
  *
  */
 void
 hal_device_client_disconnected (const char *sender)
 {
+        GHashTable *owned;
+        GSList *devices;
         GSList *i;
 
+        if (locks_by_owner == NULL)
+                return;
+
+        owned = g_hash_table_lookup (locks_by_owner, sender);
+        if (owned == NULL)
+                return;
+
         HAL_INFO (("Removing locks from '%s'", sender));
 
-        for (i = locked_devices; i != NULL; i = g_slist_next (i)) {
+        /* releasing locks modifies the registry; work on a copy */
+        devices = NULL;
+        g_hash_table_foreach (owned, collect_device, &devices);
+
+        for (i = devices; i != NULL; i = g_slist_next (i)) {
                 HalDevice *device = i->data;
                 char **locks;
                 int n;
@@ -1916,7 +2061,56 @@ hal_device_client_disconnected (const char *sender)
                         }
                         g_strfreev (locks);
                 }
+
+                g_object_unref (device);
+        }
+        g_slist_free (devices);
+}
+
+/**
+ * hal_device_foreach_locked:
+ * @callback: function to call for each device
+ * @user_data: user data passed to @callback
+ *
+ * Calls @callback for every device that currently has at least one
+ * named lock, in either the GDL or the TDL. The callback may release
+ * locks. This is a static class method.
+ */
+void
+hal_device_foreach_locked (HalDeviceLockedForeachFn callback, gpointer user_data)
+{
+        GSList *devices;
+        GSList *i;
+        gboolean cont;
+
+        if (locks_by_device == NULL)
+                return;
+
+        devices = NULL;
+        g_hash_table_foreach (locks_by_device, collect_device, &devices);
+
+        cont = TRUE;
+        for (i = devices; i != NULL; i = g_slist_next (i)) {
+                HalDevice *device = i->data;
+
+                if (cont)
+                        cont = callback (device, user_data);
+                g_object_unref (device);
         }
+        g_slist_free (devices);
+}
+
+/**
+ * hal_device_get_lock_stats:
+ * @stats: return location for the statistics
+ *
+ * Get counters describing the named locks held on all devices. This
+ * is a static class method.
+ */
+void
+hal_device_get_lock_stats (HalDeviceLockStats *stats)
+{
+        *stats = lock_stats;
 }
 
 gboolean 
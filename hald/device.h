@@ -97,6 +97,20 @@ typedef void (*HalDevicePropertyForeachFn) (HalDevice *device,
 					    const char *key,
 					    gpointer user_data);
 
+/* Return value of FALSE means that the foreach should be short-circuited */
+typedef gboolean (*HalDeviceLockedForeachFn) (HalDevice *device,
+					      gpointer user_data);
+
+typedef struct _HalDeviceLockStats HalDeviceLockStats;
+struct _HalDeviceLockStats {
+	guint   num_locks;		/* named locks currently held */
+	guint   num_owners;		/* bus names holding at least one lock */
+	guint   num_locked_devices;	/* devices with at least one lock */
+	guint64 num_acquired;		/* locks acquired since startup */
+	guint64 num_released;		/* locks released since startup */
+	guint64 num_contended;		/* acquisitions refused due to an exclusive lock */
+};
+
 GType         hal_device_get_type            (void);
 
 HalDevice    *hal_device_new                 (void);
@@ -233,7 +247,11 @@ char        **hal_device_get_lock_holders (HalDevice *device, const char *lock_n
 
 int           hal_device_get_num_lock_holders (HalDevice *device, const char *lock_name);
 
-/* static method */
+/* static methods */
 void          hal_device_client_disconnected (const char *sender);
 
+void          hal_device_foreach_locked (HalDeviceLockedForeachFn callback, gpointer user_data);
+
+void          hal_device_get_lock_stats (HalDeviceLockStats *stats);
+
 #endif /* DEVICE_H */
@@ -46,10 +46,12 @@
 #include <math.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <time.h>
 
 #include "hald.h"
 #include "logger.h"
 #include "mmap_cache.h"
+#include "metrics.h"
 #include "device_info.h"
 #include "device_store.h"
 #include "util.h"
@@ -122,72 +124,67 @@ get_match_type_str (enum match_type type)
 }
 #endif
 
-static inline gboolean
-resolve_udiprop_path_old (const char *path, const char *source_udi,
-			  char *udi_result, size_t udi_result_size,
-			  char *prop_result, size_t prop_result_size)
-{
-	int i;
-	gchar **tokens = NULL;
-	gboolean rc = FALSE;
-
-	/* Split up path into ':' tokens */
-	tokens = g_strsplit (path, ":", 64);
-
-	/* Detect trivial property access, e.g. path='foo.bar'   */
-	if (tokens == NULL || tokens[0] == NULL || tokens[1] == NULL) {
-		strncpy (udi_result, source_udi, udi_result_size);
-		strncpy (prop_result, path, prop_result_size);
-		rc = TRUE;
-		goto out;
-	}
-
-	/* Start with the source udi */
-	strncpy (udi_result, source_udi, udi_result_size);
-
-	for (i = 0; tokens[i] != NULL; i++) {
-		HalDevice *d;
-		gchar *curtoken;
+/* What an '@property' hop resolved to last time; valid as long as no
+ * device entered or left a store and the property still holds the udi
+ * of the target */
+typedef struct {
+	HalDevice *target;
+	guint generation;
+} UdiPropMemo;
 
-		/*HAL_INFO (("tokens[%d] = '%s'", i, tokens[i]));*/
+static GQuark udiprop_memo_quark = 0;
 
-		d = hal_device_store_find (hald_get_gdl (), udi_result);
-		if (d == NULL)
-			d = hal_device_store_find (hald_get_tdl (), udi_result);
-		if (d == NULL)
-			goto out;
-
-		curtoken = tokens[i];
-
-		/* process all but the last tokens as UDI paths */
-		if (tokens[i+1] == NULL) {
-			strncpy (prop_result, curtoken, prop_result_size);
-			rc = TRUE;
-			goto out;
-		}
-
-
-		/* Check for indirection */
-		if (curtoken[0] == '@') {
-			const char *udiprop;
-			const char *newudi;
+static HalDevice *
+find_device (const char *udi)
+{
+	HalDevice *d;
 
-			udiprop = curtoken + 1;
+	d = hal_device_store_find (hald_get_gdl (), udi);
+	if (d == NULL)
+		d = hal_device_store_find (hald_get_tdl (), udi);
+	return d;
+}
 
-			newudi = hal_device_property_get_string (d, udiprop);
-			if (newudi == NULL)
-				goto out;
+/* Follow one '@property' hop from d; the result is remembered on d */
+static HalDevice *
+resolve_udiprop_hop (HalDevice *d, const char *udiprop)
+{
+	GHashTable *memo;
+	UdiPropMemo *m;
+	const char *udi;
+	HalDevice *target;
+
+	udi = hal_device_property_get_string (d, udiprop);
+	if (udi == NULL)
+		return NULL;
+
+	if (udiprop_memo_quark == 0)
+		udiprop_memo_quark = g_quark_from_static_string ("hald-udiprop-memo");
+
+	memo = g_object_get_qdata (G_OBJECT (d), udiprop_memo_quark);
+	if (memo != NULL) {
+		m = g_hash_table_lookup (memo, udiprop);
+		if (m != NULL &&
+		    m->generation == hal_device_store_get_generation () &&
+		    strcmp (hal_device_get_udi (m->target), udi) == 0)
+			return m->target;
+	}
 
-			strncpy (udi_result, newudi, udi_result_size);
-		} else {
-			strncpy (udi_result, curtoken, udi_result_size);
-		}
+	target = find_device (udi);
+	if (target == NULL)
+		return NULL;
 
+	if (memo == NULL) {
+		memo = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+		g_object_set_qdata_full (G_OBJECT (d), udiprop_memo_quark, memo,
+					 (GDestroyNotify) g_hash_table_destroy);
 	}
+	m = g_new (UdiPropMemo, 1);
+	m->target = target;
+	m->generation = hal_device_store_get_generation ();
+	g_hash_table_replace (memo, g_strdup (udiprop), m);
 
-out:
-	g_strfreev (tokens);
-	return rc;
+	return target;
 }
 
 /** Resolve a udi-property path as used in .fdi files.
@@ -199,31 +196,43 @@ out:
  *   @block.storage_device:storage.bus
  *   @block.storage_device:@storage.originating_device:ide.channel
  *
- *  @param  source_udi          UDI of source device
+ *  The cache generator splits paths with a ':' into a struct rule_path.
+ *
+ *  @param  d                   Source device
  *  @param  path                The given path
- *  @param  udi_result          Where to store the resulting UDI
+ *  @param  path_offset         Offset of the split up path in the cache,
+ *                              0 if path is a plain property name
  *  @param  prop_result         Where to store the resulting property name
- *  @param  scratch		 
- *  @return                     TRUE if and only if the path resolved.
+ *  @return                     The device the property is on, NULL if
+ *                              the path didn't resolve
  */
-static gboolean
-resolve_udiprop_path (const char *path, const char *source_udi,
-		      const char **udi_result, const char **prop_result,
-		      const char *scratch /* HAL_PATH_MAX * 2 + 3 */)
+static HalDevice *
+resolve_udiprop_path (HalDevice *d, const char *path, u_int32_t path_offset,
+		      const char **prop_result)
 {
-	/* Detect trivial property access, e.g. path='foo.bar'   */
-	if (path == NULL || !strchr (path, ':')) {
-		*udi_result = source_udi;
+	struct rule_path *rule_path;
+	const char *token;
+	u_int32_t i;
+
+	if (path_offset == 0) {
 		*prop_result = path;
-		return TRUE;
+		return d;
+	}
+
+	rule_path = (struct rule_path *) RULES_PTR (path_offset);
+	token = rule_path->tokens;
+	for (i = 0; i < rule_path->num_hops; i++) {
+		if (token[0] == '@')
+			d = resolve_udiprop_hop (d, token + 1);
+		else
+			d = find_device (token);
+		if (d == NULL)
+			return NULL;
+		token += strlen (token) + 1;
 	}
 
-	/* the sub 5% 'everything else' case */
-	*udi_result = scratch;
-	*prop_result = scratch + HAL_PATH_MAX + 2;
-	return resolve_udiprop_path_old (path, source_udi,
-					 (char *) *udi_result, HAL_PATH_MAX,
-					 (char *) *prop_result, HAL_PATH_MAX);
+	*prop_result = token;
+	return d;
 }
 
 /* Compare the value of a property on a hal device object against a string value
@@ -288,35 +297,16 @@ out:
 static gboolean
 handle_match (struct rule *rule, HalDevice *d)
 {
-	char resolve_scratch[HAL_PATH_MAX*2 + 3];
-	const char *udi_to_check;
 	const char *prop_to_check;
-	const char *key = rule->key;
 	const char *value = (char *)RULES_PTR(rule->value_offset);
-	const char *d_udi;
-	
-	d_udi = hal_device_get_udi (d);
 
 	/* Resolve key paths like 'someudi/foo/bar/baz:prop.name' '@prop.here.is.an.udi:with.prop.name' */
-	if (!resolve_udiprop_path (key,
-				   d_udi,
-				   &udi_to_check,
-				   &prop_to_check,
-				   resolve_scratch)) {
-		/*HAL_ERROR (("Could not resolve keypath '%s' on udi '%s'", key, value));*/
+	d = resolve_udiprop_path (d, rule->key, rule->key_path_offset, &prop_to_check);
+	if (d == NULL) {
+		/*HAL_ERROR (("Could not resolve keypath '%s'", rule->key));*/
 		return FALSE;
 	}
 
-	if (strcmp(udi_to_check, d_udi)) {
-		d = hal_device_store_find (hald_get_gdl (), udi_to_check);
-		if (d == NULL)
-			d = hal_device_store_find (hald_get_tdl (), udi_to_check);
-		if (d == NULL) {
-			HAL_ERROR (("Could not find device with udi '%s'", udi_to_check));
-			return FALSE;
-		}
-	}
-
 	switch (rule->type_match) {
 	case MATCH_STRING:
 	{
@@ -615,9 +605,7 @@ handle_match (struct rule *rule, HalDevice *d)
 			GSList *i;
 			GSList *siblings;
 
-			siblings = hal_device_store_match_multiple_key_value_string (hald_get_gdl (),
-										     "info.parent",
-										     parent_udi);
+			siblings = hal_device_store_get_children (hald_get_gdl (), parent_udi);
 			for (i = siblings; i != NULL; i = g_slist_next (i)) {
 				HalDevice *sib = HAL_DEVICE (i->data);
 
@@ -855,34 +843,18 @@ handle_merge (struct rule *rule, HalDevice *d)
 {
 	const char *value = (char *)RULES_PTR(rule->value_offset);
 	const char *key;
-	char resolve_scratch[HAL_PATH_MAX*2 + 3];
-	const char *key_to_merge;
 
 	if (rule->rtype == RULE_MERGE || rule->rtype == RULE_APPEND || 
 	    rule->rtype == RULE_PREPEND || rule->rtype == RULE_ADDSET ) {
-		const char *udi_to_merge;
+		HalDevice *to_merge;
 
 		/* Resolve key paths like 'someudi/foo/bar/baz:prop.name' '@prop.here.is.an.udi:with.prop.name' */
-                if (!resolve_udiprop_path (rule->key, hal_device_get_udi (d),
-			&udi_to_merge, &key_to_merge, resolve_scratch)) {
-	                 HAL_ERROR (("Could not resolve keypath '%s' on udi '%s'", rule->key, hal_device_get_udi (d)));
+		to_merge = resolve_udiprop_path (d, rule->key, rule->key_path_offset, &key);
+		if (to_merge == NULL) {
+			HAL_ERROR (("Could not resolve keypath '%s' on udi '%s'", rule->key, hal_device_get_udi (d)));
 			return FALSE;
-		} else {
-			key = key_to_merge;	
-
-			if (strcmp(hal_device_get_udi (d), udi_to_merge) != 0) {
-
-				d = hal_device_store_find (hald_get_gdl (), udi_to_merge);
-				if (d == NULL) {
-					d = hal_device_store_find (hald_get_tdl (), udi_to_merge);
-
-					if (d == NULL) {
-						HAL_ERROR (("Could not find device with udi '%s'", udi_to_merge));
-						return FALSE;
-					}
-				}
-			}
 		}
+		d = to_merge;
 	} else {
 		key = rule->key;
 	} 
@@ -915,30 +887,17 @@ handle_merge (struct rule *rule, HalDevice *d)
 			hal_device_property_set_double (d, key, atof (value));
 
 		} else if (rule->type_merge == MERGE_COPY_PROPERTY) {
-			char more_resolve_scratch[HAL_PATH_MAX*2 + 3];
-			const char *udi_to_merge_from;
+			HalDevice *copyfrom;
 			const char *prop_to_merge;
 
 			/* Resolve key paths like 'someudi/foo/bar/baz:prop.name'
 			 * '@prop.here.is.an.udi:with.prop.name'
 			 */
-			if (!resolve_udiprop_path (value,
-						   hal_device_get_udi (d),
-						   &udi_to_merge_from, &prop_to_merge,
-						   more_resolve_scratch)) {
+			copyfrom = resolve_udiprop_path (d, value, rule->value_path_offset, &prop_to_merge);
+			if (copyfrom == NULL) {
 				HAL_ERROR (("Could not resolve keypath '%s' on udi '%s'", value, hal_device_get_udi (d)));
 			} else {
-				HalDevice *copyfrom;
-
-				copyfrom = hal_device_store_find (hald_get_gdl (), udi_to_merge_from);
-				if (copyfrom == NULL) {
-					copyfrom = hal_device_store_find (hald_get_tdl (), udi_to_merge_from);
-				}
-				if (copyfrom == NULL) {
-					HAL_ERROR (("Could not find device with udi '%s'", udi_to_merge_from));
-				} else {
-					hal_device_copy_property (copyfrom, prop_to_merge, d, key);
-				}
+				hal_device_copy_property (copyfrom, prop_to_merge, d, key);
 			}
 
 		} else {
@@ -970,30 +929,17 @@ handle_merge (struct rule *rule, HalDevice *d)
 				break;
 			case MERGE_COPY_PROPERTY:
 			{
-				char more_resolve_scratch[HAL_PATH_MAX*2 + 3];
-				const char *udi_to_merge_from;
+				HalDevice *copyfrom;
 				const char *prop_to_merge;
 
 				/* Resolve key paths like 'someudi/foo/bar/baz:prop.name'
 				 * '@prop.here.is.an.udi:with.prop.name'
 				 */
-				if (!resolve_udiprop_path (value,
-							   hal_device_get_udi (d),
-							   &udi_to_merge_from, &prop_to_merge,
-							   more_resolve_scratch)) {
+				copyfrom = resolve_udiprop_path (d, value, rule->value_path_offset, &prop_to_merge);
+				if (copyfrom == NULL) {
 					HAL_ERROR (("Could not resolve keypath '%s' on udi '%s'", value, hal_device_get_udi (d)));
 				} else {
-					HalDevice *copyfrom;
-
-					copyfrom = hal_device_store_find (hald_get_gdl (), udi_to_merge_from);
-					if (copyfrom == NULL) {
-						copyfrom = hal_device_store_find (hald_get_tdl (), udi_to_merge_from);
-					}
-					if (copyfrom == NULL) {
-						HAL_ERROR (("Could not find device with udi '%s'", udi_to_merge_from));
-					} else {
-						hal_device_property_get_as_string (copyfrom, prop_to_merge, buf, sizeof (buf));
-					}
+					hal_device_property_get_as_string (copyfrom, prop_to_merge, buf, sizeof (buf));
 				}
 				break;
 			}
@@ -1071,6 +1017,190 @@ handle_merge (struct rule *rule, HalDevice *d)
 	return TRUE;
 }
 
+/* Profiling of rule evaluation, see di_profile_enable () */
+typedef struct {
+	guint64 evaluations;
+	guint64 hits;
+	guint64 time_ns;
+} DeviceInfoRuleProfile;
+
+/* rule offset in the cache -> DeviceInfoRuleProfile, NULL unless profiling */
+static GHashTable *rule_profiles = NULL;
+
+static guint64
+di_profile_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+di_profile_account (struct rule *rule, guint64 start, gboolean hit)
+{
+	DeviceInfoRuleProfile *profile;
+	gpointer offset;
+
+	offset = GUINT_TO_POINTER ((char *) rule - (char *) rules_ptr);
+	profile = g_hash_table_lookup (rule_profiles, offset);
+	if (profile == NULL) {
+		profile = g_slice_new0 (DeviceInfoRuleProfile);
+		g_hash_table_insert (rule_profiles, offset, profile);
+	}
+
+	profile->evaluations++;
+	if (hit)
+		profile->hits++;
+	profile->time_ns += di_profile_now () - start;
+}
+
+static void
+di_profile_free (gpointer data)
+{
+	g_slice_free (DeviceInfoRuleProfile, data);
+}
+
+/**
+ * di_profile_enable:
+ * @enable:             Whether to profile rule evaluation
+ *
+ * Start or stop counting, for every rule in the fdi cache, how often it
+ * is evaluated, how often it matches and the time spent in it; this
+ * makes matching noticeably slower. Stopping throws away what has been
+ * collected.
+ */
+void
+di_profile_enable (gboolean enable)
+{
+	if (enable && rule_profiles == NULL) {
+		rule_profiles = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, di_profile_free);
+	} else if (!enable && rule_profiles != NULL) {
+		g_hash_table_destroy (rule_profiles);
+		rule_profiles = NULL;
+	}
+}
+
+gboolean
+di_profile_is_enabled (void)
+{
+	return rule_profiles != NULL;
+}
+
+/* offsets change when the cache is regenerated */
+static void
+di_profile_reset (void)
+{
+	if (rule_profiles != NULL) {
+		di_profile_enable (FALSE);
+		di_profile_enable (TRUE);
+	}
+}
+
+static void
+di_profile_foreach_section (u_int32_t begin, u_int32_t end, gboolean per_file,
+			    DeviceInfoProfileFunc func, gpointer user_data)
+{
+	GArray *pending;
+	DeviceInfoRuleProfile file_profile;
+	u_int32_t file_offset;
+	u_int32_t offset;
+	guint i;
+
+	pending = g_array_new (FALSE, FALSE, sizeof (u_int32_t));
+	memset (&file_profile, 0, sizeof (file_profile));
+	file_offset = begin;
+
+	/* the rules of a file are followed by an EOF rule with its name */
+	for (offset = begin; offset < end; offset += ((struct rule *) RULES_PTR (offset))->rule_size) {
+		struct rule *rule = RULES_PTR (offset);
+		DeviceInfoRuleProfile *profile;
+
+		if (rule->rule_size == 0)
+			break;
+
+		if (rule->rtype != RULE_EOF) {
+			profile = g_hash_table_lookup (rule_profiles, GUINT_TO_POINTER (offset));
+			if (profile != NULL) {
+				file_profile.evaluations += profile->evaluations;
+				file_profile.hits += profile->hits;
+				file_profile.time_ns += profile->time_ns;
+				g_array_append_val (pending, offset);
+			}
+			continue;
+		}
+
+		if (per_file) {
+			if (file_profile.evaluations > 0)
+				func (rule->key, file_offset, NULL, file_profile.evaluations,
+				      file_profile.hits, file_profile.time_ns, user_data);
+		} else {
+			for (i = 0; i < pending->len; i++) {
+				u_int32_t o = g_array_index (pending, u_int32_t, i);
+				struct rule *r = RULES_PTR (o);
+
+				profile = g_hash_table_lookup (rule_profiles, GUINT_TO_POINTER (o));
+				func (rule->key, o, r->key, profile->evaluations,
+				      profile->hits, profile->time_ns, user_data);
+			}
+		}
+
+		g_array_set_size (pending, 0);
+		memset (&file_profile, 0, sizeof (file_profile));
+		file_offset = offset + rule->rule_size;
+	}
+
+	g_array_free (pending, TRUE);
+}
+
+static void
+di_profile_foreach (gboolean per_file, DeviceInfoProfileFunc func, gpointer user_data)
+{
+	struct cache_header *header;
+
+	if (rule_profiles == NULL || rules_ptr == NULL)
+		return;
+
+	header = (struct cache_header*) RULES_PTR(0);
+	di_profile_foreach_section (header->fdi_rules_preprobe, header->fdi_rules_information,
+				    per_file, func, user_data);
+	di_profile_foreach_section (header->fdi_rules_information, header->fdi_rules_policy,
+				    per_file, func, user_data);
+	di_profile_foreach_section (header->fdi_rules_policy, header->all_rules_size,
+				    per_file, func, user_data);
+}
+
+/**
+ * di_profile_foreach_rule:
+ * @func:               Called for every rule evaluated at least once
+ * @user_data:          User data
+ *
+ * Report what profiling collected per rule; the rule is identified by
+ * its offset in the fdi cache, its key and the fdi file it came from.
+ * Time spent in rules that spawn devices includes matching the spawned
+ * device.
+ */
+void
+di_profile_foreach_rule (DeviceInfoProfileFunc func, gpointer user_data)
+{
+	di_profile_foreach (FALSE, func, user_data);
+}
+
+/**
+ * di_profile_foreach_file:
+ * @func:               Called for every fdi file with a rule evaluated at
+ *                      least once; the offset is that of its first rule
+ *                      and the key is NULL
+ * @user_data:          User data
+ *
+ * Report what profiling collected per fdi file.
+ */
+void
+di_profile_foreach_file (DeviceInfoProfileFunc func, gpointer user_data)
+{
+	di_profile_foreach (TRUE, func, user_data);
+}
+
 static struct rule *di_next(struct rule *rule){
 	struct cache_header	*header = (struct cache_header*) RULES_PTR(0);
 	size_t			offset = (char *)rule - (char*)rules_ptr;
@@ -1104,15 +1234,25 @@ static void
 rules_match_and_merge_device (void *fdi_rules_list, HalDevice *d)
 {
 	struct rule *rule = fdi_rules_list;
+	struct rule *evaluated;
+	guint64 start = 0;
+
 	while (rule != NULL){
 		/*HAL_INFO(("== Iterating rules =="));*/
 
+		evaluated = rule;
+		if (rule_profiles != NULL)
+			start = di_profile_now ();
+
 		switch (rule->rtype) {
 		case RULE_MATCH:
 			/* skip non-matching rules block */
 			/*HAL_INFO(("%p match '%s' at %s", rule, rule->key, hal_device_get_udi (d)));*/
 			if (!handle_match (rule, d)) {
 				/*HAL_INFO(("no match, skip to rule (%llx)", rule->jump_position));*/
+				if (rule_profiles != NULL)
+					di_profile_account (evaluated, start, FALSE);
+
 				rule = di_jump(rule);
 
 				if(rule == NULL)
@@ -1143,6 +1283,9 @@ rules_match_and_merge_device (void *fdi_rules_list, HalDevice *d)
 			break;
 		}
 
+		if (rule_profiles != NULL && evaluated->rtype != RULE_EOF)
+			di_profile_account (evaluated, start, TRUE);
+
 		if (rule)
 			rule = di_next(rule);
 	}
@@ -1152,10 +1295,14 @@ rules_match_and_merge_device (void *fdi_rules_list, HalDevice *d)
 gboolean
 di_search_and_merge (HalDevice *d, DeviceInfoType type){
 	struct cache_header *header;
+	GTimeVal start;
+
+	g_get_current_time (&start);
 
         /* make sure our fdi rule cache is up to date */
         if (di_cache_coherency_check (FALSE)) {
                 di_rules_init ();
+		di_profile_reset ();
 	}
 
 	header = (struct cache_header*) RULES_PTR(0);
@@ -1170,6 +1317,7 @@ di_search_and_merge (HalDevice *d, DeviceInfoType type){
 			header->fdi_rules_information - header->fdi_rules_preprobe));*/
 			rules_match_and_merge_device (RULES_PTR(header->fdi_rules_preprobe), d);
 		}
+		hal_metrics_record_since ("fdi.preprobe_us", &start);
 		break;
 
 	case DEVICE_INFO_TYPE_INFORMATION:
@@ -1181,6 +1329,7 @@ di_search_and_merge (HalDevice *d, DeviceInfoType type){
 			header->fdi_rules_policy - header->fdi_rules_information));*/
 			rules_match_and_merge_device (RULES_PTR(header->fdi_rules_information), d);
 		}
+		hal_metrics_record_since ("fdi.information_us", &start);
 		break;
 
 	case DEVICE_INFO_TYPE_POLICY:
@@ -1192,6 +1341,7 @@ di_search_and_merge (HalDevice *d, DeviceInfoType type){
 			header->all_rules_size - header->fdi_rules_policy));*/
 			rules_match_and_merge_device (RULES_PTR(header->fdi_rules_policy), d);
 		}
+		hal_metrics_record_since ("fdi.policy_us", &start);
 		break;
 
 	default:
@@ -43,4 +43,13 @@ extern int di_rules_init (void);
 extern void di_rules_cleanup (void);
 extern gboolean di_search_and_merge (HalDevice *d, DeviceInfoType type);
 
+typedef void (*DeviceInfoProfileFunc) (const char *fdi_file, guint32 offset, const char *key,
+				       guint64 evaluations, guint64 hits, guint64 time_ns,
+				       gpointer user_data);
+
+extern void di_profile_enable (gboolean enable);
+extern gboolean di_profile_is_enabled (void);
+extern void di_profile_foreach_rule (DeviceInfoProfileFunc func, gpointer user_data);
+extern void di_profile_foreach_file (DeviceInfoProfileFunc func, gpointer user_data);
+
 #endif				/* DEVICE_INFO_H */
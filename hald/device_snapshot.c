@@ -0,0 +1,818 @@
+/***************************************************************************
+ *
+ * device_snapshot.c : Device snapshot for warm restarts
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "device.h"
+#include "device_store.h"
+#include "hald.h"
+#include "logger.h"
+#include "rule.h"
+
+#include "device_snapshot.h"
+
+/* Coldplug runs every device through preprobe rules, callouts, a prober
+ * and information/policy rules. When hald is restarted most devices are
+ * exactly the same as last time, so what the pipeline produced for each
+ * device is kept in a snapshot that is written periodically and on
+ * shutdown. At startup a device is restored from it, skipping preprobing
+ * and probing, if the OS backend computes the same identity for it as
+ * last time (see hal_util_get_snapshot_identity() for Linux).
+ *
+ * The whole snapshot is thrown away if its format version, the fdi
+ * cache, or (where known) the boot changed. It survives upgrading hald
+ * so a restart after an upgrade is fast too; bump SNAPSHOT_VERSION when
+ * the layout changes or hald starts to compute properties in a way that
+ * makes old snapshots wrong.
+ *
+ * File layout, in host byte order as the file never leaves the machine:
+ *
+ *   header   char magic[8], guint32 version, guint32 num_records
+ *   key      string
+ *   records  guint32 length (including itself), string sysfs_path,
+ *            string identity, guint32 num_props and then for each
+ *            property guint32 type, string key and the value
+ *
+ * A string is a guint32 length followed by the bytes and a NUL. A value
+ * is a string, a guint32 count followed by that many strings (strlist)
+ * or the raw int32, uint64, double or bool (as guint32).
+ */
+
+#define SNAPSHOT_MAGIC		"HALSNAP"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_FILE		PACKAGE_LOCALSTATEDIR "/cache/hald/device-snapshot"
+
+/* seconds to wait after a change before writing the snapshot */
+#define SNAPSHOT_SAVE_DELAY	60
+
+#define SNAPSHOT_DATA_KEY	"hald-snapshot-identity"
+
+typedef struct {
+	char *sysfs_path;
+	char *identity;
+} SnapshotIdentity;
+
+typedef struct {
+	const guchar *p;
+	const guchar *end;
+	gboolean error;
+} SnapshotReader;
+
+static gboolean enabled = FALSE;
+
+/* the snapshot read at startup; keys and values point into map */
+static guchar *map = NULL;
+static gsize map_size = 0;
+static GHashTable *loaded = NULL;
+
+/* sysfs_path -> GByteArray with the record, for devices in the GDL */
+static GHashTable *records = NULL;
+
+static guint save_timeout_id = 0;
+
+static DeviceSnapshotStats snapshot_stats;
+
+static const char *
+get_snapshot_file (void)
+{
+	const char *path;
+
+	path = getenv ("HAL_DEVICE_SNAPSHOT_NAME");
+	if (path == NULL)
+		path = SNAPSHOT_FILE;
+	return path;
+}
+
+static char *
+compute_key (void)
+{
+	const char *cachename;
+	struct stat st;
+	gchar *boot_id;
+	char *key;
+
+	cachename = getenv ("HAL_FDI_CACHE_NAME");
+	if (cachename == NULL)
+		cachename = HALD_CACHE_FILE;
+	if (stat (cachename, &st) != 0)
+		memset (&st, 0, sizeof (st));
+
+	if (g_file_get_contents ("/proc/sys/kernel/random/boot_id", &boot_id, NULL, NULL))
+		g_strstrip (boot_id);
+	else
+		boot_id = g_strdup ("");
+
+	key = g_strdup_printf ("fdi=%lu:%lu boot=%s",
+			       (unsigned long) st.st_mtime, (unsigned long) st.st_size, boot_id);
+	g_free (boot_id);
+	return key;
+}
+
+/*--------------------------------------------------------------------------------------------------------------*/
+
+static void
+write_u32 (GByteArray *buf, guint32 value)
+{
+	g_byte_array_append (buf, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+write_string (GByteArray *buf, const char *s)
+{
+	guint32 len;
+
+	len = strlen (s);
+	write_u32 (buf, len);
+	g_byte_array_append (buf, (const guint8 *) s, len + 1);
+}
+
+static guint32
+read_u32 (SnapshotReader *r)
+{
+	guint32 value;
+
+	if (r->error || r->end - r->p < (gssize) sizeof (value)) {
+		r->error = TRUE;
+		return 0;
+	}
+	memcpy (&value, r->p, sizeof (value));
+	r->p += sizeof (value);
+	return value;
+}
+
+static void
+read_bytes (SnapshotReader *r, void *dst, gsize size)
+{
+	if (r->error || (gsize) (r->end - r->p) < size) {
+		r->error = TRUE;
+		memset (dst, 0, size);
+		return;
+	}
+	memcpy (dst, r->p, size);
+	r->p += size;
+}
+
+static const char *
+read_string (SnapshotReader *r)
+{
+	guint32 len;
+	const char *s;
+
+	len = read_u32 (r);
+	if (r->error || (gsize) (r->end - r->p) < (gsize) len + 1 || r->p[len] != '\0') {
+		r->error = TRUE;
+		return NULL;
+	}
+	s = (const char *) r->p;
+	r->p += len + 1;
+	return s;
+}
+
+/*--------------------------------------------------------------------------------------------------------------*/
+
+typedef struct {
+	GByteArray *buf;
+	guint32 num_props;
+} SerializeData;
+
+static void
+serialize_property (HalDevice *d, const char *key, gpointer user_data)
+{
+	SerializeData *sd = (SerializeData *) user_data;
+	int type;
+
+	type = hal_device_property_get_type (d, key);
+
+	switch (type) {
+	case HAL_PROPERTY_TYPE_STRING:
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		write_string (sd->buf, hal_device_property_get_string (d, key));
+		break;
+	case HAL_PROPERTY_TYPE_INT32:
+	{
+		dbus_int32_t value = hal_device_property_get_int (d, key);
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		g_byte_array_append (sd->buf, (const guint8 *) &value, sizeof (value));
+		break;
+	}
+	case HAL_PROPERTY_TYPE_UINT64:
+	{
+		dbus_uint64_t value = hal_device_property_get_uint64 (d, key);
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		g_byte_array_append (sd->buf, (const guint8 *) &value, sizeof (value));
+		break;
+	}
+	case HAL_PROPERTY_TYPE_DOUBLE:
+	{
+		double value = hal_device_property_get_double (d, key);
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		g_byte_array_append (sd->buf, (const guint8 *) &value, sizeof (value));
+		break;
+	}
+	case HAL_PROPERTY_TYPE_BOOLEAN:
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		write_u32 (sd->buf, hal_device_property_get_bool (d, key) ? 1 : 0);
+		break;
+	case HAL_PROPERTY_TYPE_STRLIST:
+	{
+		HalDeviceStrListIter iter;
+
+		write_u32 (sd->buf, type);
+		write_string (sd->buf, key);
+		write_u32 (sd->buf, hal_device_property_get_strlist_length (d, key));
+		for (hal_device_property_strlist_iter_init (d, key, &iter);
+		     hal_device_property_strlist_iter_is_valid (&iter);
+		     hal_device_property_strlist_iter_next (&iter)) {
+			write_string (sd->buf, hal_device_property_strlist_iter_get_value (&iter));
+		}
+		break;
+	}
+	default:
+		HAL_WARNING (("Not saving property %s of unknown type %d", key, type));
+		return;
+	}
+
+	sd->num_props++;
+}
+
+static GByteArray *
+serialize_device (HalDevice *d, SnapshotIdentity *id)
+{
+	SerializeData sd;
+	guint num_props_offset;
+	guint32 len;
+
+	sd.buf = g_byte_array_new ();
+	sd.num_props = 0;
+
+	write_u32 (sd.buf, 0);
+	write_string (sd.buf, id->sysfs_path);
+	write_string (sd.buf, id->identity);
+	num_props_offset = sd.buf->len;
+	write_u32 (sd.buf, 0);
+
+	hal_device_property_foreach (d, serialize_property, &sd);
+
+	len = sd.buf->len;
+	memcpy (sd.buf->data, &len, sizeof (len));
+	memcpy (sd.buf->data + num_props_offset, &sd.num_props, sizeof (sd.num_props));
+
+	return sd.buf;
+}
+
+static gboolean
+deserialize_properties (HalDevice *d, SnapshotReader *r)
+{
+	guint32 num_props;
+	guint32 n;
+
+	num_props = read_u32 (r);
+	for (n = 0; n < num_props && !r->error; n++) {
+		guint32 type;
+		const char *key;
+
+		type = read_u32 (r);
+		key = read_string (r);
+		if (r->error)
+			break;
+
+		switch (type) {
+		case HAL_PROPERTY_TYPE_STRING:
+		{
+			const char *value = read_string (r);
+			if (value != NULL)
+				hal_device_property_set_string (d, key, value);
+			break;
+		}
+		case HAL_PROPERTY_TYPE_INT32:
+		{
+			dbus_int32_t value;
+			read_bytes (r, &value, sizeof (value));
+			hal_device_property_set_int (d, key, value);
+			break;
+		}
+		case HAL_PROPERTY_TYPE_UINT64:
+		{
+			dbus_uint64_t value;
+			read_bytes (r, &value, sizeof (value));
+			hal_device_property_set_uint64 (d, key, value);
+			break;
+		}
+		case HAL_PROPERTY_TYPE_DOUBLE:
+		{
+			double value;
+			read_bytes (r, &value, sizeof (value));
+			hal_device_property_set_double (d, key, value);
+			break;
+		}
+		case HAL_PROPERTY_TYPE_BOOLEAN:
+			hal_device_property_set_bool (d, key, read_u32 (r) != 0);
+			break;
+		case HAL_PROPERTY_TYPE_STRLIST:
+		{
+			guint32 num_elems;
+			guint32 m;
+			GSList *list;
+
+			list = NULL;
+			num_elems = read_u32 (r);
+			for (m = 0; m < num_elems && !r->error; m++)
+				list = g_slist_prepend (list, (gpointer) read_string (r));
+			list = g_slist_reverse (list);
+			if (!r->error)
+				hal_device_property_set_strlist (d, key, list);
+			g_slist_free (list);
+			break;
+		}
+		default:
+			r->error = TRUE;
+			break;
+		}
+	}
+
+	return !r->error;
+}
+
+/*--------------------------------------------------------------------------------------------------------------*/
+
+static void
+snapshot_unload (void)
+{
+	if (loaded != NULL) {
+		g_hash_table_destroy (loaded);
+		loaded = NULL;
+	}
+	if (map != NULL) {
+		munmap (map, map_size);
+		map = NULL;
+		map_size = 0;
+	}
+}
+
+static void
+snapshot_load (void)
+{
+	const char *path;
+	int fd;
+	struct stat st;
+	SnapshotReader r;
+	char magic[8];
+	guint32 num_records;
+	const char *file_key;
+	char *key;
+	guint32 n;
+
+	path = get_snapshot_file ();
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		HAL_INFO (("No device snapshot at %s", path));
+		return;
+	}
+	if (fstat (fd, &st) != 0 || st.st_size == 0) {
+		close (fd);
+		return;
+	}
+
+	map_size = st.st_size;
+	map = mmap (NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) {
+		HAL_WARNING (("Couldn't mmap device snapshot %s: %s", path, strerror (errno)));
+		map = NULL;
+		map_size = 0;
+		return;
+	}
+
+	r.p = map;
+	r.end = map + map_size;
+	r.error = FALSE;
+
+	read_bytes (&r, magic, sizeof (magic));
+	if (r.error || memcmp (magic, SNAPSHOT_MAGIC, sizeof (magic)) != 0 ||
+	    read_u32 (&r) != SNAPSHOT_VERSION) {
+		HAL_INFO (("Ignoring device snapshot %s in unknown format", path));
+		goto error;
+	}
+
+	num_records = read_u32 (&r);
+	file_key = read_string (&r);
+	key = compute_key ();
+	if (file_key == NULL || strcmp (file_key, key) != 0) {
+		HAL_INFO (("Ignoring stale device snapshot (is '%s', want '%s')",
+			   file_key != NULL ? file_key : "", key));
+		g_free (key);
+		goto error;
+	}
+	g_free (key);
+
+	loaded = g_hash_table_new (g_str_hash, g_str_equal);
+	for (n = 0; n < num_records; n++) {
+		const guchar *record;
+		guint32 len;
+		const char *sysfs_path;
+
+		record = r.p;
+		len = read_u32 (&r);
+		if (r.error || len < sizeof (len) || (gsize) (r.end - record) < len)
+			goto error;
+		r.end = record + len;
+		sysfs_path = read_string (&r);
+		if (r.error)
+			goto error;
+		g_hash_table_insert (loaded, (gpointer) sysfs_path, (gpointer) record);
+
+		r.p = record + len;
+		r.end = map + map_size;
+	}
+
+	snapshot_stats.num_loaded = num_records;
+	HAL_INFO (("Loaded device snapshot with %u devices", num_records));
+	return;
+
+error:
+	HAL_WARNING (("Discarding device snapshot %s", path));
+	snapshot_unload ();
+}
+
+/*--------------------------------------------------------------------------------------------------------------*/
+
+static gboolean
+save_timeout (gpointer data)
+{
+	save_timeout_id = 0;
+	device_snapshot_save ();
+	return FALSE;
+}
+
+static void
+schedule_save (void)
+{
+	if (save_timeout_id != 0 || hald_is_initialising)
+		return;
+
+#ifdef HAVE_GLIB_2_14
+	save_timeout_id = g_timeout_add_seconds (SNAPSHOT_SAVE_DELAY, save_timeout, NULL);
+#else
+	save_timeout_id = g_timeout_add (SNAPSHOT_SAVE_DELAY * 1000, save_timeout, NULL);
+#endif
+}
+
+static void
+gdl_store_changed (HalDeviceStore *store, HalDevice *device,
+		   gboolean is_added, gpointer user_data)
+{
+	SnapshotIdentity *id;
+
+	id = (SnapshotIdentity *) g_object_get_data (G_OBJECT (device), SNAPSHOT_DATA_KEY);
+	if (id == NULL)
+		return;
+
+	/* record what the pipeline produced, before addons and clients
+	 * start changing things */
+	if (is_added)
+		g_hash_table_replace (records, g_strdup (id->sysfs_path), serialize_device (device, id));
+	else
+		g_hash_table_remove (records, id->sysfs_path);
+
+	schedule_save ();
+}
+
+static void
+byte_array_free (gpointer data)
+{
+	g_byte_array_free ((GByteArray *) data, TRUE);
+}
+
+static void
+snapshot_identity_free (gpointer data)
+{
+	SnapshotIdentity *id = (SnapshotIdentity *) data;
+
+	g_free (id->sysfs_path);
+	g_free (id->identity);
+	g_free (id);
+}
+
+/**
+ * device_snapshot_init:
+ *
+ * Load the snapshot from the last run and start keeping track of
+ * devices for the next one. Must be called after the fdi cache has
+ * been checked and before devices are probed.
+ */
+void
+device_snapshot_init (void)
+{
+	enabled = TRUE;
+
+	records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, byte_array_free);
+	g_signal_connect (hald_get_gdl (), "store_changed",
+			  G_CALLBACK (gdl_store_changed), NULL);
+
+	snapshot_load ();
+}
+
+/**
+ * device_snapshot_coldplug_done:
+ *
+ * Drop the snapshot read at startup; only coldplug restores devices.
+ */
+void
+device_snapshot_coldplug_done (void)
+{
+	if (!enabled)
+		return;
+
+	HAL_INFO (("Restored %u of %u devices from snapshot (%u changed)",
+		   snapshot_stats.num_restored, snapshot_stats.num_loaded, snapshot_stats.num_mismatched));
+
+	snapshot_unload ();
+	schedule_save ();
+}
+
+/**
+ * device_snapshot_set_identity:
+ * @d:                  Device that is being added
+ * @sysfs_path:         Where the device lives
+ * @identity:           What the device looked like when it was added
+ *
+ * Make a device part of the snapshot once it's added to the GDL. The
+ * identity is computed by the OS backend before probing and must
+ * change whenever the device may have changed.
+ */
+void
+device_snapshot_set_identity (HalDevice *d, const char *sysfs_path, const char *identity)
+{
+	SnapshotIdentity *id;
+
+	if (!enabled || identity == NULL)
+		return;
+
+	id = g_new0 (SnapshotIdentity, 1);
+	id->sysfs_path = g_strdup (sysfs_path);
+	id->identity = g_strdup (identity);
+	g_object_set_data_full (G_OBJECT (d), SNAPSHOT_DATA_KEY, id, snapshot_identity_free);
+}
+
+/**
+ * device_snapshot_has:
+ * @sysfs_path:         Where the device lives
+ *
+ * Returns:             TRUE if the snapshot from the last run has a
+ *                      device at @sysfs_path that is not restored yet
+ */
+gboolean
+device_snapshot_has (const char *sysfs_path)
+{
+	return loaded != NULL && g_hash_table_lookup (loaded, sysfs_path) != NULL;
+}
+
+/**
+ * device_snapshot_restore:
+ * @sysfs_path:         Where the device lives
+ * @identity:           What the device looks like now
+ *
+ * Returns:             A new device with all properties from the last
+ *                      run, or NULL if the device must be probed
+ *
+ * Restore a device from the snapshot taken in the last run if it has
+ * the same identity and its parent is already known. The device is
+ * not added to any store; the caller still needs to run the add
+ * callouts.
+ */
+HalDevice *
+device_snapshot_restore (const char *sysfs_path, const char *identity)
+{
+	const guchar *record;
+	SnapshotReader r;
+	guint32 len;
+	const char *record_identity;
+	const char *parent;
+	char *udi;
+	HalDevice *d;
+
+	if (loaded == NULL || identity == NULL)
+		return NULL;
+
+	record = g_hash_table_lookup (loaded, sysfs_path);
+	if (record == NULL)
+		return NULL;
+
+	/* the record is used at most once */
+	g_hash_table_remove (loaded, sysfs_path);
+
+	r.p = record;
+	r.end = map + map_size;
+	r.error = FALSE;
+	len = read_u32 (&r);
+	r.end = record + len;
+
+	read_string (&r);
+	record_identity = read_string (&r);
+	if (r.error)
+		return NULL;
+
+	if (strcmp (record_identity, identity) != 0) {
+		HAL_INFO (("%s changed since the snapshot was taken", sysfs_path));
+		snapshot_stats.num_mismatched++;
+		return NULL;
+	}
+
+	d = hal_device_new ();
+	if (!deserialize_properties (d, &r)) {
+		HAL_WARNING (("Broken snapshot record for %s", sysfs_path));
+		goto fail;
+	}
+
+	if (hal_device_property_get_string (d, "info.udi") == NULL)
+		goto fail;
+	udi = g_strdup (hal_device_property_get_string (d, "info.udi"));
+
+	/* let the regular path sort out collisions and missing parents */
+	parent = hal_device_property_get_string (d, "info.parent");
+	if ((hal_device_store_find (hald_get_gdl (), udi) != NULL ||
+	     hal_device_store_find (hald_get_tdl (), udi) != NULL) ||
+	    (parent != NULL &&
+	     hal_device_store_find (hald_get_gdl (), parent) == NULL &&
+	     hal_device_store_find (hald_get_tdl (), parent) == NULL)) {
+		HAL_INFO (("Not restoring %s; udi in use or parent not present", sysfs_path));
+		g_free (udi);
+		goto fail;
+	}
+
+	hal_device_set_udi (d, udi);
+	g_free (udi);
+
+	device_snapshot_set_identity (d, sysfs_path, identity);
+	snapshot_stats.num_restored++;
+
+	HAL_INFO (("Restored %s from snapshot", hal_device_get_udi (d)));
+	return d;
+
+fail:
+	g_object_unref (d);
+	return NULL;
+}
+
+typedef struct {
+	int fd;
+	gboolean error;
+} SaveData;
+
+static gboolean
+write_all (int fd, const void *buf, gsize size)
+{
+	const guchar *p = buf;
+
+	while (size > 0) {
+		ssize_t written;
+
+		written = write (fd, p, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		p += written;
+		size -= written;
+	}
+	return TRUE;
+}
+
+static void
+foreach_record_save (gpointer key, gpointer value, gpointer user_data)
+{
+	GByteArray *record = (GByteArray *) value;
+	SaveData *sd = (SaveData *) user_data;
+
+	if (!sd->error && !write_all (sd->fd, record->data, record->len))
+		sd->error = TRUE;
+}
+
+/**
+ * device_snapshot_save:
+ *
+ * Returns:             TRUE if the snapshot was written
+ *
+ * Write the snapshot for the next run.
+ */
+gboolean
+device_snapshot_save (void)
+{
+	const char *path;
+	char *tmp_path;
+	GByteArray *header;
+	char *key;
+	SaveData sd;
+	gboolean ret;
+
+	if (!enabled)
+		return FALSE;
+
+	ret = FALSE;
+	path = get_snapshot_file ();
+	tmp_path = g_strdup_printf ("%s.tmp", path);
+
+	header = g_byte_array_new ();
+	g_byte_array_append (header, (const guint8 *) SNAPSHOT_MAGIC, 8);
+	write_u32 (header, SNAPSHOT_VERSION);
+	write_u32 (header, g_hash_table_size (records));
+	key = compute_key ();
+	write_string (header, key);
+	g_free (key);
+
+	sd.fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (sd.fd < 0) {
+		HAL_WARNING (("Cannot write device snapshot %s: %s", tmp_path, strerror (errno)));
+		goto out;
+	}
+	sd.error = !write_all (sd.fd, header->data, header->len);
+	g_hash_table_foreach (records, foreach_record_save, &sd);
+	if (close (sd.fd) != 0)
+		sd.error = TRUE;
+
+	if (sd.error || rename (tmp_path, path) != 0) {
+		HAL_WARNING (("Cannot write device snapshot %s: %s", path, strerror (errno)));
+		unlink (tmp_path);
+		goto out;
+	}
+
+	snapshot_stats.num_saved = g_hash_table_size (records);
+	HAL_INFO (("Wrote device snapshot with %u devices", snapshot_stats.num_saved));
+	ret = TRUE;
+
+out:
+	g_byte_array_free (header, TRUE);
+	g_free (tmp_path);
+	return ret;
+}
+
+/**
+ * device_snapshot_invalidate:
+ *
+ * Throw away the snapshot, e.g. because the fdi files changed. Devices
+ * already added are not part of the next snapshot either.
+ */
+void
+device_snapshot_invalidate (void)
+{
+	if (!enabled)
+		return;
+
+	HAL_INFO (("Invalidating device snapshot"));
+
+	snapshot_unload ();
+	g_hash_table_destroy (records);
+	records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, byte_array_free);
+	unlink (get_snapshot_file ());
+}
+
+/**
+ * device_snapshot_get_stats:
+ * @stats:              Where to store the statistics
+ *
+ * Get snapshot counters.
+ */
+void
+device_snapshot_get_stats (DeviceSnapshotStats *stats)
+{
+	*stats = snapshot_stats;
+}
@@ -0,0 +1,53 @@
+/***************************************************************************
+ *
+ * device_snapshot.h : Device snapshot for warm restarts
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef DEVICE_SNAPSHOT_H
+#define DEVICE_SNAPSHOT_H
+
+#include <glib.h>
+
+#include "device.h"
+
+typedef struct {
+	guint num_loaded;		/* devices in the snapshot read at startup */
+	guint num_restored;		/* devices restored from it */
+	guint num_mismatched;		/* devices found but changed since */
+	guint num_saved;		/* devices in the last snapshot written */
+} DeviceSnapshotStats;
+
+void       device_snapshot_init          (void);
+
+void       device_snapshot_coldplug_done (void);
+
+void       device_snapshot_set_identity  (HalDevice *d, const char *sysfs_path, const char *identity);
+
+HalDevice *device_snapshot_restore       (const char *sysfs_path, const char *identity);
+
+gboolean   device_snapshot_has           (const char *sysfs_path);
+
+gboolean   device_snapshot_save          (void);
+
+void       device_snapshot_invalidate    (void);
+
+void       device_snapshot_get_stats     (DeviceSnapshotStats *stats);
+
+#endif /* DEVICE_SNAPSHOT_H */
@@ -37,6 +37,16 @@
 
 static GObjectClass *parent_class;
 
+/* Node in a path index; a prefix tree over '/'-separated path
+ * components of a string property such as linux.sysfs_path. */
+typedef struct _PathNode PathNode;
+struct _PathNode {
+	PathNode *parent;
+	char *component;
+	GHashTable *children;	/* component -> PathNode */
+	GSList *devices;	/* devices whose property equals this path */
+};
+
 enum {
 	STORE_CHANGED,
 	DEVICE_PROPERTY_CHANGED,
@@ -48,6 +58,9 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* bumped whenever a device enters or leaves any store */
+static guint store_generation = 0;
+
 static void
 hal_device_store_finalize (GObject *obj)
 {
@@ -138,6 +151,8 @@ static void
 hal_device_store_init (HalDeviceStore *device)
 {
 	device->property_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	device->path_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	device->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 GType
@@ -178,10 +193,20 @@ hal_device_store_new (void)
 static void
 property_index_check_all (HalDeviceStore *store, HalDevice *device, gboolean add);
 
+static void
+path_index_check_all (HalDeviceStore *store, HalDevice *device, gboolean add);
+
 static void
 property_index_modify_string (HalDeviceStore *store, HalDevice *device,
 			      const char *key, gboolean added);
 
+static void
+path_index_modify (HalDeviceStore *store, HalDevice *device,
+		   const char *key, gboolean added);
+
+static void
+children_modify (HalDeviceStore *store, HalDevice *device, gboolean added);
+
 static void
 device_pre_property_changed (HalDevice *device,
 			      const char *key,
@@ -192,6 +217,9 @@ device_pre_property_changed (HalDevice *device,
 
 	if (hal_device_property_get_type (device, key) == HAL_PROPERTY_TYPE_STRING) {
 		property_index_modify_string(store, device, key, FALSE);
+		path_index_modify (store, device, key, FALSE);
+		if (strcmp (key, "info.parent") == 0)
+			children_modify (store, device, FALSE);
 	}
 }
 
@@ -207,6 +235,9 @@ emit_device_property_changed (HalDevice *device,
 
 	if (hal_device_property_get_type (device, key) == HAL_PROPERTY_TYPE_STRING) {
 		property_index_modify_string(store, device, key, TRUE);
+		path_index_modify (store, device, key, TRUE);
+		if (strcmp (key, "info.parent") == 0)
+			children_modify (store, device, TRUE);
 	}
 
 	g_signal_emit (store, signals[DEVICE_PROPERTY_CHANGED], 0,
@@ -261,6 +292,7 @@ hal_device_store_add (HalDeviceStore *store, HalDevice *device)
 	}
 	store->devices = g_slist_prepend (store->devices,
 					  g_object_ref (device));
+	store_generation++;
 
 	g_signal_connect (device, "property_changed",
 			  G_CALLBACK (emit_device_property_changed), store);
@@ -274,6 +306,8 @@ hal_device_store_add (HalDeviceStore *store, HalDevice *device)
 			  G_CALLBACK (emit_device_lock_released), store);
 
 	property_index_check_all (store, device, TRUE);
+	path_index_check_all (store, device, TRUE);
+	children_modify (store, device, TRUE);
 	g_signal_emit (store, signals[STORE_CHANGED], 0, device, TRUE);
 
 out:
@@ -287,6 +321,7 @@ hal_device_store_remove (HalDeviceStore *store, HalDevice *device)
 		return FALSE;
 
 	store->devices = g_slist_remove (store->devices, device);
+	store_generation++;
 
 	g_signal_handlers_disconnect_by_func (device,
 					      (gpointer)emit_device_property_changed,
@@ -305,6 +340,8 @@ hal_device_store_remove (HalDeviceStore *store, HalDevice *device)
 					      store);
 
 	property_index_check_all (store, device, FALSE);
+	path_index_check_all (store, device, FALSE);
+	children_modify (store, device, FALSE);
 
 	g_signal_emit (store, signals[STORE_CHANGED], 0, device, FALSE);
 
@@ -328,6 +365,20 @@ hal_device_store_find (HalDeviceStore *store, const char *udi)
 	return NULL;
 }
 
+/**
+ * hal_device_store_get_generation:
+ *
+ * Returns: A number that changes whenever a device is added to or
+ * removed from any store. A device looked up while it had a given
+ * generation is still in its store, and alive, as long as the
+ * generation hasn't changed.
+ */
+guint
+hal_device_store_get_generation (void)
+{
+	return store_generation;
+}
+
 void
 hal_device_store_foreach (HalDeviceStore *store,
 			  HalDeviceStoreForeachFn callback,
@@ -554,3 +605,425 @@ property_index_check_all (HalDeviceStore *store, HalDevice *device, gboolean add
 	g_list_free (indexed_properties);
 }
 
+static PathNode *
+path_node_new (PathNode *parent, const char *component)
+{
+	PathNode *node;
+
+	node = g_new0 (PathNode, 1);
+	node->parent = parent;
+	node->component = g_strdup (component);
+	return node;
+}
+
+static PathNode *
+path_node_lookup_child (PathNode *node, const char *component)
+{
+	if (node->children == NULL)
+		return NULL;
+	return g_hash_table_lookup (node->children, component);
+}
+
+/* free nodes that no longer carry devices or children, bottom-up */
+static void
+path_node_prune (PathNode *node)
+{
+	while (node->parent != NULL &&
+	       node->devices == NULL &&
+	       (node->children == NULL || g_hash_table_size (node->children) == 0)) {
+		PathNode *parent = node->parent;
+
+		g_hash_table_remove (parent->children, node->component);
+		if (node->children != NULL)
+			g_hash_table_destroy (node->children);
+		g_free (node->component);
+		g_free (node);
+		node = parent;
+	}
+}
+
+void
+hal_device_store_index_path_property (HalDeviceStore *store, const char *key)
+{
+	GSList *iter;
+
+	if (g_hash_table_lookup (store->path_index, key) != NULL)
+		return;
+
+	g_hash_table_insert (store->path_index, g_strdup (key), path_node_new (NULL, ""));
+
+	for (iter = store->devices; iter != NULL; iter = iter->next) {
+		HalDevice *d = HAL_DEVICE (iter->data);
+
+		if (hal_device_property_get_type (d, key) == HAL_PROPERTY_TYPE_STRING)
+			path_index_modify (store, d, key, TRUE);
+	}
+}
+
+static void
+path_index_modify (HalDeviceStore *store, HalDevice *device,
+		   const char *key, gboolean added)
+{
+	PathNode *root;
+	PathNode *node;
+	char **components;
+	int n;
+
+	root = g_hash_table_lookup (store->path_index, key);
+	if (root == NULL)
+		return;
+
+	components = g_strsplit (hal_device_property_get_string (device, key), "/", 0);
+
+	node = root;
+	for (n = 0; components[n] != NULL; n++) {
+		PathNode *child;
+
+		if (components[n][0] == '\0')
+			continue;
+
+		child = path_node_lookup_child (node, components[n]);
+		if (child == NULL) {
+			if (!added)
+				goto out;
+			if (node->children == NULL)
+				node->children = g_hash_table_new (g_str_hash, g_str_equal);
+			child = path_node_new (node, components[n]);
+			g_hash_table_insert (node->children, child->component, child);
+		}
+		node = child;
+	}
+
+	if (added) {
+		node->devices = g_slist_prepend (node->devices, device);
+	} else {
+		node->devices = g_slist_remove_all (node->devices, device);
+		path_node_prune (node);
+	}
+
+out:
+	g_strfreev (components);
+}
+
+static void
+path_index_check_all (HalDeviceStore *store, HalDevice *device, gboolean added)
+{
+	GList *indexed_properties, *lp;
+
+	if (g_hash_table_size (store->path_index) == 0)
+		return;
+
+	indexed_properties = g_hash_table_get_keys (store->path_index);
+	for (lp = indexed_properties; lp; lp = g_list_next (lp)) {
+		if (hal_device_property_get_type (device, lp->data) == HAL_PROPERTY_TYPE_STRING) {
+			path_index_modify (store, device, lp->data, added);
+		}
+	}
+	g_list_free (indexed_properties);
+}
+
+static gboolean
+is_stop_component (const char **stop_components, const char *component)
+{
+	int n;
+
+	if (stop_components == NULL)
+		return FALSE;
+
+	for (n = 0; stop_components[n] != NULL; n++) {
+		if (strcmp (stop_components[n], component) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * hal_device_store_match_path_ancestor:
+ * @store: the device store
+ * @key: a property previously indexed with hal_device_store_index_path_property()
+ * @path: the path to look up
+ * @include_self: whether a device whose @key equals @path itself matches
+ * @stop_components: NULL-terminated list of path components that the
+ *                   search must not ascend through, or NULL
+ * @ancestor_len: return location for the length of the matching
+ *                prefix of @path, or NULL
+ *
+ * Find the device whose @key is the longest '/'-separated prefix of
+ * @path. This is a single walk down the path index, equivalent to
+ * ascending @path one directory at a time and calling
+ * hal_device_store_match_key_value_string() at each level, stopping
+ * when the ascended path ends in one of @stop_components.
+ *
+ * Returns: the device, or NULL if no ancestor is known
+ */
+HalDevice *
+hal_device_store_match_path_ancestor (HalDeviceStore *store,
+				      const char *key,
+				      const char *path,
+				      gboolean include_self,
+				      const char **stop_components,
+				      gsize *ancestor_len)
+{
+	PathNode *node;
+	PathNode *best;
+	gsize best_len;
+	const char *p;
+	char component[256];
+
+	g_return_val_if_fail (store != NULL, NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+	g_return_val_if_fail (path != NULL, NULL);
+
+	node = g_hash_table_lookup (store->path_index, key);
+	if (node == NULL) {
+		HAL_ERROR (("Property %s is not path indexed", key));
+		return NULL;
+	}
+
+	best = NULL;
+	best_len = 0;
+	p = path;
+	while (*p != '\0') {
+		const char *end;
+		gsize len;
+
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		end = strchr (p, '/');
+		if (end == NULL)
+			end = p + strlen (p);
+		len = end - p;
+		if (len >= sizeof (component))
+			break;
+		memcpy (component, p, len);
+		component[len] = '\0';
+
+		node = path_node_lookup_child (node, component);
+		if (node == NULL)
+			break;
+
+		if (*end == '\0') {
+			/* this is @path itself; not subject to the stop list */
+			if (include_self && node->devices != NULL) {
+				best = node;
+				best_len = end - path;
+			}
+			break;
+		}
+
+		if (is_stop_component (stop_components, component)) {
+			/* ascending from below would stop here */
+			best = NULL;
+		} else if (node->devices != NULL) {
+			best = node;
+			best_len = end - path;
+		}
+		p = end;
+	}
+
+	if (best == NULL)
+		return NULL;
+
+	if (ancestor_len != NULL)
+		*ancestor_len = best_len;
+	return (HalDevice *) best->devices->data;
+}
+
+/* Keep the parent -> children adjacency in sync with info.parent; the
+ * list is keyed by the parent's UDI so children added before their
+ * parent, or kept around after it, are still found. */
+static void
+children_modify (HalDeviceStore *store, HalDevice *device, gboolean added)
+{
+	const char *parent_udi;
+	gpointer orig_key;
+	gpointer value;
+	GSList *children;
+
+	if (hal_device_property_get_type (device, "info.parent") != HAL_PROPERTY_TYPE_STRING)
+		return;
+
+	parent_udi = hal_device_property_get_string (device, "info.parent");
+
+	if (g_hash_table_lookup_extended (store->children, parent_udi, &orig_key, &value)) {
+		children = (GSList *) value;
+	} else {
+		orig_key = NULL;
+		children = NULL;
+	}
+
+	if (added) {
+		children = g_slist_prepend (children, device);
+		if (orig_key == NULL)
+			g_hash_table_insert (store->children, g_strdup (parent_udi), children);
+		else
+			g_hash_table_insert (store->children, orig_key, children);
+	} else if (orig_key != NULL) {
+		children = g_slist_remove_all (children, device);
+		if (children == NULL)
+			g_hash_table_remove (store->children, parent_udi);
+		else
+			g_hash_table_insert (store->children, orig_key, children);
+	}
+}
+
+/**
+ * hal_device_store_get_children:
+ * @store: the device store
+ * @parent_udi: UDI of the parent device
+ *
+ * Get the devices whose info.parent is @parent_udi, without scanning
+ * the store.
+ *
+ * Returns: a new list the caller must free with g_slist_free()
+ */
+GSList *
+hal_device_store_get_children (HalDeviceStore *store, const char *parent_udi)
+{
+	g_return_val_if_fail (store != NULL, NULL);
+	g_return_val_if_fail (parent_udi != NULL, NULL);
+
+	return g_slist_copy (g_hash_table_lookup (store->children, parent_udi));
+}
+
+/**
+ * hal_device_store_get_num_children:
+ * @store: the device store
+ * @parent_udi: UDI of the parent device
+ *
+ * Returns: number of devices whose info.parent is @parent_udi
+ */
+guint
+hal_device_store_get_num_children (HalDeviceStore *store, const char *parent_udi)
+{
+	g_return_val_if_fail (store != NULL, 0);
+	g_return_val_if_fail (parent_udi != NULL, 0);
+
+	return g_slist_length (g_hash_table_lookup (store->children, parent_udi));
+}
+
+/**
+ * hal_device_store_foreach_child:
+ * @store: the device store
+ * @parent_udi: UDI of the parent device
+ * @callback: function to call for each child; return FALSE to stop
+ * @user_data: user data for @callback
+ *
+ * Call @callback for each direct child of @parent_udi. The callback
+ * may remove devices from the store.
+ */
+void
+hal_device_store_foreach_child (HalDeviceStore *store,
+				const char *parent_udi,
+				HalDeviceStoreForeachFn callback,
+				gpointer user_data)
+{
+	GSList *children;
+	GSList *iter;
+
+	g_return_if_fail (store != NULL);
+	g_return_if_fail (callback != NULL);
+
+	children = hal_device_store_get_children (store, parent_udi);
+	for (iter = children; iter != NULL; iter = iter->next) {
+		if (!callback (store, HAL_DEVICE (iter->data), user_data))
+			break;
+	}
+	g_slist_free (children);
+}
+
+static gboolean
+foreach_descendant (HalDeviceStore *store,
+		    const char *parent_udi,
+		    HalDeviceStoreForeachFn callback,
+		    gpointer user_data,
+		    GHashTable *visited)
+{
+	GSList *children;
+	GSList *iter;
+	gboolean cont;
+
+	cont = TRUE;
+	children = hal_device_store_get_children (store, parent_udi);
+	for (iter = children; iter != NULL && cont; iter = iter->next) {
+		HalDevice *child = HAL_DEVICE (iter->data);
+
+		/* guard against info.parent loops */
+		if (g_hash_table_lookup (visited, child) != NULL)
+			continue;
+		g_hash_table_insert (visited, child, child);
+
+		/* hold a reference; the callback may remove the child */
+		g_object_ref (child);
+		cont = callback (store, child, user_data);
+		if (cont)
+			cont = foreach_descendant (store, hal_device_get_udi (child),
+						   callback, user_data, visited);
+		g_object_unref (child);
+	}
+	g_slist_free (children);
+
+	return cont;
+}
+
+/**
+ * hal_device_store_foreach_descendant:
+ * @store: the device store
+ * @parent_udi: UDI of the root of the subtree
+ * @callback: function to call for each descendant; return FALSE to stop
+ * @user_data: user data for @callback
+ *
+ * Walk the subtree below @parent_udi in pre-order; a device is visited
+ * before its children. The root itself is not visited.
+ *
+ * Returns: FALSE if @callback stopped the walk
+ */
+gboolean
+hal_device_store_foreach_descendant (HalDeviceStore *store,
+				     const char *parent_udi,
+				     HalDeviceStoreForeachFn callback,
+				     gpointer user_data)
+{
+	GHashTable *visited;
+	gboolean ret;
+
+	g_return_val_if_fail (store != NULL, FALSE);
+	g_return_val_if_fail (parent_udi != NULL, FALSE);
+	g_return_val_if_fail (callback != NULL, FALSE);
+
+	visited = g_hash_table_new (g_direct_hash, g_direct_equal);
+	ret = foreach_descendant (store, parent_udi, callback, user_data, visited);
+	g_hash_table_destroy (visited);
+
+	return ret;
+}
+
+static gboolean
+collect_descendant (HalDeviceStore *store, HalDevice *device, gpointer user_data)
+{
+	GSList **list = (GSList **) user_data;
+
+	*list = g_slist_prepend (*list, device);
+	return TRUE;
+}
+
+/**
+ * hal_device_store_get_descendants:
+ * @store: the device store
+ * @parent_udi: UDI of the root of the subtree
+ *
+ * Get all devices below @parent_udi, parents before their children.
+ *
+ * Returns: a new list the caller must free with g_slist_free()
+ */
+GSList *
+hal_device_store_get_descendants (HalDeviceStore *store, const char *parent_udi)
+{
+	GSList *list;
+
+	list = NULL;
+	hal_device_store_foreach_descendant (store, parent_udi, collect_descendant, &list);
+	return g_slist_reverse (list);
+}
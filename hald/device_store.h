@@ -39,6 +39,8 @@ struct _HalDeviceStore {
 
 	GSList *devices;
 	GHashTable *property_index;
+	GHashTable *path_index;
+	GHashTable *children;	/* parent udi -> GSList of child devices */
 };
 
 struct _HalDeviceStoreClass {
@@ -104,6 +106,8 @@ gboolean        hal_device_store_remove     (HalDeviceStore *store,
 HalDevice      *hal_device_store_find       (HalDeviceStore *store,
 					     const char     *udi);
 
+guint           hal_device_store_get_generation (void);
+
 void            hal_device_store_foreach    (HalDeviceStore *store,
 					     HalDeviceStoreForeachFn callback,
 					     gpointer user_data);
@@ -120,8 +124,36 @@ GSList         *hal_device_store_match_multiple_key_value_string (HalDeviceStore
 								  const char *key,
 								  const char *value);
 
+GSList         *hal_device_store_get_children (HalDeviceStore *store,
+					       const char *parent_udi);
+
+guint           hal_device_store_get_num_children (HalDeviceStore *store,
+						   const char *parent_udi);
+
+GSList         *hal_device_store_get_descendants (HalDeviceStore *store,
+						  const char *parent_udi);
+
+void            hal_device_store_foreach_child (HalDeviceStore *store,
+						const char *parent_udi,
+						HalDeviceStoreForeachFn callback,
+						gpointer user_data);
+
+gboolean        hal_device_store_foreach_descendant (HalDeviceStore *store,
+						     const char *parent_udi,
+						     HalDeviceStoreForeachFn callback,
+						     gpointer user_data);
+
 void hal_device_store_print (HalDeviceStore *store);
 
 void		hal_device_store_index_property (HalDeviceStore *store, const char *key);
 
+void		hal_device_store_index_path_property (HalDeviceStore *store, const char *key);
+
+HalDevice      *hal_device_store_match_path_ancestor (HalDeviceStore *store,
+						      const char *key,
+						      const char *path,
+						      gboolean include_self,
+						      const char **stop_components,
+						      gsize *ancestor_len);
+
 #endif /* DEVICE_STORE_H */
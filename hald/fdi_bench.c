@@ -0,0 +1,443 @@
+/***************************************************************************
+ *
+ * fdi_bench.c : Replay recorded devices through the fdi rule engine
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+
+#include "logger.h"
+#include "rule.h"
+#include "mmap_cache.h"
+#include "device.h"
+#include "device_info.h"
+#include "device_store.h"
+#include "hald_runner.h"
+#include "util.h"
+
+/* The corpus is the output of lshal, e.g. recorded on the machines we
+ * care about with "lshal > corpus". Every device in it is added to the
+ * GDL, so that rules refering to other devices work, and then copies
+ * of them are run through the preprobe, information and policy rules
+ * like a newly added device would be.
+ */
+
+extern void *rules_ptr;
+
+/* What the rule engine uses from the rest of hald */
+
+static HalDeviceStore *gdl = NULL;
+static HalDeviceStore *tdl = NULL;
+
+HalDeviceStore *
+hald_get_gdl (void)
+{
+	if (gdl == NULL)
+		gdl = hal_device_store_new ();
+	return gdl;
+}
+
+HalDeviceStore *
+hald_get_tdl (void)
+{
+	if (tdl == NULL)
+		tdl = hal_device_store_new ();
+	return tdl;
+}
+
+void
+hal_util_callout_device_add (HalDevice *d, HalCalloutsDone callback, gpointer userdata1, gpointer userdata2)
+{
+	callback (d, userdata1, userdata2);
+}
+
+void
+runner_device_finalized (HalDevice *device)
+{
+}
+
+gboolean
+di_cache_coherency_check (gboolean setup_watches)
+{
+	return FALSE;
+}
+
+int
+di_rules_init (void)
+{
+	char *cachename;
+	int fd;
+	struct stat statbuf;
+
+	cachename = getenv ("HAL_FDI_CACHE_NAME");
+	if (cachename == NULL)
+		cachename = HALD_CACHE_FILE;
+
+	if ((fd = open (cachename, O_RDONLY)) < 0)
+		DIE (("Unable to open cache %s\n", cachename));
+
+	if (fstat (fd, &statbuf) < 0)
+		DIE (("Unable to stat cache %s\n", cachename));
+
+	rules_ptr = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (rules_ptr == MAP_FAILED)
+		DIE (("Couldn't mmap file '%s', errno=%d: %s", cachename, errno, strerror (errno)));
+	if (statbuf.st_size < (off_t) sizeof (struct cache_header) ||
+	    ((struct cache_header *) rules_ptr)->magic != HALD_CACHE_MAGIC)
+		DIE (("Cache %s was written by another version of hald-generate-fdi-cache", cachename));
+
+	close (fd);
+
+	return 0;
+}
+
+/* Reading the corpus */
+
+static gboolean
+parse_property (HalDevice *d, char *line)
+{
+	char *key;
+	char *value;
+	char *end;
+	char *sep;
+
+	/* "  key = value  (type)" */
+	key = g_strstrip (line);
+	value = strstr (key, " = ");
+	if (value == NULL)
+		return FALSE;
+	*value = '\0';
+	value += 3;
+
+	if (g_str_has_suffix (value, "  (string)")) {
+		end = strrchr (value, '\'');
+		if (value[0] != '\'' || end == value)
+			return FALSE;
+		*end = '\0';
+		hal_device_property_set_string (d, key, value + 1);
+	} else if (g_str_has_suffix (value, "} (string list)")) {
+		if (value[0] != '{')
+			return FALSE;
+		end = strrchr (value, '}');
+		*end = '\0';
+		hal_device_property_strlist_clear (d, key, FALSE);
+		for (value++; *value == '\''; value = sep + 3) {
+			sep = strstr (value + 1, "', '");
+			if (sep == NULL)
+				sep = strrchr (value, '\'');
+			*sep = '\0';
+			hal_device_property_strlist_append (d, key, value + 1, FALSE);
+			if (sep[1] != ',')
+				break;
+		}
+	} else if (g_str_has_suffix (value, "  (int)")) {
+		hal_device_property_set_int (d, key, strtol (value, NULL, 10));
+	} else if (g_str_has_suffix (value, "  (uint64)")) {
+		hal_device_property_set_uint64 (d, key, g_ascii_strtoull (value, NULL, 10));
+	} else if (g_str_has_suffix (value, " (double)")) {
+		/* the value in parenthesis has all the digits */
+		sep = strchr (value, '(');
+		if (sep == NULL)
+			return FALSE;
+		hal_device_property_set_double (d, key, g_ascii_strtod (sep + 1, NULL));
+	} else if (g_str_has_suffix (value, "  (bool)")) {
+		hal_device_property_set_bool (d, key, g_str_has_prefix (value, "true"));
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GSList *
+read_corpus (const char *path)
+{
+	gchar *contents;
+	gchar **lines;
+	GSList *devices;
+	HalDevice *d;
+	guint n;
+
+	if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+		fprintf (stderr, "hald-fdi-bench: cannot read %s\n", path);
+		exit (1);
+	}
+
+	devices = NULL;
+	d = NULL;
+	lines = g_strsplit (contents, "\n", 0);
+	for (n = 0; lines[n] != NULL; n++) {
+		char *line = lines[n];
+
+		if (g_str_has_prefix (line, "udi = '")) {
+			char *end;
+
+			end = strrchr (line, '\'');
+			if (end != NULL)
+				*end = '\0';
+			d = hal_device_new ();
+			hal_device_set_udi (d, line + strlen ("udi = '"));
+			devices = g_slist_prepend (devices, d);
+			hal_device_store_add (hald_get_gdl (), d);
+		} else if (d != NULL && g_str_has_prefix (line, "  ")) {
+			if (!parse_property (d, line))
+				fprintf (stderr, "hald-fdi-bench: ignoring line %u: %s\n", n + 1, lines[n]);
+		}
+	}
+	g_strfreev (lines);
+	g_free (contents);
+
+	return g_slist_reverse (devices);
+}
+
+static void
+copy_property (HalDevice *device, const char *key, gpointer user_data)
+{
+	hal_device_copy_property (device, key, (HalDevice *) user_data, key);
+}
+
+/* Reporting */
+
+typedef struct {
+	char *fdi_file;
+	guint32 offset;
+	char *key;
+	guint64 evaluations;
+	guint64 hits;
+	guint64 time_ns;
+} ProfileEntry;
+
+static void
+collect_profile (const char *fdi_file, guint32 offset, const char *key,
+		 guint64 evaluations, guint64 hits, guint64 time_ns, gpointer user_data)
+{
+	GSList **entries = user_data;
+	ProfileEntry *e;
+
+	e = g_new0 (ProfileEntry, 1);
+	e->fdi_file = g_strdup (fdi_file);
+	e->offset = offset;
+	e->key = g_strdup (key);
+	e->evaluations = evaluations;
+	e->hits = hits;
+	e->time_ns = time_ns;
+	*entries = g_slist_prepend (*entries, e);
+}
+
+static gint
+compare_profile (gconstpointer a, gconstpointer b)
+{
+	const ProfileEntry *ea = a;
+	const ProfileEntry *eb = b;
+
+	if (ea->time_ns != eb->time_ns)
+		return ea->time_ns < eb->time_ns ? 1 : -1;
+	return ea->offset < eb->offset ? -1 : (ea->offset > eb->offset);
+}
+
+static void
+print_profile (gboolean per_file, guint top)
+{
+	GSList *entries = NULL;
+	GSList *i;
+	guint n;
+
+	if (per_file)
+		di_profile_foreach_file (collect_profile, &entries);
+	else
+		di_profile_foreach_rule (collect_profile, &entries);
+	entries = g_slist_sort (entries, compare_profile);
+
+	printf ("\n%-10s %12s %12s %12s  %s\n", "offset", "evaluations", "hits", "time (us)",
+		per_file ? "fdi file" : "key (fdi file)");
+	for (i = entries, n = 0; i != NULL; i = g_slist_next (i), n++) {
+		ProfileEntry *e = i->data;
+
+		if (n < top) {
+			if (per_file)
+				printf ("0x%08x %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %12.1f  %s\n",
+					e->offset, e->evaluations, e->hits, e->time_ns / 1000.0, e->fdi_file);
+			else
+				printf ("0x%08x %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %12.1f  %s (%s)\n",
+					e->offset, e->evaluations, e->hits, e->time_ns / 1000.0, e->key, e->fdi_file);
+		}
+		g_free (e->fdi_file);
+		g_free (e->key);
+		g_free (e);
+	}
+	g_slist_free (entries);
+}
+
+static double
+elapsed (const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+usage (void)
+{
+	fprintf (stderr,
+		 "\n"
+		 "usage : hald-fdi-bench [--iterations <n>] [--profile] [--top <n>] <corpus>\n"
+		 "\n"
+		 "        --iterations      Times to replay the corpus (default 10)\n"
+		 "        --profile         Report the cost of each rule and fdi file\n"
+		 "        --top             Number of rules and files to report (default 20)\n"
+		 "        --help            Show this information and exit\n"
+		 "\n"
+		 "Runs the devices in <corpus>, the output of lshal, through the rules\n"
+		 "in the fdi cache (HAL_FDI_CACHE_NAME or the installed one) and reports\n"
+		 "the throughput.\n"
+		 "\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	guint iterations = 10;
+	guint top = 20;
+	gboolean profile = FALSE;
+	GSList *corpus;
+	GSList *i;
+	guint num_devices;
+	guint n;
+	double phase[3] = {0.0, 0.0, 0.0};
+	struct timespec start;
+	struct timespec phase_start;
+	double total;
+
+	while (1) {
+		int c;
+		int option_index = 0;
+		const char *opt;
+		static struct option long_options[] = {
+			{"iterations", 1, NULL, 0},
+			{"profile", 0, NULL, 0},
+			{"top", 1, NULL, 0},
+			{"help", 0, NULL, 0},
+			{NULL, 0, NULL, 0}
+		};
+
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			opt = long_options[option_index].name;
+
+			if (strcmp (opt, "help") == 0) {
+				usage ();
+				return 0;
+			} else if (strcmp (opt, "iterations") == 0) {
+				iterations = strtoul (optarg, NULL, 10);
+			} else if (strcmp (opt, "profile") == 0) {
+				profile = TRUE;
+			} else if (strcmp (opt, "top") == 0) {
+				top = strtoul (optarg, NULL, 10);
+			}
+			break;
+
+		default:
+			usage ();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || iterations == 0) {
+		usage ();
+		return 1;
+	}
+
+	g_type_init ();
+	logger_disable ();
+
+	di_rules_init ();
+	corpus = read_corpus (argv[optind]);
+	num_devices = g_slist_length (corpus);
+	if (num_devices == 0) {
+		fprintf (stderr, "hald-fdi-bench: no devices in %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (profile)
+		di_profile_enable (TRUE);
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (n = 0; n < iterations; n++) {
+		for (i = corpus; i != NULL; i = g_slist_next (i)) {
+			HalDevice *template = i->data;
+			HalDevice *d;
+
+			d = hal_device_new ();
+			hal_device_property_foreach (template, copy_property, d);
+			hal_device_set_udi (d, hal_device_get_udi (template));
+
+			clock_gettime (CLOCK_MONOTONIC, &phase_start);
+			di_search_and_merge (d, DEVICE_INFO_TYPE_PREPROBE);
+			phase[0] += elapsed (&phase_start);
+
+			clock_gettime (CLOCK_MONOTONIC, &phase_start);
+			di_search_and_merge (d, DEVICE_INFO_TYPE_INFORMATION);
+			phase[1] += elapsed (&phase_start);
+
+			clock_gettime (CLOCK_MONOTONIC, &phase_start);
+			di_search_and_merge (d, DEVICE_INFO_TYPE_POLICY);
+			phase[2] += elapsed (&phase_start);
+
+			g_object_unref (d);
+		}
+	}
+	total = elapsed (&start);
+
+	printf ("%u devices, %u iterations: %.3f s (%.3f s matching)\n",
+		num_devices, iterations, total, phase[0] + phase[1] + phase[2]);
+	printf ("%.0f devices/s, %.1f us per device (preprobe %.1f, information %.1f, policy %.1f)\n",
+		num_devices * iterations / total,
+		total * 1e6 / (num_devices * iterations),
+		phase[0] * 1e6 / (num_devices * iterations),
+		phase[1] * 1e6 / (num_devices * iterations),
+		phase[2] * 1e6 / (num_devices * iterations));
+
+	if (profile) {
+		print_profile (TRUE, top);
+		print_profile (FALSE, top);
+	}
+
+	return 0;
+}
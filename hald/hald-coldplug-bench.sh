@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+# Measure coldplug on a synthetic sysfs tree
+#
+# usage: ./hald-coldplug-bench.sh [--partitions <m>] [<n> ...]
+#
+# For each n (default 1000, 10000 and 50000) this generates a sysfs
+# tree and udev database with n PCI, USB, SCSI and block devices and m
+# partitions (default 4) on each block device, see
+# linux/gen-fake-sysfs.c. hald is pointed at it with HALD_SYSFS_ROOT
+# and HALD_UDEVDB_EXPORT, every prober, addon and callout is replaced
+# by a program that does nothing, and hald is run with
+# --exit-after-probing. The coldplug time, peak RSS and the time spent
+# in each phase are printed; no real hardware is touched.
+#
+# Run it from the build directory after "make", or use "make bench".
+# hald still listens for uevents and creates its sockets in the socket
+# directory it was configured with, so this usually needs to be run as
+# root.
+
+partitions=4
+if [ "$1" = "--partitions" ] ; then
+    partitions=$2
+    shift 2
+fi
+if [ $# -eq 0 ] ; then
+    set -- 1000 10000 50000
+fi
+
+if [ ! -x ./hald -o ! -x linux/hald-gen-fake-sysfs ] ; then
+    echo "ERROR: build hald and linux/hald-gen-fake-sysfs first (make bench)"
+    exit 1
+fi
+
+BENCH_TMPDIR=${TMPDIR:-/tmp}/hald-bench-$USER
+rm -rf $BENCH_TMPDIR
+mkdir -p $BENCH_TMPDIR/stubs
+
+make -s -C ../fdi install DESTDIR=$BENCH_TMPDIR prefix=/ > /dev/null || exit 1
+export HAL_FDI_SOURCE_PREPROBE=$BENCH_TMPDIR/share/hal/fdi/preprobe
+export HAL_FDI_SOURCE_INFORMATION=$BENCH_TMPDIR/share/hal/fdi/information
+export HAL_FDI_SOURCE_POLICY=$BENCH_TMPDIR/share/hal/fdi/policy
+export HAL_FDI_CACHE_NAME=$BENCH_TMPDIR/hald-local-fdi-cache
+export HAL_DEVICE_SNAPSHOT_NAME=$BENCH_TMPDIR/hald-device-snapshot
+
+# stub probers, addons and callouts
+for true_prog in /bin/true /usr/bin/true ; do
+    [ -x $true_prog ] && break
+done
+for prog in `grep -rhoE '(hald-probe|hald-addon|hal-acl|hal-storage|hal-system|hal-setup)-[a-z0-9-]*' \
+             $BENCH_TMPDIR/share/hal/fdi linux/probing/Makefile.am linux/addons/Makefile.am | sort -u` ; do
+    ln -s $true_prog $BENCH_TMPDIR/stubs/$prog
+done
+export HALD_RUNNER_PATH=$BENCH_TMPDIR/stubs
+export PATH=`pwd`/../hald-runner:`pwd`:$PATH
+
+for devices in "$@" ; do
+    tree=$BENCH_TMPDIR/tree-$devices
+    rm -rf $tree
+    mkdir -p $tree
+    echo "== $devices devices, `linux/hald-gen-fake-sysfs --devices $devices --partitions $partitions $tree`"
+
+    export HALD_SYSFS_ROOT=$tree/sys
+    export HALD_UDEVDB_EXPORT=$tree/udevdb
+
+    start=`date +%s%N`
+    ./hald --daemon=no --verbose=no --retain-privileges --snapshot=no \
+           --exit-after-probing > $tree/stats 2> $tree/log
+    status=$?
+    end=`date +%s%N`
+    if [ $status -ne 0 ] ; then
+        echo "ERROR: hald exited with $status, see $tree/log"
+        exit 1
+    fi
+
+    echo "wall time          $(( (end - start) / 1000000 )) ms"
+    awk '
+        $1 == "coldplug_us"          { printf "coldplug           %d ms\n", $2 / 1000 }
+        $1 == "coldplug_peak_rss_kb" { printf "peak RSS           %d kB\n", $2 }
+        $1 == "devices"              { printf "devices in GDL     %d\n", $2 }
+    ' $tree/stats
+    echo "time per phase (ms, count, max ms):"
+    awk '
+        $1 ~ /_us\.sum$/   { name = substr ($1, 1, length ($1) - 4); sum[name] = $2 }
+        $1 ~ /_us\.count$/ { name = substr ($1, 1, length ($1) - 6); count[name] = $2 }
+        $1 ~ /_us\.max$/   { name = substr ($1, 1, length ($1) - 4); max[name] = $2 }
+        END {
+            for (name in sum)
+                printf "  %-40s %10.1f %8d %10.1f\n", name, sum[name] / 1000, count[name], max[name] / 1000
+        }
+    ' $tree/stats | sort -k2 -n -r
+    echo
+done
+
+rm -rf $BENCH_TMPDIR
@@ -65,6 +65,8 @@
 #include "hald_runner.h"
 #include "util_helper.h"
 #include "mmap_cache.h"
+#include "device_snapshot.h"
+#include "metrics.h"
 
 static void delete_pid(void)
 {
@@ -151,6 +153,7 @@ gdl_store_changed (HalDeviceStore *store, HalDevice *device,
 			hald_singleton_device_removed (command_line, device);
 		}
 
+		hald_dbus_drop_interface_handlers (device);
 		hald_runner_kill_device(device);
 	}
 
@@ -307,8 +310,10 @@ usage (void)
 		 "                              if hald runs as a daemon.\n"
 		 "        --help                Show this information and exit\n"
 		 "        --version             Output version information and exit\n"
-		 "        --exit-after-probing  Exit when probing is complete. Useful only\n"
-		 "                              when profiling hald.\n"
+		 "        --exit-after-probing  Exit when probing is complete and print the\n"
+		 "                              statistics. Useful only when profiling hald.\n"
+		 "        --snapshot=yes|no     Restore unchanged devices from the snapshot\n"
+		 "                              taken in the last run (default yes)\n"
 		 "\n"
 		 "The HAL daemon detects devices present in the system and provides the\n"
 		 "org.freedesktop.Hal service through the system-wide message bus provided\n"
@@ -324,6 +329,9 @@ static dbus_bool_t opt_become_daemon = TRUE;
 /** If #TRUE, we will retain privs */
 static dbus_bool_t opt_retain_privileges = FALSE;
 
+/** If #TRUE, we will use the device snapshot */
+static dbus_bool_t opt_snapshot = TRUE;
+
 /** If #TRUE, we will spew out debug */
 dbus_bool_t hald_is_verbose = FALSE;
 dbus_bool_t hald_use_syslog = FALSE;
@@ -336,6 +344,36 @@ PolKitContext *pk_context;
 static int sigterm_unix_signal_pipe_fds[2];
 static GIOChannel *sigterm_iochn;
 
+/* where the last log messages go on SIGUSR2 or a crash */
+#define HALD_LOG_DUMP_FILE HALD_SOCKET_DIR "/hald-log.dump"
+
+static guint log_flush_id = 0;
+
+static gboolean
+log_flush_idle (gpointer data)
+{
+	log_flush_id = 0;
+	logger_flush ();
+	return FALSE;
+}
+
+static void
+log_flush_notify (void)
+{
+	if (log_flush_id == 0)
+		log_flush_id = g_idle_add (log_flush_idle, NULL);
+}
+
+static void
+handle_sigusr2 (int value)
+{
+	ssize_t written;
+	static char marker[1] = {'D'};
+
+	/* dump the log from the mainloop, see handle_sigterm() */
+	written = write (sigterm_unix_signal_pipe_fds[1], marker, 1);
+}
+
 static void 
 handle_sigterm (int value)
 {
@@ -369,8 +407,21 @@ sigterm_iochn_data (GIOChannel *source,
 		goto out;
 	}
 
+	if (data[0] == 'D') {
+		int fd;
+
+		HAL_INFO (("Caught SIGUSR2, dumping log to %s", HALD_LOG_DUMP_FILE));
+		fd = open (HALD_LOG_DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd >= 0) {
+			logger_dump (fd);
+			close (fd);
+		}
+		goto out;
+	}
+
 	HAL_INFO (("Caught SIGTERM, initiating shutdown"));
 	hald_runner_kill_all();
+	device_snapshot_save ();
 	exit (0);
 
 out:
@@ -383,6 +434,9 @@ dbus_bool_t hald_is_initialising;
 
 static int startup_daemonize_pipe[2];
 
+/** When coldplug started */
+static GTimeVal probe_started;
+
 
 /*--------------------------------------------------------------------------------------------------*/
 
@@ -596,6 +650,7 @@ main (int argc, char *argv[])
 			{"retain-privileges", 0, NULL, 0},
 			{"child-timeout", 1, NULL, 0},
 			{"use-syslog", 0, NULL, 0},
+			{"snapshot", 1, NULL, 0},
 			{"help", 0, NULL, 0},
 			{"version", 0, NULL, 0},
 			{NULL, 0, NULL, 0}
@@ -642,6 +697,15 @@ main (int argc, char *argv[])
                                 opt_retain_privileges = TRUE;
 			} else if (strcmp (opt, "use-syslog") == 0) {
                                 hald_use_syslog = TRUE;
+			} else if (strcmp (opt, "snapshot") == 0) {
+				if (strcmp ("yes", optarg) == 0) {
+					opt_snapshot = TRUE;
+				} else if (strcmp ("no", optarg) == 0) {
+					opt_snapshot = FALSE;
+				} else {
+					usage ();
+					return 1;
+				}
 			}
 
 			break;
@@ -657,12 +721,18 @@ main (int argc, char *argv[])
 		logger_enable ();
 	else
 		logger_disable ();
+	/* whatever is written out, keep enough in the ring for a useful
+	 * dump on SIGUSR2 or a crash */
+	logger_set_ring_priorities (HAL_LOGPRI_INFO | HAL_LOGPRI_WARNING | HAL_LOGPRI_ERROR);
 
 	if (hald_use_syslog)
 		logger_enable_syslog ();
 	else
 		logger_disable_syslog ();
 
+	/* write log messages from the mainloop when idle */
+	logger_set_async (log_flush_notify);
+
 	/* will fork into two; only the child will return here if we are successful */
 	/*master_slave_setup ();
 	  sleep (100000000);*/
@@ -694,6 +764,9 @@ main (int argc, char *argv[])
 			exit (1);
 		}
 
+		/* don't have both processes write pending messages */
+		logger_flush ();
+
 		child_pid = fork ();
 		switch (child_pid) {
 		case -1:
@@ -761,6 +834,10 @@ main (int argc, char *argv[])
 	/* Finally, setup unix signal handler for TERM */
 	signal (SIGTERM, handle_sigterm);
 
+	/* dump recent log messages on request and when crashing */
+	signal (SIGUSR2, handle_sigusr2);
+	logger_dump_on_crash (HALD_LOG_DUMP_FILE);
+
 	/* set up the local dbus server */
 	if (!hald_dbus_local_server_init ())
 		return 1;
@@ -801,13 +878,22 @@ main (int argc, char *argv[])
 	/* make sure our fdi rule cache is up to date and setup file monitoring */
 	di_cache_coherency_check(TRUE);
 
+	/* restore unchanged devices from the last run */
+	if (opt_snapshot)
+		device_snapshot_init ();
+
+	hal_metrics_init ();
+
 	/* initialize operating system specific parts */
 	osspec_init ();
 
 	/* Init FDI files */
 	di_rules_init();
+	if (getenv ("HALD_FDI_PROFILE") != NULL)
+		di_profile_enable (TRUE);
 
 	/* detect devices */
+	g_get_current_time (&probe_started);
 	osspec_probe ();
 
 	/* run the main loop and serve clients */
@@ -860,16 +946,32 @@ next:
 }
 #endif
 
+static void
+print_metric (const char *name, guint64 value, gpointer user_data)
+{
+	fprintf ((FILE *) user_data, "%s %" G_GUINT64_FORMAT "\n", name, value);
+}
+
 void 
 osspec_probe_done (void)
 {
 	ssize_t written;
 	char buf[1] = {0};
+	struct rusage usage;
 
 	HAL_INFO (("Device probing completed"));
 
+	hal_metrics_set ("coldplug_us", hal_metrics_elapsed_us (&probe_started));
+	if (getrusage (RUSAGE_SELF, &usage) == 0)
+		hal_metrics_set ("coldplug_peak_rss_kb", usage.ru_maxrss);
+
+	device_snapshot_coldplug_done ();
+
 	if (hald_debug_exit_after_probing) {
 		HAL_INFO (("Exiting on user request (--exit-after-probing)"));
+		/* same format as hal-stats, for profiling scripts */
+		hal_metrics_foreach (print_metric, stdout);
+		fflush (stdout);
 		hald_runner_kill_all();
 		exit (0);
 	}
@@ -48,9 +48,13 @@
 #include "logger.h"
 #include "osspec.h"
 #include "util.h"
+#include "util_wakeup.h"
 #include "hald_runner.h"
+#include "device_snapshot.h"
+#include "metrics.h"
 #include "ci-tracker.h"
 #include "access-check.h"
+#include "libhal/libhal-packed.h"
 
 #ifdef HAVE_CONKIT
 #include "ck-tracker.h"
@@ -683,6 +687,35 @@ manager_find_device_by_capability (DBusConnection * connection,
 }
 
 
+static void
+append_statistic (DBusMessageIter *iter_dict, const char *name, dbus_uint64_t value)
+{
+	DBusMessageIter iter_dict_entry;
+
+	dbus_message_iter_open_container (iter_dict,
+					  DBUS_TYPE_DICT_ENTRY,
+					  NULL,
+					  &iter_dict_entry);
+	dbus_message_iter_append_basic (&iter_dict_entry, DBUS_TYPE_STRING, &name);
+	dbus_message_iter_append_basic (&iter_dict_entry, DBUS_TYPE_UINT64, &value);
+	dbus_message_iter_close_container (iter_dict, &iter_dict_entry);
+}
+
+static void
+append_lock_statistics (DBusMessageIter *iter_dict)
+{
+	HalDeviceLockStats stats;
+
+	hal_device_get_lock_stats (&stats);
+
+	append_statistic (iter_dict, "locks.held", stats.num_locks);
+	append_statistic (iter_dict, "locks.owners", stats.num_owners);
+	append_statistic (iter_dict, "locks.locked_devices", stats.num_locked_devices);
+	append_statistic (iter_dict, "locks.acquired", stats.num_acquired);
+	append_statistic (iter_dict, "locks.released", stats.num_released);
+	append_statistic (iter_dict, "locks.contended", stats.num_contended);
+}
+
 /**  
  *  manager_device_exists:
  *  @connection:         D-BUS connection
@@ -740,6 +773,87 @@ manager_device_exists (DBusConnection * connection, DBusMessage * message)
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+static gboolean
+foreach_device_append_udi (HalDeviceStore *store, HalDevice *device, gpointer user_data)
+{
+	DBusMessageIter *iter = (DBusMessageIter *) user_data;
+	const char *udi;
+
+	udi = hal_device_get_udi (device);
+	dbus_message_iter_append_basic (iter, DBUS_TYPE_STRING, &udi);
+
+	return TRUE;
+}
+
+/**
+ *  manager_get_children:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *  @recursive:          Whether to return all descendants
+ *
+ *  Returns:             What to do with the message
+ *
+ *  Get the devices in the GDL whose info.parent is the given UDI, or,
+ *  if @recursive is set, the whole subtree below it with parents listed
+ *  before their children.
+ *
+ *  <pre>
+ *  array{object_reference} Manager.GetChildren(string udi)
+ *  array{object_reference} Manager.GetDescendants(string udi)
+ *  </pre>
+ *
+ */
+static DBusHandlerResult
+manager_get_children (DBusConnection * connection, DBusMessage * message, gboolean recursive)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_array;
+	DBusError error;
+	const char *udi;
+
+	dbus_error_init (&error);
+	if (!dbus_message_get_args (message, &error,
+				    DBUS_TYPE_STRING, &udi,
+				    DBUS_TYPE_INVALID)) {
+		raise_syntax (connection, message, recursive ? "Manager.GetDescendants" : "Manager.GetChildren");
+		dbus_error_free (&error);
+
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	HAL_TRACE (("entering, udi=%s", udi));
+
+	if (hal_device_store_find (hald_get_gdl (), udi) == NULL) {
+		raise_no_such_device (connection, message, udi);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+
+	dbus_message_iter_init_append (reply, &iter);
+	dbus_message_iter_open_container (&iter, 
+					  DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_STRING_AS_STRING,
+					  &iter_array);
+
+	if (recursive)
+		hal_device_store_foreach_descendant (hald_get_gdl (), udi, foreach_device_append_udi, &iter_array);
+	else
+		hal_device_store_foreach_child (hald_get_gdl (), udi, foreach_device_append_udi, &iter_array);
+
+	dbus_message_iter_close_container (&iter, &iter_array);
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 /** 
  *  manager_send_signal_device_added:
  *  @device:             The HalDevice added
@@ -1396,6 +1510,222 @@ device_set_multiple_properties (DBusConnection *connection, DBusMessage *message
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+typedef struct {
+	const guchar *p;
+	const guchar *end;
+} PackedReader;
+
+static gboolean
+packed_get (PackedReader *r, void *dst, size_t len)
+{
+	if ((size_t) (r->end - r->p) < len)
+		return FALSE;
+	memcpy (dst, r->p, len);
+	r->p += len;
+	return TRUE;
+}
+
+static gboolean
+packed_get_str (PackedReader *r, const char **str)
+{
+	guint32 len;
+
+	if (!packed_get (r, &len, sizeof (len)) ||
+	    len == 0 || (size_t) (r->end - r->p) < len ||
+	    r->p[len - 1] != '\0')
+		return FALSE;
+	*str = (const char *) r->p;
+	r->p += len;
+	return TRUE;
+}
+
+/* Walk a packed property set (see libhal/libhal-packed.h); only
+ * change the device if apply is TRUE. Returns FALSE if it is
+ * malformed, in which case nothing has been applied when it was first
+ * walked with apply set to FALSE. */
+static gboolean
+packed_properties_walk (HalDevice *d, const guchar *data, int len, gboolean apply)
+{
+	PackedReader r;
+	guint32 header[2];
+	guint32 n;
+
+	r.p = data;
+	r.end = data + len;
+
+	if (!packed_get (&r, header, sizeof (header)) || header[0] != LIBHAL_PACKED_MAGIC)
+		return FALSE;
+
+	for (n = 0; n < header[1]; n++) {
+		guchar type;
+		const char *key;
+
+		if (!packed_get (&r, &type, 1) || !packed_get_str (&r, &key))
+			return FALSE;
+
+		switch (type) {
+		case LIBHAL_PACKED_TYPE_STRING:
+		{
+			const char *v;
+			if (!packed_get_str (&r, &v))
+				return FALSE;
+			if (apply)
+				hal_device_property_set_string (d, key, v);
+			break;
+		}
+		case LIBHAL_PACKED_TYPE_INT32:
+		{
+			gint32 v;
+			if (!packed_get (&r, &v, sizeof (v)))
+				return FALSE;
+			if (apply)
+				hal_device_property_set_int (d, key, v);
+			break;
+		}
+		case LIBHAL_PACKED_TYPE_UINT64:
+		{
+			guint64 v;
+			if (!packed_get (&r, &v, sizeof (v)))
+				return FALSE;
+			if (apply)
+				hal_device_property_set_uint64 (d, key, v);
+			break;
+		}
+		case LIBHAL_PACKED_TYPE_DOUBLE:
+		{
+			double v;
+			if (!packed_get (&r, &v, sizeof (v)))
+				return FALSE;
+			if (apply)
+				hal_device_property_set_double (d, key, v);
+			break;
+		}
+		case LIBHAL_PACKED_TYPE_BOOLEAN:
+		{
+			guchar v;
+			if (!packed_get (&r, &v, 1))
+				return FALSE;
+			if (apply)
+				hal_device_property_set_bool (d, key, v != 0);
+			break;
+		}
+		case LIBHAL_PACKED_TYPE_STRLIST:
+		{
+			guint32 count;
+			guint32 i;
+			gboolean type_error;
+			gboolean added;
+
+			if (!packed_get (&r, &count, sizeof (count)))
+				return FALSE;
+
+			/* same as for a string list in SetMultipleProperties */
+			type_error = FALSE;
+			added = TRUE;
+			if (apply) {
+				if (hal_device_has_property (d, key)) {
+					if (hal_device_property_get_type (d, key) != HAL_PROPERTY_TYPE_STRLIST)
+						type_error = TRUE;
+					added = FALSE;
+				}
+				hal_device_property_strlist_clear (d, key, TRUE);
+			}
+
+			for (i = 0; i < count; i++) {
+				const char *v;
+				if (!packed_get_str (&r, &v))
+					return FALSE;
+				if (apply)
+					hal_device_property_strlist_append (d, key, v, TRUE);
+			}
+
+			if (apply && !type_error)
+				hal_device_property_strlist_append_finish_changeset (d, key, added);
+			break;
+		}
+		default:
+			return FALSE;
+		}
+	}
+
+	return r.p == r.end;
+}
+
+/**
+ *  device_set_packed_properties:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *  @local_interface:    Whether the message was sent on the private socket
+ *
+ *  Returns:             What to do with the message
+ *
+ *  Set the properties in a packed property set, as sent by libhal from
+ *  probers and addons instead of SetMultipleProperties. The set is
+ *  checked completely before any property is changed, and is applied
+ *  in one atomic update, so clients see a single PropertyModified
+ *  signal. Only available on the private socket.
+ *
+ *  <pre>
+ *  void Device.SetPackedProperties(array{byte} packed)
+ *
+ *    raises org.freedesktop.Hal.NoSuchDevice,
+ *           org.freedesktop.Hal.SyntaxError,
+ *           org.freedesktop.Hal.PermissionDenied
+ *  </pre>
+ */
+static DBusHandlerResult
+device_set_packed_properties (DBusConnection *connection, DBusMessage *message, dbus_bool_t local_interface)
+{
+	DBusMessage *reply;
+	DBusError error;
+	HalDevice *d;
+	const char *udi;
+	const guchar *data;
+	int len;
+
+	udi = dbus_message_get_path (message);
+
+	HAL_TRACE (("entering, udi=%s", udi));
+
+	if (!local_interface) {
+		raise_permission_denied (connection, message, "SetPackedProperties: only on the private socket");
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	d = hal_device_store_find (hald_get_gdl (), udi);
+	if (d == NULL)
+		d = hal_device_store_find (hald_get_tdl (), udi);
+
+	if (d == NULL) {
+		raise_no_such_device (connection, message, udi);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	dbus_error_init (&error);
+	if (!dbus_message_get_args (message, &error,
+				    DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &data, &len,
+				    DBUS_TYPE_INVALID) ||
+	    !packed_properties_walk (d, data, len, FALSE)) {
+		raise_syntax (connection, message, "SetPackedProperties");
+		dbus_error_free (&error);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	device_property_atomic_update_begin ();
+	packed_properties_walk (d, data, len, TRUE);
+	device_property_atomic_update_end ();
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 
 /** 
  *  device_get_property:
@@ -2595,49 +2925,76 @@ device_release_global_interface_lock (DBusConnection *connection, DBusMessage *m
 
 /*------------------------------------------------------------------------*/
 
+/* lock owner (D-Bus name) -> set of HalDevice objects it has Lock()'ed */
 static GHashTable *services_with_locks = NULL;
 
 static void
 services_with_locks_add_lock (const char* lock_owner, HalDevice *device) {
 
-	GSList *devices;
+	GHashTable *devices;
 
-	devices = g_hash_table_lookup (services_with_locks, lock_owner);
+	if (services_with_locks == NULL) {
+		services_with_locks =
+			g_hash_table_new_full (g_str_hash,
+					       g_str_equal,
+					       g_free,
+					       (GDestroyNotify) g_hash_table_destroy);
+	}
 
-        devices = g_slist_prepend (devices, device);
+	devices = g_hash_table_lookup (services_with_locks, lock_owner);
+	if (devices == NULL) {
+		devices = g_hash_table_new_full (g_direct_hash,
+						 g_direct_equal,
+						 g_object_unref,
+						 NULL);
+		g_hash_table_insert (services_with_locks, g_strdup (lock_owner), devices);
+	}
 
-	g_hash_table_insert (services_with_locks, strdup(lock_owner), devices);
+	if (g_hash_table_lookup (devices, device) == NULL)
+		g_hash_table_insert (devices, g_object_ref (device), device);
 }
 
-static void 
+static gboolean
 services_with_locks_remove_lock (const char* lock_owner, HalDevice *device) {
 	
-	GSList *devices;
+	GHashTable *devices;
+
+	if (services_with_locks == NULL)
+		return FALSE;
 
 	devices = g_hash_table_lookup (services_with_locks, lock_owner);
+	if (devices == NULL)
+		return FALSE;
+
+	if (!g_hash_table_remove (devices, device))
+		return FALSE;
+
+	if (g_hash_table_size (devices) == 0)
+		g_hash_table_remove (services_with_locks, lock_owner);
+
+	return TRUE;
+}
 
-	devices = g_slist_remove (devices, device);
+static void
+services_with_locks_unlock_device (gpointer key, gpointer value, gpointer user_data)
+{
+	HalDevice *d = key;
 
-	g_hash_table_insert (services_with_locks, strdup(lock_owner), devices);
+	hal_device_property_remove (d, "info.locked");
+	hal_device_property_remove (d, "info.locked.reason");
+	hal_device_property_remove (d, "info.locked.dbus_name");
 }
 
 static void 
 services_with_locks_remove_lockowner (const char* lock_owner) {
 	
-	GSList *devices;
+	GHashTable *devices;
 
 	devices = g_hash_table_lookup (services_with_locks, lock_owner);
+	if (devices == NULL)
+		return;
 
-        if (devices != NULL) {
-		GSList *iter;
-
-		for (iter = devices; iter != NULL; iter = iter->next) {
-			HalDevice *d = iter->data;
-			hal_device_property_remove (d, "info.locked");
-			hal_device_property_remove (d, "info.locked.reason");
-			hal_device_property_remove (d, "info.locked.dbus_name");
-		}
-	}
+	g_hash_table_foreach (devices, services_with_locks_unlock_device, NULL);
 	g_hash_table_remove (services_with_locks, lock_owner);		
 }
 
@@ -2710,14 +3067,6 @@ device_lock (DBusConnection * connection,
 	hal_device_property_set_string (d, "info.locked.dbus_name",
 					sender);
 
-	if (services_with_locks == NULL) {
-		services_with_locks =
-			g_hash_table_new_full (g_str_hash,
-					       g_str_equal,
-					       g_free,
-					       g_object_unref);
-	}
-
 	services_with_locks_add_lock (sender, d);
 
 	if (!dbus_connection_send (connection, reply, NULL))
@@ -2804,9 +3153,7 @@ device_unlock (DBusConnection *connection,
 		return DBUS_HANDLER_RESULT_HANDLED;
 	}
 
-	if (g_hash_table_lookup (services_with_locks, sender)) {
-		services_with_locks_remove_lock (sender, d);
-	} else {
+	if (!services_with_locks_remove_lock (sender, d)) {
 		HAL_WARNING (("Service '%s' was not in the list of services "
 			      "with locks!", sender));
 	}
@@ -2840,25 +3187,215 @@ typedef struct PendingUpdate_s {
 
 static PendingUpdate *pending_updates_head = NULL;
 
-/** 
- *  device_property_atomic_update_begin:
- *
- *  Begin an atomic update - this is useful for updating several properties
- *  in one go.
- *
- *  Note that an atomic update is recursive - use with caution!
- */
-void
-device_property_atomic_update_begin (void)
+/** A client's interest in changes of some properties */
+typedef struct {
+	dbus_uint32_t id;
+	char *owner;		/**< unique bus name of the client */
+	GPatternSpec **keys;	/**< NULL-terminated; no patterns means all keys */
+	char *capability;	/**< only devices with this capability, or NULL */
+} PropertySubscription;
+
+/* Every subscription is checked on every property change, so a client
+ * may only have this many of them, with this many keys in total */
+#define MAX_SUBSCRIPTIONS_PER_SENDER 32
+#define MAX_SUBSCRIPTION_KEYS_PER_SENDER 256
+
+static GSList *property_subscriptions = NULL;
+static dbus_uint32_t next_subscription_id = 1;
+static guint64 num_subscription_signals = 0;
+
+static void
+property_subscription_free (PropertySubscription *sub)
 {
-	atomic_count++;
+	int i;
+
+	for (i = 0; sub->keys[i] != NULL; i++)
+		g_pattern_spec_free (sub->keys[i]);
+	g_free (sub->keys);
+	g_free (sub->owner);
+	g_free (sub->capability);
+	g_free (sub);
 }
 
-/** 
- *  device_property_atomic_update_end:
- *
- *  End an atomic update.
- *
+/* drop the subscriptions of a client that left the bus */
+static void
+property_subscriptions_remove_owner (const char *owner)
+{
+	GSList *i;
+	GSList *next;
+
+	for (i = property_subscriptions; i != NULL; i = next) {
+		PropertySubscription *sub = i->data;
+
+		next = g_slist_next (i);
+		if (strcmp (sub->owner, owner) == 0) {
+			HAL_INFO (("Dropping property subscription %u of %s", sub->id, owner));
+			property_subscriptions = g_slist_delete_link (property_subscriptions, i);
+			property_subscription_free (sub);
+		}
+	}
+}
+
+static gboolean
+property_subscription_wants_key (PropertySubscription *sub, const char *key)
+{
+	int i;
+
+	if (sub == NULL || sub->keys[0] == NULL)
+		return TRUE;
+
+	for (i = 0; sub->keys[i] != NULL; i++) {
+		if (g_pattern_match_string (sub->keys[i], key))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* whether keys[n] is the first occurence of the key; a key may be
+ * changed several times in an atomic update */
+static gboolean
+is_first_key (GPtrArray *keys, guint n)
+{
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		if (strcmp (g_ptr_array_index (keys, i), g_ptr_array_index (keys, n)) == 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* PropertiesChanged with the current values of the keys sub wants, or
+ * NULL if it wants none of them; added is the subset of keys that are
+ * new on the device */
+static DBusMessage *
+new_properties_changed (HalDevice *device, GPtrArray *keys, GPtrArray *added, PropertySubscription *sub)
+{
+	DBusMessage *message;
+	DBusMessageIter iter;
+	DBusMessageIter iter_dict;
+	DBusMessageIter iter_array;
+	guint num_keys;
+	guint i;
+
+	message = dbus_message_new_signal (hal_device_get_udi (device),
+					   "org.freedesktop.Hal.Device.Properties",
+					   "PropertiesChanged");
+	dbus_message_iter_init_append (message, &iter);
+
+	num_keys = 0;
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					  DBUS_TYPE_STRING_AS_STRING
+					  DBUS_TYPE_VARIANT_AS_STRING
+					  DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					  &iter_dict);
+	for (i = 0; i < keys->len; i++) {
+		const char *key = g_ptr_array_index (keys, i);
+
+		if (hal_device_has_property (device, key) &&
+		    property_subscription_wants_key (sub, key) &&
+		    is_first_key (keys, i)) {
+			foreach_property_append (device, key, &iter_dict);
+			num_keys++;
+		}
+	}
+	dbus_message_iter_close_container (&iter, &iter_dict);
+
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_STRING_AS_STRING,
+					  &iter_array);
+	for (i = 0; i < keys->len; i++) {
+		const char *key = g_ptr_array_index (keys, i);
+
+		if (!hal_device_has_property (device, key) &&
+		    property_subscription_wants_key (sub, key) &&
+		    is_first_key (keys, i)) {
+			dbus_message_iter_append_basic (&iter_array, DBUS_TYPE_STRING, &key);
+			num_keys++;
+		}
+	}
+	dbus_message_iter_close_container (&iter, &iter_array);
+
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_STRING_AS_STRING,
+					  &iter_array);
+	for (i = 0; i < added->len; i++) {
+		const char *key = g_ptr_array_index (added, i);
+
+		if (hal_device_has_property (device, key) &&
+		    property_subscription_wants_key (sub, key) &&
+		    is_first_key (added, i))
+			dbus_message_iter_append_basic (&iter_array, DBUS_TYPE_STRING, &key);
+	}
+	dbus_message_iter_close_container (&iter, &iter_array);
+
+	if (num_keys == 0) {
+		dbus_message_unref (message);
+		message = NULL;
+	}
+
+	return message;
+}
+
+/* Emit PropertiesChanged with the current values of the given keys on
+ * the org.freedesktop.Hal.Device.Properties interface. It's on its own
+ * interface so only clients that add a match rule for it get it, and
+ * they don't need a round trip for every changed property. Clients
+ * with a subscription get their own copy with only the keys they want. */
+static void
+send_signal_properties_changed (HalDevice *device, GPtrArray *keys, GPtrArray *added)
+{
+	DBusMessage *message;
+	GSList *i;
+
+	message = new_properties_changed (device, keys, added, NULL);
+	if (message == NULL)
+		return;
+	if (!dbus_connection_send (dbus_connection, message, NULL))
+		DIE (("error broadcasting message"));
+	dbus_message_unref (message);
+
+	for (i = property_subscriptions; i != NULL; i = g_slist_next (i)) {
+		PropertySubscription *sub = i->data;
+
+		if (sub->capability != NULL && !hal_device_has_capability (device, sub->capability))
+			continue;
+
+		message = new_properties_changed (device, keys, added, sub);
+		if (message == NULL)
+			continue;
+
+		dbus_message_set_destination (message, sub->owner);
+		if (!dbus_connection_send (dbus_connection, message, NULL))
+			DIE (("error sending message"));
+		dbus_message_unref (message);
+		num_subscription_signals++;
+	}
+}
+
+/** 
+ *  device_property_atomic_update_begin:
+ *
+ *  Begin an atomic update - this is useful for updating several properties
+ *  in one go.
+ *
+ *  Note that an atomic update is recursive - use with caution!
+ */
+void
+device_property_atomic_update_begin (void)
+{
+	atomic_count++;
+}
+
+/** 
+ *  device_property_atomic_update_end:
+ *
+ *  End an atomic update.
+ *
  *  Note that an atomic update is recursive - use with caution!
  */
 void
@@ -2883,6 +3420,9 @@ device_property_atomic_update_end (void)
 		for (pu_iter = pending_updates_head;
 		     pu_iter != NULL; pu_iter = pu_iter_next) {
 			int num_updates_this;
+			GPtrArray *keys;
+			GPtrArray *added;
+			HalDevice *device;
 
 			pu_iter_next = pu_iter->next;
 
@@ -2914,6 +3454,8 @@ device_property_atomic_update_end (void)
 							  DBUS_STRUCT_END_CHAR_AS_STRING,
 							  &iter_array);
 
+			keys = g_ptr_array_sized_new (num_updates_this);
+			added = g_ptr_array_new ();
 			for (pu_iter2 = pu_iter; pu_iter2 != NULL;
 			     pu_iter2 = pu_iter2->next) {
 				if (strcmp (pu_iter2->udi, pu_iter->udi) == 0) {
@@ -2938,7 +3480,9 @@ device_property_atomic_update_end (void)
 					dbus_message_iter_close_container (&iter_array, &iter_struct);
 
 					/* signal this is already processed */
-					g_free (pu_iter2->key);
+					g_ptr_array_add (keys, pu_iter2->key);
+					if (pu_iter2->added)
+						g_ptr_array_add (added, pu_iter2->key);
 					if (pu_iter2 != pu_iter) {
 						g_free (pu_iter2->udi);
 						pu_iter2->udi = NULL;
@@ -2946,15 +3490,23 @@ device_property_atomic_update_end (void)
 				}
 			}
 
-			g_free (pu_iter->udi);
 			dbus_message_iter_close_container (&iter, &iter_array);
 
 			if (dbus_connection != NULL) {
 				if (!dbus_connection_send (dbus_connection, message, NULL))
 					DIE (("error broadcasting message"));
+
+				/* the device may be gone by now */
+				device = hal_device_store_find (hald_get_gdl (), pu_iter->udi);
+				if (device != NULL)
+					send_signal_properties_changed (device, keys, added);
 			}
 
 			dbus_message_unref (message);
+			g_free (pu_iter->udi);
+			g_ptr_array_foreach (keys, (GFunc) g_free, NULL);
+			g_ptr_array_free (keys, TRUE);
+			g_ptr_array_free (added, TRUE);
 
 		already_processed:
 			g_free (pu_iter);
@@ -3000,6 +3552,8 @@ device_send_signal_property_modified (HalDevice *device, const char *key,
 		dbus_int32_t i;
 		DBusMessageIter iter_struct;
 		DBusMessageIter iter_array;
+		GPtrArray *keys;
+		GPtrArray *added_keys;
 
 		if (dbus_connection == NULL || hald_is_initialising)
 			goto out;
@@ -3037,6 +3591,15 @@ device_send_signal_property_modified (HalDevice *device, const char *key,
 			DIE (("error broadcasting message"));
 
 		dbus_message_unref (message);
+
+		keys = g_ptr_array_sized_new (1);
+		g_ptr_array_add (keys, (gpointer) key);
+		added_keys = g_ptr_array_sized_new (1);
+		if (added)
+			g_ptr_array_add (added_keys, (gpointer) key);
+		send_signal_properties_changed (device, keys, added_keys);
+		g_ptr_array_free (keys, TRUE);
+		g_ptr_array_free (added_keys, TRUE);
 	}
 out:
 	;
@@ -3262,6 +3825,42 @@ typedef struct
 
 static GSList *helper_interface_handlers = NULL;
 
+static void
+helper_interface_handler_free (HelperInterfaceHandler *hih)
+{
+	g_free (hih->interface_name);
+	g_free (hih->introspection_xml);
+	g_free (hih->udi);
+	g_free (hih);
+}
+
+/**
+ * hald_dbus_drop_interface_handlers:
+ * @device:             Device that left the GDL
+ *
+ * Forget the interfaces addons claimed on a device. A singleton addon
+ * outlives the devices it looks after, so we can't wait for its
+ * connection to go away.
+ */
+void
+hald_dbus_drop_interface_handlers (HalDevice *device)
+{
+	const char *udi;
+	GSList *i;
+	GSList *j;
+
+	udi = hal_device_get_udi (device);
+	for (i = helper_interface_handlers; i != NULL; i = j) {
+		HelperInterfaceHandler *hih = i->data;
+
+		j = g_slist_next (i);
+		if (strcmp (hih->udi, udi) == 0) {
+			helper_interface_handler_free (hih);
+			helper_interface_handlers = g_slist_delete_link (helper_interface_handlers, i);
+		}
+	}
+}
+
 static DBusHandlerResult
 device_claim_interface (DBusConnection * connection, DBusMessage * message, dbus_bool_t local_interface)
 {
@@ -3273,6 +3872,7 @@ device_claim_interface (DBusConnection * connection, DBusMessage * message, dbus
 	const char *interface_name;
 	const char *introspection_xml;
 	HelperInterfaceHandler *hih;
+	GSList *i;
 	dbus_bool_t res;
 	
 	HAL_TRACE (("entering"));
@@ -3314,12 +3914,26 @@ device_claim_interface (DBusConnection * connection, DBusMessage * message, dbus
 
 	hal_device_property_strlist_add (device, "info.interfaces", interface_name);
 
-	hih = g_new0 (HelperInterfaceHandler, 1);
-	hih->connection = connection;
-	hih->interface_name = g_strdup (interface_name);
-	hih->introspection_xml = g_strdup (introspection_xml);
-	hih->udi = g_strdup (udi);
-	helper_interface_handlers = g_slist_append (helper_interface_handlers, hih);
+	/* claiming the same interface again just updates the introspection */
+	for (i = helper_interface_handlers; i != NULL; i = g_slist_next (i)) {
+		hih = i->data;
+		if (hih->connection == connection &&
+		    strcmp (hih->udi, udi) == 0 &&
+		    strcmp (hih->interface_name, interface_name) == 0)
+			break;
+	}
+
+	if (i != NULL) {
+		g_free (hih->introspection_xml);
+		hih->introspection_xml = g_strdup (introspection_xml);
+	} else {
+		hih = g_new0 (HelperInterfaceHandler, 1);
+		hih->connection = connection;
+		hih->interface_name = g_strdup (interface_name);
+		hih->introspection_xml = g_strdup (introspection_xml);
+		hih->udi = g_strdup (udi);
+		helper_interface_handlers = g_slist_append (helper_interface_handlers, hih);
+	}
 	
 
 	reply = dbus_message_new_method_return (message);
@@ -3964,6 +4578,26 @@ manager_commit_to_gdl (DBusConnection * connection, DBusMessage * message, dbus_
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/* Method invocations are queued per device. By default a method is
+ * exclusive; it only runs when nothing else runs on the device and
+ * everything queued before it has finished. Methods that only read
+ * state can be declared as shared in <iface>.method_concurrency; these
+ * run alongside each other (but never overtake an exclusive method
+ * queued before them). Methods declared as coalesce are shared and in
+ * addition an identical call, i.e. same method, arguments and caller,
+ * joins an invocation already in the queue and gets its result.
+ */
+typedef enum {
+	METHOD_EXCLUSIVE,
+	METHOD_SHARED,
+	METHOD_COALESCE
+} MethodConcurrency;
+
+typedef struct {
+	DBusMessage *message;
+	DBusConnection *connection;
+} MethodCaller;
+
 typedef struct {
 	char *udi;
 	char *execpath;
@@ -3973,8 +4607,105 @@ typedef struct {
 	char *interface;
 	DBusMessage *message;
 	DBusConnection *connection;
+	MethodConcurrency concurrency;
+	gboolean running;
+	GTimeVal queued;
+	GSList *coalesced;		/* MethodCaller's sharing the result */
 } MethodInvocation;
 
+typedef struct {
+	GQueue *invocations;		/* running invocations come first */
+	guint num_running;
+	gboolean processing;
+	gboolean again;
+} MethodQueue;
+
+/* histograms have power-of-four buckets; the last one is unbounded */
+#define METHOD_HISTOGRAM_BUCKETS 8
+
+typedef struct {
+	guint64 num_invoked;
+	guint64 num_coalesced;
+	guint64 num_concurrent;		/* started while others were running */
+	guint64 depth_max;
+	guint64 depth[METHOD_HISTOGRAM_BUCKETS];
+	guint64 wait_ms[METHOD_HISTOGRAM_BUCKETS];
+} MethodStats;
+
+static const guint method_depth_bounds[METHOD_HISTOGRAM_BUCKETS - 1] = {0, 1, 2, 4, 8, 16, 64};
+static const guint method_wait_bounds[METHOD_HISTOGRAM_BUCKETS - 1] = {1, 4, 16, 64, 256, 1024, 4096};
+
+static GHashTable *interface_to_method_stats = NULL;
+
+static MethodStats *
+method_stats_get (const char *interface)
+{
+	MethodStats *stats;
+
+	if (interface_to_method_stats == NULL)
+		interface_to_method_stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	stats = g_hash_table_lookup (interface_to_method_stats, interface);
+	if (stats == NULL) {
+		stats = g_new0 (MethodStats, 1);
+		g_hash_table_insert (interface_to_method_stats, g_strdup (interface), stats);
+	}
+	return stats;
+}
+
+static void
+method_histogram_add (guint64 *histogram, const guint *bounds, guint64 value)
+{
+	guint n;
+
+	for (n = 0; n < METHOD_HISTOGRAM_BUCKETS - 1; n++) {
+		if (value <= bounds[n])
+			break;
+	}
+	histogram[n]++;
+}
+
+static MethodConcurrency
+get_method_concurrency (HalDevice *d, const char *interface, guint num)
+{
+	char *names_prop;
+	char *conc_prop;
+	const char *conc;
+	MethodConcurrency ret;
+
+	ret = METHOD_EXCLUSIVE;
+
+	names_prop = g_strdup_printf ("%s.method_names", interface);
+	conc_prop = g_strdup_printf ("%s.method_concurrency", interface);
+
+	if (!hal_device_has_property (d, conc_prop))
+		goto out;
+
+	/* if the lists don't line up we can't tell which method is which;
+	 * play it safe */
+	if (hal_device_property_get_strlist_length (d, conc_prop) !=
+	    hal_device_property_get_strlist_length (d, names_prop)) {
+		HAL_WARNING (("%s doesn't match %s on %s; treating all methods as exclusive",
+			      conc_prop, names_prop, hal_device_get_udi (d)));
+		goto out;
+	}
+
+	conc = hal_device_property_get_strlist_elem (d, conc_prop, num);
+	if (conc == NULL || strlen (conc) == 0 || strcmp (conc, "exclusive") == 0)
+		ret = METHOD_EXCLUSIVE;
+	else if (strcmp (conc, "shared") == 0)
+		ret = METHOD_SHARED;
+	else if (strcmp (conc, "coalesce") == 0)
+		ret = METHOD_COALESCE;
+	else
+		HAL_WARNING (("Unknown method concurrency '%s' in %s on %s", conc, conc_prop, hal_device_get_udi (d)));
+
+out:
+	g_free (names_prop);
+	g_free (conc_prop);
+	return ret;
+}
+
 static void
 hald_exec_method_cb (HalDevice *d, guint32 exit_type, 
 		     gint return_code, gchar **error,
@@ -3984,7 +4715,18 @@ hald_exec_method_cb (HalDevice *d, guint32 exit_type,
 static void
 hald_exec_method_free_mi (MethodInvocation *mi)
 {
-	/* hald_runner_run_method() assumes ownership of mi->message.. so we don't free it here */
+	GSList *i;
+
+	for (i = mi->coalesced; i != NULL; i = g_slist_next (i)) {
+		MethodCaller *caller = (MethodCaller *) i->data;
+
+		dbus_message_unref (caller->message);
+		g_free (caller);
+	}
+	g_slist_free (mi->coalesced);
+
+	if (mi->message != NULL)
+		dbus_message_unref (mi->message);
 	g_free (mi->udi);
 	g_free (mi->execpath);
 	g_strfreev (mi->extra_env);
@@ -4000,6 +4742,7 @@ hald_exec_method_do_invocation (MethodInvocation *mi)
 {
 	gboolean ret;
 	HalDevice *d;
+	GSList *i;
 
 	ret = FALSE;
 
@@ -4016,14 +4759,18 @@ hald_exec_method_do_invocation (MethodInvocation *mi)
 				       TRUE,
 				       0,
 				       hald_exec_method_cb,
-				       (gpointer) mi->message, 
-				       (gpointer) mi->connection);
+				       (gpointer) mi, 
+				       NULL);
 
 		ret = TRUE;
 	} else {
 		HAL_WARNING (("In-queue method call on non-existant device"));
 
 		raise_no_such_device (mi->connection, mi->message, mi->udi);
+		for (i = mi->coalesced; i != NULL; i = g_slist_next (i)) {
+			MethodCaller *caller = (MethodCaller *) i->data;
+			raise_no_such_device (caller->connection, caller->message, mi->udi);
+		}
 	}
 
 	return ret;
@@ -4032,13 +4779,18 @@ hald_exec_method_do_invocation (MethodInvocation *mi)
 
 static GHashTable *udi_to_method_queue = NULL;
 
+static void
+method_queue_free (MethodQueue *q)
+{
+	g_queue_free (q->invocations);
+	g_free (q);
+}
 
 gboolean 
 device_is_executing_method (HalDevice *d, const char *interface_name, const char *method_name)
 {
-	gpointer origkey;
 	gboolean ret;
-	GList *queue;
+	MethodQueue *q;
 
 	ret = FALSE;
 
@@ -4046,11 +4798,14 @@ device_is_executing_method (HalDevice *d, const char *interface_name, const char
 		goto out;
 	}
 
-	if (g_hash_table_lookup_extended (udi_to_method_queue, hal_device_get_udi (d), &origkey, (gpointer) &queue)) {
+	q = (MethodQueue *) g_hash_table_lookup (udi_to_method_queue, hal_device_get_udi (d));
+	if (q != NULL) {
+		GList *i;
 
-		if (queue != NULL) {
-			MethodInvocation *mi;
-			mi = (MethodInvocation *) queue->data;
+		for (i = q->invocations->head; i != NULL; i = i->next) {
+			MethodInvocation *mi = (MethodInvocation *) i->data;
+			if (!mi->running)
+				break;
 			if ((strcmp (mi->interface, interface_name) == 0) &&
 			    (strcmp (mi->member, method_name) == 0)) {
 				ret = TRUE;
@@ -4063,108 +4818,237 @@ out:
 	return ret;
 }
 
+/* TRUE if an exclusive method is queued or running for the device */
+static gboolean
+device_has_exclusive_method (HalDevice *d)
+{
+	MethodQueue *q;
+	GList *i;
+
+	if (udi_to_method_queue == NULL)
+		return FALSE;
+
+	q = (MethodQueue *) g_hash_table_lookup (udi_to_method_queue, hal_device_get_udi (d));
+	if (q == NULL)
+		return FALSE;
+
+	for (i = q->invocations->head; i != NULL; i = i->next) {
+		if (((MethodInvocation *) i->data)->concurrency == METHOD_EXCLUSIVE)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static void 
 hald_exec_method_process_queue (const char *udi);
 
+static gboolean
+method_invocation_is_same (MethodInvocation *a, MethodInvocation *b)
+{
+	guint n;
+
+	if (strcmp (a->execpath, b->execpath) != 0 ||
+	    strcmp (a->interface, b->interface) != 0 ||
+	    strcmp (a->member, b->member) != 0 ||
+	    strcmp (a->mstdin, b->mstdin) != 0)
+		return FALSE;
+
+	/* the caller is in the environment; the method may check
+	 * PolicyKit, so only ever share results with the same caller */
+	for (n = 0; a->extra_env[n] != NULL && b->extra_env[n] != NULL; n++) {
+		if (strcmp (a->extra_env[n], b->extra_env[n]) != 0)
+			return FALSE;
+	}
+	return a->extra_env[n] == NULL && b->extra_env[n] == NULL;
+}
+
 static void
 hald_exec_method_enqueue (MethodInvocation *mi)
 {
-	gpointer origkey;
-	GList *queue;
+	MethodQueue *q;
+	MethodStats *stats;
+	guint depth;
+	GList *i;
 
 	if (udi_to_method_queue == NULL) {
 		udi_to_method_queue = g_hash_table_new_full (g_str_hash,
 							     g_str_equal,
 							     g_free,
-							     NULL);
+							     (GDestroyNotify) method_queue_free);
+	}
+
+	stats = method_stats_get (mi->interface);
+	stats->num_invoked++;
+
+	q = (MethodQueue *) g_hash_table_lookup (udi_to_method_queue, mi->udi);
+	if (q == NULL) {
+		q = g_new0 (MethodQueue, 1);
+		q->invocations = g_queue_new ();
+		g_hash_table_insert (udi_to_method_queue, g_strdup (mi->udi), q);
+	}
+
+	if (mi->concurrency == METHOD_COALESCE) {
+		/* join an identical call unless an exclusive method is queued after it */
+		for (i = q->invocations->tail; i != NULL; i = i->prev) {
+			MethodInvocation *other = (MethodInvocation *) i->data;
+
+			if (other->concurrency == METHOD_EXCLUSIVE)
+				break;
+
+			if (other->concurrency == METHOD_COALESCE &&
+			    method_invocation_is_same (other, mi)) {
+				MethodCaller *caller;
+
+				HAL_INFO (("coalescing %s.%s on %s", mi->interface, mi->member, mi->udi));
+
+				caller = g_new0 (MethodCaller, 1);
+				caller->message = mi->message;
+				caller->connection = mi->connection;
+				other->coalesced = g_slist_prepend (other->coalesced, caller);
+				stats->num_coalesced++;
+
+				mi->message = NULL;
+				hald_exec_method_free_mi (mi);
+				return;
+			}
+		}
 	}
 
-	if (g_hash_table_lookup_extended (udi_to_method_queue, mi->udi, &origkey, (gpointer) &queue)) {
+	depth = g_queue_get_length (q->invocations);
+	method_histogram_add (stats->depth, method_depth_bounds, depth);
+	if (depth > stats->depth_max)
+		stats->depth_max = depth;
+
+	if (depth > 0)
 		HAL_INFO (("enqueue"));
-		queue = g_list_append (queue, mi);
-		g_hash_table_replace (udi_to_method_queue, g_strdup (mi->udi), queue);
-	} else {
+	else
 		HAL_INFO (("no need to enqueue"));
-		queue = g_list_append (NULL, mi);
-		g_hash_table_insert (udi_to_method_queue, g_strdup (mi->udi), queue);
 
-		hald_exec_method_do_invocation (mi);
-	}
+	g_get_current_time (&mi->queued);
+	g_queue_push_tail (q->invocations, mi);
+
+	hald_exec_method_process_queue (mi->udi);
 }
 
+/* called when an invocation is done, or never got started */
+static void
+hald_exec_method_complete (MethodInvocation *mi)
+{
+	MethodQueue *q;
+	char *udi;
+	char *metric;
+
+	q = (MethodQueue *) g_hash_table_lookup (udi_to_method_queue, mi->udi);
+	g_queue_remove (q->invocations, mi);
+	if (mi->running)
+		q->num_running--;
+
+	/* if method was Volume.Unmount() then refresh mount state */
+	if (strcmp (mi->interface, "org.freedesktop.Hal.Device.Volume") == 0 &&
+	    strcmp (mi->member, "Unmount") == 0) {
+		HalDevice *d;
+
+		HAL_INFO (("Refreshing mount state for %s since Unmount() completed", mi->udi));
+
+		d = hal_device_store_find (hald_get_gdl (), mi->udi);
+		if (d == NULL) {
+			d = hal_device_store_find (hald_get_tdl (), mi->udi);
+		}
+
+		if (d != NULL) {
+			osspec_refresh_mount_state_for_block_device (d);
+		} else {
+			HAL_WARNING ((" Cannot find device object for %s", mi->udi));
+		}
+	}
+
+	metric = g_strdup_printf ("dbus.exec.%s_us", mi->member);
+	hal_metrics_record_since (metric, &mi->queued);
+	g_free (metric);
+
+	udi = g_strdup (mi->udi);
+	hald_exec_method_free_mi (mi);
+	hald_exec_method_process_queue (udi);
+	g_free (udi);
+}
 
 static void 
 hald_exec_method_process_queue (const char *udi)
 {
-	gpointer origkey;
-	GList *queue;
-	MethodInvocation *mi;
+	MethodQueue *q;
+	GList *i;
+	GList *next;
 
-	if (g_hash_table_lookup_extended (udi_to_method_queue, udi, &origkey, (gpointer) &queue)) {
+	q = (MethodQueue *) g_hash_table_lookup (udi_to_method_queue, udi);
+	if (q == NULL)
+		return;
 
-		/* clean the top of the list */
-		if (queue != NULL) {
-			mi = (MethodInvocation *) queue->data;
-			queue = g_list_delete_link (queue, queue);
-			if (queue == NULL) {
-				g_hash_table_remove (udi_to_method_queue, udi);
-				HAL_INFO (("No more methods in queue"));
-			}
+	/* starting a method may complete it right away */
+	if (q->processing) {
+		q->again = TRUE;
+		return;
+	}
+	q->processing = TRUE;
 
-			/* if method was Volume.Unmount() then refresh mount state */
-			if (strcmp (mi->interface, "org.freedesktop.Hal.Device.Volume") == 0 &&
-			    strcmp (mi->member, "Unmount") == 0) {
-				HalDevice *d;
+	do {
+		q->again = FALSE;
 
-				HAL_INFO (("Refreshing mount state for %s since Unmount() completed", mi->udi));
+		for (i = q->invocations->head; i != NULL; i = next) {
+			MethodInvocation *mi = (MethodInvocation *) i->data;
+			MethodConcurrency concurrency;
+			GTimeVal now;
 
-				d = hal_device_store_find (hald_get_gdl (), mi->udi);
-				if (d == NULL) {
-					d = hal_device_store_find (hald_get_tdl (), mi->udi);
-				}
+			next = i->next;
+			concurrency = mi->concurrency;
 
-				if (d != NULL) {
-					osspec_refresh_mount_state_for_block_device (d);
-				} else {
-					HAL_WARNING ((" Cannot find device object for %s", mi->udi));
-				}
+			if (mi->running) {
+				if (concurrency == METHOD_EXCLUSIVE)
+					break;
+				continue;
 			}
+			if (concurrency == METHOD_EXCLUSIVE && q->num_running > 0)
+				break;
 
-			hald_exec_method_free_mi (mi);
-		}
+			if (q->num_running > 0) {
+				HAL_INFO (("Execing %s.%s alongside %u other methods", mi->interface, mi->member, q->num_running));
+				method_stats_get (mi->interface)->num_concurrent++;
+			}
 
-		/* process the rest of the list */
-		if (queue != NULL) {
-			HAL_INFO (("Execing next method in queue"));
-			g_hash_table_replace (udi_to_method_queue, g_strdup (udi), queue);
+			g_get_current_time (&now);
+			method_histogram_add (method_stats_get (mi->interface)->wait_ms, method_wait_bounds,
+					      (now.tv_sec - mi->queued.tv_sec) * 1000 +
+					      (now.tv_usec - mi->queued.tv_usec) / 1000);
 
-			mi = (MethodInvocation *) queue->data;
+			mi->running = TRUE;
+			q->num_running++;
 			if (!hald_exec_method_do_invocation (mi)) {
 				/* the device went away before we got to it... */
-				hald_exec_method_process_queue (mi->udi);
+				hald_exec_method_complete (mi);
 			}
+
+			if (concurrency == METHOD_EXCLUSIVE)
+				break;
 		}
+	} while (q->again);
+
+	q->processing = FALSE;
+
+	if (g_queue_is_empty (q->invocations)) {
+		g_hash_table_remove (udi_to_method_queue, udi);
+		HAL_INFO (("No more methods in queue"));
 	}
 }
 
 static void
-hald_exec_method_cb (HalDevice *d, guint32 exit_type, 
-		     gint return_code, gchar **error,
-		     gpointer data1, gpointer data2)
+hald_exec_method_reply (DBusConnection *conn, DBusMessage *message,
+			guint32 exit_type, gint return_code, gchar **error)
 {
 	dbus_int32_t result;
 	DBusMessage *reply = NULL;
-	DBusMessage *message;
 	DBusMessageIter iter;
-	DBusConnection *conn;
 	gchar *exp_name = NULL;
 	gchar *exp_detail = NULL;
 
-	hald_exec_method_process_queue (hal_device_get_udi (d));
-
-	message = (DBusMessage *) data1;
-	conn = (DBusConnection *) data2;
-	
 	if (exit_type == HALD_RUN_SUCCESS && error != NULL && 
 	    error[0] != NULL && error[1] != NULL) {
 		exp_name = error[0];
@@ -4219,15 +5103,649 @@ hald_exec_method_cb (HalDevice *d, guint32 exit_type,
 	}
 
 	g_free(exp_detail);
-	dbus_message_unref (message);
 }
 
-static DBusHandlerResult
-hald_exec_method (HalDevice *d, CICallerInfo *ci, DBusConnection *connection, dbus_bool_t local_interface, 
-		  DBusMessage *message, const char *execpath)
-{
-	int type;
-	GString *stdin_str = NULL;
+static void
+hald_exec_method_cb (HalDevice *d, guint32 exit_type, 
+		     gint return_code, gchar **error,
+		     gpointer data1, gpointer data2)
+{
+	MethodInvocation *mi = (MethodInvocation *) data1;
+	GSList *i;
+
+	hald_exec_method_reply (mi->connection, mi->message, exit_type, return_code, error);
+	for (i = mi->coalesced; i != NULL; i = g_slist_next (i)) {
+		MethodCaller *caller = (MethodCaller *) i->data;
+		hald_exec_method_reply (caller->connection, caller->message, exit_type, return_code, error);
+	}
+
+	hald_exec_method_complete (mi);
+}
+
+static void
+append_method_histogram (DBusMessageIter *iter_dict, const char *prefix, const guint64 *histogram, const guint *bounds)
+{
+	char name[256];
+	guint n;
+
+	for (n = 0; n < METHOD_HISTOGRAM_BUCKETS; n++) {
+		if (n < METHOD_HISTOGRAM_BUCKETS - 1)
+			g_snprintf (name, sizeof (name), "%s.le_%u", prefix, bounds[n]);
+		else
+			g_snprintf (name, sizeof (name), "%s.inf", prefix);
+		append_statistic (iter_dict, name, histogram[n]);
+	}
+}
+
+static void
+foreach_method_stats_append (gpointer key, gpointer value, gpointer user_data)
+{
+	const char *interface = (const char *) key;
+	MethodStats *stats = (MethodStats *) value;
+	DBusMessageIter *iter_dict = (DBusMessageIter *) user_data;
+	char name[256];
+
+	g_snprintf (name, sizeof (name), "methods.%s.invoked", interface);
+	append_statistic (iter_dict, name, stats->num_invoked);
+	g_snprintf (name, sizeof (name), "methods.%s.coalesced", interface);
+	append_statistic (iter_dict, name, stats->num_coalesced);
+	g_snprintf (name, sizeof (name), "methods.%s.concurrent", interface);
+	append_statistic (iter_dict, name, stats->num_concurrent);
+	g_snprintf (name, sizeof (name), "methods.%s.depth_max", interface);
+	append_statistic (iter_dict, name, stats->depth_max);
+
+	g_snprintf (name, sizeof (name), "methods.%s.depth", interface);
+	append_method_histogram (iter_dict, name, stats->depth, method_depth_bounds);
+	g_snprintf (name, sizeof (name), "methods.%s.wait_ms", interface);
+	append_method_histogram (iter_dict, name, stats->wait_ms, method_wait_bounds);
+}
+
+static void
+foreach_metric_append (const char *name, guint64 value, gpointer user_data)
+{
+	append_statistic ((DBusMessageIter *) user_data, name, value);
+}
+
+static void
+foreach_fdi_profile_append (const char *fdi_file, guint32 offset, const char *key,
+			    guint64 evaluations, guint64 hits, guint64 time_ns,
+			    gpointer user_data)
+{
+	DBusMessageIter *iter_dict = user_data;
+	char *prefix;
+	char *name;
+
+	if (key == NULL)
+		prefix = g_strdup_printf ("fdi.profile.file.%s", fdi_file);
+	else
+		prefix = g_strdup_printf ("fdi.profile.rule.%u", offset);
+
+	name = g_strdup_printf ("%s.evaluations", prefix);
+	append_statistic (iter_dict, name, evaluations);
+	g_free (name);
+	name = g_strdup_printf ("%s.hits", prefix);
+	append_statistic (iter_dict, name, hits);
+	g_free (name);
+	name = g_strdup_printf ("%s.time_ns", prefix);
+	append_statistic (iter_dict, name, time_ns);
+	g_free (name);
+
+	g_free (prefix);
+}
+
+/**  
+ *  manager_get_statistics:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *
+ *  Returns:             What to do with the message
+ *
+ *  Get all counters, gauges and histograms the daemon keeps, among
+ *  them the interface lock counters ("locks.*") and the method queue
+ *  counters for each interface ("methods.INTERFACE.*").
+ *
+ *  <pre>
+ *  map{string, uint64} Manager.GetStatistics()
+ *  </pre>
+ *
+ */
+static DBusHandlerResult
+manager_get_statistics (DBusConnection * connection, DBusMessage * message)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_dict;
+	HalWakeupStats wakeup_stats;
+	HalUtilAttrStats attr_stats;
+	DeviceSnapshotStats snapshot_stats;
+
+	HAL_TRACE (("entering"));
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+
+	dbus_message_iter_init_append (reply, &iter);
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					  DBUS_TYPE_STRING_AS_STRING
+					  DBUS_TYPE_UINT64_AS_STRING
+					  DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					  &iter_dict);
+
+	hal_metrics_foreach (foreach_metric_append, &iter_dict);
+
+	/* only when hald runs with HALD_FDI_PROFILE set */
+	di_profile_foreach_file (foreach_fdi_profile_append, &iter_dict);
+	di_profile_foreach_rule (foreach_fdi_profile_append, &iter_dict);
+
+	append_lock_statistics (&iter_dict);
+
+	if (interface_to_method_stats != NULL)
+		g_hash_table_foreach (interface_to_method_stats, foreach_method_stats_append, &iter_dict);
+
+	hal_wakeup_get_stats (&wakeup_stats);
+	append_statistic (&iter_dict, "wakeups.wakeups", wakeup_stats.num_wakeups);
+	append_statistic (&iter_dict, "wakeups.dispatched", wakeup_stats.num_dispatched);
+	append_statistic (&iter_dict, "wakeups.elapsed_ms", wakeup_stats.elapsed_ms);
+	append_statistic (&iter_dict, "wakeups.timers", wakeup_stats.num_timers);
+	append_statistic (&iter_dict, "wakeups.buckets", wakeup_stats.num_buckets);
+
+	hal_util_get_attr_stats (&attr_stats);
+	append_statistic (&iter_dict, "attrs.reads", attr_stats.num_reads);
+	append_statistic (&iter_dict, "attrs.dir_opens", attr_stats.num_dir_opens);
+	append_statistic (&iter_dict, "attrs.dir_cache_hits", attr_stats.num_dir_cache_hits);
+	append_statistic (&iter_dict, "attrs.syscalls", attr_stats.num_syscalls);
+
+	device_snapshot_get_stats (&snapshot_stats);
+	append_statistic (&iter_dict, "snapshot.loaded", snapshot_stats.num_loaded);
+	append_statistic (&iter_dict, "snapshot.restored", snapshot_stats.num_restored);
+	append_statistic (&iter_dict, "snapshot.mismatched", snapshot_stats.num_mismatched);
+	append_statistic (&iter_dict, "snapshot.saved", snapshot_stats.num_saved);
+
+	append_statistic (&iter_dict, "subscriptions.active", g_slist_length (property_subscriptions));
+	append_statistic (&iter_dict, "subscriptions.signals", num_subscription_signals);
+
+	dbus_message_iter_close_container (&iter, &iter_dict);
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/**  
+ *  manager_subscribe_properties:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *  
+ *  Returns:             What to do with the message
+ *
+ *  Ask for PropertiesChanged signals, sent only to the caller, with
+ *  the properties matching one of the given globs (e.g. "battery.*")
+ *  on devices with the given capability ("" for all devices). The
+ *  subscription ends with UnsubscribeProperties or when the caller
+ *  leaves the bus.
+ *
+ *  <pre>
+ *  uint32 Manager.SubscribeProperties(array{string} keys,
+ *                                     string capability)
+ *  </pre>
+ *
+ *  Raises the org.freedesktop.Hal.LimitExceeded error if the caller
+ *  would have more than MAX_SUBSCRIPTIONS_PER_SENDER subscriptions or
+ *  MAX_SUBSCRIPTION_KEYS_PER_SENDER keys in them.
+ */
+static DBusHandlerResult
+manager_subscribe_properties (DBusConnection * connection, DBusMessage * message)
+{
+	DBusMessage *reply;
+	DBusError error;
+	char **keys;
+	int num_keys;
+	const char *capability;
+	const char *sender;
+	PropertySubscription *sub;
+	int num_sender_subs;
+	int num_sender_keys;
+	GSList *l;
+	int i;
+
+	HAL_TRACE (("entering"));
+
+	sender = dbus_message_get_sender (message);
+
+	dbus_error_init (&error);
+	if (sender == NULL ||
+	    !dbus_message_get_args (message, &error,
+				    DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &keys, &num_keys,
+				    DBUS_TYPE_STRING, &capability,
+				    DBUS_TYPE_INVALID)) {
+		raise_syntax (connection, message, "Manager.SubscribeProperties");
+		dbus_error_free (&error);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	num_sender_subs = 0;
+	num_sender_keys = 0;
+	for (l = property_subscriptions; l != NULL; l = g_slist_next (l)) {
+		PropertySubscription *s = l->data;
+
+		if (strcmp (s->owner, sender) == 0) {
+			num_sender_subs++;
+			for (i = 0; s->keys[i] != NULL; i++)
+				num_sender_keys++;
+		}
+	}
+
+	if (num_sender_subs + 1 > MAX_SUBSCRIPTIONS_PER_SENDER ||
+	    num_sender_keys + num_keys > MAX_SUBSCRIPTION_KEYS_PER_SENDER) {
+		HAL_WARNING (("Refusing property subscription for %s: %d subscriptions with %d keys already",
+			      sender, num_sender_subs, num_sender_keys));
+		raise_error (connection, message,
+			     "org.freedesktop.Hal.LimitExceeded",
+			     "At most %d subscriptions with %d keys in total per client",
+			     MAX_SUBSCRIPTIONS_PER_SENDER, MAX_SUBSCRIPTION_KEYS_PER_SENDER);
+		dbus_free_string_array (keys);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	sub = g_new0 (PropertySubscription, 1);
+	sub->id = next_subscription_id++;
+	sub->owner = g_strdup (sender);
+	sub->keys = g_new0 (GPatternSpec *, num_keys + 1);
+	for (i = 0; i < num_keys; i++)
+		sub->keys[i] = g_pattern_spec_new (keys[i]);
+	if (capability[0] != '\0')
+		sub->capability = g_strdup (capability);
+	property_subscriptions = g_slist_prepend (property_subscriptions, sub);
+	dbus_free_string_array (keys);
+
+	HAL_INFO (("Property subscription %u for %s (%d keys, capability '%s')",
+		   sub->id, sender, num_keys, capability));
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+	dbus_message_append_args (reply, DBUS_TYPE_UINT32, &sub->id, DBUS_TYPE_INVALID);
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/**  
+ *  manager_unsubscribe_properties:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *  
+ *  Returns:             What to do with the message
+ *
+ *  End a subscription made with SubscribeProperties.
+ *
+ *  <pre>
+ *  void Manager.UnsubscribeProperties(uint32 subscription)
+ *  </pre>
+ *
+ *  Raises the org.freedesktop.Hal.NoSuchSubscription error if the
+ *  caller has no such subscription.
+ */
+static DBusHandlerResult
+manager_unsubscribe_properties (DBusConnection * connection, DBusMessage * message)
+{
+	DBusMessage *reply;
+	DBusError error;
+	dbus_uint32_t id;
+	const char *sender;
+	GSList *i;
+
+	HAL_TRACE (("entering"));
+
+	sender = dbus_message_get_sender (message);
+
+	dbus_error_init (&error);
+	if (sender == NULL ||
+	    !dbus_message_get_args (message, &error,
+				    DBUS_TYPE_UINT32, &id,
+				    DBUS_TYPE_INVALID)) {
+		raise_syntax (connection, message, "Manager.UnsubscribeProperties");
+		dbus_error_free (&error);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	for (i = property_subscriptions; i != NULL; i = g_slist_next (i)) {
+		PropertySubscription *sub = i->data;
+
+		if (sub->id == id && strcmp (sub->owner, sender) == 0) {
+			property_subscriptions = g_slist_delete_link (property_subscriptions, i);
+			property_subscription_free (sub);
+			break;
+		}
+	}
+
+	if (i == NULL) {
+		raise_error (connection, message,
+			     "org.freedesktop.Hal.NoSuchSubscription",
+			     "No subscription %u for %s", id, sender);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+typedef struct {
+	char **keys;		/**< exact names or prefixes ending in '*' */
+	int num_keys;
+	DBusMessageIter *iter;
+} GetPropertiesInfo;
+
+static gboolean
+get_properties_wants_key (GetPropertiesInfo *info, const char *key)
+{
+	int i;
+
+	if (info->num_keys == 0)
+		return TRUE;
+
+	for (i = 0; i < info->num_keys; i++) {
+		const char *k = info->keys[i];
+		size_t len = strlen (k);
+
+		if (len > 0 && k[len - 1] == '*') {
+			if (strncmp (key, k, len - 1) == 0)
+				return TRUE;
+		} else if (strcmp (key, k) == 0) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void
+foreach_property_append_wanted (HalDevice *device, const char *key, gpointer user_data)
+{
+	GetPropertiesInfo *info = (GetPropertiesInfo *) user_data;
+
+	if (get_properties_wants_key (info, key))
+		foreach_property_append (device, key, info->iter);
+}
+
+static void
+get_properties_append_device (HalDevice *device, GetPropertiesInfo *info)
+{
+	DBusMessageIter *iter_devices;
+	DBusMessageIter iter_entry;
+	DBusMessageIter iter_dict;
+	const char *udi;
+	gboolean have_prefix;
+	int i;
+
+	iter_devices = info->iter;
+	udi = hal_device_get_udi (device);
+
+	dbus_message_iter_open_container (iter_devices,
+					  DBUS_TYPE_DICT_ENTRY,
+					  NULL,
+					  &iter_entry);
+	dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_STRING, &udi);
+	dbus_message_iter_open_container (&iter_entry,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					  DBUS_TYPE_STRING_AS_STRING
+					  DBUS_TYPE_VARIANT_AS_STRING
+					  DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					  &iter_dict);
+
+	have_prefix = (info->num_keys == 0);
+	for (i = 0; i < info->num_keys && !have_prefix; i++) {
+		size_t len = strlen (info->keys[i]);
+		if (len > 0 && info->keys[i][len - 1] == '*')
+			have_prefix = TRUE;
+	}
+
+	info->iter = &iter_dict;
+	if (have_prefix) {
+		hal_device_property_foreach (device, foreach_property_append_wanted, info);
+	} else {
+		/* only exact names; look them up instead of walking every property */
+		for (i = 0; i < info->num_keys; i++) {
+			int j;
+
+			for (j = 0; j < i; j++) {
+				if (strcmp (info->keys[i], info->keys[j]) == 0)
+					break;
+			}
+			if (j == i && hal_device_has_property (device, info->keys[i]))
+				foreach_property_append (device, info->keys[i], &iter_dict);
+		}
+	}
+	info->iter = iter_devices;
+
+	dbus_message_iter_close_container (&iter_entry, &iter_dict);
+	dbus_message_iter_close_container (iter_devices, &iter_entry);
+}
+
+static gboolean
+foreach_device_get_properties (HalDeviceStore *store, HalDevice *device, gpointer user_data)
+{
+	get_properties_append_device (device, (GetPropertiesInfo *) user_data);
+	return TRUE;
+}
+
+/**  
+ *  manager_get_properties:
+ *  @connection:         D-BUS connection
+ *  @message:            Message
+ *  
+ *  Returns:             What to do with the message
+ *
+ *  Get properties of many devices in one call. A key ending in '*'
+ *  selects every property starting with the rest of it, e.g.
+ *  "storage.*"; no keys selects all properties and no UDIs selects
+ *  every device in the GDL. UDIs that don't exist (any more) are left
+ *  out of the reply rather than failing the whole call, as are
+ *  properties a device doesn't have.
+ *
+ *  <pre>
+ *  map{string, map{string, any}} Manager.GetProperties(array{string} udis,
+ *                                                      array{string} keys)
+ *  </pre>
+ *
+ */
+static DBusHandlerResult
+manager_get_properties (DBusConnection * connection, DBusMessage * message)
+{
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_devices;
+	DBusError error;
+	char **udis;
+	int num_udis;
+	GetPropertiesInfo info;
+	int i;
+
+	HAL_TRACE (("entering"));
+
+	dbus_error_init (&error);
+	if (!dbus_message_get_args (message, &error,
+				    DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &udis, &num_udis,
+				    DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &info.keys, &info.num_keys,
+				    DBUS_TYPE_INVALID)) {
+		raise_syntax (connection, message, "Manager.GetProperties");
+		dbus_error_free (&error);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	reply = dbus_message_new_method_return (message);
+	if (reply == NULL)
+		DIE (("No memory"));
+
+	dbus_message_iter_init_append (reply, &iter);
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					  DBUS_TYPE_STRING_AS_STRING
+					  DBUS_TYPE_ARRAY_AS_STRING
+					  DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					  DBUS_TYPE_STRING_AS_STRING
+					  DBUS_TYPE_VARIANT_AS_STRING
+					  DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+					  DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					  &iter_devices);
+	info.iter = &iter_devices;
+
+	if (num_udis == 0) {
+		hal_device_store_foreach (hald_get_gdl (),
+					  foreach_device_get_properties,
+					  &info);
+	} else {
+		for (i = 0; i < num_udis; i++) {
+			HalDevice *d;
+
+			d = hal_device_store_find (hald_get_gdl (), udis[i]);
+			if (d == NULL)
+				d = hal_device_store_find (hald_get_tdl (), udis[i]);
+			if (d != NULL)
+				get_properties_append_device (d, &info);
+		}
+	}
+
+	dbus_message_iter_close_container (&iter, &iter_devices);
+
+	dbus_free_string_array (udis);
+	dbus_free_string_array (info.keys);
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+
+	dbus_message_unref (reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/* Some methods are getters that desktop sessions call all the time
+ * (think brightness sliders and LaptopPanel.GetBrightness). Running
+ * the method script for these forks a shell that sources hal-functions,
+ * runs hal-is-caller-privileged and then execs the OS backend script.
+ *
+ * Instead a C implementation can be registered for a method script. It
+ * runs in hald, does the same PolicyKit check the script would do and
+ * replies exactly like the script exiting would. If it returns FALSE,
+ * e.g. for a backend it doesn't know about, the script is run as usual.
+ */
+static GHashTable *native_methods = NULL;
+
+/**
+ * hald_dbus_register_native_method:
+ * @execpath:           Method script to replace, as in method_execpaths
+ * @func:               Native implementation
+ *
+ * Register a native implementation of a method script.
+ */
+void
+hald_dbus_register_native_method (const char *execpath, HaldNativeMethodFunc func)
+{
+	if (native_methods == NULL)
+		native_methods = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	g_hash_table_insert (native_methods, g_strdup (execpath), (gpointer) func);
+}
+
+/* returns FALSE if the method script needs to be run instead */
+static gboolean
+hald_exec_native_method (HalDevice *d, DBusConnection *connection, dbus_bool_t local_interface,
+			 DBusMessage *message, const char *execpath)
+{
+	HaldNativeMethodFunc func;
+	HaldNativeMethodReturn ret;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+
+	if (native_methods == NULL)
+		return FALSE;
+
+	func = (HaldNativeMethodFunc) g_hash_table_lookup (native_methods, execpath);
+	if (func == NULL)
+		return FALSE;
+
+	/* don't overtake exclusive methods queued for the device; a
+	 * GetBrightness() right after a SetBrightness() must see the new
+	 * value */
+	if (device_has_exclusive_method (d))
+		return FALSE;
+
+	memset (&ret, 0, sizeof (ret));
+	if (!func (d, message, &ret)) {
+		g_free (ret.action);
+		g_free (ret.error_detail);
+		return FALSE;
+	}
+
+#ifdef HAVE_POLKIT
+	/* same as hal_check_priv in hal-functions */
+	if (!local_interface && ret.action != NULL) {
+		int polkit_result;
+
+		polkit_result = -1;
+		access_check_caller_have_access_to_device (ci_tracker, d, ret.action,
+							   dbus_message_get_sender (message),
+							   &polkit_result);
+		if (polkit_result < 0) {
+			g_free (ret.error_detail);
+			ret.error_name = "org.freedesktop.Hal.Device.Error";
+			ret.error_detail = g_strdup ("Cannot determine if caller is privileged");
+		} else if (polkit_result != POLKIT_RESULT_YES) {
+			g_free (ret.error_detail);
+			ret.error_name = "org.freedesktop.Hal.Device.PermissionDeniedByPolicy";
+			ret.error_detail = g_strdup_printf ("%s %s <-- (action, result)", ret.action,
+							    polkit_result_to_string_representation (polkit_result));
+		}
+	}
+#endif
+
+	HAL_INFO (("native method '%s' on %s: %s", execpath, hal_device_get_udi (d),
+		   ret.error_name != NULL ? ret.error_name : "ok"));
+
+	if (ret.error_name != NULL) {
+		reply = dbus_message_new_error (message, ret.error_name,
+						ret.error_detail != NULL ? ret.error_detail : "");
+		if (reply == NULL)
+			DIE (("No memory"));
+	} else {
+		reply = dbus_message_new_method_return (message);
+		if (reply == NULL)
+			DIE (("No memory"));
+		dbus_message_iter_init_append (reply, &iter);
+		dbus_message_iter_append_basic (&iter, DBUS_TYPE_INT32, &ret.result);
+	}
+
+	if (!dbus_connection_send (connection, reply, NULL))
+		DIE (("No memory"));
+	dbus_message_unref (reply);
+
+	g_free (ret.action);
+	g_free (ret.error_detail);
+	return TRUE;
+}
+
+static DBusHandlerResult
+hald_exec_method (HalDevice *d, CICallerInfo *ci, DBusConnection *connection, dbus_bool_t local_interface, 
+		  DBusMessage *message, const char *execpath, MethodConcurrency concurrency)
+{
+	int type;
+	GString *stdin_str = NULL;
 	DBusMessageIter iter;
 	char *extra_env[6];
 	char uid_export[256];
@@ -4390,13 +5908,13 @@ hald_exec_method (HalDevice *d, CICallerInfo *ci, DBusConnection *connection, db
 	mi->execpath = g_strdup (execpath);
 	mi->extra_env = g_strdupv (extra_env);
 	mi->mstdin = g_strdup (stdin_str->str);
-	mi->message = message;
+	mi->message = dbus_message_ref (message);
 	mi->connection = connection;
 	mi->member = g_strdup (dbus_message_get_member (message));
 	mi->interface = g_strdup (dbus_message_get_interface (message));
+	mi->concurrency = concurrency;
 	hald_exec_method_enqueue (mi);
 
-	dbus_message_ref (message);
 	g_string_free (stdin_str, TRUE);
 	return DBUS_HANDLER_RESULT_HANDLED;
 
@@ -4495,6 +6013,14 @@ do_introspect (DBusConnection  *connection,
 				       "      <arg name=\"devices\" direction=\"out\" type=\"as\"/>\n"
 				       "      <arg name=\"capability\" direction=\"in\" type=\"s\"/>\n"
 				       "    </method>\n"
+				       "    <method name=\"GetChildren\">\n"
+				       "      <arg name=\"devices\" direction=\"out\" type=\"as\"/>\n"
+				       "      <arg name=\"udi\" direction=\"in\" type=\"s\"/>\n"
+				       "    </method>\n"
+				       "    <method name=\"GetDescendants\">\n"
+				       "      <arg name=\"devices\" direction=\"out\" type=\"as\"/>\n"
+				       "      <arg name=\"udi\" direction=\"in\" type=\"s\"/>\n"
+				       "    </method>\n"
 				       "    <method name=\"NewDevice\">\n"
 				       "      <arg name=\"temporary_udi\" direction=\"out\" type=\"s\"/>\n"
 				       "    </method>\n"
@@ -4516,6 +6042,22 @@ do_introspect (DBusConnection  *connection,
 				       "    <method name=\"SingletonAddonIsReady\">\n"
 				       "      <arg name=\"command_line\" direction=\"in\" type=\"s\"/>\n"
 				       "    </method>\n"
+				       "    <method name=\"GetStatistics\">\n"
+				       "      <arg name=\"statistics\" direction=\"out\" type=\"a{st}\"/>\n"
+				       "    </method>\n"
+				       "    <method name=\"GetProperties\">\n"
+				       "      <arg name=\"udis\" direction=\"in\" type=\"as\"/>\n"
+				       "      <arg name=\"keys\" direction=\"in\" type=\"as\"/>\n"
+				       "      <arg name=\"properties\" direction=\"out\" type=\"a{sa{sv}}\"/>\n"
+				       "    </method>\n"
+				       "    <method name=\"SubscribeProperties\">\n"
+				       "      <arg name=\"keys\" direction=\"in\" type=\"as\"/>\n"
+				       "      <arg name=\"capability\" direction=\"in\" type=\"s\"/>\n"
+				       "      <arg name=\"subscription\" direction=\"out\" type=\"u\"/>\n"
+				       "    </method>\n"
+				       "    <method name=\"UnsubscribeProperties\">\n"
+				       "      <arg name=\"subscription\" direction=\"in\" type=\"u\"/>\n"
+				       "    </method>\n"
 				       "    <signal name=\"DeviceAdded\">\n"
 				       "      <arg name=\"udi\" type=\"s\"/>\n"
 				       "    </signal>\n"
@@ -4711,6 +6253,13 @@ do_introspect (DBusConnection  *connection,
 				       "      <arg name=\"num_locks\" type=\"i\"/>\n"
 				       "    </signal>\n"
 
+				       "  </interface>\n"
+				       "  <interface name=\"org.freedesktop.Hal.Device.Properties\">\n"
+				       "    <signal name=\"PropertiesChanged\">\n"
+				       "      <arg name=\"changed\" type=\"a{sv}\"/>\n"
+				       "      <arg name=\"removed\" type=\"as\"/>\n"
+				       "      <arg name=\"added\" type=\"as\"/>\n"
+				       "    </signal>\n"
 				       "  </interface>\n");
 
 			for (hal_device_property_strlist_iter_init (d, "info.interfaces", &if_iter);
@@ -4721,6 +6270,7 @@ do_introspect (DBusConnection  *connection,
 				char *method_sign_prop;
 				char *method_argn_prop;
 				GSList *i;
+				guint num;
 				HalDeviceStrListIter name_iter;
 				HalDeviceStrListIter sign_iter;
 				HalDeviceStrListIter argn_iter;
@@ -4742,13 +6292,15 @@ do_introspect (DBusConnection  *connection,
 					}
 				}
 				
-				for (hal_device_property_strlist_iter_init (d, method_name_prop, &name_iter),
+				for (num = 0,
+					     hal_device_property_strlist_iter_init (d, method_name_prop, &name_iter),
 					     hal_device_property_strlist_iter_init (d, method_sign_prop, &sign_iter),
 					     hal_device_property_strlist_iter_init (d, method_argn_prop, &argn_iter);
 				     hal_device_property_strlist_iter_is_valid (&name_iter) &&
 					     hal_device_property_strlist_iter_is_valid (&sign_iter) &&
 					     hal_device_property_strlist_iter_is_valid (&argn_iter);
-				     hal_device_property_strlist_iter_next (&name_iter),
+				     num++,
+					     hal_device_property_strlist_iter_next (&name_iter),
 					     hal_device_property_strlist_iter_next (&sign_iter),
 					     hal_device_property_strlist_iter_next (&argn_iter)) {
 					const char *name;
@@ -4793,6 +6345,20 @@ do_introspect (DBusConnection  *connection,
 					xml = g_string_append (
 						xml, 
 						"      <arg name=\"return_code\" direction=\"out\" type=\"i\"/>\n");
+					switch (get_method_concurrency (d, ifname, num)) {
+					case METHOD_SHARED:
+						xml = g_string_append (
+							xml,
+							"      <annotation name=\"org.freedesktop.Hal.Method.Concurrency\" value=\"shared\"/>\n");
+						break;
+					case METHOD_COALESCE:
+						xml = g_string_append (
+							xml,
+							"      <annotation name=\"org.freedesktop.Hal.Method.Concurrency\" value=\"coalesce\"/>\n");
+						break;
+					default:
+						break;
+					}
 					xml = g_string_append  (
 						xml, 
 						"    </method>\n");
@@ -4859,9 +6425,13 @@ reply_from_fwd_message (DBusPendingCall *pending_call,
 	dbus_pending_call_unref (pending_call);
 }
 
+/* known_method is set to FALSE unless the message went to one of the
+ * built-in methods or a method declared in the device's properties;
+ * forwarded and refused calls may have any member name */
 static DBusHandlerResult
 hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *message, 
-				 void *user_data, dbus_bool_t local_interface)
+				 void *user_data, dbus_bool_t local_interface,
+				 dbus_bool_t *known_method)
 {
 	/*HAL_INFO (("connection=0x%x obj_path=%s interface=%s method=%s local_interface=%d", 
 		   connection,
@@ -4870,6 +6440,8 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
 		   dbus_message_get_member (message),
 		   local_interface));*/
 
+	*known_method = TRUE;
+
 	if (dbus_message_is_method_call (message,
 					 "org.freedesktop.Hal.Manager",
 					 "GetAllDevices") &&
@@ -4888,6 +6460,30 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
 		   strcmp (dbus_message_get_path (message),
 			   "/org/freedesktop/Hal/Manager") == 0) {
 		return manager_device_exists (connection, message);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"GetStatistics") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_get_statistics (connection, message);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"GetProperties") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_get_properties (connection, message);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"SubscribeProperties") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_subscribe_properties (connection, message);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"UnsubscribeProperties") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_unsubscribe_properties (connection, message);
 	} else if (dbus_message_is_method_call (message,
 						"org.freedesktop.Hal.Manager",
 						"FindDeviceStringMatch") &&
@@ -4895,6 +6491,18 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
 			   "/org/freedesktop/Hal/Manager") == 0) {
 		return manager_find_device_string_match (connection,
 							 message);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"GetChildren") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_get_children (connection, message, FALSE);
+	} else if (dbus_message_is_method_call (message,
+						"org.freedesktop.Hal.Manager",
+						"GetDescendants") &&
+		   strcmp (dbus_message_get_path (message),
+			   "/org/freedesktop/Hal/Manager") == 0) {
+		return manager_get_children (connection, message, TRUE);
 	} else if (dbus_message_is_method_call
 		   (message, "org.freedesktop.Hal.Manager",
 		    "FindDeviceByCapability")
@@ -4966,6 +6574,10 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
 					      "org.freedesktop.Hal.Device",
 					      "SetMultipleProperties")) {
 		return device_set_multiple_properties (connection, message, local_interface);
+	} else if (dbus_message_is_method_call (message,
+					      "org.freedesktop.Hal.Device",
+					      "SetPackedProperties")) {
+		return device_set_packed_properties (connection, message, local_interface);
 	} else if (dbus_message_is_method_call (message,
 						"org.freedesktop.Hal.Device",
 						"GetProperty")) {
@@ -5093,6 +6705,8 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
 
 		/* check for device-specific interfaces that individual objects may support */
 
+		*known_method = FALSE;
+
 		udi = dbus_message_get_path (message);
 		interface = dbus_message_get_interface (message);
 		method = dbus_message_get_member (message);
@@ -5201,10 +6815,17 @@ hald_dbus_filter_handle_methods (DBusConnection *connection, DBusMessage *messag
                                                     strcmp (sig, signature) == 0) {
                                                         
                                                         HAL_INFO (("OK for method '%s' with signature '%s' on interface '%s' for UDI '%s' and execpath '%s'", method, signature, interface, udi, execpath));
+
+                                                        *known_method = TRUE;
+
+                                                        if (hald_exec_native_method (d, connection, local_interface,
+                                                                                     message, execpath))
+                                                                return DBUS_HANDLER_RESULT_HANDLED;
                                                         
                                                         return hald_exec_method (d, ci, connection, 
                                                                                  local_interface,
-                                                                                 message, execpath);
+                                                                                 message, execpath,
+                                                                                 get_method_concurrency (d, interface, num));
                                                 }
                                                 
                                         }
@@ -5216,6 +6837,38 @@ out:
 	return osspec_filter_function (connection, message, user_data);
 }
 
+/* time how long handling a method call takes, by member; calls that
+ * didn't go to a known method all count as "other" so clients can't
+ * make up new metrics */
+static DBusHandlerResult
+hald_dbus_filter_handle_methods_timed (DBusConnection *connection, DBusMessage *message, 
+				       void *user_data, dbus_bool_t local_interface)
+{
+	DBusHandlerResult ret;
+	GTimeVal start;
+	const char *member;
+	dbus_bool_t known_method;
+
+	g_get_current_time (&start);
+	ret = hald_dbus_filter_handle_methods (connection, message, user_data, local_interface,
+					       &known_method);
+
+	member = dbus_message_get_member (message);
+	if (ret == DBUS_HANDLER_RESULT_HANDLED && member != NULL &&
+	    dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+		char *metric;
+
+		if (known_method)
+			metric = g_strdup_printf ("dbus.dispatch.%s_us", member);
+		else
+			metric = g_strdup ("dbus.dispatch.other_us");
+		hal_metrics_record_since (metric, &start);
+		g_free (metric);
+	}
+
+	return ret;
+}
+
 /**  
  *  hald_dbus_filter_function:
  *  @connection:          D-BUS connection
@@ -5278,6 +6931,9 @@ hald_dbus_filter_function (DBusConnection * connection,
 		if (services_with_locks != NULL)
 			services_with_locks_remove_lockowner(old_service_name);
 
+		if (strlen (old_service_name) > 0 && strlen (new_service_name) == 0)
+			property_subscriptions_remove_owner (old_service_name);
+
                 if (strlen (old_service_name) > 0)
                         hal_device_client_disconnected (old_service_name);
 
@@ -5308,7 +6964,7 @@ hald_dbus_filter_function (DBusConnection * connection,
                         ck_tracker_process_system_bus_message (ck_tracker, message);
                 }
 #endif
-		return hald_dbus_filter_handle_methods (connection, message, user_data, FALSE);
+		return hald_dbus_filter_handle_methods_timed (connection, message, user_data, FALSE);
         }
 
 out:
@@ -5361,11 +7017,8 @@ local_server_message_handler (DBusConnection *connection,
 			j = g_slist_next (i);
 
 			if (hih->connection == connection) {
-				g_free (hih->interface_name);
-				g_free (hih->introspection_xml);
-				g_free (hih->udi);
-				g_free (hih);
-				helper_interface_handlers = g_slist_remove_link (helper_interface_handlers, i);
+				helper_interface_handler_free (hih);
+				helper_interface_handlers = g_slist_delete_link (helper_interface_handlers, i);
 			}
 		}
 
@@ -5385,7 +7038,7 @@ local_server_message_handler (DBusConnection *connection,
 		dbus_message_unref (copy);
 	} else {
 		DBusHandlerResult ret;
-		ret = hald_dbus_filter_handle_methods (connection, message, user_data, TRUE);
+		ret = hald_dbus_filter_handle_methods_timed (connection, message, user_data, TRUE);
 		return ret;
 	}
 
@@ -5489,9 +7142,8 @@ hald_dbus_seat_removed (CKTracker *tracker, CKSeat *seat, void *user_data)
 }
 
 static gboolean
-validate_lock_for_device (HalDeviceStore *store,
-                          HalDevice      *device,
-                          gpointer        user_data)
+validate_lock_for_device (HalDevice *device,
+                          gpointer   user_data)
 {
         int n, m;
         char **holders;
@@ -5530,8 +7182,8 @@ out:
 static void
 validate_locks (void)
 {
-        hal_device_store_foreach (hald_get_tdl (), validate_lock_for_device, NULL);
-        hal_device_store_foreach (hald_get_gdl (), validate_lock_for_device, NULL);
+        /* only devices with named locks can have lock holders to kick out */
+        hal_device_foreach_locked (validate_lock_for_device, NULL);
 }
 
 static void
@@ -117,9 +117,23 @@ char *hald_dbus_local_server_addr (void);
 
 gboolean device_is_executing_method (HalDevice *d, const char *interface_name, const char *method_name);
 
+typedef struct {
+	char *action;			/* PolicyKit action the caller needs, or NULL */
+	dbus_int32_t result;		/* what the method script would exit with */
+	const char *error_name;		/* set if the method failed */
+	char *error_detail;
+} HaldNativeMethodReturn;
+
+/* return FALSE to have the method script run instead */
+typedef gboolean (*HaldNativeMethodFunc) (HalDevice *d, DBusMessage *message, HaldNativeMethodReturn *ret);
+
+void hald_dbus_register_native_method (const char *execpath, HaldNativeMethodFunc func);
+
 
 gboolean hald_singleton_device_added (const char * commandline, HalDevice *device);
 gboolean hald_singleton_device_removed (const char * commandline, HalDevice *device);
+
+void hald_dbus_drop_interface_handlers (HalDevice *device);
 #ifdef HAVE_CONKIT
 #include "ck-tracker.h"
 
@@ -44,6 +44,7 @@
 #include "logger.h"
 #include "hald_dbus.h"
 #include "hald_runner.h"
+#include "metrics.h"
 
 #ifdef HAVE_CONKIT
 #include "ck-tracker.h"
@@ -54,6 +55,8 @@ typedef struct {
 	HalRunTerminatedCB cb;
 	gpointer data1;
 	gpointer data2;
+	gchar *metric;
+	GTimeVal started;
 } HelperData;
 
 #define DBUS_SERVER_ADDRESS "unix:tmpdir=" HALD_SOCKET_DIR
@@ -364,6 +367,8 @@ add_basic_env (DBusMessageIter * iter, const gchar * udi)
 
 	if (hald_is_verbose) {
 		add_env (iter, "HALD_VERBOSE", "1");
+		if (getenv ("HALD_LOG_LEVEL") != NULL)
+			add_env (iter, "HALD_LOG_LEVEL", getenv ("HALD_LOG_LEVEL"));
 	}
 	if (hald_is_initialising) {
 		add_env (iter, "HALD_STARTUP", "1");
@@ -611,6 +616,7 @@ runner_start (HalDevice * device, const gchar * command_line,
 	DBusMessage *msg, *reply;
 	DBusError error;
 	DBusMessageIter iter;
+	GTimeVal started;
 
 	dbus_error_init (&error);
 	msg = dbus_message_new_method_call ("org.freedesktop.HalRunner",
@@ -631,8 +637,10 @@ runner_start (HalDevice * device, const gchar * command_line,
 	}
 
 	/* Wait for the reply, should be almost instantanious */
+	g_get_current_time (&started);
 	reply = dbus_connection_send_with_reply_and_block (runner_connection,
 							   msg, -1, &error);
+	hal_metrics_record_since ("runner.spawn_us", &started);
 	if (reply) {
 		gboolean ret =
 		    (dbus_message_get_type (reply) ==
@@ -700,6 +708,26 @@ hald_runner_start_singleton (const gchar * command_line,
 }
 
 
+/* e.g. runner.run.hald-probe-storage_us for "hald-probe-storage --only-check-for-media" */
+static gchar *
+get_run_metric (const gchar *command_line)
+{
+	const gchar *program;
+	gsize len;
+	gsize n;
+
+	program = command_line;
+	len = strcspn (program, " \t");
+	for (n = 0; n < len; n++) {
+		if (command_line[n] == '/') {
+			program = command_line + n + 1;
+		}
+	}
+	len -= program - command_line;
+
+	return g_strdup_printf ("runner.run.%.*s_us", (int) len, program);
+}
+
 static void
 process_reply (DBusMessage *m, HelperData *hb)
 {
@@ -708,6 +736,9 @@ process_reply (DBusMessage *m, HelperData *hb)
 	GArray *error = NULL;
 	DBusMessageIter iter;
 
+	hal_metrics_record_since (hb->metric, &hb->started);
+	g_free (hb->metric);
+
 	error = g_array_new (TRUE, FALSE, sizeof (char *));
 
 	if (dbus_message_get_type (m) != DBUS_MESSAGE_TYPE_METHOD_RETURN)
@@ -828,6 +859,8 @@ hald_runner_run_method (HalDevice * device,
 	hd->cb = cb;
 	hd->data1 = data1;
 	hd->data2 = data2;
+	hd->metric = get_run_metric (command_line);
+	g_get_current_time (&hd->started);
 
 	if (device != NULL)
 		g_object_ref (device);
@@ -864,6 +897,7 @@ hald_runner_run_sync (HalDevice * device,
 	const char *input = "";
 	gboolean error_on_stderr = FALSE;
 	DBusError error;
+	GTimeVal started;
 
 	msg = dbus_message_new_method_call ("org.freedesktop.HalRunner",
 					    "/org/freedesktop/HalRunner",
@@ -882,6 +916,7 @@ hald_runner_run_sync (HalDevice * device,
 	dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &timeout);
 
 	dbus_error_init (&error);
+	g_get_current_time (&started);
 	reply = dbus_connection_send_with_reply_and_block (runner_connection, msg, INT_MAX, &error);
 	if (reply == NULL) {
 		if (dbus_error_is_set (&error)) {
@@ -896,6 +931,8 @@ hald_runner_run_sync (HalDevice * device,
 	hd->cb = cb;
 	hd->data1 = data1;
 	hd->data2 = data2;
+	hd->metric = get_run_metric (command_line);
+	hd->started = started;
 
 	/* this will free the HelperData and unref the reply (it's
 	 * used also by the async version) 
@@ -33,6 +33,7 @@
 #include "../logger.h"
 #include "../util.h"
 #include "../util_pm.h"
+#include "../util_wakeup.h"
 
 #include "osspec_linux.h"
 
@@ -54,7 +55,7 @@ enum {
 	ACPI_TYPE_BUTTON
 };
 
-#define ACPI_POLL_INTERVAL 30 /* in seconds */
+#define ACPI_POLL_INTERVAL 32 /* in seconds; a wakeup bucket */
 
 typedef struct ACPIDevHandler_s
 {
@@ -132,7 +133,7 @@ battery_refresh_poll (HalDevice *d)
  *  Recalculates the battery.reporting.last_full key as this may drift
  *  over time. 
  *
- *  Note: This is called 120x less often than battery_refresh_poll
+ *  Note: This is called 128x less often than battery_refresh_poll
  */
 static gboolean
 battery_poll_infrequently (gpointer data) {
@@ -937,25 +938,18 @@ acpi_synthesize_hotplug_events (void)
 	acpi_synthesize_sonypi_display ();
 
 	/* setup timer for things that we need to poll */
-#ifdef HAVE_GLIB_2_14
-	g_timeout_add_seconds (ACPI_POLL_INTERVAL,
-                               acpi_poll,
-                               NULL);
-#else
-	g_timeout_add (1000 * ACPI_POLL_INTERVAL,
-		       acpi_poll,
-		       NULL);
-#endif
-
-	/* setup timer for things that we need only to poll infrequently */
-
-        /* don't use g_timeout_add_seconds() here as the related code path
-         * is possibly CPU and time eating and we don't want have any
-         * other timeout synced with this one
-         */
-	g_timeout_add (1000 * ACPI_POLL_INTERVAL * 120,
-                       battery_poll_infrequently,
-                       NULL);
+	hal_wakeup_add (1000 * ACPI_POLL_INTERVAL,
+			acpi_poll,
+			NULL);
+
+	/* setup timer for things that we need only to poll infrequently;
+	 * this one is CPU and time eating but runs only about once an hour,
+	 * so sharing the wakeup with acpi_poll() is cheaper than a wakeup
+	 * of its own
+	 */
+	hal_wakeup_add (1000 * ACPI_POLL_INTERVAL * 128,
+			battery_poll_infrequently,
+			NULL);
 
 	return TRUE;
 }
@@ -26,7 +26,7 @@
 #define ADDON_CPUFREQ_USERSPACE_H
 
 #define USERSPACE_STRING	"userspace"
-#define USERSPACE_POLL_INTERVAL	333
+#define USERSPACE_POLL_INTERVAL	333 /* in ms; ends up in the 250ms wakeup bucket */
 
 struct userspace_interface {
 	int	base_cpu;
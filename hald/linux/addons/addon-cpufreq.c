@@ -38,6 +38,7 @@
 #include "libhal/libhal.h"
 #include "../../logger.h"
 #include "../../util_helper_priv.h"
+#include "../../util_wakeup.h"
 
 #define MAX_LINE_SIZE				255
 #define CPUFREQ_POLKIT_PRIVILEGE		"org.freedesktop.hal.power-management.cpufreq"
@@ -700,7 +701,7 @@ static gboolean set_governors(DBusConnection *connection, DBusMessage *message,
 		}
 		g_slist_free(cpufreq_objs);
 		cpufreq_objs = NULL;
-		g_source_remove(g_source_id);
+		hal_wakeup_remove(g_source_id);
 		g_source_id = -1;
 	}
 
@@ -742,9 +743,9 @@ static gboolean set_governors(DBusConnection *connection, DBusMessage *message,
 				return FALSE;
 			}
 		}
-		g_source_id = g_timeout_add(USERSPACE_POLL_INTERVAL,
-					    (GSourceFunc)userspace_adjust_speeds,
-					    cpufreq_objs);
+		g_source_id = hal_wakeup_add(USERSPACE_POLL_INTERVAL,
+					     (GSourceFunc)userspace_adjust_speeds,
+					     cpufreq_objs);
 
 	} else if (!strcmp(governor, ONDEMAND_STRING)) {
 		struct cpufreq_obj *cpufreq_obj;
@@ -44,6 +44,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -52,6 +54,7 @@
 
 #include "../../util_helper.h"
 #include "../../util_pm.h"
+#include "../../util_wakeup.h"
 #include "../../logger.h"
 
 #define UPS_USAGE		0x840000
@@ -119,17 +122,175 @@ ups_get_string (int fd, int sindex)
 }
 
 
+/* A usage whose value changes while we run, found on the first pass */
+typedef struct {
+	unsigned int usage_index;
+	unsigned int usage_code;
+} UpsUsage;
+
+/* A field holding such usages */
+typedef struct {
+	unsigned int report_type;
+	unsigned int report_id;
+	unsigned int field_index;
+	/* number of values to read with HIDIOCGUSAGES from index 0, or
+	 * 0 if the usages have to be read one at a time */
+	unsigned int num_values;
+	GArray *usages;
+} UpsField;
+
+/* Where the values we refresh live; discovered once so refreshing
+ * doesn't have to walk every report, field and usage again */
+typedef struct {
+	GArray *reports;		/* of struct hiddev_report_info */
+	GSList *fields;			/* of UpsField */
+} UpsLayout;
+
+/* What we last told hald */
+typedef struct {
+	dbus_int32_t remaining;
+	dbus_int32_t runtime;
+	dbus_bool_t charging;
+	dbus_bool_t discharging;
+} UpsState;
+
+/* Changes of at most this many percent resp. seconds are not passed
+ * on to hald; see battery.ups.deadband.* */
+static int deadband_charge_level = 0;
+static int deadband_remaining_time = 0;
+
+static dbus_bool_t
+is_dynamic_usage (unsigned int usage_code)
+{
+	switch (usage_code) {
+	case UPS_REMAINING_CAPACITY:
+	case UPS_RUNTIME_TO_EMPTY:
+	case UPS_CHARGING:
+	case UPS_DISCHARGING:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static dbus_bool_t
+beyond_deadband (dbus_int32_t old_value, dbus_int32_t new_value, int deadband)
+{
+	if (new_value == old_value)
+		return FALSE;
+
+	return ABS (new_value - old_value) > deadband;
+}
+
+/* Puts a new value of a dynamic usage into the changeset if it differs
+ * enough from what hald has.
+ *
+ * Returns: whether the changeset was changed
+ */
 static dbus_bool_t
-ups_get_static (LibHalContext *ctx, const char *udi, int fd, 
-		dbus_int32_t *prop_remaining,
-		dbus_int32_t *prop_runtime,
-		dbus_bool_t *prop_charging,
-		dbus_bool_t *prop_discharging)
+ups_update_value (LibHalChangeSet *cs, UpsState *state, unsigned int usage_code, __s32 value)
+{
+	switch (usage_code) {
+	case UPS_REMAINING_CAPACITY:
+		/* always report empty and full */
+		if (beyond_deadband (state->remaining, value, deadband_charge_level) ||
+		    (value != state->remaining && (value == 0 || value == 100))) {
+			state->remaining = value;
+			libhal_changeset_set_property_int (
+				cs, "battery.charge_level.current", value);
+			libhal_changeset_set_property_int (
+				cs, "battery.charge_level.percentage", value);
+			libhal_changeset_set_property_int (
+				cs, "battery.reporting.current", value);
+			libhal_changeset_set_property_int (
+				cs, "battery.reporting.percentage", value);
+			return TRUE;
+		}
+		break;
+
+	case UPS_RUNTIME_TO_EMPTY:
+		if (beyond_deadband (state->runtime, value, deadband_remaining_time) ||
+		    (value != state->runtime && value == 0)) {
+			state->runtime = value;
+			libhal_changeset_set_property_int (
+				cs, "battery.remaining_time", value);
+			return TRUE;
+		}
+		break;
+
+	case UPS_CHARGING:
+		if ((value != 0) != state->charging) {
+			state->charging = (value != 0);
+			libhal_changeset_set_property_bool (
+				cs, "battery.rechargeable.is_charging", value != 0);
+			return TRUE;
+		}
+		break;
+
+	case UPS_DISCHARGING:
+		if ((value != 0) != state->discharging) {
+			state->discharging = (value != 0);
+			libhal_changeset_set_property_bool (
+				cs, "battery.rechargeable.is_discharging", value != 0);
+			return TRUE;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return FALSE;
+}
+
+static void
+layout_add_field (UpsLayout *layout, const struct hiddev_field_info *finfo,
+		  GArray *usages, dbus_bool_t can_read_multi)
+{
+	UpsField *field;
+	struct hiddev_report_info rinfo;
+	unsigned int i;
+
+	field = g_new0 (UpsField, 1);
+	field->report_type = finfo->report_type;
+	field->report_id = finfo->report_id;
+	field->field_index = finfo->field_index;
+	field->usages = usages;
+	if (can_read_multi) {
+		for (i = 0; i < usages->len; i++) {
+			UpsUsage *usage = &g_array_index (usages, UpsUsage, i);
+
+			if (usage->usage_index + 1 > field->num_values)
+				field->num_values = usage->usage_index + 1;
+		}
+	}
+	layout->fields = g_slist_append (layout->fields, field);
+
+	for (i = 0; i < layout->reports->len; i++) {
+		struct hiddev_report_info *known = &g_array_index (layout->reports, struct hiddev_report_info, i);
+
+		if (known->report_type == finfo->report_type && known->report_id == finfo->report_id)
+			return;
+	}
+
+	memset (&rinfo, 0, sizeof (rinfo));
+	rinfo.report_type = finfo->report_type;
+	rinfo.report_id = finfo->report_id;
+	g_array_append_val (layout->reports, rinfo);
+}
+
+static dbus_bool_t
+ups_get_static (LibHalContext *ctx, const char *udi, int fd,
+		UpsState *state, UpsLayout *layout)
 {
 	int ret;
 	struct hiddev_report_info rinfo;
 	struct hiddev_field_info finfo;
 	struct hiddev_usage_ref uref;
+	static struct hiddev_usage_ref_multi uref_multi;
+	dbus_bool_t have_multi;
+	GArray *usages;
+	__s32 value;
 	int rtype;
 	unsigned int i, j;
 	char *type;
@@ -159,7 +320,22 @@ ups_get_static (LibHalContext *ctx, const char *udi, int fd,
 				finfo.report_id = rinfo.report_id;
 				finfo.field_index = i;
 				ioctl (fd, HIDIOCGFIELDINFO, &finfo);
-				
+
+				/* get the values of all usages in one go; only
+				 * variable fields have one value per usage */
+				have_multi = FALSE;
+				if ((finfo.flags & HID_FIELD_VARIABLE) &&
+				    finfo.maxusage > 0 && finfo.maxusage <= HID_MAX_MULTI_USAGES) {
+					memset (&uref_multi.uref, 0, sizeof (uref_multi.uref));
+					uref_multi.uref.report_type = finfo.report_type;
+					uref_multi.uref.report_id = finfo.report_id;
+					uref_multi.uref.field_index = i;
+					uref_multi.uref.usage_index = 0;
+					uref_multi.num_values = finfo.maxusage;
+					have_multi = ioctl (fd, HIDIOCGUSAGES, &uref_multi) >= 0;
+				}
+
+				usages = g_array_new (FALSE, FALSE, sizeof (UpsUsage));
 				memset (&uref, 0, sizeof (uref));
 				for (j = 0; j < finfo.maxusage; j++) {
 					uref.report_type = finfo.report_type;
@@ -167,57 +343,70 @@ ups_get_static (LibHalContext *ctx, const char *udi, int fd,
 					uref.field_index = i;
 					uref.usage_index = j;
 					ioctl (fd, HIDIOCGUCODE, &uref);
-					ioctl (fd, HIDIOCGUSAGE, &uref);
+					if (have_multi) {
+						value = uref_multi.values[j];
+					} else {
+						ioctl (fd, HIDIOCGUSAGE, &uref);
+						value = uref.value;
+					}
+
+					if (is_dynamic_usage (uref.usage_code)) {
+						UpsUsage usage;
+
+						usage.usage_index = j;
+						usage.usage_code = uref.usage_code;
+						g_array_append_val (usages, usage);
+					}
 
 					switch (uref.usage_code) {
 
 					case UPS_REMAINING_CAPACITY:
 						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.current", uref.value);
+							cs, "battery.charge_level.current", value);
 						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.percentage", uref.value);
+							cs, "battery.charge_level.percentage", value);
 						libhal_changeset_set_property_string (
 							cs, "battery.charge_level.unit", "percent");
 						libhal_changeset_set_property_int (
-							cs, "battery.reporting.current", uref.value);
+							cs, "battery.reporting.current", value);
 						libhal_changeset_set_property_int (
-							cs, "battery.reporting.percentage", uref.value);
+							cs, "battery.reporting.percentage", value);
 						libhal_changeset_set_property_string (
 							cs, "battery.reporting.unit", "percent");
-						*prop_remaining = uref.value;
+						state->remaining = value;
 						break;
 
 					case UPS_RUNTIME_TO_EMPTY:
 						libhal_changeset_set_property_int (
-							cs, "battery.remaining_time", uref.value);
-						*prop_runtime = uref.value;
+							cs, "battery.remaining_time", value);
+						state->runtime = value;
 						break;
 
 					case UPS_CHARGING:
 						libhal_changeset_set_property_bool (
-							cs, "battery.rechargeable.is_charging", uref.value != 0);
-						*prop_charging = uref.value != 0;
+							cs, "battery.rechargeable.is_charging", value != 0);
+						state->charging = value != 0;
 						break;
 
 					case UPS_DISCHARGING:
 						libhal_changeset_set_property_bool (
-							cs, "battery.rechargeable.is_discharging", uref.value != 0);
-						*prop_discharging = uref.value != 0;
+							cs, "battery.rechargeable.is_discharging", value != 0);
+						state->discharging = value != 0;
 						break;
 
 					case UPS_BATTERYPRESENT:
 						libhal_changeset_set_property_bool (
-							cs, "battery.present", uref.value != 0);
+							cs, "battery.present", value != 0);
 						break;
 
 					case UPS_DEVICENAME:
 						libhal_changeset_set_property_string (
 							cs, "foo", 
-							ups_get_string (fd, uref.value));
+							ups_get_string (fd, value));
 						break;
 
 					case UPS_CHEMISTRY:
-						type = ups_get_string (fd, uref.value);
+						type = ups_get_string (fd, value);
 						libhal_changeset_set_property_string (
 							cs, "battery.reporting.technology", 
 							type);
@@ -228,42 +417,47 @@ ups_get_static (LibHalContext *ctx, const char *udi, int fd,
 
 					case UPS_RECHARGEABLE:
 						libhal_changeset_set_property_bool (
-							cs, "battery.is_rechargeable", uref.value != 0);
+							cs, "battery.is_rechargeable", value != 0);
 						break;
 
 					case UPS_OEMINFORMATION:
 						libhal_changeset_set_property_string (
 							cs, "battery.vendor", 
-							ups_get_string (fd, uref.value));
+							ups_get_string (fd, value));
 						break;
 
 					case UPS_PRODUCT:
 						libhal_changeset_set_property_string (
 							cs, "battery.model", 
-							ups_get_string (fd, uref.value));
+							ups_get_string (fd, value));
 						break;
 
 					case UPS_SERIALNUMBER:
 						libhal_changeset_set_property_string (
 							cs, "battery.serial", 
-							ups_get_string (fd, uref.value));
+							ups_get_string (fd, value));
 						break;
 
 					case UPS_DESIGNCAPACITY:
 						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.design", uref.value);
+							cs, "battery.charge_level.design", value);
 						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.last_full", uref.value);
+							cs, "battery.charge_level.last_full", value);
 						libhal_changeset_set_property_int (
-							cs, "battery.reporting.design", uref.value);
+							cs, "battery.reporting.design", value);
 						libhal_changeset_set_property_int (
-							cs, "battery.reporting.last_full", uref.value);
+							cs, "battery.reporting.last_full", value);
 						break;
 
 					default:
 						break;
 					}
 				}
+
+				if (usages->len > 0)
+					layout_add_field (layout, &finfo, usages, have_multi);
+				else
+					g_array_free (usages, TRUE);
 			}
 			rinfo.report_id |= HID_REPORT_ID_NEXT;
 		}
@@ -287,6 +481,89 @@ out:
 	return ret;
 }
 
+/* Re-read the values the UPS doesn't send events for: one
+ * HIDIOCGREPORT per report and one HIDIOCGUSAGES per field we know
+ * holds such values, instead of walking every usage again */
+static void
+ups_refresh (LibHalContext *ctx, const char *udi, int fd, UpsLayout *layout, UpsState *state)
+{
+	static struct hiddev_usage_ref_multi uref_multi;
+	struct hiddev_usage_ref uref;
+	LibHalChangeSet *cs;
+	DBusError error;
+	dbus_bool_t changed;
+	GSList *l;
+	unsigned int i;
+
+	for (i = 0; i < layout->reports->len; i++) {
+		struct hiddev_report_info *rinfo = &g_array_index (layout->reports, struct hiddev_report_info, i);
+
+		if (ioctl (fd, HIDIOCGREPORT, rinfo) < 0)
+			HAL_DEBUG (("Cannot get report %u of type %u: %s",
+				    rinfo->report_id, rinfo->report_type, strerror (errno)));
+	}
+
+	cs = libhal_device_new_changeset (udi);
+	if (cs == NULL) {
+		HAL_ERROR (("Cannot initialize changeset"));
+		return;
+	}
+
+	changed = FALSE;
+	for (l = layout->fields; l != NULL; l = l->next) {
+		UpsField *field = l->data;
+
+		if (field->num_values > 0) {
+			memset (&uref_multi.uref, 0, sizeof (uref_multi.uref));
+			uref_multi.uref.report_type = field->report_type;
+			uref_multi.uref.report_id = field->report_id;
+			uref_multi.uref.field_index = field->field_index;
+			uref_multi.uref.usage_index = 0;
+			uref_multi.num_values = field->num_values;
+			if (ioctl (fd, HIDIOCGUSAGES, &uref_multi) < 0)
+				continue;
+		}
+
+		for (i = 0; i < field->usages->len; i++) {
+			UpsUsage *usage = &g_array_index (field->usages, UpsUsage, i);
+			__s32 value;
+
+			if (field->num_values > 0) {
+				value = uref_multi.values[usage->usage_index];
+			} else {
+				memset (&uref, 0, sizeof (uref));
+				uref.report_type = field->report_type;
+				uref.report_id = field->report_id;
+				uref.field_index = field->field_index;
+				uref.usage_index = usage->usage_index;
+				if (ioctl (fd, HIDIOCGUSAGE, &uref) < 0)
+					continue;
+				value = uref.value;
+			}
+
+			changed |= ups_update_value (cs, state, usage->usage_code, value);
+		}
+	}
+
+	if (changed) {
+		dbus_error_init (&error);
+		libhal_device_commit_changeset (ctx, cs, &error);
+		LIBHAL_FREE_DBUS_ERROR (&error);
+	}
+	libhal_device_free_changeset (cs);
+}
+
+static int
+getenv_int (const char *name, int default_value)
+{
+	const char *str;
+
+	if ((str = getenv (name)) == NULL)
+		return default_value;
+
+	return atoi (str);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -299,10 +576,12 @@ main (int argc, char *argv[])
 	fd_set fdset;
 	struct hiddev_event ev[64];
 	int rd;
-	dbus_int32_t prop_remaining = 0;
-	dbus_int32_t prop_runtime = 0;
-	dbus_bool_t prop_charging = FALSE;
-	dbus_bool_t prop_discharging = FALSE;
+	char *str;
+	int refresh_interval;
+	time_t next_refresh;
+	struct timeval timeout;
+	UpsState state;
+	UpsLayout layout;
 
 	hal_set_proc_title_init (argc, argv);
 
@@ -320,26 +599,62 @@ main (int argc, char *argv[])
 	if (device_file == NULL)
 		goto out;
 
+	refresh_interval = getenv_int ("HAL_PROP_BATTERY_UPS_REFRESH_INTERVAL", 30);
+	str = getenv ("HAL_PROP_BATTERY_QUIRK_DO_NOT_POLL");
+	if (str != NULL && strcmp (str, "true") == 0)
+		refresh_interval = 0;
+	/* share the wakeup schedule of the other addons (30s becomes 32s) */
+	if (refresh_interval > 0)
+		refresh_interval = hal_wakeup_round_interval (refresh_interval * 1000) / 1000;
+	deadband_charge_level = getenv_int ("HAL_PROP_BATTERY_UPS_DEADBAND_CHARGE_LEVEL", deadband_charge_level);
+	deadband_remaining_time = getenv_int ("HAL_PROP_BATTERY_UPS_DEADBAND_REMAINING_TIME", deadband_remaining_time);
+
 	fd = open (device_file, O_RDONLY);
 	if (fd < 0)
 		goto out;
 
-	if (!ups_get_static (ctx, udi, fd, &prop_remaining, &prop_runtime, &prop_charging, &prop_discharging))
+	memset (&state, 0, sizeof (state));
+	layout.reports = g_array_new (FALSE, FALSE, sizeof (struct hiddev_report_info));
+	layout.fields = NULL;
+
+	if (!ups_get_static (ctx, udi, fd, &state, &layout))
 		goto out;
 
+	HAL_DEBUG (("%u reports with %u fields to refresh every %d seconds",
+		    layout.reports->len, g_slist_length (layout.fields), refresh_interval));
+
 	hal_set_proc_title ("hald-addon-hid-ups: listening on %s", device_file);
 
 	if (!libhal_device_addon_is_ready (ctx, udi, &error)) {
 		goto out;
 	}
 
+	/* refresh when the time since the epoch is a multiple of the
+	 * interval, so we wake up together with the other addons */
+	next_refresh = refresh_interval > 0 ? (time (NULL) / refresh_interval + 1) * refresh_interval : 0;
 	FD_ZERO(&fdset);
 	while (1) {
 		FD_SET(fd, &fdset);
-		rd = select(fd+1, &fdset, NULL, NULL, NULL);
+		if (refresh_interval > 0 && layout.fields != NULL) {
+			time_t now;
+
+			now = time (NULL);
+			/* the clock may have been set back */
+			if (next_refresh > now + refresh_interval)
+				next_refresh = (now / refresh_interval + 1) * refresh_interval;
+			timeout.tv_sec = next_refresh > now ? next_refresh - now : 0;
+			timeout.tv_usec = 0;
+			rd = select(fd+1, &fdset, NULL, NULL, &timeout);
+		} else {
+			rd = select(fd+1, &fdset, NULL, NULL, NULL);
+		}
 
-		if (rd > 0) {
+		if (rd == 0) {
+			ups_refresh (ctx, udi, fd, &layout, &state);
+			next_refresh = (time (NULL) / refresh_interval + 1) * refresh_interval;
+		} else if (rd > 0) {
 			LibHalChangeSet *cs;
+			dbus_bool_t changed;
 
 			rd = read(fd, ev, sizeof(ev));
 			if (rd < (int) sizeof(ev[0])) {
@@ -353,55 +668,15 @@ main (int argc, char *argv[])
 				goto out;
 			}
 
-			for (i = 0; i < rd / sizeof(ev[0]); i++) {				
-				switch (ev[i].hid) {
-				case UPS_REMAINING_CAPACITY:
-					if (ev[i].value != prop_remaining) {
-						prop_remaining = ev[i].value;
-						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.current", ev[i].value);
-						libhal_changeset_set_property_int (
-							cs, "battery.charge_level.percentage", ev[i].value);
-						libhal_changeset_set_property_int (
-							cs, "battery.reporting.current", ev[i].value);
-						libhal_changeset_set_property_int (
-							cs, "battery.reporting.percentage", ev[i].value);
-					}
-					break;
-					
-				case UPS_RUNTIME_TO_EMPTY:
-					if (ev[i].value != prop_runtime) {
-						prop_runtime = ev[i].value;
-						libhal_changeset_set_property_int (
-							cs, "battery.remaining_time", ev[i].value);
-					}
-					break;
-					
-				case UPS_CHARGING:
-					if ((ev[i].value != 0) != prop_charging) {
-						prop_charging = (ev[i].value != 0);
-						libhal_changeset_set_property_bool (
-							cs, "battery.rechargeable.is_charging", ev[i].value != 0);
-					}
-					break;
-					
-				case UPS_DISCHARGING:
-					if ((ev[i].value != 0) != prop_discharging) {
-						prop_discharging = (ev[i].value != 0);
-						libhal_changeset_set_property_bool (
-							cs, "battery.rechargeable.is_discharging", ev[i].value != 0);
-					}
-					break;
-					
-				default:
-					break;
-				}
-			}
+			changed = FALSE;
+			for (i = 0; i < rd / sizeof(ev[0]); i++)
+				changed |= ups_update_value (cs, &state, ev[i].hid, ev[i].value);
 
-			LIBHAL_FREE_DBUS_ERROR (&error);
-			/* NOTE: commit_changeset won't do IPC if set is empty */
-			libhal_device_commit_changeset (ctx, cs, &error);
-			LIBHAL_FREE_DBUS_ERROR (&error);
+			if (changed) {
+				LIBHAL_FREE_DBUS_ERROR (&error);
+				libhal_device_commit_changeset (ctx, cs, &error);
+				LIBHAL_FREE_DBUS_ERROR (&error);
+			}
 			libhal_device_free_changeset (cs);
 
 		}
@@ -190,131 +190,245 @@ static char *key_name[KEY_MAX + 1] = {
 #define LONG(x) ((x)/BITS_PER_LONG)
 #define test_bit(bit, array)    ((array[LONG(bit)] >> OFF(bit)) & 1)
 
+/* How many events we read from a device per wakeup */
+#define EVENT_BATCH_SIZE 64
+
 typedef struct _InputData InputData;
 struct _InputData
 {
-	struct input_event event;
-	gsize offset;
+	struct input_event events[EVENT_BATCH_SIZE];
+	gsize offset;			/* bytes of an incomplete event in events */
 	gboolean button_has_state;
 	gboolean button_state;
 	char udi[1];			/*variable size*/
 };
 
+/* Counters for the path from the kernel seeing an input event to hald
+ * emitting the condition for it; logged every LATENCY_REPORT_INTERVAL
+ * conditions. The latency is measured up to the reply to EmitCondition,
+ * which hald sends right after the signal.
+ */
+#define LATENCY_REPORT_INTERVAL 100
+
+typedef struct {
+	guint64 num_wakeups;		/* reads that returned events */
+	guint64 num_events;		/* input events read */
+	guint64 num_conditions;		/* conditions emitted by hald */
+	guint64 num_failed;		/* conditions that could not be emitted */
+	guint64 latency_us_sum;
+	guint64 latency_us_max;
+	guint64 num_over_10ms;
+	guint64 num_over_100ms;
+} InputStats;
+
 static LibHalContext *ctx = NULL;
 static GMainLoop *gmain = NULL;
 static GHashTable *inputs = NULL;
 static GList *devices = NULL;
+static InputStats stats;
+
+static void
+condition_emitted (LibHalContext *ctx, const DBusError *error, void *user_data)
+{
+	struct timeval *event_time = (struct timeval *) user_data;
+	GTimeVal now;
+	gint64 latency_us;
+
+	if (error != NULL) {
+		HAL_WARNING (("Cannot emit condition: %s: %s", error->name, error->message));
+		stats.num_failed++;
+		goto out;
+	}
+
+	g_get_current_time (&now);
+	latency_us = ((gint64) now.tv_sec - event_time->tv_sec) * G_USEC_PER_SEC +
+		(now.tv_usec - event_time->tv_usec);
+	/* the wall clock may have been set in the meantime */
+	if (latency_us < 0)
+		latency_us = 0;
+
+	stats.num_conditions++;
+	stats.latency_us_sum += latency_us;
+	if ((guint64) latency_us > stats.latency_us_max)
+		stats.latency_us_max = latency_us;
+	if (latency_us > 10000)
+		stats.num_over_10ms++;
+	if (latency_us > 100000)
+		stats.num_over_100ms++;
+
+	if (stats.num_conditions % LATENCY_REPORT_INTERVAL == 0) {
+		HAL_INFO (("%" G_GUINT64_FORMAT " events in %" G_GUINT64_FORMAT " wakeups; "
+			   "%" G_GUINT64_FORMAT " conditions (%" G_GUINT64_FORMAT " failed), "
+			   "latency avg %" G_GUINT64_FORMAT " us, max %" G_GUINT64_FORMAT " us, "
+			   "%" G_GUINT64_FORMAT " over 10 ms, %" G_GUINT64_FORMAT " over 100 ms",
+			   stats.num_events, stats.num_wakeups,
+			   stats.num_conditions, stats.num_failed,
+			   stats.latency_us_sum / stats.num_conditions, stats.latency_us_max,
+			   stats.num_over_10ms, stats.num_over_100ms));
+	}
+
+out:
+	g_free (event_time);
+}
+
+/* Doesn't wait for hald; see condition_emitted() for the reply */
+static void
+emit_button_pressed (InputData *input_data, const char *name, const struct timeval *time)
+{
+	DBusError error;
+	struct timeval *event_time;
+
+	event_time = g_new (struct timeval, 1);
+	*event_time = *time;
+
+	dbus_error_init (&error);
+	if (!libhal_device_emit_condition_async (ctx, input_data->udi,
+						 "ButtonPressed", name,
+						 condition_emitted, event_time,
+						 &error)) {
+		HAL_WARNING (("Cannot emit condition on %s", input_data->udi));
+		stats.num_failed++;
+		g_free (event_time);
+	}
+	LIBHAL_FREE_DBUS_ERROR (&error);
+}
+
+static const char *
+switch_name (int code)
+{
+	switch (code) {
+	case SW_LID:
+		return "lid";
+	case SW_TABLET_MODE:
+		return "tablet_mode";
+	case SW_HEADPHONE_INSERT:
+		return "headphone_insert";
+#ifdef SW_RADIO
+	case SW_RADIO:
+		return "radio";
+#endif
+	}
+
+	return NULL;
+}
+
+/* Look at the state of a switch once after a batch of events for it */
+static void
+update_switch_state (InputData *input_data, int fd, int code, const struct timeval *time)
+{
+	long bitmask[NBITS(SW_MAX)];
+	int new_state;
+	LibHalChangeSet *cs;
+	DBusError error;
+
+	/* check switch state - cuz apparently we get spurious events (or I don't know
+	 * how to use the input layer correctly)
+	 *
+	 * Lid close:
+	 * 19:08:22.911 [I] event.value=1 ; event.code=0 (0x00)
+	 * 19:08:22.914 [I] event.value=0 ; event.code=0 (0x00)
+	 *
+	 * Lid open:
+	 * 19:08:26.772 [I] event.value=0 ; event.code=0 (0x00)
+	 * 19:08:26.776 [I] event.value=0 ; event.code=0 (0x00)
+	 * 19:08:26.863 [I] event.value=1 ; event.code=0 (0x00)
+	 * 19:08:26.868 [I] event.value=0 ; event.code=0 (0x00)
+	 * 19:08:26.955 [I] event.value=0 ; event.code=0 (0x00)
+	 * 19:08:26.960 [I] event.value=0 ; event.code=0 (0x00)
+	 */
+	if (ioctl (fd, EVIOCGSW(sizeof (bitmask)), bitmask) < 0) {
+		HAL_DEBUG (("ioctl EVIOCGSW failed"));
+		return;
+	}
+
+	new_state = test_bit (code, bitmask);
+	if (new_state == input_data->button_state)
+		return;
+	input_data->button_state = new_state;
+
+	/* Neither call waits for hald; it handles them in order, so the
+	 * property is set by the time the condition goes out */
+	cs = libhal_device_new_changeset (input_data->udi);
+	if (cs != NULL) {
+		libhal_changeset_set_property_bool (cs, "button.state.value", input_data->button_state);
+		dbus_error_init (&error);
+		if (!libhal_device_commit_changeset_async (ctx, cs, NULL, NULL, &error))
+			HAL_WARNING (("Cannot set button.state.value on %s", input_data->udi));
+		LIBHAL_FREE_DBUS_ERROR (&error);
+		libhal_device_free_changeset (cs);
+	}
+
+	emit_button_pressed (input_data, switch_name (code), time);
+}
 
 static gboolean
 event_io (GIOChannel *channel, GIOCondition condition, gpointer data)
 {
 	InputData *input_data = (InputData*) data;
-	DBusError error;
-	GError *gerror = NULL;
-	gsize read_bytes;
+	int fd;
+	ssize_t read_bytes;
+	gsize num_events;
+	gsize i;
+	int switch_code;
+	struct timeval switch_time;
 
 	if (condition & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
 		return FALSE;
 
-	dbus_error_init (&error);
+	fd = g_io_channel_unix_get_fd (channel);
 
-	/** tbh, we can probably assume every time we read we have a whole
-	 * event availiable, but hey..*/
-	while (g_io_channel_read_chars (channel,
-			((gchar*)&input_data->event) + input_data->offset,
-			sizeof(struct input_event) - input_data->offset,
-			&read_bytes, &gerror) == G_IO_STATUS_NORMAL) {
+	/* Read everything that is there, a batch at a time; switches are
+	 * only looked at once per batch however many events they sent */
+	do {
+		read_bytes = read (fd, ((gchar *) input_data->events) + input_data->offset,
+				   sizeof (input_data->events) - input_data->offset);
+		if (read_bytes <= 0)
+			break;
 
-		if (input_data->offset + read_bytes < sizeof (struct input_event)) {
-			input_data->offset = input_data->offset + read_bytes;
+		read_bytes += input_data->offset;
+		num_events = read_bytes / sizeof (struct input_event);
+		input_data->offset = read_bytes % sizeof (struct input_event);
+		if (num_events == 0) {
 			HAL_DEBUG (("incomplete read"));
-			goto out;
-		} else {
-			input_data->offset = 0;
+			break;
 		}
 
-		if (input_data->button_has_state &&
-		    input_data->event.type == EV_SW) {
-			char *name = NULL;
-
-			HAL_INFO (("%s: event.value=%d ; event.code=%d (0x%02x)",
-				   input_data->udi, input_data->event.value,
-				   input_data->event.code,
-				   input_data->event.code));
-
-
-			switch (input_data->event.code) {
-			case SW_LID:
-				name = "lid";
-				break;
-			case SW_TABLET_MODE:
-				name = "tablet_mode";
-				break;
-			case SW_HEADPHONE_INSERT:
-				name = "headphone_insert";
-				break;
-#ifdef SW_RADIO
-			case SW_RADIO:
-				name = "radio";
-				break;
-#endif
-			}
-			if (name != NULL) {
-				long bitmask[NBITS(SW_MAX)];
-
-				/* check switch state - cuz apparently we get spurious events (or I don't know
-				 * how to use the input layer correctly)
-				 *
-				 * Lid close:
-				 * 19:08:22.911 [I] event.value=1 ; event.code=0 (0x00)
-				 * 19:08:22.914 [I] event.value=0 ; event.code=0 (0x00)
-				 *
-				 * Lid open:
-				 * 19:08:26.772 [I] event.value=0 ; event.code=0 (0x00)
-				 * 19:08:26.776 [I] event.value=0 ; event.code=0 (0x00)
-				 * 19:08:26.863 [I] event.value=1 ; event.code=0 (0x00)
-				 * 19:08:26.868 [I] event.value=0 ; event.code=0 (0x00)
-				 * 19:08:26.955 [I] event.value=0 ; event.code=0 (0x00)
-				 * 19:08:26.960 [I] event.value=0 ; event.code=0 (0x00)
-				 */
-
-				if (ioctl (g_io_channel_unix_get_fd(channel), EVIOCGSW(sizeof (bitmask)), bitmask) < 0) {
-					HAL_DEBUG (("ioctl EVIOCGSW failed"));
-				} else {
-					int new_state = test_bit (input_data->event.code, bitmask);
-					if (new_state != input_data->button_state) {
-						input_data->button_state = new_state;
-
-						libhal_device_set_property_bool (ctx, input_data->udi, "button.state.value",
-										 input_data->button_state, &error);
-
-						LIBHAL_FREE_DBUS_ERROR (&error);
-
-						libhal_device_emit_condition (ctx, input_data->udi,
-									      "ButtonPressed",
-									      name,
-									      &error);
-						dbus_error_free (&error);
-					}
+		stats.num_wakeups++;
+		stats.num_events += num_events;
+
+		switch_code = -1;
+		for (i = 0; i < num_events; i++) {
+			struct input_event *event = &input_data->events[i];
+
+			if (input_data->button_has_state &&
+			    event->type == EV_SW) {
+				HAL_INFO (("%s: event.value=%d ; event.code=%d (0x%02x)",
+					   input_data->udi, event->value,
+					   event->code,
+					   event->code));
+
+				if (switch_name (event->code) != NULL) {
+					switch_code = event->code;
+					switch_time = event->time;
+				}
+			} else if (event->type == EV_KEY && key_name[event->code] != NULL && event->value) {
+				/* this is a key repeat and should be ignored for the sleep key */
+				if (event->code == KEY_SLEEP && event->value == 2) {
+					HAL_INFO (("key release event for KEY_SLEEP, ignoring"));
+					continue;
 				}
-			}
-		} else if (input_data->event.type == EV_KEY && key_name[input_data->event.code] != NULL && input_data->event.value) {
-			/* this is a key repeat and should be ignored for the sleep key */
-			if (input_data->event.code == KEY_SLEEP && input_data->event.value == 2) {
-				HAL_INFO (("key release event for KEY_SLEEP, ignoring"));
-				goto out;	
-			}
 
-			libhal_device_emit_condition (ctx, input_data->udi,
-						      "ButtonPressed",
-						      key_name[input_data->event.code],
-						      &error);
-			dbus_error_free (&error);
+				emit_button_pressed (input_data, key_name[event->code], &event->time);
+			}
 		}
-	}
 
-out:
-	LIBHAL_FREE_DBUS_ERROR (&error);
+		if (switch_code != -1)
+			update_switch_state (input_data, fd, switch_code, &switch_time);
+
+		/* keep the incomplete event, if any, for the next read */
+		if (input_data->offset > 0)
+			memmove (input_data->events, &input_data->events[num_events], input_data->offset);
+	} while (num_events == EVENT_BATCH_SIZE);
 
 	return TRUE;
 }
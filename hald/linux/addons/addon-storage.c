@@ -34,6 +34,7 @@
 #include <mntent.h>
 #include <sys/types.h>
 #include <scsi/sg.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,26 +44,58 @@
 #include <glib.h>
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
+#include <libudev.h>
 
 #include "libhal/libhal.h"
 
 #include "../../logger.h"
 #include "../../util_helper.h"
+#include "../../util_wakeup.h"
 
 
-static char *udi;
-static char *device_file;
-static int media_status;
-static int is_cdrom;
-static int support_media_changed;
+
+
+/* State kept for each drive we look after */
+typedef struct {
+	char *udi;
+	char *device_file;
+	char *sysfs_path;
+	char *match_rule;
+	int media_status;
+	gboolean is_cdrom;
+	gboolean support_media_changed;
+	gboolean support_async_notification;
+
+	gboolean check_lock_state;
+	gboolean is_locked_by_hal;
+	gboolean is_locked_via_o_excl;
+	gboolean polling_disabled;
+
+	/* when the kernel block layer reports media change/eject request
+	 * events for the drive we don't poll at all; we just listen for
+	 * the change uevents the kernel sends
+	 */
+	gboolean use_kernel_events;
+	gboolean kernel_events_async;
+	int kernel_poll_msecs_orig;
+	gboolean kernel_poll_msecs_owned;
+} Drive;
+
 static LibHalContext *ctx = NULL;
 static DBusConnection *con = NULL;
-static guint poll_timer = -1;
 static GMainLoop *loop;
 static gboolean system_is_idle = FALSE;
-static gboolean check_lock_state = TRUE;
 
-static gboolean polling_disabled = FALSE;
+/* The drives we look after; just one, unless we run as a singleton
+ * addon, in which case it's every removable drive on the system. All
+ * polled drives share one timer and all drives on kernel events share
+ * one uevent monitor. They also share one thread, so an open() or
+ * SG_IO command that blocks on one drive delays all the others.
+ */
+static GSList *drives = NULL;
+static gboolean is_singleton = FALSE;
+static guint poll_timer = 0;
+static struct udev_monitor *udev_monitor = NULL;
 
 static void 
 force_unmount (LibHalContext *ctx, const char *udi)
@@ -280,114 +313,450 @@ enum {
 	MEDIA_STATUS_NO_MEDIA = 2
 };
 
+
 static gboolean poll_for_media (gpointer user_data);
-static gboolean poll_for_media_force (void);
+static gboolean poll_for_media_force (Drive *drive);
 
 static int interval_in_seconds = 2;
 
-static gboolean is_locked_by_hal = FALSE;
-static gboolean is_locked_via_o_excl = FALSE;
+static Drive *
+find_drive (const char *udi)
+{
+	GSList *l;
+
+	if (udi == NULL)
+		return NULL;
+
+	for (l = drives; l != NULL; l = l->next) {
+		Drive *drive = l->data;
+
+		if (strcmp (drive->udi, udi) == 0)
+			return drive;
+	}
+
+	return NULL;
+}
+
+static Drive *
+drive_new (const char *udi, const char *device_file, const char *sysfs_path,
+	   const char *drive_type, gboolean support_media_changed, gboolean support_async_notification)
+{
+	Drive *drive;
+
+	drive = g_new0 (Drive, 1);
+	drive->udi = g_strdup (udi);
+	drive->device_file = g_strdup (device_file);
+	drive->sysfs_path = g_strdup (sysfs_path);
+	drive->is_cdrom = (strcmp (drive_type, "cdrom") == 0);
+	drive->support_media_changed = support_media_changed;
+	drive->support_async_notification = support_async_notification;
+	drive->media_status = MEDIA_STATUS_UNKNOWN;
+	drive->check_lock_state = TRUE;
+	drive->kernel_poll_msecs_orig = -1;
+
+	return drive;
+}
+
+static void
+drive_free (Drive *drive)
+{
+	g_free (drive->udi);
+	g_free (drive->device_file);
+	g_free (drive->sysfs_path);
+	g_free (drive->match_rule);
+	g_free (drive);
+}
 
 static void
 update_proc_title (void)
 {
+	Drive *drive;
+
+	if (is_singleton) {
+		GSList *l;
+		int num_polled = 0;
+		int num_kernel_events = 0;
+		int num_idle = 0;
+
+		for (l = drives; l != NULL; l = l->next) {
+			drive = l->data;
+			if (drive->polling_disabled || drive->is_locked_by_hal || drive->is_locked_via_o_excl)
+				num_idle++;
+			else if (drive->use_kernel_events)
+				num_kernel_events++;
+			else
+				num_polled++;
+		}
+
+		hal_set_proc_title ("hald-addon-storage: polling %d drives (every %d sec), %d on kernel media events, "
+				    "%d locked or disabled", num_polled, interval_in_seconds, num_kernel_events, num_idle);
+		return;
+	}
 
-        if (polling_disabled) {
-                hal_set_proc_title ("hald-addon-storage: no polling on %s because it is explicitly disabled", device_file);
-        } else if (is_locked_by_hal) {
-                if (is_locked_via_o_excl) {
-                        hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via HAL and O_EXCL", device_file);
+	if (drives == NULL)
+		return;
+	drive = drives->data;
+
+        if (drive->polling_disabled) {
+                hal_set_proc_title ("hald-addon-storage: no polling on %s because it is explicitly disabled", drive->device_file);
+        } else if (drive->is_locked_by_hal) {
+                if (drive->is_locked_via_o_excl) {
+                        hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via HAL and O_EXCL", drive->device_file);
                 } else {
-                        hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via HAL", device_file);
+                        hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via HAL", drive->device_file);
                 }
-        } else if (is_locked_via_o_excl) {
-                hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via O_EXCL", device_file);
+        } else if (drive->is_locked_via_o_excl) {
+                hal_set_proc_title ("hald-addon-storage: no polling because %s is locked via O_EXCL", drive->device_file);
+        } else if (drive->use_kernel_events && drive->kernel_events_async) {
+                hal_set_proc_title ("hald-addon-storage: listening for kernel media events on %s", drive->device_file);
+        } else if (drive->use_kernel_events) {
+                hal_set_proc_title ("hald-addon-storage: listening for kernel media events on %s (kernel polls every %d sec)", drive->device_file, interval_in_seconds);
         } else {
-                hal_set_proc_title ("hald-addon-storage: polling %s (every %d sec)", device_file, interval_in_seconds);
+                hal_set_proc_title ("hald-addon-storage: polling %s (every %d sec)", drive->device_file, interval_in_seconds);
         }
 }
 
+static int
+read_sysfs_int (const char *path, int default_value)
+{
+	gchar *contents;
+	int value;
+
+	value = default_value;
+	if (g_file_get_contents (path, &contents, NULL, NULL)) {
+		char *endp;
+		long l;
+
+		l = strtol (contents, &endp, 10);
+		if (endp != contents)
+			value = (int) l;
+		g_free (contents);
+	}
+
+	return value;
+}
+
+static gboolean
+write_sysfs_int (const char *path, int value)
+{
+	FILE *f;
+	gboolean ret;
+
+	ret = FALSE;
+	if ((f = fopen (path, "w")) == NULL) {
+		HAL_WARNING (("Cannot open %s for writing: %s", path, strerror (errno)));
+		goto out;
+	}
+	if (fprintf (f, "%d\n", value) < 0 || fclose (f) != 0) {
+		HAL_WARNING (("Cannot write %d to %s: %s", value, path, strerror (errno)));
+		goto out;
+	}
+	ret = TRUE;
+out:
+	return ret;
+}
+
+/* Find out whether the kernel can report media changes on the drive
+ * on its own. The kernel sends a change uevent with DISK_MEDIA_CHANGE=1
+ * either because the drive supports asynchronous notification or
+ * because the block layer polls it (events_poll_msecs). Only if one of
+ * these is, or can be made, true do we stop polling from userspace.
+ */
+static gboolean
+kernel_events_probe (Drive *drive)
+{
+	gchar *path;
+	gchar *events;
+	int poll_msecs;
+	gboolean ret;
+
+	ret = FALSE;
+	events = NULL;
+
+	if (drive->sysfs_path == NULL)
+		goto out;
+
+	path = g_strdup_printf ("%s/events", drive->sysfs_path);
+	if (!g_file_get_contents (path, &events, NULL, NULL)) {
+		g_free (path);
+		goto out;
+	}
+	g_free (path);
+
+	if (strstr (events, "media_change") == NULL)
+		goto out;
+
+	if (drive->support_async_notification) {
+		drive->kernel_events_async = TRUE;
+		ret = TRUE;
+		goto out;
+	}
+
+	path = g_strdup_printf ("%s/events_poll_msecs", drive->sysfs_path);
+	poll_msecs = read_sysfs_int (path, 0);
+	g_free (path);
+
+	drive->kernel_poll_msecs_orig = poll_msecs;
+	if (poll_msecs == -1) {
+		/* -1 means the system wide default; if that is zero the
+		 * kernel doesn't poll and we have to ask it to */
+		if (read_sysfs_int ("/sys/module/block/parameters/events_dfl_poll_msecs", 0) > 0) {
+			drive->kernel_events_async = TRUE;
+		} else {
+			drive->kernel_poll_msecs_owned = TRUE;
+		}
+		ret = TRUE;
+	} else if (poll_msecs > 0) {
+		/* explicitly configured by the administrator; leave it alone */
+		drive->kernel_events_async = TRUE;
+		ret = TRUE;
+	}
+
+out:
+	g_free (events);
+	return ret;
+}
+
+/* Set how often the kernel polls the drive; only touches drives where
+ * we asked the kernel to poll in the first place. Passing a negative
+ * interval hands the drive back to the original setting.
+ */
+static void
+kernel_events_set_interval (Drive *drive, int seconds)
+{
+	gchar *path;
+
+	if (!drive->kernel_poll_msecs_owned)
+		return;
+
+	path = g_strdup_printf ("%s/events_poll_msecs", drive->sysfs_path);
+	if (seconds < 0)
+		write_sysfs_int (path, drive->kernel_poll_msecs_orig);
+	else
+		write_sysfs_int (path, seconds * 1000);
+	g_free (path);
+}
+
+/* Start or stop the poll timer depending on whether any drive needs it */
+static void
+update_poll_timer (gboolean restart)
+{
+	GSList *l;
+	gboolean need_timer;
+
+	need_timer = FALSE;
+	for (l = drives; l != NULL; l = l->next) {
+		Drive *drive = l->data;
+
+		if (!drive->use_kernel_events) {
+			need_timer = TRUE;
+			break;
+		}
+	}
+
+	if (poll_timer > 0 && (restart || !need_timer)) {
+		hal_wakeup_remove (poll_timer);
+		poll_timer = 0;
+	}
+
+	if (need_timer && poll_timer == 0)
+		poll_timer = hal_wakeup_add (interval_in_seconds * 1000, poll_for_media, NULL);
+}
+
 static void
 update_polling_interval (void)
 {
-	/* TODO: ideally we want all things that do polling to do it
-	 * at the same time.. such as to minimize battery
-	 * usage. Suppose we want to wake up to do poll_for_media()
-	 * every N seconds.  Suppose M is the number of seconds since
-	 * epoch. The fix is to wake up at exactly when M is divisible
-	 * by N... plus some system wide offset (ideally read from
-	 * /sys so kernel threads can use the same offset) to make Xen
-	 * + friends work.... 
-	 *
-	 * Also, the polling intervals should be powers of two to
-	 * ensure that wakeup's with different intervals happen at the
-	 * same time when possible.
-	 *
-	 * This is sorta-kinda what g_timeout_source_new_seconds()
-	 * tries to achieve, not enough I think, and it's only
-	 * available in glib >= 2.14. Too little, too late? *shrug*
-	 */
+	GSList *l;
 
+	/* Power-of-two intervals on the shared wakeup schedule, so
+	 * media polling coincides with the other pollers on the system.
+	 */
 	if (system_is_idle)
 		interval_in_seconds = 16;
 	else
 		interval_in_seconds = 2;
 
-	if (poll_timer > 0)
-		g_source_remove (poll_timer);
+	for (l = drives; l != NULL; l = l->next) {
+		Drive *drive = l->data;
 
-#ifdef HAVE_GLIB_2_14
-	poll_timer = g_timeout_add_seconds (interval_in_seconds, poll_for_media, NULL);
-#else
-	poll_timer = g_timeout_add (interval_in_seconds * 1000, poll_for_media, NULL);
-#endif
+		if (drive->use_kernel_events && !drive->is_locked_by_hal && !drive->polling_disabled)
+			kernel_events_set_interval (drive, interval_in_seconds);
+	}
+
+	update_poll_timer (TRUE);
 
         update_proc_title ();
 }
 
+/* returns: whether we are allowed to look at the drive */
 static gboolean
-poll_for_media (gpointer user_data)
+update_lock_state (Drive *drive)
 {
-        if (check_lock_state) {
+        if (drive->check_lock_state) {
                 DBusError error;
                 dbus_bool_t should_poll;
+                gboolean was_checking;
 
-                check_lock_state = FALSE;
+                drive->check_lock_state = FALSE;
+                was_checking = !drive->is_locked_by_hal && !drive->polling_disabled;
 
-                HAL_INFO (("Checking whether device %s is locked on HAL", device_file));
+                HAL_INFO (("Checking whether device %s is locked on HAL", drive->device_file));
                 dbus_error_init (&error);
-                if (libhal_device_is_locked_by_others (ctx, udi, "org.freedesktop.Hal.Device.Storage", &error)) {
-                        HAL_INFO (("... device %s is locked on HAL", device_file));
-                        is_locked_by_hal = TRUE;
-                        update_proc_title ();
+                if (libhal_device_is_locked_by_others (ctx, drive->udi, "org.freedesktop.Hal.Device.Storage", &error)) {
+                        HAL_INFO (("... device %s is locked on HAL", drive->device_file));
+                        drive->is_locked_by_hal = TRUE;
 			LIBHAL_FREE_DBUS_ERROR (&error);
-                        goto skip_check;
                 } else {
-                        HAL_INFO (("... device %s is not locked on HAL", device_file));
-                        is_locked_by_hal = FALSE;
+                        HAL_INFO (("... device %s is not locked on HAL", drive->device_file));
+                        drive->is_locked_by_hal = FALSE;
+			LIBHAL_FREE_DBUS_ERROR (&error);
+
+			should_poll = libhal_device_get_property_bool (ctx, drive->udi, "storage.media_check_enabled", &error);
+			LIBHAL_FREE_DBUS_ERROR (&error);
+			drive->polling_disabled = !should_poll;
                 }
 
-		LIBHAL_FREE_DBUS_ERROR (&error);
+                /* stop the kernel from polling a locked drive as well */
+                if (drive->use_kernel_events && was_checking != (!drive->is_locked_by_hal && !drive->polling_disabled)) {
+                        kernel_events_set_interval (drive, was_checking ? -1 : interval_in_seconds);
+                }
 
-                should_poll = libhal_device_get_property_bool (ctx, udi, "storage.media_check_enabled", &error);
-		LIBHAL_FREE_DBUS_ERROR (&error);
-		polling_disabled = !should_poll;
 		update_proc_title ();
         }
 
-        /* TODO: we could remove the timeout completely... */
-        if (is_locked_by_hal || polling_disabled)
-                goto skip_check;
+        return !drive->is_locked_by_hal && !drive->polling_disabled;
+}
+
+static gboolean
+poll_for_media (gpointer user_data)
+{
+	GSList *l;
+
+	for (l = drives; l != NULL; l = l->next) {
+		Drive *drive = l->data;
 
-        poll_for_media_force ();
+		/* TODO: we could remove the timeout completely... */
+		if (!drive->use_kernel_events && update_lock_state (drive))
+			poll_for_media_force (drive);
+	}
 
-skip_check:
+	return TRUE;
+}
+
+static gboolean
+kernel_event (GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	struct udev_device *device;
+	const char *action;
+	const char *devnode;
+	const char *value;
+	Drive *drive;
+	GSList *l;
+
+	device = udev_monitor_receive_device (udev_monitor);
+	if (device == NULL)
+		goto out;
+
+	action = udev_device_get_action (device);
+	devnode = udev_device_get_devnode (device);
+	if (action == NULL || strcmp (action, "change") != 0 || devnode == NULL)
+		goto out;
+
+	drive = NULL;
+	for (l = drives; l != NULL; l = l->next) {
+		Drive *d = l->data;
+
+		if (d->use_kernel_events && strcmp (devnode, d->device_file) == 0) {
+			drive = d;
+			break;
+		}
+	}
+	if (drive == NULL)
+		goto out;
+
+	value = udev_device_get_property_value (device, "DISK_EJECT_REQUEST");
+	if (value != NULL && strcmp (value, "1") == 0) {
+		DBusError error;
+
+		HAL_DEBUG (("Kernel reports eject request on %s", drive->device_file));
+		dbus_error_init (&error);
+		libhal_device_emit_condition (ctx, drive->udi, "EjectPressed", "", &error);
+		LIBHAL_FREE_DBUS_ERROR (&error);
+	}
+
+	value = udev_device_get_property_value (device, "DISK_MEDIA_CHANGE");
+	if (value != NULL && strcmp (value, "1") == 0) {
+		HAL_DEBUG (("Kernel reports media change on %s", drive->device_file));
+		if (update_lock_state (drive))
+			poll_for_media_force (drive);
+	}
+
+out:
+	if (device != NULL)
+		udev_device_unref (device);
+	return TRUE;
+}
+
+/* returns: whether we are listening for block device uevents */
+static gboolean
+kernel_monitor_setup (void)
+{
+	static gboolean failed = FALSE;
+	struct udev *udev;
+	GIOChannel *channel;
+	int fd;
+
+	if (udev_monitor != NULL)
+		return TRUE;
+	if (failed)
+		return FALSE;
+
+	failed = TRUE;
+
+	if ((udev = udev_new ()) == NULL)
+		return FALSE;
+
+	udev_monitor = udev_monitor_new_from_netlink (udev, "udev");
+	if (udev_monitor == NULL) {
+		udev_unref (udev);
+		return FALSE;
+	}
+	if (udev_monitor_filter_add_match_subsystem_devtype (udev_monitor, "block", "disk") != 0 ||
+	    udev_monitor_enable_receiving (udev_monitor) != 0 ||
+	    (fd = udev_monitor_get_fd (udev_monitor)) < 0) {
+		HAL_WARNING (("Cannot listen for uevents; falling back to polling"));
+		udev_monitor_unref (udev_monitor);
+		udev_monitor = NULL;
+		udev_unref (udev);
+		return FALSE;
+	}
+
+	channel = g_io_channel_unix_new (fd);
+	g_io_add_watch (channel, G_IO_IN, kernel_event, NULL);
+	g_io_channel_unref (channel);
+
+	failed = FALSE;
+	return TRUE;
+}
+
+/* returns: whether we are now getting media change events from the kernel */
+static gboolean
+kernel_events_setup (Drive *drive)
+{
+	if (!kernel_events_probe (drive))
+		return FALSE;
+
+	if (!kernel_monitor_setup ())
+		return FALSE;
+
+	HAL_INFO (("Using kernel media events for %s (%s)", drive->device_file,
+		   drive->kernel_events_async ? "reported by the kernel" : "kernel polls the drive"));
 	return TRUE;
 }
 
 /* returns: whether the state changed */
 static gboolean
-poll_for_media_force (void)
+poll_for_media_force (Drive *drive)
 {
         int fd;
         int got_media;
@@ -395,85 +764,85 @@ poll_for_media_force (void)
 
 	got_media = FALSE;
 
-        old_media_status = media_status;
-	if (is_cdrom) {
-		int drive;
-		
-		fd = open (device_file, O_RDONLY | O_NONBLOCK | O_EXCL);
-		
+        old_media_status = drive->media_status;
+	if (drive->is_cdrom) {
+		int cd_status;
+
+		fd = open (drive->device_file, O_RDONLY | O_NONBLOCK | O_EXCL);
+
 		if (fd < 0 && errno == EBUSY) {
 			/* this means the disc is mounted or some other app,
 			 * like a cd burner, has already opened O_EXCL */
-			
+
 			/* HOWEVER, when starting hald, a disc may be
 			 * mounted; so check /etc/mtab to see if it
 			 * actually is mounted. If it is we retry to open
 			 * without O_EXCL
 			 */
-			if (!is_mounted (device_file)) {
-                                if (!is_locked_via_o_excl) {
-                                        is_locked_via_o_excl = TRUE;
+			if (!is_mounted (drive->device_file)) {
+                                if (!drive->is_locked_via_o_excl) {
+                                        drive->is_locked_via_o_excl = TRUE;
                                         update_proc_title ();
                                 } else {
-                                        is_locked_via_o_excl = TRUE;
+                                        drive->is_locked_via_o_excl = TRUE;
                                 }
 				goto skip_check;
                         }
-			
-			fd = open (device_file, O_RDONLY | O_NONBLOCK);
+
+			fd = open (drive->device_file, O_RDONLY | O_NONBLOCK);
 		}
-		
+
 		if (fd < 0) {
-			HAL_ERROR (("open failed for %s: %s", device_file, strerror (errno))); 
+			HAL_ERROR (("open failed for %s: %s", drive->device_file, strerror (errno)));
 			goto skip_check;
 		}
 
-                if (is_locked_via_o_excl) {
-                        is_locked_via_o_excl = FALSE;
+                if (drive->is_locked_via_o_excl) {
+                        drive->is_locked_via_o_excl = FALSE;
                         update_proc_title ();
                 }
-		
-		
+
+
 		/* Check if a disc is in the drive
 		 *
 		 * @todo Use MMC-2 API if applicable
 		 */
-		drive = ioctl (fd, CDROM_DRIVE_STATUS, CDSL_CURRENT);
-		switch (drive) {
+		cd_status = ioctl (fd, CDROM_DRIVE_STATUS, CDSL_CURRENT);
+		switch (cd_status) {
 		case CDS_NO_INFO:
 		case CDS_NO_DISC:
 		case CDS_TRAY_OPEN:
 		case CDS_DRIVE_NOT_READY:
 			break;
-			
+
 		case CDS_DISC_OK:
 			/* some CD-ROMs report CDS_DISK_OK even with an open
 			 * tray; if media check has the same value two times in
 			 * a row then this seems to be the case and we must not
 			 * report that there is a media in it. */
-			if (support_media_changed &&
-			    ioctl (fd, CDROM_MEDIA_CHANGED, CDSL_CURRENT) && 
+			if (drive->support_media_changed &&
+			    ioctl (fd, CDROM_MEDIA_CHANGED, CDSL_CURRENT) &&
 			    ioctl (fd, CDROM_MEDIA_CHANGED, CDSL_CURRENT)) {
 			} else {
 				got_media = TRUE;
 			}
 			break;
-			
+
 		case -1:
 			HAL_ERROR (("CDROM_DRIVE_STATUS failed: %s\n", strerror(errno)));
 			break;
-			
+
 		default:
 			break;
 		}
-		
+
 		/* check if eject button was pressed */
 		if (got_media) {
 			unsigned char cdb[10] = { 0x4a, 1, 0, 0, 16, 0, 0, 0, 8, 0};
 			unsigned char buffer[8];
 			struct sg_io_hdr sg_h;
 			int retval;
-			
+
 			memset(buffer, 0, sizeof(buffer));
 			memset(&sg_h, 0, sizeof(struct sg_io_hdr));
 			sg_h.interface_id = 'S';
@@ -486,94 +855,94 @@ poll_for_media_force (void)
 			retval = ioctl(fd, SG_IO, &sg_h);
 			if (retval == 0 && sg_h.status == 0 && (buffer[4] & 0x0f) == 0x01) {
 				DBusError error;
-				
+
 				/* emit signal from drive device object */
 				dbus_error_init (&error);
-				libhal_device_emit_condition (ctx, udi, "EjectPressed", "", &error);
+				libhal_device_emit_condition (ctx, drive->udi, "EjectPressed", "", &error);
 				LIBHAL_FREE_DBUS_ERROR (&error);
 			}
 		}
 		close (fd);
 	} else {
-		fd = open (device_file, O_RDONLY);
+		fd = open (drive->device_file, O_RDONLY);
 		if (fd < 0 && errno == ENOMEDIUM) {
 			got_media = FALSE;
 		} else if (fd >= 0) {
 			got_media = TRUE;
 			close (fd);
 		} else {
-			HAL_ERROR (("open failed for %s: %s", device_file, strerror (errno))); 
+			HAL_ERROR (("open failed for %s: %s", drive->device_file, strerror (errno)));
 			goto skip_check;
 		}
 	}
-	
+
 	/* set correct state on startup, this avoid endless loops if there was a media in the device on startup */
-	if (media_status == MEDIA_STATUS_UNKNOWN) {
-		if (got_media) 
-			media_status = MEDIA_STATUS_NO_MEDIA;
-		else 
-			media_status = MEDIA_STATUS_GOT_MEDIA;	
+	if (drive->media_status == MEDIA_STATUS_UNKNOWN) {
+		if (got_media)
+			drive->media_status = MEDIA_STATUS_NO_MEDIA;
+		else
+			drive->media_status = MEDIA_STATUS_GOT_MEDIA;
 	}
 
-	switch (media_status) {
+	switch (drive->media_status) {
 	case MEDIA_STATUS_GOT_MEDIA:
 		if (!got_media) {
 			DBusError error;
-			
-			HAL_DEBUG (("Media removal detected on %s", device_file));
-			libhal_device_set_property_bool (ctx, udi, "storage.removable.media_available", FALSE, NULL);
-			libhal_device_set_property_string (ctx, udi, "storage.partitioning_scheme", "", NULL);
-			
-			
+
+			HAL_DEBUG (("Media removal detected on %s", drive->device_file));
+			libhal_device_set_property_bool (ctx, drive->udi, "storage.removable.media_available", FALSE, NULL);
+			libhal_device_set_property_string (ctx, drive->udi, "storage.partitioning_scheme", "", NULL);
+
+
 			/* attempt to unmount all childs */
-			unmount_childs (ctx, udi);
-			
+			unmount_childs (ctx, drive->udi);
+
 			/* could have a fs on the main block device; do a rescan to remove it */
 			dbus_error_init (&error);
-			libhal_device_rescan (ctx, udi, &error);
+			libhal_device_rescan (ctx, drive->udi, &error);
 			LIBHAL_FREE_DBUS_ERROR (&error);
-			
+
 			/* have to this to trigger appropriate hotplug events */
-			fd = open (device_file, O_RDONLY | O_NONBLOCK);
+			fd = open (drive->device_file, O_RDONLY | O_NONBLOCK);
 			if (fd >= 0) {
 				ioctl (fd, BLKRRPART);
 				close (fd);
 			}
 		}
 		break;
-		
+
 	case MEDIA_STATUS_NO_MEDIA:
 		if (got_media) {
 			DBusError error;
-			
-			HAL_DEBUG (("Media insertion detected on %s", device_file));
-			
+
+			HAL_DEBUG (("Media insertion detected on %s", drive->device_file));
+
 			/* our probe will trigger the appropriate hotplug events */
 			libhal_device_set_property_bool (
-				ctx, udi, "storage.removable.media_available", TRUE, NULL);
-			
+				ctx, drive->udi, "storage.removable.media_available", TRUE, NULL);
+
 			/* could have a fs on the main block device; do a rescan to add it */
 			dbus_error_init (&error);
-			libhal_device_rescan (ctx, udi, &error);
+			libhal_device_rescan (ctx, drive->udi, &error);
 			LIBHAL_FREE_DBUS_ERROR (&error);
 		}
 		break;
-		
+
 	case MEDIA_STATUS_UNKNOWN:
 	default:
 		break;
 	}
-	
+
 	/* update our current status */
 	if (got_media)
-		media_status = MEDIA_STATUS_GOT_MEDIA;
+		drive->media_status = MEDIA_STATUS_GOT_MEDIA;
 	else
-		media_status = MEDIA_STATUS_NO_MEDIA;
-	
-	/*HAL_DEBUG (("polling %s; got media=%d", device_file, got_media));*/
-	
+		drive->media_status = MEDIA_STATUS_NO_MEDIA;
+
+	/*HAL_DEBUG (("polling %s; got media=%d", drive->device_file, got_media));*/
+
 skip_check:
-	return old_media_status != media_status;
+	return old_media_status != drive->media_status;
 }
 
 #ifdef HAVE_CONKIT
@@ -618,18 +987,23 @@ error:
 #endif /* HAVE_CONKIT */
 
 
+
 static DBusHandlerResult
 direct_filter_function (DBusConnection *connection, DBusMessage *message, void *user_data)
 {
-	if (dbus_message_is_method_call (message, 
-					 "org.freedesktop.Hal.Device.Storage.Removable", 
+	if (dbus_message_is_method_call (message,
+					 "org.freedesktop.Hal.Device.Storage.Removable",
 					 "CheckForMedia")) {
                 DBusMessage *reply;
                 dbus_bool_t call_had_sideeffect;
+                Drive *drive;
 
-                HAL_INFO (("Forcing poll for media becusse CheckForMedia() was called"));
+                if ((drive = find_drive (dbus_message_get_path (message))) == NULL)
+                        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-                call_had_sideeffect = poll_for_media_force ();
+                HAL_INFO (("Forcing poll for media on %s because CheckForMedia() was called", drive->device_file));
+
+                call_had_sideeffect = poll_for_media_force (drive);
 
                 reply = dbus_message_new_method_return (message);
                 dbus_message_append_args (reply,
@@ -637,19 +1011,23 @@ direct_filter_function (DBusConnection *connection, DBusMessage *message, void *
                                           DBUS_TYPE_INVALID);
                 dbus_connection_send (connection, reply, NULL);
                 dbus_message_unref (reply);
+
+                return DBUS_HANDLER_RESULT_HANDLED;
         }
 
-	return DBUS_HANDLER_RESULT_HANDLED;
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
 static DBusHandlerResult
 dbus_filter_function (DBusConnection *connection, DBusMessage *message, void *user_data)
 {
+	Drive *only_drive;
+	GSList *l;
 #ifdef HAVE_CONKIT
 	gboolean system_is_idle_new;
 
-	if (dbus_message_is_signal (message, 
-				    "org.freedesktop.ConsoleKit.Manager", 
+	if (dbus_message_is_signal (message,
+				    "org.freedesktop.ConsoleKit.Manager",
 				    "SystemIdleHintChanged")) {
 		if (!dbus_message_get_args (message, NULL,
 					    DBUS_TYPE_BOOLEAN, &system_is_idle_new,
@@ -667,8 +1045,8 @@ dbus_filter_function (DBusConnection *connection, DBusMessage *message, void *us
 out:
 #endif /* HAVE_CONKIT */
 
-        /* Check, just before the next poll, whether lock state have changed; 
-         * 
+        /* Check, just before the next poll, whether lock state have changed;
+         *
          * Note that we get called on at least these signals
          *
          * 1. CK.Manager  - SystemIdleHintChanged
@@ -677,88 +1055,199 @@ out:
          * 3. HAL.Device  - LockAcquired, LockReleased
          *
          * meaning that every time the locking situation changes, we
-         * will get updated.
+         * will get updated. Signals from a device only concern that
+         * drive.
          */
-        check_lock_state = TRUE;
+        only_drive = NULL;
+        if (dbus_message_has_interface (message, "org.freedesktop.Hal.Device"))
+                only_drive = find_drive (dbus_message_get_path (message));
+
+        for (l = drives; l != NULL; l = l->next) {
+                Drive *drive = l->data;
+
+                if (only_drive != NULL && drive != only_drive)
+                        continue;
+
+                drive->check_lock_state = TRUE;
+
+                /* without a timer there is no next poll; update right away */
+                if (drive->use_kernel_events)
+                        update_lock_state (drive);
+        }
 
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
-int
-main (int argc, char *argv[])
+/* Start looking after a drive; returns FALSE if we can't */
+static gboolean
+drive_start (Drive *drive, DBusError *error)
 {
-	DBusError error;
-        LibHalContext *ctx_direct;
-        DBusConnection *con_direct;
-	char *bus;
-	char *drive_type;
-	char *support_media_changed_str;
-        char *str;
+        drive->match_rule = g_strdup_printf ("type='signal'"
+                                             ",interface='org.freedesktop.Hal.Device'"
+                                             ",sender='org.freedesktop.Hal'"
+                                             ",path='%s'",
+                                             drive->udi);
+	dbus_bus_add_match (con,
+                            drive->match_rule,
+			    NULL);
 
-	hal_set_proc_title_init (argc, argv);
+	if (!libhal_device_claim_interface (ctx,
+					    drive->udi,
+					    "org.freedesktop.Hal.Device.Storage.Removable",
+					    "    <method name=\"CheckForMedia\">\n"
+					    "      <arg name=\"call_had_sideeffect\" direction=\"out\" type=\"b\"/>\n"
+					    "    </method>\n",
+					    error)) {
+		HAL_ERROR (("Cannot claim interface 'org.freedesktop.Hal.Device.Storage.Removable' on %s", drive->udi));
+		dbus_bus_remove_match (con, drive->match_rule, NULL);
+                return FALSE;
+	}
 
-	/* We could drop privs if we know that the haldaemon user is
-	 * to be able to access block devices...
-	 */
-        /*drop_privileges (1);*/
+	drives = g_slist_append (drives, drive);
 
-	if ((udi = getenv ("UDI")) == NULL)
-		goto out;
-	if ((device_file = getenv ("HAL_PROP_BLOCK_DEVICE")) == NULL)
-		goto out;
-	if ((bus = getenv ("HAL_PROP_STORAGE_BUS")) == NULL)
-		goto out;
-	if ((drive_type = getenv ("HAL_PROP_STORAGE_DRIVE_TYPE")) == NULL)
-		goto out;
+	drive->use_kernel_events = kernel_events_setup (drive);
 
-	setup_logger ();
+	if (drive->use_kernel_events) {
+		kernel_events_set_interval (drive, interval_in_seconds);
+		/* pick up the current state; from now on the kernel tells us */
+		if (update_lock_state (drive))
+			poll_for_media_force (drive);
+	} else {
+		update_poll_timer (FALSE);
+	}
 
-	support_media_changed_str = getenv ("HAL_PROP_STORAGE_CDROM_SUPPORT_MEDIA_CHANGED");
-	if (support_media_changed_str != NULL && strcmp (support_media_changed_str, "true") == 0)
-		support_media_changed = TRUE;
-	else
-		support_media_changed = FALSE;
+	update_proc_title ();
+	return TRUE;
+}
+
+static void
+drive_stop (Drive *drive)
+{
+	kernel_events_set_interval (drive, -1);
+	drives = g_slist_remove (drives, drive);
+	dbus_bus_remove_match (con, drive->match_rule, NULL);
+	update_poll_timer (FALSE);
+	update_proc_title ();
+}
+
+static void
+add_device (LibHalContext *ctx,
+	    const char *udi,
+	    const LibHalPropertySet *properties)
+{
+	const char *device_file;
+	const char *drive_type;
+	DBusError error;
+	Drive *drive;
+
+	if (find_drive (udi) != NULL) {
+		HAL_WARNING (("Already looking after %s", udi));
+		return;
+	}
+
+	if ((device_file = libhal_ps_get_string (properties, "block.device")) == NULL) {
+		HAL_ERROR (("%s has no property block.device", udi));
+		return;
+	}
+	if ((drive_type = libhal_ps_get_string (properties, "storage.drive_type")) == NULL) {
+		HAL_ERROR (("%s has no property storage.drive_type", udi));
+		return;
+	}
+
+	HAL_DEBUG (("Doing addon-storage for %s (bus %s) (drive_type %s) (udi %s)", device_file,
+		    libhal_ps_get_string (properties, "storage.bus"), drive_type, udi));
+
+	drive = drive_new (udi, device_file,
+			   libhal_ps_get_string (properties, "linux.sysfs_path"),
+			   drive_type,
+			   libhal_ps_get_bool (properties, "storage.cdrom.support_media_changed"),
+			   libhal_ps_get_bool (properties, "storage.removable.support_async_notification"));
 
 	dbus_error_init (&error);
-	con = dbus_bus_get (DBUS_BUS_SYSTEM, &error);
-	if (con == NULL) {
-		HAL_ERROR (("Cannot connect to system bus"));
-		goto out;
+	if (!drive_start (drive, &error)) {
+		LIBHAL_FREE_DBUS_ERROR (&error);
+		drive_free (drive);
+
+		if (drives == NULL) {
+			HAL_INFO (("no devices to look after, exiting"));
+			g_main_loop_quit (loop);
+		}
 	}
-	loop = g_main_loop_new (NULL, FALSE);
-	dbus_connection_setup_with_g_main (con, NULL);
-	dbus_connection_set_exit_on_disconnect (con, 0);
+}
 
-	if ((ctx_direct = libhal_ctx_init_direct (&error)) == NULL) {
-		HAL_ERROR (("Cannot connect to hald"));
-                goto out;
+static void
+remove_device (LibHalContext *ctx,
+	       const char *udi,
+	       const LibHalPropertySet *properties)
+{
+	Drive *drive;
+
+	if ((drive = find_drive (udi)) == NULL) {
+		HAL_ERROR (("DeviceRemoved called for unknown device: '%s'.", udi));
+		return;
 	}
-	if (!libhal_device_addon_is_ready (ctx_direct, udi, &error)) {
-                goto out;
+
+	HAL_DEBUG (("No longer looking after %s", drive->device_file));
+	drive_stop (drive);
+	drive_free (drive);
+
+	if (drives == NULL) {
+		HAL_INFO (("no more devices, exiting"));
+		g_main_loop_quit (loop);
 	}
-	con_direct = libhal_ctx_get_dbus_connection (ctx_direct);
-	dbus_connection_setup_with_g_main (con_direct, NULL);
-	dbus_connection_set_exit_on_disconnect (con_direct, 0);
-	dbus_connection_add_filter (con_direct, direct_filter_function, NULL, NULL);
+}
 
+/* The signal handler only wakes up the main loop through a pipe; the
+ * drives are handed back to the kernel from main () once it returns.
+ */
+static int sigterm_pipe[2] = { -1, -1 };
 
-	if ((ctx = libhal_ctx_init_direct (&error)) == NULL)
-		goto out;
+static void
+handle_sigterm (int value)
+{
+	char c = 0;
 
-	if (!libhal_device_addon_is_ready (ctx, udi, &error))
-		goto out;
+	if (write (sigterm_pipe[1], &c, 1) != 1)
+		_exit (1);
+}
 
-	HAL_DEBUG (("**************************************************"));
-	HAL_DEBUG (("Doing addon-storage for %s (bus %s) (drive_type %s) (udi %s)", device_file, bus, drive_type, udi));
-	HAL_DEBUG (("**************************************************"));
+static gboolean
+sigterm_received (GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	HAL_INFO (("Received SIGTERM, exiting"));
+	g_main_loop_quit (loop);
+	return FALSE;
+}
 
-	if (strcmp (drive_type, "cdrom") == 0)
-		is_cdrom = 1;
-	else
-		is_cdrom = 0;
+static void
+sigterm_setup (void)
+{
+	GIOChannel *channel;
 
-	media_status = MEDIA_STATUS_UNKNOWN;
+	if (pipe (sigterm_pipe) != 0) {
+		HAL_WARNING (("Cannot create pipe for SIGTERM: %s", strerror (errno)));
+		return;
+	}
 
+	channel = g_io_channel_unix_new (sigterm_pipe[0]);
+	g_io_add_watch (channel, G_IO_IN, sigterm_received, NULL);
+	g_io_channel_unref (channel);
+
+	signal (SIGTERM, handle_sigterm);
+}
+
+/* Connect to the system bus for the signals that tell us about idleness
+ * and locking */
+static gboolean
+system_bus_setup (DBusError *error)
+{
+	con = dbus_bus_get (DBUS_BUS_SYSTEM, error);
+	if (con == NULL) {
+		HAL_ERROR (("Cannot connect to system bus"));
+		return FALSE;
+	}
+	dbus_connection_setup_with_g_main (con, NULL);
+	dbus_connection_set_exit_on_disconnect (con, 0);
 
 #ifdef HAVE_CONKIT
 	/* TODO: ideally we should track the sessions on the seats on
@@ -783,46 +1272,158 @@ main (int argc, char *argv[])
 
         /* this is a bit weird; but we want to listen to signals about
          * locking from hald.. and signals are not pushed over direct
-         * connections (for a good reason).
+         * connections (for a good reason). The signals for each drive
+         * are added in drive_start().
          */
 	dbus_bus_add_match (con,
 			    "type='signal'"
 			    ",interface='org.freedesktop.Hal.Manager'"
 			    ",sender='org.freedesktop.Hal'",
 			    NULL);
-	dbus_bus_add_match (con,
-			    "type='signal'"
-			    ",interface='org.freedesktop.Hal.Manager'"
-			    ",sender='org.freedesktop.Hal'",
-			    NULL);
-        str = g_strdup_printf ("type='signal'"
-                               ",interface='org.freedesktop.Hal.Device'"
-                               ",sender='org.freedesktop.Hal'"
-                               ",path='%s'",
-                               udi);
-	dbus_bus_add_match (con,
-                            str,
-			    NULL);
-        g_free (str);
 	dbus_connection_add_filter (con, dbus_filter_function, NULL, NULL);
 
-	if (!libhal_device_claim_interface (ctx,
-					    udi, 
-					    "org.freedesktop.Hal.Device.Storage.Removable", 
-					    "    <method name=\"CheckForMedia\">\n"
-					    "      <arg name=\"call_had_sideeffect\" direction=\"out\" type=\"b\"/>\n"
-					    "    </method>\n",
-					    &error)) {
-		HAL_ERROR (("Cannot claim interface 'org.freedesktop.Hal.Device.Storage.Removable'"));
-                goto out;
+	update_polling_interval ();
+
+	return TRUE;
+}
+
+/* Run as a singleton addon looking after every removable drive; hald
+ * tells us about the drives through add_device() and remove_device() */
+static gboolean
+singleton_setup (const char *commandline, DBusError *error)
+{
+	DBusConnection *con_direct;
+
+	setup_logger ();
+
+	is_singleton = TRUE;
+	loop = g_main_loop_new (NULL, FALSE);
+
+	if (!system_bus_setup (error))
+		return FALSE;
+
+	if ((ctx = libhal_ctx_init_direct (error)) == NULL) {
+		HAL_ERROR (("Cannot connect to hald"));
+		return FALSE;
 	}
+	con_direct = libhal_ctx_get_dbus_connection (ctx);
+	dbus_connection_setup_with_g_main (con_direct, NULL);
+	dbus_connection_set_exit_on_disconnect (con_direct, 0);
+	dbus_connection_add_filter (con_direct, direct_filter_function, NULL, NULL);
 
+	libhal_ctx_set_singleton_device_added (ctx, add_device);
+	libhal_ctx_set_singleton_device_removed (ctx, remove_device);
 
-	update_polling_interval ();
+	return libhal_device_singleton_addon_is_ready (ctx, commandline, error);
+}
+
+/* Look after the single drive we were started for */
+static gboolean
+drive_setup (DBusError *error)
+{
+        LibHalContext *ctx_direct;
+        DBusConnection *con_direct;
+	char *udi;
+	char *device_file;
+	char *bus;
+	char *drive_type;
+	char *str;
+	gboolean support_media_changed;
+	gboolean support_async_notification;
+	Drive *drive;
+
+	if ((udi = getenv ("UDI")) == NULL)
+		return FALSE;
+	if ((device_file = getenv ("HAL_PROP_BLOCK_DEVICE")) == NULL)
+		return FALSE;
+	if ((bus = getenv ("HAL_PROP_STORAGE_BUS")) == NULL)
+		return FALSE;
+	if ((drive_type = getenv ("HAL_PROP_STORAGE_DRIVE_TYPE")) == NULL)
+		return FALSE;
+
+	setup_logger ();
+
+	str = getenv ("HAL_PROP_STORAGE_CDROM_SUPPORT_MEDIA_CHANGED");
+	support_media_changed = (str != NULL && strcmp (str, "true") == 0);
+	str = getenv ("HAL_PROP_STORAGE_REMOVABLE_SUPPORT_ASYNC_NOTIFICATION");
+	support_async_notification = (str != NULL && strcmp (str, "true") == 0);
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	if (!system_bus_setup (error))
+		return FALSE;
+
+	if ((ctx_direct = libhal_ctx_init_direct (error)) == NULL) {
+		HAL_ERROR (("Cannot connect to hald"));
+		return FALSE;
+	}
+	if (!libhal_device_addon_is_ready (ctx_direct, udi, error)) {
+		return FALSE;
+	}
+	con_direct = libhal_ctx_get_dbus_connection (ctx_direct);
+	dbus_connection_setup_with_g_main (con_direct, NULL);
+	dbus_connection_set_exit_on_disconnect (con_direct, 0);
+	dbus_connection_add_filter (con_direct, direct_filter_function, NULL, NULL);
+
+
+	if ((ctx = libhal_ctx_init_direct (error)) == NULL)
+		return FALSE;
+
+	if (!libhal_device_addon_is_ready (ctx, udi, error))
+		return FALSE;
+
+	HAL_DEBUG (("**************************************************"));
+	HAL_DEBUG (("Doing addon-storage for %s (bus %s) (drive_type %s) (udi %s)", device_file, bus, drive_type, udi));
+	HAL_DEBUG (("**************************************************"));
+
+	drive = drive_new (udi, device_file, getenv ("HAL_PROP_LINUX_SYSFS_PATH"), drive_type,
+			   support_media_changed, support_async_notification);
+	if (!drive_start (drive, error)) {
+		drive_free (drive);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+	DBusError error;
+	const char *commandline;
+	gboolean ok;
+
+	hal_set_proc_title_init (argc, argv);
+
+	/* We could drop privs if we know that the haldaemon user is
+	 * to be able to access block devices...
+	 */
+        /*drop_privileges (1);*/
+
+	dbus_error_init (&error);
+
+	/* Started from info.addons.singleton we look after all removable
+	 * drives; from info.addons just after the one we were started for.
+	 */
+	if ((commandline = getenv ("SINGLETON_COMMAND_LINE")) != NULL)
+		ok = singleton_setup (commandline, &error);
+	else
+		ok = drive_setup (&error);
+	if (!ok)
+		goto out;
+
+	sigterm_setup ();
+
+	/* the singleton quits when the last drive goes away */
 	g_main_loop_run (loop);
 
 out:
-	HAL_DEBUG (("An error occured, exiting cleanly"));
+	if (!ok)
+		HAL_DEBUG (("An error occured, exiting cleanly"));
+
+	/* give the remaining drives back their original kernel poll interval */
+	while (drives != NULL)
+		drive_stop ((Drive *) drives->data);
 
 	LIBHAL_FREE_DBUS_ERROR (&error);
 
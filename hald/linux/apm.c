@@ -31,6 +31,7 @@
 #include "../logger.h"
 #include "../util.h"
 #include "../util_pm.h"
+#include "../util_wakeup.h"
 
 #include "osspec_linux.h"
 
@@ -310,15 +311,9 @@ apm_synthesize_hotplug_events (void)
 	hotplug_event->apm.apm_type = APM_TYPE_AC_ADAPTER;
 	hotplug_event_enqueue (hotplug_event);
 
-#ifdef HAVE_GLIB_2_14
-	g_timeout_add_seconds (APM_POLL_INTERVAL,
-                               apm_poll,
-                               NULL);
-#else
-	g_timeout_add (1000 * APM_POLL_INTERVAL,
-		       apm_poll,
-		       NULL);
-#endif
+	hal_wakeup_add (1000 * APM_POLL_INTERVAL,
+			apm_poll,
+			NULL);
 
 out:
 	return ret;
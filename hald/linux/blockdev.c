@@ -43,6 +43,7 @@
 #include <dbus/dbus-glib.h>
 
 #include "../device_info.h"
+#include "../device_snapshot.h"
 #include "../hald.h"
 #include "../hald_dbus.h"
 #include "../hald_runner.h"
@@ -878,6 +879,28 @@ error:
 }
 
 
+/* What the kernel says about the block device plus what udev found on
+ * it, as a file system may be relabeled without anything in sysfs
+ * changing.
+ */
+static gchar *
+get_blockdev_snapshot_identity (const gchar *sysfs_path, HotplugEvent *hotplug_event)
+{
+	gchar *identity;
+	gchar *ret;
+
+	identity = hal_util_get_snapshot_identity (sysfs_path);
+	if (identity == NULL)
+		return NULL;
+
+	ret = g_strdup_printf ("%sfs=%s %s %s %s %s\n", identity,
+			       hotplug_event->sysfs.fsusage, hotplug_event->sysfs.fstype,
+			       hotplug_event->sysfs.fsversion, hotplug_event->sysfs.fsuuid,
+			       hotplug_event->sysfs.fslabel);
+	g_free (identity);
+	return ret;
+}
+
 void
 hotplug_event_begin_add_blockdev (const gchar *sysfs_path, const gchar *device_file, gboolean is_partition,
 				  HalDevice *parent, void *end_token)
@@ -895,6 +918,8 @@ hotplug_event_begin_add_blockdev (const gchar *sysfs_path, const gchar *device_f
         int md_number;
 	char tc;
 	const gchar *last_elem;
+	gchar *identity = NULL;
+	gchar dm_name[256];
 
 	is_device_mapper = FALSE;
         is_fakevolume = FALSE;
@@ -936,7 +961,29 @@ hotplug_event_begin_add_blockdev (const gchar *sysfs_path, const gchar *device_f
 		goto out;
 	}
 
+	/* on coldplug, skip probing if the device didn't change since the last run;
+	 * md and device-mapper devices depend on other volumes so always probe them */
+	if (!is_md_device && hal_util_read_attr (sysfs_path_real, "dm/name", dm_name, sizeof (dm_name)) < 0) {
+		identity = get_blockdev_snapshot_identity (sysfs_path, hotplug_event);
+		if (hald_is_initialising && (d = device_snapshot_restore (sysfs_path, identity)) != NULL) {
+			char fake_sysfs_path[HAL_PATH_MAX];
+
+			hal_device_store_add (hald_get_tdl (), d);
+
+			if (hal_device_property_get_bool (d, "block.is_volume"))
+				blockdev_refresh_mount_state (d);
+
+			hal_util_callout_device_add (d, blockdev_callouts_add_done, end_token, NULL);
+
+			snprintf (fake_sysfs_path, sizeof (fake_sysfs_path), "%s/fakevolume", sysfs_path);
+			if (device_snapshot_has (fake_sysfs_path))
+				generate_fakevolume_hotplug_event_add_for_storage_device (d);
+			goto out2;
+		}
+	}
+
 	d = hal_device_new ();
+	device_snapshot_set_identity (d, sysfs_path, identity);
 
 	/* OK, no parent... */
 	if (parent == NULL && !is_partition && !is_fakevolume && !hotplug_event->reposted) {
@@ -1602,6 +1649,7 @@ hotplug_event_begin_add_blockdev (const gchar *sysfs_path, const gchar *device_f
 	}
 out2:
 	g_free (sysfs_path_real);
+	g_free (identity);
 	return;
 
 error:
@@ -1611,6 +1659,7 @@ error:
 out:
         hotplug_event_end (end_token);
 	g_free (sysfs_path_real);
+	g_free (identity);
         return;
 }
 
@@ -1955,7 +2004,7 @@ blockdev_process_mdstat (void)
 
                 if (sscanf (line, "md%d : ", &num) == 1) {
                         char *sysfs_path;
-                        sysfs_path = g_strdup_printf ("/sys/block/md%d", num);
+                        sysfs_path = g_strdup_printf ("%s/block/md%d", hal_util_get_sysfs_root (), num);
                         read_md_devs = g_slist_prepend (read_md_devs, sysfs_path);
                 }
 
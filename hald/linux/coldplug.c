@@ -88,7 +88,7 @@ udev_info_to_hotplug_event (const UdevInfo *info)
 	gchar *str;
 
 	hotplug_event = g_slice_new0 (HotplugEvent);
-	g_strlcpy (hotplug_event->sysfs.sysfs_path, "/sys", sizeof(hotplug_event->sysfs.sysfs_path));
+	g_strlcpy (hotplug_event->sysfs.sysfs_path, hal_util_get_sysfs_root (), sizeof(hotplug_event->sysfs.sysfs_path));
 	g_strlcat (hotplug_event->sysfs.sysfs_path, info->sysfs_path, sizeof(hotplug_event->sysfs.sysfs_path));
 
 	HAL_INFO(("creating HotplugEvent for %s", hotplug_event->sysfs.sysfs_path));
@@ -155,6 +155,7 @@ static gboolean
 hal_util_init_sysfs_to_udev_map (void)
 {
 	char *udevdb_export_argv[] = { "/usr/bin/udevadm", "info", "-e", NULL };
+	const char *udevdb_export;
 	int udevinfo_exitcode;
 	UdevInfo *info = NULL;
 	char *p;
@@ -166,6 +167,16 @@ hal_util_init_sysfs_to_udev_map (void)
 	 * http://cgit.freedesktop.org/systemd/systemd/commit/?id=4f5d327a49e1a40ae0a3b8f1855dc90f3c0d953f */
 	g_strlcpy(dev_root, "/dev", sizeof(dev_root));
 
+	/* a synthetic sysfs tree (see HALD_SYSFS_ROOT) comes with a saved udevdb export */
+	udevdb_export = g_getenv ("HALD_UDEVDB_EXPORT");
+	if (udevdb_export != NULL) {
+		if (!g_file_get_contents (udevdb_export, &udevinfo_stdout, NULL, NULL)) {
+			HAL_ERROR (("Couldn't read %s", udevdb_export));
+			goto error;
+		}
+		goto have_export;
+	}
+
 	/* get udevdb export */
 	if (g_spawn_sync ("/", udevdb_export_argv, NULL, G_SPAWN_LEAVE_DESCRIPTORS_OPEN, NULL, NULL,
 			  &udevinfo_stdout,
@@ -182,6 +193,8 @@ hal_util_init_sysfs_to_udev_map (void)
 		goto error;
 	}
 
+have_export:
+
 	/* read the export of the udev database */
 	p = udevinfo_stdout;
 	while (p[0] != '\0') {
@@ -198,9 +211,11 @@ hal_util_init_sysfs_to_udev_map (void)
 		/* insert device */
 		if (line[0] == '\0') {
 			if (info != NULL) {
-				g_hash_table_insert (sysfs_to_udev_map, g_strdup_printf ("/sys%s", info->sysfs_path), info);
-				HAL_INFO (("found (udevdb export) '/sys%s' -> '%s/%s'",
-					   info->sysfs_path, dev_root, info->device_file));
+				g_hash_table_insert (sysfs_to_udev_map,
+						     g_strdup_printf ("%s%s", hal_util_get_sysfs_root (), info->sysfs_path),
+						     info);
+				HAL_INFO (("found (udevdb export) '%s%s' -> '%s/%s'",
+					   hal_util_get_sysfs_root (), info->sysfs_path, dev_root, info->device_file));
 				info = NULL;
 			}
 			continue;
@@ -363,7 +378,8 @@ scan_single_bus (const char *bus_name)
         DIR *dir2;
         struct dirent *dent2;
         
-        g_strlcpy(dirname, "/sys/bus/", sizeof(dirname));
+        g_strlcpy(dirname, hal_util_get_sysfs_root (), sizeof(dirname));
+        g_strlcat(dirname, "/bus/", sizeof(dirname));
         g_strlcat(dirname, bus_name, sizeof(dirname));
         g_strlcat(dirname, "/devices", sizeof(dirname));
         
@@ -391,7 +407,8 @@ static void scan_subsystem(const char *subsys)
 	DIR *dir;
 	struct dirent *dent;
 
-	g_strlcpy(base, "/sys/", sizeof(base));
+	g_strlcpy(base, hal_util_get_sysfs_root (), sizeof(base));
+	g_strlcat(base, "/", sizeof(base));
 	g_strlcat(base, subsys, sizeof(base));
 
 	dir = opendir(base);
@@ -432,10 +449,13 @@ static void scan_subsystem(const char *subsys)
 
 static void scan_block(void)
 {
+	char base[HAL_PATH_MAX];
 	DIR *dir;
 	struct dirent *dent;
 
-	dir = opendir("/sys/block");
+	g_strlcpy(base, hal_util_get_sysfs_root (), sizeof(base));
+	g_strlcat(base, "/block", sizeof(base));
+	dir = opendir(base);
 	if (dir != NULL) {
 		for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
 			char dirname[HAL_PATH_MAX];
@@ -451,7 +471,8 @@ static void scan_block(void)
                                 continue;
                         }
 
-			g_strlcpy(dirname, "/sys/block/", sizeof(dirname));
+			g_strlcpy(dirname, base, sizeof(dirname));
+			g_strlcat(dirname, "/", sizeof(dirname));
 			g_strlcat(dirname, dent->d_name, sizeof(dirname));
 			if (device_list_insert(dirname, "block", HOTPLUG_EVENT_SYSFS_BLOCK) != 0)
 				continue;
@@ -481,10 +502,13 @@ static void scan_block(void)
 
 static void scan_class(void)
 {
+	char base[HAL_PATH_MAX];
 	DIR *dir;
 	struct dirent *dent;
 
-	dir = opendir("/sys/class");
+	g_strlcpy(base, hal_util_get_sysfs_root (), sizeof(base));
+	g_strlcat(base, "/class", sizeof(base));
+	dir = opendir(base);
 	if (dir != NULL) {
 		for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
 			char dirname[HAL_PATH_MAX];
@@ -494,7 +518,8 @@ static void scan_class(void)
 			if (dent->d_name[0] == '.')
 				continue;
 
-			g_strlcpy(dirname, "/sys/class/", sizeof(dirname));
+			g_strlcpy(dirname, base, sizeof(dirname));
+			g_strlcat(dirname, "/", sizeof(dirname));
 			g_strlcat(dirname, dent->d_name, sizeof(dirname));
 			dir2 = opendir(dirname);
 			if (dir2 != NULL) {
@@ -560,6 +585,7 @@ gboolean
 coldplug_synthesize_events (void)
 {
 	struct stat statbuf;
+	char path[HAL_PATH_MAX];
 
 	if (hal_util_init_sysfs_to_udev_map () == FALSE) {
 		HAL_ERROR (("Unable to get sysfs to dev map"));
@@ -567,7 +593,8 @@ coldplug_synthesize_events (void)
 	}
 
 	/* if we have /sys/subsystem, forget all the old stuff */
-	if (stat("/sys/subsystem", &statbuf) == 0) {
+	g_snprintf (path, sizeof (path), "%s/subsystem", hal_util_get_sysfs_root ());
+	if (stat(path, &statbuf) == 0) {
 		scan_subsystem ("subsystem");
 		device_list = g_slist_sort (device_list, _device_order);
 		process_coldplug_events ();
@@ -582,7 +609,8 @@ coldplug_synthesize_events (void)
 		process_coldplug_events ();
 
 		/* scan /sys/block, if it isn't already a class */
-		if (stat("/sys/class/block", &statbuf) != 0) {
+		g_snprintf (path, sizeof (path), "%s/class/block", hal_util_get_sysfs_root ());
+		if (stat(path, &statbuf) != 0) {
 			scan_block ();
 			device_list = g_slist_sort (device_list, _device_order);
 			process_coldplug_events ();
@@ -54,6 +54,7 @@
 
 #include "../device_info.h"
 #include "../device_pm.h"
+#include "../device_snapshot.h"
 #include "../device_store.h"
 #include "../hald.h"
 #include "../hald_dbus.h"
@@ -62,6 +63,7 @@
 #include "../osspec.h"
 #include "../util.h"
 #include "../util_pm.h"
+#include "../util_wakeup.h"
 #include "../ids.h"
 
 #include "coldplug.h"
@@ -77,7 +79,7 @@ gboolean _have_sysfs_sleep_button = FALSE;
 gboolean _have_sysfs_power_supply = FALSE; 
 static gboolean battery_poll_running = FALSE;
 
-#define POWER_SUPPLY_BATTERY_POLL_INTERVAL 30  /* in seconds */
+#define POWER_SUPPLY_BATTERY_POLL_INTERVAL 32  /* in seconds; a wakeup bucket */
 #define DOCK_STATION_UNDOCK_POLL_INTERVAL 300  /* in milliseconds */
 
 /* we must use this kernel-compatible implementation */
@@ -2654,15 +2656,9 @@ power_supply_add (const gchar *sysfs_path, const gchar *device_file, HalDevice *
 
 		/* setup timer for things that we need to poll */
 		if (!battery_poll_running) {
-#ifdef HAVE_GLIB_2_14
-			g_timeout_add_seconds (POWER_SUPPLY_BATTERY_POLL_INTERVAL,
-                                               power_supply_battery_poll,
-                                               NULL);
-#else
-			g_timeout_add (1000 * POWER_SUPPLY_BATTERY_POLL_INTERVAL,
-                                       power_supply_battery_poll,
-                                       NULL);
-#endif
+			hal_wakeup_add (1000 * POWER_SUPPLY_BATTERY_POLL_INTERVAL,
+					power_supply_battery_poll,
+					NULL);
 			battery_poll_running = TRUE;
 		}
 	}
@@ -3058,17 +3054,8 @@ missing_scsi_host (const gchar *sysfs_path, HotplugEvent *device_event, HotplugA
 	/* skip "remove" if more than one child still exists */
 	if (action == HOTPLUG_ACTION_REMOVE && d != NULL)
 	{
-		GSList *siblings;
-
-		siblings = hal_device_store_match_multiple_key_value_string (hald_get_gdl(),
-									     "info.parent",
-									     hal_device_get_udi(d));
-		if (siblings && g_slist_next(siblings) != NULL)
-		{
-			g_slist_free(siblings);
+		if (hal_device_store_get_num_children (hald_get_gdl (), hal_device_get_udi (d)) > 1)
 			goto out;
-		}
-		g_slist_free(siblings);
 	}
 
 	/* fake host event */
@@ -3939,12 +3926,28 @@ usb_add (const gchar *sysfs_path, const gchar *device_file, HalDevice *parent_de
 
 		hal_device_property_set_string (d, "usb.linux.sysfs_path", sysfs_path);
 
-		hal_util_set_int_from_file (d, "usb.interface.number", sysfs_path, "bInterfaceNumber", 10);
-
-		hal_util_set_int_from_file (d, "usb.interface.class", sysfs_path, "bInterfaceClass", 16);
-		hal_util_set_int_from_file (d, "usb.interface.subclass", sysfs_path, "bInterfaceSubClass", 16);
-		hal_util_set_int_from_file (d, "usb.interface.protocol", sysfs_path, "bInterfaceProtocol", 16);
-		hal_util_set_string_from_file(d, "usb.interface.description", sysfs_path, "interface");
+		{
+			gchar number[16], class[16], subclass[16], protocol[16], description[256];
+			HalUtilAttr attrs[] = {
+				{"bInterfaceNumber",   number,      sizeof (number),      -1},
+				{"bInterfaceClass",    class,       sizeof (class),       -1},
+				{"bInterfaceSubClass", subclass,    sizeof (subclass),    -1},
+				{"bInterfaceProtocol", protocol,    sizeof (protocol),    -1},
+				{"interface",          description, sizeof (description), -1},
+			};
+
+			hal_util_read_attrs (sysfs_path, attrs, G_N_ELEMENTS (attrs));
+			if (attrs[0].len >= 0)
+				hal_device_property_set_int (d, "usb.interface.number", strtol (number, NULL, 10));
+			if (attrs[1].len >= 0)
+				hal_device_property_set_int (d, "usb.interface.class", strtol (class, NULL, 16));
+			if (attrs[2].len >= 0)
+				hal_device_property_set_int (d, "usb.interface.subclass", strtol (subclass, NULL, 16));
+			if (attrs[3].len >= 0)
+				hal_device_property_set_int (d, "usb.interface.protocol", strtol (protocol, NULL, 16));
+			if (attrs[4].len >= 0)
+				hal_device_property_set_string (d, "usb.interface.description", description);
+		}
 
 		usbif_set_name (d, 
 				hal_device_property_get_int (d, "usb.interface.class"),
@@ -5001,12 +5004,39 @@ out:
   ;
 }
 
+/* subsystems where a device restored from the snapshot is as good as a probed one */
+static const char *snapshot_subsystems[] = {
+	"pci",
+	"usb",
+	"usb_device",
+	"scsi",
+	"scsi_host",
+	"scsi_generic",
+	"ieee1394",
+	NULL
+};
+
+static gboolean
+is_snapshot_subsystem (const gchar *subsystem)
+{
+	guint i;
+
+	for (i = 0; snapshot_subsystems[i] != NULL; i++) {
+		if (strcmp (snapshot_subsystems[i], subsystem) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 void
 hotplug_event_begin_add_dev (const gchar *subsystem, const gchar *sysfs_path, const gchar *device_file,
 				  HalDevice *parent_dev, const gchar *parent_path,
 				  void *end_token)
 {
 	guint i;
+	gchar *identity;
+
+	identity = NULL;
 
 	HAL_INFO (("add_dev: subsys=%s sysfs_path=%s dev=%s parent_dev=0x%08x", subsystem, sysfs_path, device_file, parent_dev));
 
@@ -5044,6 +5074,17 @@ hotplug_event_begin_add_dev (const gchar *subsystem, const gchar *sysfs_path, co
 				goto out; 
 			}
 
+			/* on coldplug, skip probing if the device didn't change since the last run */
+			if (identity == NULL && is_snapshot_subsystem (subsystem)) {
+				identity = hal_util_get_snapshot_identity (sysfs_path);
+				if (hald_is_initialising &&
+				    (d = device_snapshot_restore (sysfs_path, identity)) != NULL) {
+					hal_device_store_add (hald_get_tdl (), d);
+					hal_util_callout_device_add (d, dev_callouts_add_done, end_token, NULL);
+					goto out;
+				}
+			}
+
 			/* attempt to add the device */
 			d = handler->add (sysfs_path, device_file, parent_dev, parent_path);
 			if (d == NULL) {
@@ -5051,6 +5092,8 @@ hotplug_event_begin_add_dev (const gchar *subsystem, const gchar *sysfs_path, co
 				continue;
 			}
 
+			device_snapshot_set_identity (d, sysfs_path, identity);
+
 			hal_device_property_set_int (d, "linux.hotplug_type", HOTPLUG_EVENT_SYSFS_DEVICE);
 			hal_device_property_set_string (d, "linux.subsystem", subsystem);
 			
@@ -5077,7 +5120,7 @@ hotplug_event_begin_add_dev (const gchar *subsystem, const gchar *sysfs_path, co
 	/* didn't find anything - thus, ignore this hotplug event */
 	hotplug_event_end (end_token);
 out:
-	;
+	g_free (identity);
 }
 
 void
@@ -5105,9 +5148,7 @@ hotplug_event_begin_remove_dev (const gchar *subsystem, const gchar *sysfs_path,
 				}
 
 				/* check if there are children left before remove the device */
-				children = hal_device_store_match_multiple_key_value_string (hald_get_gdl (), 
-                        								     "info.parent",
-											     hal_device_get_udi(d));
+				children = hal_device_store_get_children (hald_get_gdl (), hal_device_get_udi (d));
 
 				for (tmp = children; tmp != NULL; tmp = g_slist_next (tmp)) {
 			                child = HAL_DEVICE (tmp->data);
@@ -0,0 +1,421 @@
+/***************************************************************************
+ *
+ * gen-fake-sysfs.c : Generate a synthetic sysfs tree and udev database
+ *                    for benchmarking coldplug
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* The tree is made of identical chains, each of which looks like a USB
+ * mass storage device on its own controller:
+ *
+ *   pci0000:00/0000:BB:SS.F                     pci
+ *     K-1                                       usb (device)
+ *       K-1:1.0                                 usb (interface)
+ *         hostK/targetK:0:0/K:0:0:0             scsi
+ *           block/sdX, block/sdX/sdXN           block
+ *
+ * so a chain contributes one device each of PCI, USB, SCSI and block
+ * (plus the USB interface, SCSI host and target in between) and one
+ * block device for every partition.
+ */
+
+static const char *root;
+static FILE *udevdb;
+static guint dev_minor = 0;
+
+static void
+usage (void)
+{
+	fprintf (stderr,
+		 "\n"
+		 "usage : hald-gen-fake-sysfs [--devices <n>] [--partitions <m>] <directory>\n"
+		 "\n"
+		 "        --devices         Number of PCI, USB, SCSI and block devices\n"
+		 "                          together (default 1000)\n"
+		 "        --partitions      Partitions on each block device (default 4)\n"
+		 "        --help            Show this information and exit\n"
+		 "\n"
+		 "Creates <directory>/sys and <directory>/udevdb for use with the\n"
+		 "HALD_SYSFS_ROOT and HALD_UDEVDB_EXPORT environment variables.\n"
+		 "\n");
+}
+
+static void
+make_dir (const char *path)
+{
+	gchar *full;
+
+	full = g_build_filename (root, path, NULL);
+	if (g_mkdir_with_parents (full, 0755) != 0) {
+		fprintf (stderr, "hald-gen-fake-sysfs: cannot create %s: %s\n", full, strerror (errno));
+		exit (1);
+	}
+	g_free (full);
+}
+
+static void
+make_attr (const char *dir, const char *name, const char *format, ...)
+{
+	gchar *full;
+	FILE *f;
+	va_list args;
+
+	full = g_build_filename (root, dir, name, NULL);
+	f = fopen (full, "w");
+	if (f == NULL) {
+		fprintf (stderr, "hald-gen-fake-sysfs: cannot create %s: %s\n", full, strerror (errno));
+		exit (1);
+	}
+	va_start (args, format);
+	vfprintf (f, format, args);
+	va_end (args);
+	fclose (f);
+	g_free (full);
+}
+
+/* make @path a link to @target, both relative to the root, using a
+ * relative link like the kernel does */
+static void
+make_link (const char *path, const char *target)
+{
+	GString *rel;
+	gchar *full;
+	const char *p;
+
+	rel = g_string_new (NULL);
+	for (p = strchr (path, '/'); p != NULL; p = strchr (p + 1, '/'))
+		g_string_append (rel, "../");
+	g_string_append (rel, target);
+
+	full = g_build_filename (root, path, NULL);
+	if (symlink (rel->str, full) != 0) {
+		fprintf (stderr, "hald-gen-fake-sysfs: cannot create %s: %s\n", full, strerror (errno));
+		exit (1);
+	}
+	g_free (full);
+	g_string_free (rel, TRUE);
+}
+
+static void
+make_device (const char *path, const char *subsystem, const char *uevent)
+{
+	gchar *link;
+
+	make_dir (path);
+	make_attr (path, "uevent", "%s", uevent);
+
+	link = g_strdup_printf ("%s/subsystem", path);
+	make_link (link, subsystem);
+	g_free (link);
+}
+
+/* sda, ..., sdz, sdaa, ... */
+static gchar *
+disk_name (guint n)
+{
+	char buf[16];
+	int i;
+
+	i = sizeof (buf) - 1;
+	buf[i] = '\0';
+	n++;
+	while (n > 0 && i > 2) {
+		n--;
+		buf[--i] = 'a' + n % 26;
+		n /= 26;
+	}
+	buf[--i] = 'd';
+	buf[--i] = 's';
+	return g_strdup (&buf[i]);
+}
+
+static void
+make_block (const char *path, const char *name, const char *devtype, guint k)
+{
+	gchar *link;
+	gchar *uevent;
+	guint minor;
+
+	minor = dev_minor++;
+	uevent = g_strdup_printf ("MAJOR=259\nMINOR=%u\nDEVNAME=%s\nDEVTYPE=%s\n", minor, name, devtype);
+	make_device (path, "sys/class/block", uevent);
+	g_free (uevent);
+
+	make_attr (path, "dev", "259:%u\n", minor);
+	make_attr (path, "ro", "0\n");
+
+	link = g_strdup_printf ("sys/class/block/%s", name);
+	make_link (link, path);
+	g_free (link);
+
+	fprintf (udevdb,
+		 "P: %s\n"
+		 "N: %s\n"
+		 "E: ID_VENDOR=HAL\n"
+		 "E: ID_MODEL=Bench_Disk\n"
+		 "E: ID_REVISION=1.00\n"
+		 "E: ID_SERIAL=HAL_Bench_Disk_%08u-0:0\n",
+		 path + strlen ("sys"), name, k);
+}
+
+static void
+make_chain (guint k, guint num_partitions)
+{
+	gchar *pci_name;
+	gchar *pci;
+	gchar *usb_name;
+	gchar *usb;
+	gchar *intf;
+	gchar *host;
+	gchar *target;
+	gchar *scsi;
+	gchar *disk;
+	gchar *disk_path;
+	gchar *link;
+	gchar *uevent;
+	guint n;
+
+	pci_name = g_strdup_printf ("0000:%02x:%02x.%x", k / 256, (k / 8) % 32, k % 8);
+	pci = g_strdup_printf ("sys/devices/pci0000:00/%s", pci_name);
+	uevent = g_strdup_printf ("DRIVER=ehci_hcd\nPCI_CLASS=C0320\nPCI_ID=8086:24CD\n"
+				  "PCI_SUBSYS_ID=1028:0126\nPCI_SLOT_NAME=%s\n"
+				  "MODALIAS=pci:v00008086d000024CDsv00001028sd00000126bc0Csc03i20\n",
+				  pci_name);
+	make_device (pci, "sys/bus/pci", uevent);
+	g_free (uevent);
+	make_attr (pci, "vendor", "0x8086\n");
+	make_attr (pci, "device", "0x24cd\n");
+	make_attr (pci, "subsystem_vendor", "0x1028\n");
+	make_attr (pci, "subsystem_device", "0x0126\n");
+	make_attr (pci, "class", "0x0c0320\n");
+	link = g_strdup_printf ("sys/bus/pci/devices/%s", pci_name);
+	make_link (link, pci);
+	g_free (link);
+	fprintf (udevdb, "P: %s\n\n", pci + strlen ("sys"));
+
+	usb_name = g_strdup_printf ("%u-1", k + 1);
+	usb = g_strdup_printf ("%s/%s", pci, usb_name);
+	uevent = g_strdup_printf ("MAJOR=189\nMINOR=%u\nDEVTYPE=usb_device\nDRIVER=usb\n"
+				  "PRODUCT=781/5567/100\nTYPE=0/0/0\nBUSNUM=%03u\nDEVNUM=002\n",
+				  k * 128 + 1, k + 1);
+	make_device (usb, "sys/bus/usb", uevent);
+	g_free (uevent);
+	make_attr (usb, "idVendor", "0781\n");
+	make_attr (usb, "idProduct", "5567\n");
+	make_attr (usb, "bcdDevice", "0100\n");
+	make_attr (usb, "manufacturer", "HAL\n");
+	make_attr (usb, "product", "Bench Disk\n");
+	make_attr (usb, "serial", "%08u\n", k);
+	make_attr (usb, "speed", "480\n");
+	make_attr (usb, "version", " 2.00\n");
+	make_attr (usb, "busnum", "%u\n", k + 1);
+	make_attr (usb, "devnum", "2\n");
+	make_attr (usb, "bDeviceClass", "00\n");
+	make_attr (usb, "bDeviceSubClass", "00\n");
+	make_attr (usb, "bDeviceProtocol", "00\n");
+	make_attr (usb, "bConfigurationValue", "1\n");
+	make_attr (usb, "bNumConfigurations", "1\n");
+	make_attr (usb, "bNumInterfaces", " 1\n");
+	make_attr (usb, "bMaxPower", "200mA\n");
+	make_attr (usb, "maxchild", "0\n");
+	link = g_strdup_printf ("sys/bus/usb/devices/%s", usb_name);
+	make_link (link, usb);
+	g_free (link);
+	fprintf (udevdb, "P: %s\nN: bus/usb/%03u/002\n\n", usb + strlen ("sys"), k + 1);
+
+	intf = g_strdup_printf ("%s/%s:1.0", usb, usb_name);
+	make_device (intf, "sys/bus/usb",
+		     "DEVTYPE=usb_interface\nDRIVER=usb-storage\nPRODUCT=781/5567/100\n"
+		     "TYPE=0/0/0\nINTERFACE=8/6/80\n");
+	make_attr (intf, "bInterfaceClass", "08\n");
+	make_attr (intf, "bInterfaceSubClass", "06\n");
+	make_attr (intf, "bInterfaceProtocol", "50\n");
+	make_attr (intf, "bInterfaceNumber", "00\n");
+	make_attr (intf, "bAlternateSetting", " 0\n");
+	make_attr (intf, "bNumEndpoints", "02\n");
+	link = g_strdup_printf ("sys/bus/usb/devices/%s:1.0", usb_name);
+	make_link (link, intf);
+	g_free (link);
+
+	host = g_strdup_printf ("%s/host%u", intf, k);
+	make_device (host, "sys/bus/scsi", "DEVTYPE=scsi_host\n");
+	link = g_strdup_printf ("sys/bus/scsi/devices/host%u", k);
+	make_link (link, host);
+	g_free (link);
+
+	target = g_strdup_printf ("%s/target%u:0:0", host, k);
+	make_device (target, "sys/bus/scsi", "DEVTYPE=scsi_target\n");
+	link = g_strdup_printf ("sys/bus/scsi/devices/target%u:0:0", k);
+	make_link (link, target);
+	g_free (link);
+
+	scsi = g_strdup_printf ("%s/%u:0:0:0", target, k);
+	make_device (scsi, "sys/bus/scsi", "DEVTYPE=scsi_device\nDRIVER=sd\nMODALIAS=scsi:t-0x00\n");
+	make_attr (scsi, "type", "0\n");
+	make_attr (scsi, "vendor", "HAL     \n");
+	make_attr (scsi, "model", "Bench Disk      \n");
+	make_attr (scsi, "rev", "1.00\n");
+	link = g_strdup_printf ("sys/bus/scsi/devices/%u:0:0:0", k);
+	make_link (link, scsi);
+	g_free (link);
+
+	disk = disk_name (k);
+	disk_path = g_strdup_printf ("%s/block/%s", scsi, disk);
+	make_block (disk_path, disk, "disk", k);
+	make_attr (disk_path, "range", "16\n");
+	make_attr (disk_path, "removable", "0\n");
+	make_attr (disk_path, "capability", "50\n");
+	make_attr (disk_path, "size", "%u\n", (num_partitions + 1) * 2048);
+	link = g_strdup_printf ("%s/device", disk_path);
+	make_link (link, scsi);
+	g_free (link);
+	fprintf (udevdb, "\n");
+
+	for (n = 1; n <= num_partitions; n++) {
+		gchar *part;
+		gchar *part_path;
+
+		part = g_strdup_printf ("%s%u", disk, n);
+		part_path = g_strdup_printf ("%s/%s", disk_path, part);
+		make_block (part_path, part, "partition", k);
+		make_attr (part_path, "partition", "%u\n", n);
+		make_attr (part_path, "start", "%u\n", n * 2048);
+		make_attr (part_path, "size", "2048\n");
+		fprintf (udevdb,
+			 "E: ID_FS_USAGE=filesystem\n"
+			 "E: ID_FS_TYPE=ext4\n"
+			 "E: ID_FS_VERSION=1.0\n"
+			 "E: ID_FS_UUID=%08x-0000-4000-8000-%012x\n"
+			 "E: ID_FS_LABEL_ENC=bench%u\n"
+			 "\n",
+			 k, n, n);
+		g_free (part_path);
+		g_free (part);
+	}
+
+	g_free (disk_path);
+	g_free (disk);
+	g_free (scsi);
+	g_free (target);
+	g_free (host);
+	g_free (intf);
+	g_free (usb);
+	g_free (usb_name);
+	g_free (pci);
+	g_free (pci_name);
+}
+
+int
+main (int argc, char *argv[])
+{
+	guint num_devices = 1000;
+	guint num_partitions = 4;
+	guint num_chains;
+	gchar *path;
+	guint k;
+
+	while (1) {
+		int c;
+		int option_index = 0;
+		const char *opt;
+		static struct option long_options[] = {
+			{"devices", 1, NULL, 0},
+			{"partitions", 1, NULL, 0},
+			{"help", 0, NULL, 0},
+			{NULL, 0, NULL, 0}
+		};
+
+		c = getopt_long (argc, argv, "", long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			opt = long_options[option_index].name;
+
+			if (strcmp (opt, "help") == 0) {
+				usage ();
+				return 0;
+			} else if (strcmp (opt, "devices") == 0) {
+				num_devices = strtoul (optarg, NULL, 10);
+			} else if (strcmp (opt, "partitions") == 0) {
+				num_partitions = strtoul (optarg, NULL, 10);
+			}
+			break;
+
+		default:
+			usage ();
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || num_partitions > 15) {
+		usage ();
+		return 1;
+	}
+	root = argv[optind];
+
+	/* one of each of PCI, USB, SCSI and block per chain; the PCI
+	 * addressing used above runs out at 65536 */
+	num_chains = MAX (num_devices / 4, 1);
+	if (num_chains > 65536) {
+		fprintf (stderr, "hald-gen-fake-sysfs: at most 262144 devices are supported\n");
+		return 1;
+	}
+
+	make_dir ("sys/devices/pci0000:00");
+	make_dir ("sys/bus/pci/devices");
+	make_dir ("sys/bus/usb/devices");
+	make_dir ("sys/bus/scsi/devices");
+	make_dir ("sys/class/block");
+
+	path = g_build_filename (root, "udevdb", NULL);
+	udevdb = fopen (path, "w");
+	if (udevdb == NULL) {
+		fprintf (stderr, "hald-gen-fake-sysfs: cannot create %s: %s\n", path, strerror (errno));
+		return 1;
+	}
+	g_free (path);
+
+	for (k = 0; k < num_chains; k++)
+		make_chain (k, num_partitions);
+
+	fclose (udevdb);
+
+	printf ("%u devices in %u chains with %u partitions each\n",
+		num_chains * (7 + num_partitions), num_chains, num_partitions);
+
+	return 0;
+}
@@ -38,6 +38,7 @@
 #include "../device_info.h"
 #include "../hald.h"
 #include "../logger.h"
+#include "../metrics.h"
 #include "../osspec.h"
 
 #include "acpi.h"
@@ -65,8 +66,14 @@ hotplug_event_end (void *end_token)
 
 	hotplug_events_in_progress = g_list_remove (hotplug_events_in_progress, hotplug_event);
 
+	if (hotplug_event->begun.tv_sec != 0)
+		hal_metrics_record_since ("hotplug.event_us", &hotplug_event->begun);
+
 	g_slice_free (HotplugEvent, hotplug_event);
 
+	/* sysfs directories may go away or be reused by the next event */
+	hal_util_attr_cache_flush ();
+
 	/* An event is removed. So we need to restart from the beginning of the queue
 	 * as some events are ready to run now */
 	hotplug_event_queue_restart = TRUE;
@@ -153,7 +160,7 @@ hotplug_event_begin_sysfs (HotplugEvent *hotplug_event)
 		char sys_block_path[HAL_PATH_MAX];
 		gsize sys_block_path_len;
 
-		sys_block_path_len = g_snprintf (sys_block_path, HAL_PATH_MAX, "/sys/block");
+		sys_block_path_len = g_snprintf (sys_block_path, HAL_PATH_MAX, "%s/block", hal_util_get_sysfs_root ());
 		if (strncmp (hotplug_event->sysfs.sysfs_path, sys_block_path, sys_block_path_len) == 0) {
 			HAL_INFO (("%s is a block device (devpath)", hotplug_event->sysfs.sysfs_path));
 			hotplug_event->type = HOTPLUG_EVENT_SYSFS_BLOCK;
@@ -167,8 +174,10 @@ hotplug_event_begin_sysfs (HotplugEvent *hotplug_event)
 			HalDevice *parent;
 			gchar *parent_path;
 
-			hal_util_find_known_parent (hotplug_event->sysfs.sysfs_path,
-							&parent, &parent_path);
+			hal_util_find_known_parent_cached (hotplug_event->sysfs.sysfs_path,
+							   hotplug_event->sysfs.device_link,
+							   &hotplug_event->sysfs.device_link_resolved,
+							   &parent, &parent_path);
 			hotplug_event_begin_add_dev (hotplug_event->sysfs.subsystem,
 							  hotplug_event->sysfs.sysfs_path,
 							  hotplug_event->sysfs.device_file,
@@ -216,7 +225,10 @@ hotplug_event_begin_sysfs (HotplugEvent *hotplug_event)
 				is_partition = TRUE;
                         }
 
-			hal_util_find_known_parent (hotplug_event->sysfs.sysfs_path, &parent, NULL);
+			hal_util_find_known_parent_cached (hotplug_event->sysfs.sysfs_path,
+							   hotplug_event->sysfs.device_link,
+							   &hotplug_event->sysfs.device_link_resolved,
+							   &parent, NULL);
 			hotplug_event_begin_add_blockdev (hotplug_event->sysfs.sysfs_path,
 							  hotplug_event->sysfs.device_file,
 							  is_partition,
@@ -321,6 +333,9 @@ hotplug_event_enqueue (HotplugEvent *hotplug_event)
 		hotplug_event_queue = g_queue_new ();
 
 	g_queue_push_tail (hotplug_event_queue, hotplug_event);
+
+	g_get_current_time (&hotplug_event->queued);
+	hal_metrics_record ("hotplug.queue_depth", hotplug_event_queue->length);
 }
 
 void 
@@ -331,6 +346,9 @@ hotplug_event_enqueue_at_front (HotplugEvent *hotplug_event)
 
 	g_queue_push_head (hotplug_event_queue, hotplug_event);
 
+	g_get_current_time (&hotplug_event->queued);
+	hal_metrics_record ("hotplug.queue_depth", hotplug_event_queue->length);
+
 	/* New event added at the start, restart processing of the queue from the
 	 * start */
 	hotplug_event_queue_restart = TRUE;
@@ -485,6 +503,8 @@ hotplug_event_process_queue (void)
 			lp2 = lp->prev;
 			g_queue_unlink(hotplug_event_queue, lp);
 			hotplug_events_in_progress = g_list_concat (hotplug_events_in_progress, lp);
+			hal_metrics_record_since ("hotplug.wait_us", &hotplug_event->queued);
+			g_get_current_time (&hotplug_event->begun);
 			hotplug_event_begin (hotplug_event);
 			if (lp2 == NULL || hotplug_event_queue_restart) {
 				lp = hotplug_event_queue->head;
@@ -498,6 +518,7 @@ hotplug_event_process_queue (void)
 		}
 	}
 	HAL_DEBUG (("events queued = %d, events in progress = %d", hotplug_event_queue->length, g_list_length (hotplug_events_in_progress)));
+	hal_metrics_set ("hotplug.queued", hotplug_event_queue->length);
 
 	processing = FALSE;
 
@@ -550,7 +571,7 @@ hotplug_reprobe_generate_remove_events (HalDevice *d)
 	HotplugEvent *e;
 
 	/* first remove childs */
-	childs = hal_device_store_match_multiple_key_value_string (hald_get_gdl (), "info.parent", hal_device_get_udi (d));
+	childs = hal_device_store_get_children (hald_get_gdl (), hal_device_get_udi (d));
 	for (i = childs; i != NULL; i = g_slist_next (i)) {
 		HalDevice *child;
 
@@ -634,7 +655,7 @@ hotplug_reprobe_generate_add_events (HalDevice *d)
 	}
 
 	/* then add childs */
-	childs = hal_device_store_match_multiple_key_value_string (hald_get_gdl (), "info.parent", hal_device_get_udi (d));
+	childs = hal_device_store_get_children (hald_get_gdl (), hal_device_get_udi (d));
 	for (i = childs; i != NULL; i = g_slist_next (i)) {
 		HalDevice *child;
 
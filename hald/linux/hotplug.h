@@ -57,6 +57,8 @@ typedef struct
 	HotplugActionType action;				/* Whether the event is add or remove */
 	HotplugEventType type;					/* Type of event */
 	gboolean reposted;					/* Avoid loops */
+	GTimeVal queued;					/* When last put in the queue */
+	GTimeVal begun;						/* When processing started */
 	union {
 		struct {
 			char subsystem[HAL_NAME_MAX];		/* Kernel subsystem the device belongs to */
@@ -69,6 +71,10 @@ typedef struct
 			/* if the device is a Device mapper device, used to prevent multiple string compares */
 			gboolean is_dm_device;
 
+			/* normalized target of <sysfs_path>/device, valid once device_link_resolved is set */
+			char device_link[HAL_PATH_MAX];
+			gboolean device_link_resolved;
+
 			/* stuff udev may tell us about the device and we don't want to query */
 			char vendor[HAL_NAME_MAX];
 			char model[HAL_NAME_MAX];
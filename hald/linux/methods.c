@@ -0,0 +1,220 @@
+/***************************************************************************
+ *
+ * methods.c : Native implementations of method scripts
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/types.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "../device.h"
+#include "../hald_dbus.h"
+#include "../logger.h"
+
+#include "methods.h"
+
+/* These do what the tools/linux/hal-system-*-linux backends do for the
+ * cases that only need a file read or an ioctl. Anything else, and any
+ * unexpected failure, is left to the script so that callers always get
+ * the exact same answer as before.
+ */
+
+/* Get field @field (counting from 1, like awk) of the first line in
+ * @path containing @match, or of the first line if @match is NULL.
+ */
+static gboolean
+read_int_field (const char *path, const char *match, guint field, int *value)
+{
+	gchar *contents;
+	gchar **lines;
+	gchar **fields;
+	gboolean ret;
+	guint n;
+	guint i;
+	char *endp;
+
+	ret = FALSE;
+
+	if (path == NULL || !g_file_get_contents (path, &contents, NULL, NULL))
+		return FALSE;
+
+	lines = g_strsplit (contents, "\n", 0);
+	g_free (contents);
+
+	for (n = 0; lines[n] != NULL; n++) {
+		if (match == NULL || strstr (lines[n], match) != NULL)
+			break;
+	}
+	if (lines[n] == NULL)
+		goto out;
+
+	fields = g_strsplit_set (lines[n], " \t", 0);
+	for (i = 0, n = 0; fields[i] != NULL; i++) {
+		if (fields[i][0] == '\0')
+			continue;
+		if (++n == field) {
+			*value = strtol (fields[i], &endp, 10);
+			ret = (endp != fields[i] && *endp == '\0');
+			break;
+		}
+	}
+	g_strfreev (fields);
+
+out:
+	g_strfreev (lines);
+	return ret;
+}
+
+static gboolean
+lcd_get_brightness (HalDevice *d, DBusMessage *message, HaldNativeMethodReturn *ret)
+{
+	const char *method;
+	const char *path;
+	int value;
+
+	ret->action = g_strdup ("org.freedesktop.hal.power-management.lcd-panel");
+
+	method = hal_device_property_get_string (d, "laptop_panel.access_method");
+	path = hal_device_property_get_string (d, "linux.acpi_path");
+	if (method == NULL || path == NULL)
+		return FALSE;
+
+	if (strcmp (method, "toshiba") == 0) {
+		/* brightness:              5 */
+		if (!read_int_field (path, "brightness:", 2, &value))
+			return FALSE;
+	} else if (strcmp (method, "asus") == 0 ||
+		   strcmp (method, "panasonic") == 0) {
+		if (!read_int_field (path, NULL, 1, &value))
+			return FALSE;
+	} else if (strcmp (method, "ibm") == 0) {
+		/* level:          5 */
+		if (!read_int_field (path, "level:", 2, &value))
+			return FALSE;
+	} else if (strcmp (method, "sony") == 0) {
+		if (!read_int_field (path, NULL, 1, &value))
+			return FALSE;
+		value--;
+	} else if (strcmp (method, "omnibook") == 0) {
+		/* LCD brightness:  7 */
+		if (!read_int_field (path, NULL, 3, &value))
+			return FALSE;
+	} else {
+		/* pmu, sonypi and whatever else needs a helper */
+		return FALSE;
+	}
+
+	ret->result = value;
+	return TRUE;
+}
+
+static gboolean
+killswitch_get_power (HalDevice *d, DBusMessage *message, HaldNativeMethodReturn *ret)
+{
+	const char *type;
+	const char *method;
+	int value;
+
+	type = hal_device_property_get_string (d, "killswitch.type");
+	method = hal_device_property_get_string (d, "killswitch.access_method");
+	if (type == NULL || method == NULL)
+		return FALSE;
+
+	ret->action = g_strdup_printf ("org.freedesktop.hal.killswitch.%s", type);
+
+	if (strcmp (type, "bluetooth") != 0) {
+		ret->error_name = "org.freedesktop.Hal.Device.KillSwitch.NotSupported";
+		ret->error_detail = g_strdup ("Killswitch type not supported");
+	} else if (strcmp (method, "thinkpad") == 0) {
+		if (!read_int_field (hal_device_property_get_string (d, "linux.sysfs_path"), NULL, 1, &value))
+			return FALSE;
+		ret->result = value;
+	} else if (strcmp (method, "sonypic") == 0) {
+		return FALSE;
+	} else {
+		ret->error_name = "org.freedesktop.Hal.Device.KillSwitch.NotSupported";
+		ret->error_detail = g_strdup ("Access type not supported");
+	}
+
+	return TRUE;
+}
+
+static gboolean
+wol_get_enabled (HalDevice *d, DBusMessage *message, HaldNativeMethodReturn *ret)
+{
+	const char *ifname;
+	struct ethtool_wolinfo wol;
+	struct ifreq ifr;
+	int fd;
+	int rc;
+
+	ret->action = g_strdup ("org.freedesktop.hal.wol.enabled");
+
+	ifname = hal_device_property_get_string (d, "net.interface");
+	if (ifname == NULL || strlen (ifname) >= sizeof (ifr.ifr_name))
+		return FALSE;
+
+	fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return FALSE;
+
+	memset (&wol, 0, sizeof (wol));
+	wol.cmd = ETHTOOL_GWOL;
+	memset (&ifr, 0, sizeof (ifr));
+	strcpy (ifr.ifr_name, ifname);
+	ifr.ifr_data = (caddr_t) &wol;
+
+	rc = ioctl (fd, SIOCETHTOOL, &ifr);
+	close (fd);
+
+	if (rc < 0 && (errno == EPERM || errno == EACCES)) {
+		/* needs CAP_NET_ADMIN; let the script run ethtool as root */
+		return FALSE;
+	}
+
+	/* like the script, which is a shell test: 0 means enabled */
+	ret->result = (rc == 0 && (wol.wolopts & WAKE_MAGIC)) ? 0 : 1;
+	return TRUE;
+}
+
+/**
+ * linux_methods_register:
+ *
+ * Register the native method implementations with the D-Bus layer.
+ */
+void
+linux_methods_register (void)
+{
+	hald_dbus_register_native_method ("hal-system-lcd-get-brightness", lcd_get_brightness);
+	hald_dbus_register_native_method ("hal-system-killswitch-get-power", killswitch_get_power);
+	hald_dbus_register_native_method ("hal-system-wol-enabled", wol_get_enabled);
+}
@@ -64,6 +64,7 @@
 #include "blockdev.h"
 #include "coldplug.h"
 #include "hotplug.h"
+#include "methods.h"
 #include "pmu.h"
 
 #include "osspec_linux.h"
@@ -92,12 +93,12 @@ static void copy_dev_prop(struct udev_device *device, char * dst, size_t dst_siz
 	}
 }
 
-static void copy_dev_prop_formatted(struct udev_device *device, char * format, char * dst, size_t dst_size, const char *property)
+static void copy_dev_prop_prefixed(struct udev_device *device, const char * prefix, char * dst, size_t dst_size, const char *property)
 {
 	const char * propVal = udev_device_get_property_value(device, property);
 
 	if(propVal != NULL) {
-		g_snprintf (dst, dst_size, format, propVal);
+		g_snprintf (dst, dst_size, "%s%s", prefix, propVal);
 		HAL_INFO(("Property: %s Value: %s", property, dst));
 	}
 }
@@ -109,6 +110,7 @@ hald_udev_data (GIOChannel *source, GIOCondition condition, gpointer user_data)
 	struct udev_device *device;
 
 	char *tmp, *tmp1;
+	char md_prefix[HAL_PATH_MAX];
 
 	const char *action = NULL;
 	HotplugEvent *hotplug_event;
@@ -125,14 +127,14 @@ hald_udev_data (GIOChannel *source, GIOCondition condition, gpointer user_data)
 
 	action = udev_device_get_action(device);
 
-	copy_dev_prop_formatted(device, "/sys%s", hotplug_event->sysfs.sysfs_path, sizeof(hotplug_event->sysfs.sysfs_path), "DEVPATH");
+	copy_dev_prop_prefixed(device, hal_util_get_sysfs_root (), hotplug_event->sysfs.sysfs_path, sizeof(hotplug_event->sysfs.sysfs_path), "DEVPATH");
 	copy_dev_prop(device, hotplug_event->sysfs.subsystem, sizeof(hotplug_event->sysfs.subsystem), "SUBSYSTEM");
 	copy_dev_prop(device, hotplug_event->sysfs.device_file, sizeof(hotplug_event->sysfs.device_file), "DEVNAME");
 
 	hotplug_event->sysfs.seqnum = get_ll_dev_prop(device, "SEQNUM");
 	hotplug_event->sysfs.net_ifindex = get_ll_dev_prop(device, "IFINDEX");
 
-	copy_dev_prop_formatted(device, "/sys%s", hotplug_event->sysfs.sysfs_path_old, sizeof(hotplug_event->sysfs.sysfs_path_old), "DEVPATH_OLD");
+	copy_dev_prop_prefixed(device, hal_util_get_sysfs_root (), hotplug_event->sysfs.sysfs_path_old, sizeof(hotplug_event->sysfs.sysfs_path_old), "DEVPATH_OLD");
 	copy_dev_prop(device, hotplug_event->sysfs.vendor, sizeof(hotplug_event->sysfs.vendor), "ID_VENDOR");
 	copy_dev_prop(device, hotplug_event->sysfs.model, sizeof(hotplug_event->sysfs.model), "ID_MODEL");
 	copy_dev_prop(device, hotplug_event->sysfs.revision, sizeof(hotplug_event->sysfs.revision), "ID_REVISION");
@@ -144,11 +146,12 @@ hald_udev_data (GIOChannel *source, GIOCondition condition, gpointer user_data)
 	copy_dev_prop(device, hotplug_event->sysfs.fslabel, sizeof(hotplug_event->sysfs.fslabel), "ID_FS_LABEL_ENC");
 
     /* md devices are handled via looking at /proc/mdstat */
-    if (g_str_has_prefix (hotplug_event->sysfs.sysfs_path, "/sys/block/md")) {
+    g_snprintf (md_prefix, sizeof (md_prefix), "%s/block/md", hal_util_get_sysfs_root ());
+    if (g_str_has_prefix (hotplug_event->sysfs.sysfs_path, md_prefix)) {
         HAL_INFO (("skipping md event for %s", hotplug_event->sysfs.sysfs_path));
         goto invalid;
     }
-    if (g_str_has_prefix (hotplug_event->sysfs.sysfs_path_old, "/sys/block/md")) {
+    if (g_str_has_prefix (hotplug_event->sysfs.sysfs_path_old, md_prefix)) {
         HAL_INFO (("skipping md event for %s", hotplug_event->sysfs.sysfs_path_old));
         goto invalid;
     }
@@ -359,6 +362,9 @@ osspec_init (void)
 	 */
 
 	hal_device_store_index_property (hald_get_gdl (), "linux.sysfs_path");
+	hal_device_store_index_path_property (hald_get_gdl (), "linux.sysfs_path");
+
+	linux_methods_register ();
 
 	udev = udev_new();
 
@@ -422,6 +428,14 @@ void
 hotplug_queue_now_empty (void)
 {
 	if (hald_is_initialising && hald_done_synthesizing_coldplug) {
+		HalUtilAttrStats stats;
+
+		hal_util_get_attr_stats (&stats);
+		HAL_INFO (("Coldplug read %" G_GUINT64_FORMAT " attributes with %" G_GUINT64_FORMAT " syscalls "
+			   "(%" G_GUINT64_FORMAT " directory opens, %" G_GUINT64_FORMAT " cache hits)",
+			   stats.num_reads, stats.num_syscalls, stats.num_dir_opens,
+			   stats.num_dir_cache_hits));
+
 		osspec_probe_done ();
         }
 }
@@ -756,14 +770,16 @@ get_primary_videocard (HalDevice *d)
 {
         GDir *dir;
         const char *name;
+        char *pci_path;
 
-        dir = g_dir_open ("/sys/bus/pci/devices", 0, NULL);
+        pci_path = g_strdup_printf ("%s/bus/pci/devices", hal_util_get_sysfs_root ());
+        dir = g_dir_open (pci_path, 0, NULL);
         if (dir == NULL)
                 goto out;
         while ((name = g_dir_read_name (dir)) != NULL) {
                 int class;
                 char *path;
-                path = g_strdup_printf ("/sys/bus/pci/devices/%s", name);
+                path = g_strdup_printf ("%s/%s", pci_path, name);
                 if (hal_util_get_int_from_file (path, "class", &class, 0) && (class&0xffff00) == 0x030000 ) {
                         int vendor, device;
                         if (hal_util_get_int_from_file (path, "vendor", &vendor, 0) &&
@@ -780,7 +796,7 @@ get_primary_videocard (HalDevice *d)
         }
         g_dir_close (dir);
 out:
-        ;
+        g_free (pci_path);
 }
 
 void 
@@ -907,64 +923,68 @@ hal_util_set_driver (HalDevice *d, const char *property_name, const char *sysfs_
 	return ret;
 }
 
-static gboolean get_parent_device(char *path)
+/* ascending a sysfs path must not go through these directories */
+static const char *parent_device_stop_components[] = {
+	"class",
+	"block",
+	"devices",
+	NULL
+};
+
+static HalDevice *
+find_known_ancestor (const gchar *path, gboolean include_self, gchar **ancestor_path)
 {
-	/* go up one directory */
-	if (!hal_util_path_ascend (path))
-		return FALSE;
-	if (g_str_has_suffix (path, "/class"))
-		return FALSE;
-	if (g_str_has_suffix (path, "/block"))
-		return FALSE;
-	if (g_str_has_suffix (path, "/devices"))
-		return FALSE;
-	return TRUE;
+	HalDevice *d;
+	gsize len;
+
+	d = hal_device_store_match_path_ancestor (hald_get_gdl (),
+						  "linux.sysfs_path",
+						  path,
+						  include_self,
+						  parent_device_stop_components,
+						  &len);
+	if (d != NULL)
+		*ancestor_path = g_strndup (path, len);
+	return d;
 }
 
-/* return the first already known parent device */
+/* like hal_util_find_known_parent() but with the normalized target of
+ * <sysfs_path>/device cached in @device_link (HAL_PATH_MAX bytes) once
+ * @device_link_resolved is set, e.g. across reposts of a hotplug event */
 gboolean
-hal_util_find_known_parent (const gchar *sysfs_path, HalDevice **parent, gchar **parent_path)
+hal_util_find_known_parent_cached (const gchar *sysfs_path, gchar *device_link, gboolean *device_link_resolved,
+				   HalDevice **parent, gchar **parent_path)
 {
 	gchar *target;
 	HalDevice *parent_dev = NULL;
-	gchar *parent_devpath;
+	gchar *parent_devpath = NULL;
 	char parentdevpath[HAL_PATH_MAX];
 	gboolean retval = FALSE;
 
-	parent_devpath = g_strdup (sysfs_path);
-	while (TRUE) {
-		if (!get_parent_device (parent_devpath))
-			break;
-
-		parent_dev = hal_device_store_match_key_value_string (hald_get_gdl (),
-								      "linux.sysfs_path",
-								      parent_devpath);
-		if (parent_dev != NULL)
-			goto out;
-	}
-	g_free (parent_devpath);
-	parent_devpath = NULL;
+	/* nearest known directory above sysfs_path */
+	parent_dev = find_known_ancestor (sysfs_path, FALSE, &parent_devpath);
+	if (parent_dev != NULL)
+		goto out;
 
 	/* try if the parent chain is constructed by the device-link */
-	g_snprintf (parentdevpath, HAL_PATH_MAX, "%s/device", sysfs_path);
-	if ((target = hal_util_readlink (parentdevpath)) != NULL) {
-		parent_devpath = hal_util_get_normalized_path (sysfs_path, target);
-
-		while (TRUE) {
-			parent_dev = hal_device_store_match_key_value_string (hald_get_gdl (),
-									      "linux.sysfs_path",
-									      parent_devpath);
-			if (parent_dev != NULL)
-				goto out;
-
-			/* go up one directory */
-			if (!get_parent_device (parent_devpath))
-				break;
+	if (!*device_link_resolved) {
+		device_link[0] = '\0';
+		g_snprintf (parentdevpath, HAL_PATH_MAX, "%s/device", sysfs_path);
+		if ((target = hal_util_readlink (parentdevpath)) != NULL) {
+			gchar *normalized;
+
+			normalized = hal_util_get_normalized_path (sysfs_path, target);
+			if (normalized != NULL) {
+				g_strlcpy (device_link, normalized, HAL_PATH_MAX);
+				g_free (normalized);
+			}
 		}
-		g_free (parent_devpath);
-		parent_devpath = NULL;
+		*device_link_resolved = TRUE;
 	}
 
+	if (device_link[0] != '\0')
+		parent_dev = find_known_ancestor (device_link, TRUE, &parent_devpath);
+
 out:
 	if (parent_dev != NULL) {
 		HAL_INFO (("hal_util_find_known_parent: '%s'->'%s'", sysfs_path, parent_devpath));
@@ -979,8 +999,139 @@ out:
 	return retval;
 }
 
+/**
+ * hal_util_get_sysfs_root:
+ *
+ * Returns:             Where sysfs is mounted, normally "/sys"
+ *
+ * The environment variable HALD_SYSFS_ROOT can point the Linux backend
+ * at a synthetic sysfs tree, see hald-coldplug-bench.sh.
+ */
+const gchar *
+hal_util_get_sysfs_root (void)
+{
+	static gchar *sysfs_root = NULL;
+
+	if (sysfs_root == NULL) {
+		const gchar *root;
+
+		root = g_getenv ("HALD_SYSFS_ROOT");
+		if (root == NULL || root[0] == '\0')
+			root = "/sys";
+		sysfs_root = g_strdup (root);
+		/* paths are built as root + "/devices/..." */
+		while (strlen (sysfs_root) > 1 && g_str_has_suffix (sysfs_root, "/"))
+			sysfs_root[strlen (sysfs_root) - 1] = '\0';
+	}
+
+	return sysfs_root;
+}
+
+/* return the first already known parent device */
+gboolean
+hal_util_find_known_parent (const gchar *sysfs_path, HalDevice **parent, gchar **parent_path)
+{
+	gchar device_link[HAL_PATH_MAX];
+	gboolean device_link_resolved = FALSE;
+
+	return hal_util_find_known_parent_cached (sysfs_path, device_link, &device_link_resolved,
+						  parent, parent_path);
+}
+
 void
 osspec_refresh_mount_state_for_block_device (HalDevice *d)
 {
 	blockdev_refresh_mount_state (d);
 }
+
+/* attributes that change when a device is replaced or reconfigured */
+static const char *snapshot_identity_attrs[] = {
+	"dev",
+	"size",
+	"start",
+	"serial",
+	"wwid",
+	"device/wwid",
+	"ro",
+	NULL
+};
+
+/**
+ * hal_util_get_snapshot_identity:
+ * @sysfs_path:         Sysfs path of the device
+ *
+ * Returns:             Identity to store in the device snapshot, or
+ *                      NULL if the device must always be probed. Must
+ *                      be freed by the caller.
+ *
+ * Describe what a device looks like in sysfs such that the description
+ * changes whenever the result of probing the device might change.
+ */
+char *
+hal_util_get_snapshot_identity (const gchar *sysfs_path)
+{
+	GString *identity;
+	gchar *path;
+	gchar *uevent_path;
+	gchar *uevent;
+	gchar buf[256];
+	guint i;
+
+	identity = g_string_new ("");
+
+	/* a fakevolume is a property of the disk it lives on */
+	if (g_str_has_suffix (sysfs_path, "/fakevolume")) {
+		path = g_path_get_dirname (sysfs_path);
+		g_string_append (identity, "fakevolume\n");
+	} else {
+		path = g_strdup (sysfs_path);
+	}
+
+	uevent_path = g_build_filename (path, "uevent", NULL);
+	if (!g_file_get_contents (uevent_path, &uevent, NULL, NULL)) {
+		g_free (uevent_path);
+		goto fail;
+	}
+	g_string_append (identity, uevent);
+	g_free (uevent);
+	g_free (uevent_path);
+
+	for (i = 0; snapshot_identity_attrs[i] != NULL; i++) {
+		if (hal_util_read_attr (path, snapshot_identity_attrs[i], buf, sizeof (buf)) >= 0)
+			g_string_append_printf (identity, "%s=%s\n", snapshot_identity_attrs[i], buf);
+	}
+
+	/* Media in a removable block device can change without anything
+	 * else in sysfs changing; only the disk sequence number, where
+	 * the kernel has it, tells us. Partitions inherit it from the disk.
+	 */
+	if (strstr (path, "/block/") != NULL) {
+		gchar *disk_path;
+		gboolean is_removable;
+
+		if (hal_util_read_attr (path, "removable", buf, sizeof (buf)) >= 0) {
+			disk_path = g_strdup (path);
+		} else {
+			disk_path = g_path_get_dirname (path);
+			if (hal_util_read_attr (disk_path, "removable", buf, sizeof (buf)) < 0)
+				buf[0] = '\0';
+		}
+		is_removable = (strcmp (buf, "1") == 0);
+
+		if (hal_util_read_attr (disk_path, "diskseq", buf, sizeof (buf)) >= 0) {
+			g_string_append_printf (identity, "diskseq=%s\n", buf);
+		} else if (is_removable) {
+			g_free (disk_path);
+			goto fail;
+		}
+		g_free (disk_path);
+	}
+
+	g_free (path);
+	return g_string_free (identity, FALSE);
+
+fail:
+	g_free (path);
+	g_string_free (identity, TRUE);
+	return NULL;
+}
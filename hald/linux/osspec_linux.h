@@ -35,7 +35,14 @@ gboolean hal_util_set_driver (HalDevice *d, const char *property_name, const cha
 
 gboolean hal_util_find_known_parent (const gchar *sysfs_path, HalDevice **parent, gchar **parent_path);
 
+gboolean hal_util_find_known_parent_cached (const gchar *sysfs_path, gchar *device_link, gboolean *device_link_resolved,
+					    HalDevice **parent, gchar **parent_path);
+
 GIOChannel *get_mdstat_channel (void);
 
+char *hal_util_get_snapshot_identity (const gchar *sysfs_path);
+
+const gchar *hal_util_get_sysfs_root (void);
+
 
 #endif /* OSSPEC_LINUX_H */
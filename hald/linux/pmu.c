@@ -36,6 +36,7 @@
 #include "../logger.h"
 #include "../util.h"
 #include "../util_pm.h"
+#include "../util_wakeup.h"
 
 #include "hotplug.h"
 #include "osspec_linux.h"
@@ -360,15 +361,9 @@ pmu_synthesize_hotplug_events (void)
 
 	if (!_have_sysfs_power_supply) {
 	  	/* setup timer for things that we need to poll */
-#ifdef HAVE_GLIB_2_14
-		g_timeout_add_seconds (PMU_POLL_INTERVAL,
-                	               pmu_poll,
-                        	       NULL);
-#else
-		g_timeout_add (1000 * PMU_POLL_INTERVAL,
-			       pmu_poll,
-			       NULL);
-#endif
+		hal_wakeup_add (1000 * PMU_POLL_INTERVAL,
+				pmu_poll,
+				NULL);
 	}
 
 out:
@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -85,6 +86,116 @@ out:
 	return rc;
 }
 
+/* What CDROM_GET_CAPABILITY and get_dvd_r_rw_profile() return depends only
+ * on the drive, so it's remembered across probes and restarts. Speeds
+ * depend on the media and are always queried. */
+#define CDROM_CACHE_FILE	PACKAGE_LOCALSTATEDIR "/cache/hald/cdrom-capabilities"
+
+static const char *
+cdrom_cache_path (void)
+{
+	const char *path;
+
+	path = getenv ("HAL_CDROM_CACHE_NAME");
+	if (path == NULL)
+		path = CDROM_CACHE_FILE;
+	return path;
+}
+
+/** Name of the cache entry for the drive being probed
+ *
+ *  @return                     Newly allocated group name or NULL if the
+ *                              drive doesn't identify itself well enough
+ */
+static char *
+cdrom_cache_group (void)
+{
+	const char *vendor;
+	const char *model;
+	const char *revision;
+	const char *serial;
+	char *group;
+
+	vendor = getenv ("HAL_PROP_STORAGE_VENDOR");
+	model = getenv ("HAL_PROP_STORAGE_MODEL");
+	revision = getenv ("HAL_PROP_STORAGE_FIRMWARE_VERSION");
+	serial = getenv ("HAL_PROP_STORAGE_SERIAL");
+
+	if (vendor == NULL || model == NULL || revision == NULL || revision[0] == '\0')
+		return NULL;
+
+	group = g_strdup_printf ("%s|%s|%s|%s", vendor, model, revision, serial != NULL ? serial : "");
+	/* not allowed in key file group names */
+	g_strdelimit (group, "[]\n", '_');
+	return group;
+}
+
+static dbus_bool_t
+cdrom_cache_lookup (const char *group, int *capabilities, int *profile)
+{
+	GKeyFile *key_file;
+	GError *error = NULL;
+	dbus_bool_t ret;
+
+	ret = FALSE;
+	key_file = g_key_file_new ();
+	if (!g_key_file_load_from_file (key_file, cdrom_cache_path (), G_KEY_FILE_NONE, NULL))
+		goto out;
+
+	*capabilities = g_key_file_get_integer (key_file, group, "capabilities", &error);
+	if (error != NULL)
+		goto out;
+	*profile = g_key_file_get_integer (key_file, group, "profile", &error);
+	if (error != NULL)
+		goto out;
+
+	HAL_DEBUG (("Using cached capabilities 0x%08x and profile %d for '%s'", *capabilities, *profile, group));
+	ret = TRUE;
+out:
+	if (error != NULL)
+		g_error_free (error);
+	g_key_file_free (key_file);
+	return ret;
+}
+
+static void
+cdrom_cache_store (const char *group, int capabilities, int profile)
+{
+	GKeyFile *key_file;
+	gchar *data;
+	gsize len;
+	gchar *tmp_path;
+	int fd;
+
+	key_file = g_key_file_new ();
+	g_key_file_load_from_file (key_file, cdrom_cache_path (), G_KEY_FILE_NONE, NULL);
+	g_key_file_set_integer (key_file, group, "capabilities", capabilities);
+	g_key_file_set_integer (key_file, group, "profile", profile);
+	data = g_key_file_to_data (key_file, &len, NULL);
+	g_key_file_free (key_file);
+
+	/* several drives may be probed at the same time; if two of them
+	 * write the cache one entry is lost and added on the next probe */
+	tmp_path = g_strdup_printf ("%s.XXXXXX", cdrom_cache_path ());
+	fd = g_mkstemp (tmp_path);
+	if (fd < 0) {
+		HAL_DEBUG (("Cannot create %s: %s", tmp_path, strerror (errno)));
+		goto out;
+	}
+	if (write (fd, data, len) != (ssize_t) len || fchmod (fd, 0644) != 0) {
+		close (fd);
+		unlink (tmp_path);
+		goto out;
+	}
+	close (fd);
+	if (rename (tmp_path, cdrom_cache_path ()) != 0)
+		unlink (tmp_path);
+
+out:
+	g_free (tmp_path);
+	g_free (data);
+}
+
 int 
 main (int argc, char *argv[])
 {
@@ -205,12 +316,30 @@ main (int argc, char *argv[])
 		}
 		
 		if (!only_check_for_fs) {
-			capabilities = ioctl (fd, CDROM_GET_CAPABILITY, 0);
-			if (capabilities < 0) {
-				close (fd);
-				goto out;
+			int profile;
+			char *cache_group;
+
+			cache_group = cdrom_cache_group ();
+			if (cache_group == NULL || !cdrom_cache_lookup (cache_group, &capabilities, &profile)) {
+				capabilities = ioctl (fd, CDROM_GET_CAPABILITY, 0);
+				if (capabilities < 0) {
+					g_free (cache_group);
+					close (fd);
+					goto out;
+				}
+				HAL_DEBUG (("CDROM_GET_CAPABILITY returned: 0x%08x", capabilities));
+
+				profile = 0;
+				if (capabilities & CDC_DVD) {
+					profile = get_dvd_r_rw_profile (fd);
+					HAL_DEBUG (("get_dvd_r_rw_profile returned: %d", profile));
+				}
+
+				/* don't remember a failed GET CONFIGURATION */
+				if (cache_group != NULL && profile >= 0)
+					cdrom_cache_store (cache_group, capabilities, profile);
 			}
-			HAL_DEBUG (("CDROM_GET_CAPABILITY returned: 0x%08x", capabilities));
+			g_free (cache_group);
 			
 			libhal_changeset_set_property_bool (cs, "storage.cdrom.cdr", FALSE);
 			libhal_changeset_set_property_bool (cs, "storage.cdrom.cdrw", FALSE);
@@ -241,13 +370,8 @@ main (int argc, char *argv[])
 				libhal_changeset_set_property_bool (cs, "storage.cdrom.cdrw", TRUE);
 			}
 			if (capabilities & CDC_DVD) {
-				int profile;
-				
 				libhal_changeset_set_property_bool (cs, "storage.cdrom.dvd", TRUE);
 
-				profile = get_dvd_r_rw_profile (fd);
-				HAL_DEBUG (("get_dvd_r_rw_profile returned: %d", profile));
-
 				if (profile & DRIVE_CDROM_CAPS_DVDRW)
 					libhal_changeset_set_property_bool (cs, "storage.cdrom.dvdrw", TRUE);
 				if (profile & DRIVE_CDROM_CAPS_DVDRDL)
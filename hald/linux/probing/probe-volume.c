@@ -137,145 +137,143 @@ set_blkid_values (LibHalChangeSet *cs, blkid_probe pr)
 	libhal_changeset_set_property_string (cs, "info.product", buf);
 }
 
+static char *device_file;
+
+/* Largest path table we read; the entries for the directories in the
+ * root come first, so this is plenty for what we look for */
+#define PATH_TABLE_MAX_SIZE (64 * 1024)
+
 static void
 advanced_disc_detect (LibHalChangeSet *cs, int fd, const char *device_file)
 {
+	/* the primary volume descriptor */
+	guchar pvd[2048];
 	/* the discs block size */
-	unsigned short bs; 
+	guint16 bs;
 	/* the path table size */
-	unsigned short ts;
+	guint32 ts;
 	/* the path table location (in blocks) */
-	unsigned int tl;
+	guint32 tl;
+	/* the path table */
+	guchar *table = NULL;
+	/* number of path table bytes read */
+	ssize_t table_len;
 	/* length of the directory name in current path table entry */
-	unsigned char len_di = 0;
+	guchar len_di;
 	/* the number of the parent directory's path table entry */
-	unsigned int parent = 0; 
+	guint16 parent;
 	/* filename for the current path table entry */
 	char dirname[256];
 	/* our position into the path table */
-	int pos = 0; 
-	/* the path table record we're on */
-	int curr_record = 1; 
+	ssize_t pos;
 	/* loop counter */
-	int i; 
-	
+	int i;
+
 	/* set defaults */
 	libhal_changeset_set_property_bool (cs, "volume.disc.is_videodvd", FALSE);
 	libhal_changeset_set_property_bool (cs, "volume.disc.is_blurayvideo", FALSE);
 	libhal_changeset_set_property_bool (cs, "volume.disc.is_vcd", FALSE);
 	libhal_changeset_set_property_bool (cs, "volume.disc.is_svcd", FALSE);
-	
-	/* read the block size */
-	lseek (fd, 0x8080, SEEK_CUR);
-	if (read (fd, &bs, 2) != 2)
-	{
-		HAL_DEBUG(("Advanced probing on %s failed while reading block size", device_file));
+
+	/* Read the whole primary volume descriptor and then the whole
+	 * path table with one read each; every read on an optical drive
+	 * is a round trip to slow hardware */
+	if (pread (fd, pvd, sizeof (pvd), 0x8000) != sizeof (pvd)) {
+		HAL_DEBUG(("Advanced probing on %s failed while reading the volume descriptor", device_file));
 		goto out;
 	}
-
-	/* read in size of path table */
-	lseek (fd, 2, SEEK_CUR);
-	if (read (fd, &ts, 2) != 2)
-	{
-		HAL_DEBUG(("Advanced probing on %s failed while reading path table size", device_file));
+	memcpy (&bs, pvd + 0x80, 2);
+	memcpy (&ts, pvd + 0x84, 4);
+	memcpy (&tl, pvd + 0x8c, 4);
+	bs = GUINT16_FROM_LE (bs);
+	ts = GUINT32_FROM_LE (ts);
+	tl = GUINT32_FROM_LE (tl);
+
+	if (ts > PATH_TABLE_MAX_SIZE)
+		ts = PATH_TABLE_MAX_SIZE;
+	if (bs == 0 || ts == 0) {
+		HAL_DEBUG(("Advanced probing on %s failed, no path table", device_file));
 		goto out;
 	}
 
-	/* read in which block path table is in */
-	lseek (fd, 6, SEEK_CUR);
-	if (read (fd, &tl, 4) != 4)
-	{
-		HAL_DEBUG(("Advanced probing on %s failed while reading path table block", device_file));
+	table = g_malloc (ts);
+	table_len = pread (fd, table, ts, (off_t) bs * tl);
+	if (table_len <= 0) {
+		HAL_DEBUG(("Advanced probing on %s failed while reading the path table", device_file));
 		goto out;
 	}
 
-	/* seek to the path table */
-	lseek (fd, GUINT16_FROM_LE (bs) * GUINT32_FROM_LE (tl), SEEK_SET);
-
-	/* loop through the path table entriesi */
-	while (pos < GUINT16_FROM_LE (ts))
-	{
+	/* loop through the path table entries */
+	pos = 0;
+	while (pos + 8 <= table_len) {
 		/* get the length of the filename of the current entry */
-		if (read (fd, &len_di, 1) != 1)
-		{
-			HAL_DEBUG(("Advanced probing on %s failed, cannot read more entries", device_file));
-			break;
-		}
+		len_di = table[pos];
 
 		/* get the record number of this entry's parent
 		   i'm pretty sure that the 1st entry is always the top directory */
-		lseek (fd, 5, SEEK_CUR);
-		if (read (fd, &parent, 2) != 2)
-		{
-			HAL_DEBUG(("Advanced probing on %s failed, couldn't read parent entry", device_file));
-			break;
-		}
-		
+		memcpy (&parent, table + pos + 6, 2);
+
 		/* read the name */
-		if (read (fd, dirname, len_di) != len_di)
-		{
-			HAL_DEBUG(("Advanced probing on %s failed, couldn't read the entry name", device_file));
+		if (pos + 8 + len_di > table_len) {
+			HAL_DEBUG(("Advanced probing on %s failed, truncated path table entry", device_file));
 			break;
 		}
+		memcpy (dirname, table + pos + 8, len_di);
 		dirname[len_di] = 0;
 
 		/* strcasecmp is not POSIX or ANSI C unfortunately */
-		i=0;
-		while (dirname[i]!=0)
-		{
-			dirname[i] = (char)toupper (dirname[i]);
-			i++;
-		}
+		for (i = 0; dirname[i] != 0; i++)
+			dirname[i] = (char) toupper (dirname[i]);
 
 		/* if we found a folder that has the root as a parent, and the directory name matches 
 		   one of the special directories then set the properties accordingly */
-		if (GUINT16_FROM_LE (parent) == 1)
-		{
-			if (!strcmp (dirname, "VIDEO_TS"))
-			{
+		if (GUINT16_FROM_LE (parent) == 1) {
+			if (!strcmp (dirname, "VIDEO_TS")) {
 				libhal_changeset_set_property_bool (cs, "volume.disc.is_videodvd", TRUE);
 				HAL_DEBUG(("Disc in %s is a Video DVD", device_file));
 				break;
-			}
-			else if (!strcmp (dirname, "BDMV"))
-			{
+			} else if (!strcmp (dirname, "BDMV")) {
 				libhal_changeset_set_property_bool (cs, "volume.disc.is_blurayvideo", TRUE);
 				HAL_DEBUG(("Disc in %s is a Blu-ray video disc", device_file));
 				break;
-			}
-			else if (!strcmp (dirname, "VCD"))
-			{
+			} else if (!strcmp (dirname, "VCD")) {
 				libhal_changeset_set_property_bool (cs, "volume.disc.is_vcd", TRUE);
 				HAL_DEBUG(("Disc in %s is a Video CD", device_file));
 				break;
-			}
-			else if (!strcmp (dirname, "SVCD"))
-			{
+			} else if (!strcmp (dirname, "SVCD")) {
 				libhal_changeset_set_property_bool (cs, "volume.disc.is_svcd", TRUE);
 				HAL_DEBUG(("Disc in %s is a Super Video CD", device_file));
 				break;
 			}
 		}
 
-		/* all path table entries are padded to be even, 
-		   so if this is an odd-length table, seek a byte to fix it */
-		if (len_di%2 == 1)
-		{
-			lseek (fd, 1, SEEK_CUR);
-			pos++;
-		}
-
-		/* update our position */
-		pos += 8 + len_di;
-		curr_record++;
+		/* all path table entries are padded to be even */
+		pos += 8 + len_di + (len_di % 2);
 	}
 
 out:
-	/* go back to the start of the file */
-	lseek (fd, 0, SEEK_SET);
+	g_free (table);
+}
+
+/* How much to read ahead at the start and end of a volume; covers the
+ * superblocks blkid looks for, including the ISO9660 volume descriptors
+ * at 32k and the RAID signatures in the last 64k */
+#define PROBE_READAHEAD_SIZE (128 * 1024)
+
+/* blkid reads the volume in many small pieces at scattered offsets.
+ * Ask the kernel to read the regions it will look at up front so those
+ * reads are served from the page cache rather than each being a round
+ * trip to the device. This is only a hint; errors are ignored. */
+static void
+prefetch_region (int fd, guint64 offset, guint64 len)
+{
+	int rc;
+
+	rc = posix_fadvise (fd, (off_t) offset, (off_t) len, POSIX_FADV_WILLNEED);
+	if (rc != 0)
+		HAL_DEBUG (("posix_fadvise on %s failed: %s", device_file, strerror (rc)));
 }
 
-static char *device_file;
 
 static void
 handle_sigterm (int value)
@@ -610,6 +608,12 @@ main (int argc, char *argv[])
 			vol_size = 0;
 		}
 
+		/* Optical discs are only read where the TOC says the
+		 * data is; other volumes are read at both ends */
+		prefetch_region (fd, vol_probe_offset, PROBE_READAHEAD_SIZE);
+		if (!is_disc && vol_size > 2 * PROBE_READAHEAD_SIZE)
+			prefetch_region (fd, vol_size - PROBE_READAHEAD_SIZE, PROBE_READAHEAD_SIZE);
+
 		/* probe for file system */
 		pr = blkid_new_probe ();
 		if (pr != NULL) {
@@ -28,6 +28,9 @@
 #  include <config.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,15 +42,88 @@
 
 #include "logger.h"
 
+/* Every message is first put into a ring buffer of fixed size records.
+ * Only the message itself is formatted when logging; the timestamp,
+ * prefix and the actual write to stderr or syslog are done when the
+ * ring is flushed. By default that happens right away, but hald calls
+ * logger_set_async() and then flushes from the main loop when idle, or
+ * when the ring is about to wrap around.
+ *
+ * The ring is not cleared when flushed so the last LOGGER_RING_SIZE
+ * messages are always around to be dumped, e.g. on a crash. There is a
+ * single writer (no thread in hald or the helpers logs); a record is
+ * complete before the head moves past it, so a signal handler reading
+ * the ring never sees a torn record except possibly the one being
+ * written when the signal arrived.
+ */
+
+#define LOGGER_RING_SIZE 256
+#define LOGGER_MSG_MAX   512
+
+typedef struct {
+	struct timeval tv;
+	int priority;
+	const char *file;
+	int line;
+	const char *function;
+	char msg[LOGGER_MSG_MAX];
+} LoggerRecord;
+
+static LoggerRecord ring[LOGGER_RING_SIZE];
+/* total number of records ever written and ever flushed */
+static volatile unsigned long ring_head = 0;
+static unsigned long ring_flushed = 0;
+
+static int is_async = 0;
+static void (*flush_notify) (void) = NULL;
+
+static char dump_path[256];
+
 static int priority;
 static const char *file;
 static int line;
 static const char *function;
 
 static int log_pid  = 0;
-static int is_enabled = 1;
 static int syslog_enabled = 0;
 
+#define LOGGER_ALL_PRIORITIES (HAL_LOGPRI_TRACE | HAL_LOGPRI_DEBUG | HAL_LOGPRI_INFO | \
+			       HAL_LOGPRI_WARNING | HAL_LOGPRI_ERROR)
+
+int logger_priorities = LOGGER_ALL_PRIORITIES;
+
+/* logger_priorities is what gets recorded at all: what is written to
+ * stderr or syslog plus what is only kept in the ring for dumps */
+static int output_priorities = LOGGER_ALL_PRIORITIES;
+static int ring_priorities = 0;
+
+static void
+set_output_priorities (int priorities)
+{
+	output_priorities = priorities;
+	logger_priorities = output_priorities | ring_priorities;
+}
+
+/* HALD_LOG_LEVEL=debug|info|warning|error drops everything less severe */
+static int
+priorities_from_env (void)
+{
+	const char *level;
+
+	level = getenv ("HALD_LOG_LEVEL");
+	if (level == NULL || strcmp (level, "trace") == 0)
+		return LOGGER_ALL_PRIORITIES;
+	else if (strcmp (level, "debug") == 0)
+		return LOGGER_ALL_PRIORITIES & ~HAL_LOGPRI_TRACE;
+	else if (strcmp (level, "info") == 0)
+		return HAL_LOGPRI_INFO | HAL_LOGPRI_WARNING | HAL_LOGPRI_ERROR;
+	else if (strcmp (level, "warning") == 0)
+		return HAL_LOGPRI_WARNING | HAL_LOGPRI_ERROR;
+	else if (strcmp (level, "error") == 0)
+		return HAL_LOGPRI_ERROR;
+	else
+		return LOGGER_ALL_PRIORITIES;
+}
 
 /** 
  * logger_disable:
@@ -58,19 +134,34 @@ static int syslog_enabled = 0;
 void 
 logger_disable (void)
 {
-	is_enabled = 0;
+	set_output_priorities (0);
 }
 
 /** 
  * logger_enable:
  *
- *  Enable all logging
+ *  Enable all logging, or what HALD_LOG_LEVEL asks for
  *
  */
 void 
 logger_enable (void)
 {
-	is_enabled = 1;
+	set_output_priorities (priorities_from_env ());
+}
+
+/**
+ * logger_set_ring_priorities:
+ * @priorities:         Mask of HAL_LOGPRI_* values
+ *
+ * Keep messages of these priorities in the ring even when they are not
+ * written out, so logger_dump() has something to show when hald runs
+ * without --verbose.
+ */
+void
+logger_set_ring_priorities (int priorities)
+{
+	ring_priorities = priorities;
+	logger_priorities = output_priorities | ring_priorities;
 }
 
 /** 
@@ -107,11 +198,11 @@ void
 setup_logger (void)
 {
         if ((getenv ("HALD_VERBOSE")) != NULL) {
-                is_enabled = 1;
+                set_output_priorities (priorities_from_env ());
 		log_pid = 1;
 	}
         else
-                is_enabled = 0;
+                set_output_priorities (0);
 
         if ((getenv ("HALD_USE_SYSLOG")) != NULL)
 		syslog_enabled = 1;
@@ -119,6 +210,109 @@ setup_logger (void)
                 syslog_enabled = 0;
 }
 
+/**
+ * logger_set_async:
+ * @notify:             Called, outside of any signal handler, when the
+ *                      ring goes from flushed to having pending records
+ *
+ * Defer writing out log messages until logger_flush() is called. The
+ * ring is also flushed when full and at exit.
+ */
+void
+logger_set_async (void (*notify) (void))
+{
+	if (!is_async)
+		atexit (logger_flush);
+	is_async = 1;
+	flush_notify = notify;
+}
+
+static const char *
+priority_to_string (int pri)
+{
+	switch (pri) {
+	case HAL_LOGPRI_TRACE:
+		return "[T]";
+	case HAL_LOGPRI_DEBUG:
+		return "[D]";
+	case HAL_LOGPRI_INFO:
+		return "[I]";
+	case HAL_LOGPRI_WARNING:
+		return "[W]";
+	default:		/* explicit fallthrough */
+	case HAL_LOGPRI_ERROR:
+		return "[E]";
+	}
+}
+
+static void
+write_record (LoggerRecord *r)
+{
+	char logmsg[1024];
+	static char tbuf[32];
+	static time_t tbuf_sec = (time_t) -1;
+	static pid_t pid = -1;
+
+	/* TRACE is only kept in the ring, for dumps, as is everything
+	 * recorded just for the ring */
+	if (r->priority == HAL_LOGPRI_TRACE || !(output_priorities & r->priority))
+		return;
+
+	/* most messages share their second with the one before */
+	if (r->tv.tv_sec != tbuf_sec) {
+		struct tm *tlocaltime;
+
+		tbuf_sec = r->tv.tv_sec;
+		tlocaltime = localtime (&tbuf_sec);
+		strftime (tbuf, sizeof (tbuf), "%H:%M:%S", tlocaltime);
+	}
+
+	if (log_pid) {
+        	if ((int) pid == -1)
+                	pid = getpid ();
+		snprintf (logmsg, sizeof(logmsg), "[%d]: %s.%03d %s %s:%d: %s\n", pid, tbuf,
+			  (int)(r->tv.tv_usec/1000), priority_to_string (r->priority), r->file, r->line, r->msg);
+	} else {
+		snprintf (logmsg, sizeof(logmsg), "%s.%03d %s %s:%d: %s\n", tbuf,
+			  (int)(r->tv.tv_usec/1000), priority_to_string (r->priority), r->file, r->line, r->msg);
+	}
+
+	/** @todo Make programmatic interface to logging */
+	if (!syslog_enabled) {
+		fputs (logmsg, stderr);
+	} else {
+		/* use syslog for debug/log messages if HAL started as daemon */
+		switch (r->priority) {
+			case HAL_LOGPRI_DEBUG:
+			case HAL_LOGPRI_INFO:
+				syslog(LOG_INFO, "%s", logmsg );
+				break;
+			case HAL_LOGPRI_WARNING:
+				syslog(LOG_WARNING, "%s", logmsg );
+				break;
+			default:		 /* explicit fallthrough */
+			case HAL_LOGPRI_ERROR:
+				syslog(LOG_ERR, "%s", logmsg );
+				break;
+		}
+	}
+}
+
+/**
+ * logger_flush:
+ *
+ * Write out all log messages not written yet.
+ */
+void
+logger_flush (void)
+{
+	while (ring_flushed < ring_head) {
+		write_record (&ring[ring_flushed % LOGGER_RING_SIZE]);
+		ring_flushed++;
+	}
+	fflush (stderr);
+}
+
 /**  
  *  logger_setup:
  *  @priority:           Logging priority, one of HAL_LOGPRI_*
@@ -148,73 +342,169 @@ void
 logger_emit (const char *format, ...)
 {
 	va_list args;
-	char buf[512];
-	char *pri;
-	char tbuf[256];
-	char logmsg[1024];
-	struct timeval tnow;
-	struct tm *tlocaltime;
-	struct timezone tzone;
-	static pid_t pid = -1;
+	LoggerRecord *r;
+	int was_flushed;
 
-	if (!is_enabled)
+	if (!(logger_priorities & priority))
 		return;
 
+	/* never overwrite what hasn't been written out */
+	if (ring_head - ring_flushed >= LOGGER_RING_SIZE)
+		logger_flush ();
+	was_flushed = (ring_head == ring_flushed);
+
+	r = &ring[ring_head % LOGGER_RING_SIZE];
+	gettimeofday (&r->tv, NULL);
+	r->priority = priority;
+	r->file = file;
+	r->line = line;
+	r->function = function;
+
 	va_start (args, format);
-	vsnprintf (buf, sizeof (buf), format, args);
-
-	switch (priority) {
-		case HAL_LOGPRI_TRACE:
-			pri = "[T]";
-			break;
-		case HAL_LOGPRI_DEBUG:
-			pri = "[D]";
-			break;
-		case HAL_LOGPRI_INFO:
-			pri = "[I]";
-			break;
-		case HAL_LOGPRI_WARNING:
-			pri = "[W]";
-			break;
-		default:		/* explicit fallthrough */
-		case HAL_LOGPRI_ERROR:
-			pri = "[E]";
-			break;
+	vsnprintf (r->msg, sizeof (r->msg), format, args);
+	va_end (args);
+
+	ring_head++;
+
+	/* nothing to write out; don't wake up the main loop for it */
+	if (!(output_priorities & priority)) {
+		if (was_flushed)
+			ring_flushed = ring_head;
+		return;
 	}
 
-	gettimeofday (&tnow, &tzone);
-	tlocaltime = localtime ((time_t *) &tnow.tv_sec);
-	strftime (tbuf, sizeof (tbuf), "%H:%M:%S", tlocaltime);
+	if (!is_async)
+		logger_flush ();
+	else if (was_flushed && flush_notify != NULL)
+		flush_notify ();
+}
 
-	if (log_pid) {
-        	if ((int) pid == -1)
-                	pid = getpid ();
-		snprintf (logmsg, sizeof(logmsg), "[%d]: %s.%03d %s %s:%d: %s\n", pid, tbuf, (int)(tnow.tv_usec/1000), pri, file, line, buf);
-	} else {
-		snprintf (logmsg, sizeof(logmsg), "%s.%03d %s %s:%d: %s\n", tbuf, (int)(tnow.tv_usec/1000), pri, file, line, buf);
+/* async-signal-safe helpers for logger_dump() */
+
+static void
+dump_write (int fd, const char *s)
+{
+	size_t len;
+	ssize_t ret;
+
+	len = strlen (s);
+	while (len > 0) {
+		ret = write (fd, s, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		s += ret;
+		len -= ret;
 	}
-		
-	/** @todo Make programmatic interface to logging */
-	if (priority != HAL_LOGPRI_TRACE && !syslog_enabled ) {
-		fprintf (stderr, "%s", logmsg );
-	} else if (priority != HAL_LOGPRI_TRACE && syslog_enabled ) {   
-		/* use syslog for debug/log messages if HAL started as daemon */
-		switch (priority) {
-			case HAL_LOGPRI_DEBUG:
-			case HAL_LOGPRI_INFO:
-				syslog(LOG_INFO, "%s", logmsg );
-				break;
-			case HAL_LOGPRI_WARNING:
-				syslog(LOG_WARNING, "%s", logmsg );
-				break;
-			default:		 /* explicit fallthrough */
-			case HAL_LOGPRI_ERROR:
-				syslog(LOG_ERR, "%s", logmsg );
-				break;
-		}
+}
+
+static void
+dump_write_ulong (int fd, unsigned long value, int min_digits)
+{
+	char buf[32];
+	int n;
+
+	n = sizeof (buf) - 1;
+	buf[n] = '\0';
+	do {
+		buf[--n] = '0' + (value % 10);
+		value /= 10;
+		min_digits--;
+	} while ((value > 0 || min_digits > 0) && n > 0);
+	dump_write (fd, buf + n);
+}
+
+/**
+ * logger_dump:
+ * @fd:                 File descriptor to write to
+ *
+ * Write the last messages logged, whether they were written out already
+ * or not, including TRACE messages. Only uses async-signal-safe
+ * functions so it can be used from a signal handler.
+ */
+void
+logger_dump (int fd)
+{
+	unsigned long head;
+	unsigned long n;
+
+	head = ring_head;
+	n = head > LOGGER_RING_SIZE ? head - LOGGER_RING_SIZE : 0;
+
+	dump_write (fd, "--- last ");
+	dump_write_ulong (fd, head - n, 0);
+	dump_write (fd, " log messages, oldest first; pid ");
+	dump_write_ulong (fd, (unsigned long) getpid (), 0);
+	dump_write (fd, " ---\n");
+
+	for (; n < head; n++) {
+		LoggerRecord *r = &ring[n % LOGGER_RING_SIZE];
+
+		dump_write_ulong (fd, (unsigned long) r->tv.tv_sec, 0);
+		dump_write (fd, ".");
+		dump_write_ulong (fd, (unsigned long) r->tv.tv_usec, 6);
+		dump_write (fd, " ");
+		dump_write (fd, priority_to_string (r->priority));
+		dump_write (fd, " ");
+		dump_write (fd, r->file != NULL ? r->file : "?");
+		dump_write (fd, ":");
+		dump_write_ulong (fd, (unsigned long) r->line, 0);
+		dump_write (fd, ": ");
+		/* the message is always NUL terminated, possibly truncated */
+		r->msg[LOGGER_MSG_MAX - 1] = '\0';
+		dump_write (fd, r->msg);
+		dump_write (fd, "\n");
 	}
 
-	va_end (args);
+	dump_write (fd, "--- end of log messages ---\n");
+}
+
+static void
+crash_handler (int signum)
+{
+	int fd;
+
+	fd = open (dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd >= 0) {
+		dump_write (fd, "Caught signal ");
+		dump_write_ulong (fd, (unsigned long) signum, 0);
+		dump_write (fd, "\n");
+		logger_dump (fd);
+		close (fd);
+	}
+
+	/* die the way we would have without the handler */
+	signal (signum, SIG_DFL);
+	raise (signum);
+}
+
+/**
+ * logger_dump_on_crash:
+ * @path:               File to write the dump to
+ *
+ * Install handlers for fatal signals (SIGSEGV, SIGBUS, SIGILL, SIGFPE and
+ * SIGABRT) that write the ring to @path using logger_dump() before the
+ * process dies.
+ */
+void
+logger_dump_on_crash (const char *path)
+{
+	struct sigaction sa;
+
+	strncpy (dump_path, path, sizeof (dump_path) - 1);
+	dump_path[sizeof (dump_path) - 1] = '\0';
+
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = crash_handler;
+	sigemptyset (&sa.sa_mask);
+	sa.sa_flags = SA_RESETHAND;
+
+	sigaction (SIGSEGV, &sa, NULL);
+	sigaction (SIGBUS, &sa, NULL);
+	sigaction (SIGILL, &sa, NULL);
+	sigaction (SIGFPE, &sa, NULL);
+	sigaction (SIGABRT, &sa, NULL);
 }
 
 /**
@@ -235,9 +525,12 @@ logger_forward_debug (const char *format, ...)
         struct timezone tzone;
         static pid_t pid = -1;
 
-        if (!is_enabled)
+        if (!output_priorities)
                 return;
 
+	/* keep the forwarded messages in order with our own */
+	logger_flush ();
+
         if ((int) pid == -1)
                 pid = getpid ();
 
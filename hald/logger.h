@@ -42,6 +42,18 @@ enum {
 	HAL_LOGPRI_ERROR = (1 << 4)    /**< error */
 };
 
+/** Priorities below this are compiled out, e.g. -DHAL_LOG_MIN_PRIORITY=HAL_LOGPRI_INFO */
+#ifndef HAL_LOG_MIN_PRIORITY
+#define HAL_LOG_MIN_PRIORITY HAL_LOGPRI_TRACE
+#endif
+
+/** Mask of HAL_LOGPRI_* values currently logged, i.e. written out or
+ *  only kept in the ring for dumps; use HAL_LOG_ENABLED() */
+extern int logger_priorities;
+
+/** Whether a priority is logged; if not, the logging macros don't evaluate their arguments */
+#define HAL_LOG_ENABLED(pri) ((pri) >= HAL_LOG_MIN_PRIORITY && (logger_priorities & (pri)) != 0)
+
 void logger_setup (int priority, const char *file, int line, const char *function);
 
 void logger_emit (const char *format, ...);
@@ -50,30 +62,37 @@ void logger_forward_debug (const char *format, ...);
 
 void logger_enable (void);
 void logger_disable (void);
+void logger_set_ring_priorities (int priorities);
 
 void logger_enable_syslog (void);
 void logger_disable_syslog (void);
 
 void setup_logger (void);
 
+void logger_set_async (void (*flush_notify) (void));
+void logger_flush (void);
+
+void logger_dump (int fd);
+void logger_dump_on_crash (const char *path);
+
 #ifdef __SUNPRO_C
 #define __FUNCTION__ __func__
 #endif
 
 /** Trace logging macro */
-#define HAL_TRACE(expr)   do {logger_setup(HAL_LOGPRI_TRACE,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; } while(0)
+#define HAL_TRACE(expr)   do {if (HAL_LOG_ENABLED (HAL_LOGPRI_TRACE)) {logger_setup(HAL_LOGPRI_TRACE,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; }} while(0)
 
 /** Debug information logging macro */
-#define HAL_DEBUG(expr)   do {logger_setup(HAL_LOGPRI_DEBUG,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; } while(0)
+#define HAL_DEBUG(expr)   do {if (HAL_LOG_ENABLED (HAL_LOGPRI_DEBUG)) {logger_setup(HAL_LOGPRI_DEBUG,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; }} while(0)
 
 /** Information level logging macro */
-#define HAL_INFO(expr)    do {logger_setup(HAL_LOGPRI_INFO,    __FILE__, __LINE__, __FUNCTION__); logger_emit expr; } while(0)
+#define HAL_INFO(expr)    do {if (HAL_LOG_ENABLED (HAL_LOGPRI_INFO)) {logger_setup(HAL_LOGPRI_INFO,    __FILE__, __LINE__, __FUNCTION__); logger_emit expr; }} while(0)
 
 /** Warning level logging macro */
-#define HAL_WARNING(expr) do {logger_setup(HAL_LOGPRI_WARNING, __FILE__, __LINE__, __FUNCTION__); logger_emit expr; } while(0)
+#define HAL_WARNING(expr) do {if (HAL_LOG_ENABLED (HAL_LOGPRI_WARNING)) {logger_setup(HAL_LOGPRI_WARNING, __FILE__, __LINE__, __FUNCTION__); logger_emit expr; }} while(0)
 
 /** Error leve logging macro */
-#define HAL_ERROR(expr)   do {logger_setup(HAL_LOGPRI_ERROR,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; } while(0)
+#define HAL_ERROR(expr)   do {if (HAL_LOG_ENABLED (HAL_LOGPRI_ERROR)) {logger_setup(HAL_LOGPRI_ERROR,   __FILE__, __LINE__, __FUNCTION__); logger_emit expr; }} while(0)
 
 /** Macro for terminating the program on an unrecoverable error */
 #define DIE(expr) do {printf("*** [DIE] %s:%s():%d : ", __FILE__, __FUNCTION__, __LINE__); printf expr; printf("\n"); exit(1); } while(0)
@@ -0,0 +1,284 @@
+/***************************************************************************
+ *
+ * metrics.c : Timings and other statistics for the daemon
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "device.h"
+#include "device_store.h"
+#include "hald.h"
+#include "logger.h"
+
+#include "metrics.h"
+
+/* A metric is either a histogram, fed through hal_metrics_record(), or
+ * a gauge set with hal_metrics_set(). Names say what is measured and,
+ * for times, end in _us as all times are in microseconds, e.g.
+ * "hotplug.wait_us" or "runner.run.hald-probe-storage_us".
+ *
+ * A histogram is reported as <name>.count, .sum, .max and one
+ * <name>.le_N per bucket (values <= N not in a smaller bucket) plus
+ * <name>.inf. Buckets are powers of four which covers both queue depths
+ * and times from a microsecond to a few seconds.
+ */
+
+#define METRICS_NUM_BOUNDS 12
+
+static const guint64 metrics_bounds[METRICS_NUM_BOUNDS] = {
+	1, 4, 16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304
+};
+
+typedef struct {
+	gboolean is_gauge;
+	guint64 count;			/* the value for gauges */
+	guint64 sum;
+	guint64 max;
+	guint64 buckets[METRICS_NUM_BOUNDS + 1];
+} Metric;
+
+#define METRICS_TDL_DATA_KEY "hald-metrics-tdl"
+
+/* Some names contain program or method names; make sure they can't
+ * grow the table without bounds */
+#define METRICS_MAX 512
+
+static GHashTable *metrics = NULL;
+static guint64 num_dropped = 0;
+
+/* returns NULL if the metric is new and the table is full */
+static Metric *
+metric_get (const char *name)
+{
+	Metric *m;
+
+	if (metrics == NULL)
+		metrics = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	m = g_hash_table_lookup (metrics, name);
+	if (m == NULL) {
+		if (g_hash_table_size (metrics) >= METRICS_MAX) {
+			if (num_dropped++ == 0)
+				HAL_WARNING (("More than %d metrics; not recording %s and further new ones",
+					      METRICS_MAX, name));
+			return NULL;
+		}
+		m = g_new0 (Metric, 1);
+		g_hash_table_insert (metrics, g_strdup (name), m);
+	}
+	return m;
+}
+
+/**
+ * hal_metrics_record:
+ * @name:               Name of the histogram
+ * @value:              Value to add
+ *
+ * Add a sample to a histogram, creating it if needed.
+ */
+void
+hal_metrics_record (const char *name, guint64 value)
+{
+	Metric *m;
+	guint n;
+
+	m = metric_get (name);
+	if (m == NULL)
+		return;
+	m->count++;
+	m->sum += value;
+	if (value > m->max)
+		m->max = value;
+
+	for (n = 0; n < METRICS_NUM_BOUNDS && value > metrics_bounds[n]; n++)
+		;
+	m->buckets[n]++;
+}
+
+/**
+ * hal_metrics_elapsed_us:
+ * @start:              When something started
+ *
+ * Returns:             Microseconds since @start
+ */
+guint64
+hal_metrics_elapsed_us (const GTimeVal *start)
+{
+	GTimeVal now;
+	gint64 us;
+
+	g_get_current_time (&now);
+	us = ((gint64) now.tv_sec - start->tv_sec) * G_USEC_PER_SEC + (now.tv_usec - start->tv_usec);
+
+	/* the wall clock may have been set back */
+	return us > 0 ? (guint64) us : 0;
+}
+
+/**
+ * hal_metrics_record_since:
+ * @name:               Name of the histogram
+ * @start:              When the measured thing started
+ *
+ * Add the time since @start, in microseconds, to a histogram.
+ */
+void
+hal_metrics_record_since (const char *name, const GTimeVal *start)
+{
+	hal_metrics_record (name, hal_metrics_elapsed_us (start));
+}
+
+/**
+ * hal_metrics_set:
+ * @name:               Name of the gauge
+ * @value:              Current value
+ *
+ * Set a gauge, creating it if needed.
+ */
+void
+hal_metrics_set (const char *name, guint64 value)
+{
+	Metric *m;
+
+	m = metric_get (name);
+	if (m == NULL)
+		return;
+	m->is_gauge = TRUE;
+	m->count = value;
+}
+
+typedef struct {
+	HalMetricsForeachFunc func;
+	gpointer user_data;
+} ForeachData;
+
+static void
+foreach_metric (gpointer key, gpointer value, gpointer user_data)
+{
+	const char *name = (const char *) key;
+	Metric *m = (Metric *) value;
+	ForeachData *fd = (ForeachData *) user_data;
+	char buf[256];
+	guint n;
+
+	if (m->is_gauge) {
+		fd->func (name, m->count, fd->user_data);
+		return;
+	}
+
+	g_snprintf (buf, sizeof (buf), "%s.count", name);
+	fd->func (buf, m->count, fd->user_data);
+	g_snprintf (buf, sizeof (buf), "%s.sum", name);
+	fd->func (buf, m->sum, fd->user_data);
+	g_snprintf (buf, sizeof (buf), "%s.max", name);
+	fd->func (buf, m->max, fd->user_data);
+
+	for (n = 0; n <= METRICS_NUM_BOUNDS; n++) {
+		if (n < METRICS_NUM_BOUNDS)
+			g_snprintf (buf, sizeof (buf), "%s.le_%" G_GUINT64_FORMAT, name, metrics_bounds[n]);
+		else
+			g_snprintf (buf, sizeof (buf), "%s.inf", name);
+		fd->func (buf, m->buckets[n], fd->user_data);
+	}
+}
+
+/**
+ * hal_metrics_foreach:
+ * @func:               Function to call for each value
+ * @user_data:          User data for @func
+ *
+ * Call @func for every gauge and every value making up a histogram.
+ */
+void
+hal_metrics_foreach (HalMetricsForeachFunc func, gpointer user_data)
+{
+	ForeachData fd;
+
+	if (metrics == NULL)
+		return;
+
+	fd.func = func;
+	fd.user_data = user_data;
+	g_hash_table_foreach (metrics, foreach_metric, &fd);
+
+	if (num_dropped > 0)
+		func ("metrics.dropped", num_dropped, user_data);
+}
+
+/* time a device spends in the TDL, i.e. from being created until
+ * preprobing, probing and callouts are done */
+
+static void
+tdl_store_changed (HalDeviceStore *store, HalDevice *device,
+		   gboolean is_added, gpointer user_data)
+{
+	GTimeVal *added;
+
+	if (!is_added)
+		return;
+
+	added = g_new (GTimeVal, 1);
+	g_get_current_time (added);
+	g_object_set_data_full (G_OBJECT (device), METRICS_TDL_DATA_KEY, added, g_free);
+}
+
+static void
+gdl_store_changed (HalDeviceStore *store, HalDevice *device,
+		   gboolean is_added, gpointer user_data)
+{
+	static guint64 num_devices = 0;
+	GTimeVal *added;
+
+	if (is_added)
+		num_devices++;
+	else if (num_devices > 0)
+		num_devices--;
+	hal_metrics_set ("devices", num_devices);
+
+	if (!is_added)
+		return;
+
+	added = (GTimeVal *) g_object_get_data (G_OBJECT (device), METRICS_TDL_DATA_KEY);
+	if (added == NULL)
+		return;
+
+	hal_metrics_record_since ("device.tdl_us", added);
+	g_object_set_data (G_OBJECT (device), METRICS_TDL_DATA_KEY, NULL);
+}
+
+/**
+ * hal_metrics_init:
+ *
+ * Start collecting the metrics that can be derived from the device
+ * stores. Must be called before devices are probed.
+ */
+void
+hal_metrics_init (void)
+{
+	g_signal_connect (hald_get_tdl (), "store_changed",
+			  G_CALLBACK (tdl_store_changed), NULL);
+	g_signal_connect (hald_get_gdl (), "store_changed",
+			  G_CALLBACK (gdl_store_changed), NULL);
+}
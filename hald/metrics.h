@@ -0,0 +1,42 @@
+/***************************************************************************
+ *
+ * metrics.h : Timings and other statistics for the daemon
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+typedef void (*HalMetricsForeachFunc) (const char *name, guint64 value, gpointer user_data);
+
+void    hal_metrics_init         (void);
+
+void    hal_metrics_record       (const char *name, guint64 value);
+
+void    hal_metrics_record_since (const char *name, const GTimeVal *start);
+
+void    hal_metrics_set          (const char *name, guint64 value);
+
+guint64 hal_metrics_elapsed_us   (const GTimeVal *start);
+
+void    hal_metrics_foreach      (HalMetricsForeachFunc func, gpointer user_data);
+
+#endif /* METRICS_H */
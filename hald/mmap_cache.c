@@ -46,6 +46,7 @@
 #include "hald_runner.h"
 #include "hal-file-monitor.h"
 #include "osspec.h"
+#include "device_snapshot.h"
 
 extern void *rules_ptr;
 static size_t rules_size = 0;
@@ -79,6 +80,9 @@ int di_rules_init (void)
 		DIE (("Couldn't mmap file '%s', errno=%d: %s", cachename, errno, strerror (errno)));
 
 	header = (struct cache_header*) rules_ptr;
+	if (rules_size < sizeof (struct cache_header) || header->magic != HALD_CACHE_MAGIC)
+		DIE (("Cache %s was written by another version of hald-generate-fdi-cache", cachename));
+
 	HAL_INFO(("preprobe: offset=%08lx, size=%d", header->fdi_rules_preprobe,
 		header->fdi_rules_information - header->fdi_rules_preprobe));
 	HAL_INFO(("information: offset=%08lx, size=%d", header->fdi_rules_information,
@@ -214,6 +218,24 @@ dir_mtime (const char *path, time_t *mt, gboolean setup_watches)
 	}
 }
 
+/* whether the cache was written by our hald-generate-fdi-cache */
+static gboolean
+cache_has_our_format (const char *cachename)
+{
+	struct cache_header header;
+	gboolean ret;
+	int fd;
+
+	ret = FALSE;
+	if ((fd = open (cachename, O_RDONLY)) < 0)
+		goto out;
+	if (read (fd, &header, sizeof (header)) == sizeof (header) && header.magic == HALD_CACHE_MAGIC)
+		ret = TRUE;
+	close (fd);
+out:
+	return ret;
+}
+
 gboolean
 di_cache_coherency_check (gboolean setup_watches)
 {
@@ -269,6 +291,10 @@ di_cache_coherency_check (gboolean setup_watches)
 			HAL_INFO(("Cache zero size, so regenerating"));
 			regen_cache();
 			did_regen = TRUE;
+		} else if (!cache_has_our_format (cachename)) {
+			HAL_INFO(("Cache has an old format, so regenerating"));
+			regen_cache();
+			did_regen = TRUE;
 		}
 	} else {
 		regen_cache();
@@ -279,5 +305,9 @@ di_cache_coherency_check (gboolean setup_watches)
 
         cache_valid = TRUE;
 
+	/* devices restored from the snapshot would have the old rules applied */
+	if (did_regen)
+		device_snapshot_invalidate ();
+
 	return did_regen;
 }
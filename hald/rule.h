@@ -100,11 +100,24 @@ struct rule {
 	u_int32_t	value_offset;	/* offset to keys value (aligned to 4 bytes) */
 	size_t		value_len;	/* length of keys value */
 
+	u_int32_t	key_path_offset;	/* offset to the split up key if it is a
+						   udi-property path, 0 otherwise */
+	u_int32_t	value_path_offset;	/* likewise for the value of copy_property */
+
 	size_t		key_len;
 	char		key[0];
 };
 
+/* a udi-property path like '@block.storage_device:storage.bus', split on ':' */
+struct rule_path {
+	u_int32_t	num_hops;	/* number of devices to go through */
+	char		tokens[0];	/* num_hops + 1 strings; a hop is either an udi or
+					   '@' and a property holding one, the last string
+					   is the property name */
+};
+
 struct cache_header {
+	u_int32_t	magic;		/* HALD_CACHE_MAGIC */
 	u_int32_t	fdi_rules_preprobe;
 	u_int32_t	fdi_rules_information;
 	u_int32_t	fdi_rules_policy;
@@ -114,6 +127,9 @@ struct cache_header {
 
 #define HAL_MAX_INDENT_DEPTH		64
 
+/* change the last byte when the layout of the cache changes */
+#define HALD_CACHE_MAGIC		0x68616c02
+
 #define HALD_CACHE_FILE PACKAGE_LOCALSTATEDIR "/cache/hald/fdi-cache"
 
 #endif
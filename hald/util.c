@@ -51,6 +51,7 @@
 #include "hald_runner.h"
 #include "hald_dbus.h"
 #include "device_info.h"
+#include "metrics.h"
 
 #include "util.h"
 
@@ -182,28 +183,219 @@ hal_util_get_normalized_path (const gchar *path1, const gchar *path2)
 	return g_strdup_printf ("%s/%s", buf, p2);
 }
 
+/* Attributes are read through a small cache of open directory file
+ * descriptors; the device add paths read dozens of attributes from the
+ * same sysfs directory, and with openat() + pread() each attribute
+ * costs three syscalls instead of the four to five of fopen(), fgets()
+ * and fclose(). The cache is flushed at the end of every hotplug event
+ * so a stale directory is never consulted for a reused path.
+ */
+#define ATTR_DIR_CACHE_SIZE 8
+
+typedef struct {
+	gchar *directory;
+	int fd;
+} AttrDir;
+
+static AttrDir attr_dir_cache[ATTR_DIR_CACHE_SIZE];	/* most recently used first */
+static guint attr_dir_cache_len = 0;
+static HalUtilAttrStats attr_stats;
+
+#ifdef HAVE_OPENAT
+static int
+attr_dir_get (const gchar *directory)
+{
+	AttrDir entry;
+	guint i;
+
+	for (i = 0; i < attr_dir_cache_len; i++) {
+		if (strcmp (attr_dir_cache[i].directory, directory) == 0) {
+			entry = attr_dir_cache[i];
+			memmove (&attr_dir_cache[1], &attr_dir_cache[0], i * sizeof (AttrDir));
+			attr_dir_cache[0] = entry;
+			attr_stats.num_dir_cache_hits++;
+			return entry.fd;
+		}
+	}
+
+	entry.fd = open (directory, O_RDONLY | O_DIRECTORY);
+	attr_stats.num_syscalls++;
+	if (entry.fd < 0)
+		return -1;
+	fcntl (entry.fd, F_SETFD, FD_CLOEXEC);
+	attr_stats.num_syscalls++;
+	attr_stats.num_dir_opens++;
+	entry.directory = g_strdup (directory);
+
+	if (attr_dir_cache_len == ATTR_DIR_CACHE_SIZE) {
+		attr_dir_cache_len--;
+		close (attr_dir_cache[attr_dir_cache_len].fd);
+		attr_stats.num_syscalls++;
+		g_free (attr_dir_cache[attr_dir_cache_len].directory);
+	}
+	memmove (&attr_dir_cache[1], &attr_dir_cache[0], attr_dir_cache_len * sizeof (AttrDir));
+	attr_dir_cache[0] = entry;
+	attr_dir_cache_len++;
+
+	return entry.fd;
+}
+#endif
+
+/**
+ * hal_util_attr_cache_flush:
+ *
+ * Close all directories cached by hal_util_read_attr(). Called when
+ * the device a cached path refers to may have gone away.
+ */
+void
+hal_util_attr_cache_flush (void)
+{
+	guint i;
+
+	for (i = 0; i < attr_dir_cache_len; i++) {
+		close (attr_dir_cache[i].fd);
+		attr_stats.num_syscalls++;
+		g_free (attr_dir_cache[i].directory);
+	}
+	attr_dir_cache_len = 0;
+}
+
+static gssize
+attr_read_at (int dirfd, const gchar *directory, const gchar *file, gchar *buf, gsize size)
+{
+	int fd;
+	gssize len;
+	gchar *p;
+
+	if (size == 0)
+		return -1;
+
+	attr_stats.num_reads++;
+
+#ifdef HAVE_OPENAT
+	fd = openat (dirfd, file, O_RDONLY);
+#else
+	{
+		gchar path[HAL_PATH_MAX];
+
+		g_snprintf (path, sizeof (path), "%s/%s", directory, file);
+		fd = open (path, O_RDONLY);
+	}
+#endif
+	attr_stats.num_syscalls++;
+	if (fd < 0)
+		return -1;
+
+	len = pread (fd, buf, size - 1, 0);
+	close (fd);
+	attr_stats.num_syscalls += 2;
+	/* like fgets(), an empty file is an error */
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	/* like fgets(), only look at the first line */
+	if ((p = memchr (buf, '\n', len)) != NULL) {
+		*p = '\0';
+		len = p - buf;
+	}
+
+	/* clear remaining whitespace */
+	while (len > 0 && g_ascii_isspace (buf[len - 1]))
+		buf[--len] = '\0';
+
+	return len;
+}
+
+/**
+ * hal_util_read_attr:
+ * @directory:		Directory, e.g. a sysfs device path
+ * @file:		Attribute file, relative to @directory
+ * @buf:		Where to store the contents
+ * @size:		Size of @buf
+ *
+ * Returns:		Length of the first line of the attribute with
+ *			trailing whitespace removed, or -1 on error or
+ *			if the file is empty
+ *
+ * Read an attribute into a caller provided buffer. Unlike
+ * hal_util_get_string_from_file() this is re-entrant.
+ */
+gssize
+hal_util_read_attr (const gchar *directory, const gchar *file, gchar *buf, gsize size)
+{
+	int dirfd;
+
+	dirfd = -1;
+#ifdef HAVE_OPENAT
+	if ((dirfd = attr_dir_get (directory)) < 0)
+		return -1;
+#endif
+	return attr_read_at (dirfd, directory, file, buf, size);
+}
+
+/**
+ * hal_util_read_attrs:
+ * @directory:		Directory, e.g. a sysfs device path
+ * @attrs:		Attributes to read
+ * @num_attrs:		Number of elements in @attrs
+ *
+ * Returns:		Number of attributes successfully read
+ *
+ * Read several attributes from the same directory in one go. For each
+ * element the len member is set as hal_util_read_attr() would return.
+ */
+guint
+hal_util_read_attrs (const gchar *directory, HalUtilAttr *attrs, guint num_attrs)
+{
+	int dirfd;
+	guint i;
+	guint num_read;
+
+	num_read = 0;
+	dirfd = -1;
+#ifdef HAVE_OPENAT
+	dirfd = attr_dir_get (directory);
+#endif
+	for (i = 0; i < num_attrs; i++) {
+#ifdef HAVE_OPENAT
+		if (dirfd < 0) {
+			attrs[i].len = -1;
+			continue;
+		}
+#endif
+		attrs[i].len = attr_read_at (dirfd, directory, attrs[i].file, attrs[i].buf, attrs[i].size);
+		if (attrs[i].len >= 0)
+			num_read++;
+	}
+
+	return num_read;
+}
+
+/**
+ * hal_util_get_attr_stats:
+ * @stats:		Where to store the counters
+ *
+ * Get counters for attribute reads done through hal_util_read_attr()
+ * and the hal_util_*_from_file() helpers built on it.
+ */
+void
+hal_util_get_attr_stats (HalUtilAttrStats *stats)
+{
+	*stats = attr_stats;
+}
+
 gboolean
 hal_util_get_int_from_file (const gchar *directory, const gchar *file, gint *result, gint base)
 {
-	FILE *f;
 	char buf[64];
-	gchar path[HAL_PATH_MAX];
 	gboolean ret;
 	gint _result;
 
-	f = NULL;
 	ret = FALSE;
 
-	g_snprintf (path, sizeof (path), "%s/%s", directory, file);
-
-	f = fopen (path, "rb");
-	if (f == NULL) {
-		//HAL_ERROR (("Cannot open '%s'", path));
-		goto out;
-	}
-
-	if (fgets (buf, sizeof (buf), f) == NULL) {
-		//HAL_ERROR (("Cannot read from '%s'", path));
+	if (hal_util_read_attr (directory, file, buf, sizeof (buf)) < 0) {
+		//HAL_ERROR (("Cannot read from '%s/%s'", directory, file));
 		goto out;
 	}
 
@@ -215,9 +407,6 @@ hal_util_get_int_from_file (const gchar *directory, const gchar *file, gint *res
 	}
 
 out:
-	if (f != NULL)
-		fclose (f);
-
 	return ret;
 }
 
@@ -239,25 +428,14 @@ hal_util_set_int_from_file (HalDevice *d, const gchar *key, const gchar *directo
 gboolean
 hal_util_get_uint64_from_file (const gchar *directory, const gchar *file, guint64 *result, gint base)
 {
-	FILE *f;
 	char buf[64];
-	gchar path[HAL_PATH_MAX];
 	gboolean ret;
 	guint64 _result;
 
-	f = NULL;
 	ret = FALSE;
 
-	g_snprintf (path, sizeof (path), "%s/%s", directory, file);
-
-	f = fopen (path, "rb");
-	if (f == NULL) {
-		//HAL_ERROR (("Cannot open '%s'", path));
-		goto out;
-	}
-
-	if (fgets (buf, sizeof (buf), f) == NULL) {
-		//HAL_ERROR (("Cannot read from '%s'", path));
+	if (hal_util_read_attr (directory, file, buf, sizeof (buf)) < 0) {
+		//HAL_ERROR (("Cannot read from '%s/%s'", directory, file));
 		goto out;
 	}
 
@@ -269,9 +447,6 @@ hal_util_get_uint64_from_file (const gchar *directory, const gchar *file, guint6
 	}
 
 out:
-	if (f != NULL)
-		fclose (f);
-
 	return ret;
 }
 
@@ -289,52 +464,20 @@ hal_util_set_uint64_from_file (HalDevice *d, const gchar *key, const gchar *dire
 	return ret;
 }
 
+/* Note: returns a static buffer; use hal_util_read_attr() where that
+ * is a problem */
 gchar *
 hal_util_get_string_from_file (const gchar *directory, const gchar *file)
 {
-	FILE *f;
 	static gchar buf[256];
-	gchar path[HAL_PATH_MAX];
-	gchar *result;
-	gsize len;
-	gint i;
-	
-	f = NULL;
-	result = NULL;
-
-	g_snprintf (path, sizeof (path), "%s/%s", directory, file);
-
-	f = fopen (path, "rb");
-	if (f == NULL) {
-		//HAL_ERROR (("Cannot open '%s'", path));
-		goto out;
-	}
-
-	buf[0] = '\0';
-	if (fgets (buf, sizeof (buf), f) == NULL) {
-		//HAL_ERROR (("Cannot read from '%s'", path));
-		goto out;
-	}
 
 	/* blank file, no data */
-	len = strlen (buf);
-	if (len == 0)
-		goto out;
-
-	/* clear remaining whitespace */
-	for (i = len - 1; i >= 0; --i) {
-		if (!g_ascii_isspace (buf[i]))
-			break;
-		buf[i] = '\0';
+	if (hal_util_read_attr (directory, file, buf, sizeof (buf)) < 0) {
+		//HAL_ERROR (("Cannot read from '%s/%s'", directory, file));
+		return NULL;
 	}
 
-	result = buf;
-
-out:
-	if (f != NULL)
-		fclose (f);
-
-	return result;
+	return buf;
 }
 
 /* return is success, true_val is the value expected for a true value, e.g. "1" or "True" */
@@ -933,6 +1076,8 @@ typedef struct {
 	gpointer userdata1;
 	gpointer userdata2;
 
+	gchar *metric;
+	GTimeVal started;
 } Callout;
 
 static void callout_do_next (Callout *c);
@@ -964,7 +1109,10 @@ callout_do_next (Callout *c)
 		userdata2 = c->userdata2;
 		callback = c->callback;
 
+		hal_metrics_record_since (c->metric, &c->started);
+
 		g_strfreev (c->programs);
+		g_free (c->metric);
 		g_strfreev (c->extra_env);
 		g_free (c);
 
@@ -985,6 +1133,7 @@ hal_callout_device (HalDevice *d, HalCalloutsDone callback, gpointer userdata1,
 		    char **programs, gchar **extra_env)
 {
 	Callout *c;
+	guint i;
 
 	c = g_new0 (Callout, 1);
 	c->d = d;
@@ -995,6 +1144,18 @@ hal_callout_device (HalDevice *d, HalCalloutsDone callback, gpointer userdata1,
 	c->extra_env = g_strdupv (extra_env);
 	c->next_program = 0;
 
+	/* time callouts by action, e.g. callouts.add_us */
+	c->metric = NULL;
+	for (i = 0; extra_env != NULL && extra_env[i] != NULL; i++) {
+		if (g_str_has_prefix (extra_env[i], "HALD_ACTION=")) {
+			c->metric = g_strdup_printf ("callouts.%s_us", extra_env[i] + strlen ("HALD_ACTION="));
+			break;
+		}
+	}
+	if (c->metric == NULL)
+		c->metric = g_strdup ("callouts.other_us");
+	g_get_current_time (&c->started);
+
 	callout_do_next (c);
 }
 
@@ -48,6 +48,28 @@ gchar *hal_util_get_parent_path (const gchar *path);
 
 gchar *hal_util_get_normalized_path (const gchar *path1, const gchar *path2);
 
+typedef struct {
+	const gchar *file;		/* attribute, relative to the directory */
+	gchar *buf;			/* caller provided buffer */
+	gsize size;			/* size of buf */
+	gssize len;			/* set on return; -1 if not read */
+} HalUtilAttr;
+
+typedef struct {
+	guint64 num_reads;		/* attributes read */
+	guint64 num_dir_opens;		/* directories opened */
+	guint64 num_dir_cache_hits;	/* directory lookups served from the cache */
+	guint64 num_syscalls;		/* open/openat/fcntl/pread/close calls made */
+} HalUtilAttrStats;
+
+gssize hal_util_read_attr (const gchar *directory, const gchar *file, gchar *buf, gsize size);
+
+guint hal_util_read_attrs (const gchar *directory, HalUtilAttr *attrs, guint num_attrs);
+
+void hal_util_attr_cache_flush (void);
+
+void hal_util_get_attr_stats (HalUtilAttrStats *stats);
+
 gboolean hal_util_get_int_from_file (const gchar *directory, const gchar *file, gint *result, gint base);
 
 gboolean hal_util_set_int_from_file (HalDevice *d, const gchar *key, const gchar *directory, const gchar *file, gint base);
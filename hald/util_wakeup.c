@@ -0,0 +1,334 @@
+/***************************************************************************
+ *
+ * util_wakeup.c - Aligned wakeups for things that need to poll. This
+ *                 does not use HalDevice and is suitable for addons.
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "logger.h"
+
+#include "util_wakeup.h"
+
+/* Everything that polls wants to wake up every N seconds. If every
+ * poller arms its own timer the wakeups end up spread all over the
+ * place, and the CPU never gets to stay in a deep sleep state.
+ *
+ * Instead intervals are rounded to power-of-two buckets (..., 250ms,
+ * 500ms, 1s, 2s, 4s, ...) and a bucket fires whenever the wall clock,
+ * counted from the Unix epoch, is a multiple of its interval. As each
+ * bucket is a multiple of the smaller ones, all buckets in all
+ * processes using this (hald and the addons) fire at the same time as
+ * far as possible, and every timer in a bucket is dispatched from a
+ * single wakeup.
+ */
+
+/* smallest bucket we hand out; 1000ms / 2^3 */
+#define WAKEUP_MIN_INTERVAL 125
+
+/* wakeups closer together than this count as one */
+#define WAKEUP_SLACK 10
+
+/* how often to log wakeup statistics, in wakeups */
+#define WAKEUP_LOG_EVERY 256
+
+typedef struct {
+	guint interval;			/* in ms; always a bucket size */
+	GSList *timers;
+	guint source_id;
+	gboolean dispatching;
+} WakeupBucket;
+
+typedef struct {
+	guint id;
+	GSourceFunc func;		/* NULL when removed during dispatch */
+	gpointer data;
+	WakeupBucket *bucket;
+} WakeupTimer;
+
+static GSList *buckets = NULL;
+static GSList *timers = NULL;
+static guint next_id = 1;
+
+static guint64 first_ms = 0;
+static guint64 last_wakeup_ms = 0;
+static guint64 num_wakeups = 0;
+static guint64 num_dispatched = 0;
+
+static guint64
+now_ms (void)
+{
+	GTimeVal tv;
+
+	g_get_current_time (&tv);
+	return ((guint64) tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+/**
+ * hal_wakeup_round_interval:
+ * @interval_ms:	Requested interval in milliseconds
+ *
+ * Returns:		The bucket the interval is put in
+ *
+ * Round an interval to the nearest power-of-two multiple (or fraction)
+ * of a second.
+ */
+guint
+hal_wakeup_round_interval (guint interval_ms)
+{
+	guint bucket;
+
+	if (interval_ms >= 1000) {
+		guint secs;
+
+		secs = (interval_ms + 500) / 1000;
+		for (bucket = 1; bucket * 2 <= secs; bucket *= 2)
+			;
+		/* round to nearest, ties upward */
+		if (secs - bucket >= bucket * 2 - secs)
+			bucket *= 2;
+		return bucket * 1000;
+	}
+
+	for (bucket = 1000; bucket > WAKEUP_MIN_INTERVAL && interval_ms < bucket * 3 / 4; bucket /= 2)
+		;
+	return bucket;
+}
+
+static gboolean bucket_fire (gpointer data);
+
+static void
+bucket_arm (WakeupBucket *bucket, gboolean after_fire)
+{
+	guint delay;
+
+	delay = bucket->interval - (guint) (now_ms () % bucket->interval);
+
+	/* the main loop runs on the monotonic clock; if we were woken
+	 * up a little bit before the boundary don't fire twice */
+	if (after_fire && delay < bucket->interval / 2)
+		delay += bucket->interval;
+
+	bucket->source_id = g_timeout_add (delay, bucket_fire, bucket);
+}
+
+static void
+bucket_free (WakeupBucket *bucket)
+{
+	buckets = g_slist_remove (buckets, bucket);
+	if (bucket->source_id > 0)
+		g_source_remove (bucket->source_id);
+	g_free (bucket);
+}
+
+static void
+count_wakeup (void)
+{
+	guint64 now;
+
+	now = now_ms ();
+	if (num_wakeups == 0 || now - last_wakeup_ms > WAKEUP_SLACK) {
+		num_wakeups++;
+		last_wakeup_ms = now;
+
+		if (num_wakeups % WAKEUP_LOG_EVERY == 0) {
+			HAL_INFO (("%" G_GUINT64_FORMAT " aligned wakeups, %.3f/sec",
+				   num_wakeups, hal_wakeup_get_rate ()));
+		}
+	}
+}
+
+static gboolean
+bucket_fire (gpointer data)
+{
+	WakeupBucket *bucket = (WakeupBucket *) data;
+	GSList *i;
+	GSList *next;
+
+	bucket->source_id = 0;
+	count_wakeup ();
+
+	bucket->dispatching = TRUE;
+	for (i = bucket->timers; i != NULL; i = i->next) {
+		WakeupTimer *timer = (WakeupTimer *) i->data;
+
+		if (timer->func == NULL)
+			continue;
+		num_dispatched++;
+		if (!timer->func (timer->data))
+			timer->func = NULL;
+	}
+	bucket->dispatching = FALSE;
+
+	/* reap timers that are gone */
+	for (i = bucket->timers; i != NULL; i = next) {
+		WakeupTimer *timer = (WakeupTimer *) i->data;
+
+		next = i->next;
+		if (timer->func == NULL) {
+			bucket->timers = g_slist_delete_link (bucket->timers, i);
+			timers = g_slist_remove (timers, timer);
+			g_free (timer);
+		}
+	}
+
+	if (bucket->timers == NULL)
+		bucket_free (bucket);
+	else
+		bucket_arm (bucket, TRUE);
+
+	/* we always rearm explicitly to stay on the boundary */
+	return FALSE;
+}
+
+/**
+ * hal_wakeup_add:
+ * @interval_ms:	Requested interval in milliseconds
+ * @func:		Function to call; return FALSE to stop
+ * @data:		User data for @func
+ *
+ * Returns:		Identifier to pass to hal_wakeup_remove()
+ *
+ * Like g_timeout_add() except that @interval_ms is rounded to a
+ * power-of-two bucket and @func is called aligned with all other
+ * timers in the same or a larger bucket.
+ */
+guint
+hal_wakeup_add (guint interval_ms, GSourceFunc func, gpointer data)
+{
+	WakeupBucket *bucket;
+	WakeupTimer *timer;
+	guint interval;
+	GSList *i;
+
+	interval = hal_wakeup_round_interval (interval_ms);
+
+	bucket = NULL;
+	for (i = buckets; i != NULL; i = i->next) {
+		if (((WakeupBucket *) i->data)->interval == interval) {
+			bucket = (WakeupBucket *) i->data;
+			break;
+		}
+	}
+	if (bucket == NULL) {
+		bucket = g_new0 (WakeupBucket, 1);
+		bucket->interval = interval;
+		buckets = g_slist_prepend (buckets, bucket);
+		bucket_arm (bucket, FALSE);
+	}
+
+	timer = g_new0 (WakeupTimer, 1);
+	timer->id = next_id++;
+	timer->func = func;
+	timer->data = data;
+	timer->bucket = bucket;
+
+	bucket->timers = g_slist_append (bucket->timers, timer);
+	timers = g_slist_prepend (timers, timer);
+
+	if (first_ms == 0)
+		first_ms = now_ms ();
+
+	HAL_DEBUG (("Added wakeup %u: %ums rounded to %ums", timer->id, interval_ms, interval));
+
+	return timer->id;
+}
+
+/**
+ * hal_wakeup_remove:
+ * @id:			Identifier returned by hal_wakeup_add()
+ *
+ * Returns:		TRUE if the timer was found
+ *
+ * Stop calling a timer added with hal_wakeup_add().
+ */
+gboolean
+hal_wakeup_remove (guint id)
+{
+	WakeupTimer *timer;
+	WakeupBucket *bucket;
+	GSList *i;
+
+	timer = NULL;
+	for (i = timers; i != NULL; i = i->next) {
+		if (((WakeupTimer *) i->data)->id == id) {
+			timer = (WakeupTimer *) i->data;
+			break;
+		}
+	}
+	if (timer == NULL || timer->func == NULL)
+		return FALSE;
+
+	bucket = timer->bucket;
+	if (bucket->dispatching) {
+		/* reaped by bucket_fire() */
+		timer->func = NULL;
+		return TRUE;
+	}
+
+	bucket->timers = g_slist_remove (bucket->timers, timer);
+	timers = g_slist_remove (timers, timer);
+	g_free (timer);
+
+	if (bucket->timers == NULL)
+		bucket_free (bucket);
+
+	return TRUE;
+}
+
+/**
+ * hal_wakeup_get_stats:
+ * @stats:		Where to store the statistics
+ *
+ * Get wakeup counters for this process.
+ */
+void
+hal_wakeup_get_stats (HalWakeupStats *stats)
+{
+	stats->num_wakeups = num_wakeups;
+	stats->num_dispatched = num_dispatched;
+	stats->elapsed_ms = first_ms != 0 ? now_ms () - first_ms : 0;
+	stats->num_timers = g_slist_length (timers);
+	stats->num_buckets = g_slist_length (buckets);
+}
+
+/**
+ * hal_wakeup_get_rate:
+ *
+ * Returns:		Average number of aligned wakeups per second
+ */
+gdouble
+hal_wakeup_get_rate (void)
+{
+	guint64 elapsed;
+
+	if (first_ms == 0)
+		return 0.0;
+
+	elapsed = now_ms () - first_ms;
+	if (elapsed == 0)
+		return 0.0;
+
+	return ((gdouble) num_wakeups) * 1000.0 / ((gdouble) elapsed);
+}
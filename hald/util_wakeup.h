@@ -0,0 +1,46 @@
+/***************************************************************************
+ *
+ * util_wakeup.h - Aligned wakeups for things that need to poll
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef UTIL_WAKEUP_H
+#define UTIL_WAKEUP_H
+
+#include <glib.h>
+
+typedef struct {
+	guint64 num_wakeups;		/* distinct times the process was woken up */
+	guint64 num_dispatched;		/* number of callbacks run */
+	guint64 elapsed_ms;		/* time since the first timer was added */
+	guint num_timers;
+	guint num_buckets;
+} HalWakeupStats;
+
+guint hal_wakeup_round_interval (guint interval_ms);
+
+guint hal_wakeup_add (guint interval_ms, GSourceFunc func, gpointer data);
+
+gboolean hal_wakeup_remove (guint id);
+
+void hal_wakeup_get_stats (HalWakeupStats *stats);
+
+gdouble hal_wakeup_get_rate (void);
+
+#endif /* UTIL_WAKEUP_H */
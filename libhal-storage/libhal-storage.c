@@ -29,6 +29,7 @@
 #  include <config.h>
 #endif
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -731,6 +732,8 @@ struct LibHalDrive_s {
 	char **capabilities;
 
 	char mount_options[MOUNT_OPTIONS_SIZE];
+
+	char *bus_textual;	/* only used while the drive is built */
 };
 
 struct LibHalVolume_s {
@@ -788,6 +791,9 @@ struct LibHalVolume_s {
 
 	dbus_uint64_t partition_start_offset;
 	dbus_uint64_t partition_media_size;
+
+	char *disc_type_textual;	/* only used while the volume is built */
+	char *fsusage_textual;
 };
 
 const char *
@@ -889,128 +895,230 @@ out:
 	return res;
 }
 
-/* ok, hey, so this is a bit ugly */
+/* Which property goes into which field. Rather than comparing every
+ * property hald returns against every key we want, each key is looked
+ * up in the property set, which is already hashed by name.
+ */
 
-#define LIBHAL_PROP_EXTRACT_BEGIN if (FALSE)
-#define LIBHAL_PROP_EXTRACT_END ;
-#define LIBHAL_PROP_EXTRACT_INT(_property_, _where_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_INT32) _where_ = libhal_psi_get_int (&it)
-#define LIBHAL_PROP_EXTRACT_UINT64(_property_, _where_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_UINT64) _where_ = libhal_psi_get_uint64 (&it)
-#define LIBHAL_PROP_EXTRACT_STRING(_property_, _where_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_STRING) _where_ = (libhal_psi_get_string (&it) != NULL && strlen (libhal_psi_get_string (&it)) > 0) ? strdup (libhal_psi_get_string (&it)) : NULL
-#define LIBHAL_PROP_EXTRACT_BOOL(_property_, _where_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_BOOLEAN) _where_ = libhal_psi_get_bool (&it)
-#define LIBHAL_PROP_EXTRACT_BOOL_BITFIELD(_property_, _where_, _field_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_BOOLEAN) _where_ |= libhal_psi_get_bool (&it) ? _field_ : 0
-#define LIBHAL_PROP_EXTRACT_STRLIST(_property_, _where_) else if (strcmp (key, _property_) == 0 && type == LIBHAL_PROPERTY_TYPE_STRLIST) _where_ = my_strvdup (libhal_psi_get_strlist (&it))
+typedef enum {
+	PROP_EXTRACT_INT,
+	PROP_EXTRACT_UINT64,
+	PROP_EXTRACT_STRING,	/* NULL if missing or "" */
+	PROP_EXTRACT_BOOL,
+	PROP_EXTRACT_BOOL_BITFIELD,
+	PROP_EXTRACT_STRLIST
+} PropExtractKind;
+
+typedef struct {
+	const char *key;
+	PropExtractKind kind;
+	size_t offset;
+	unsigned int bit;	/* for PROP_EXTRACT_BOOL_BITFIELD */
+} PropExtract;
+
+#define DRIVE_PROP(_property_, _kind_, _field_) \
+	{_property_, PROP_EXTRACT_##_kind_, offsetof (LibHalDrive, _field_), 0}
+#define DRIVE_PROP_CDROM_CAP(_property_, _bit_) \
+	{_property_, PROP_EXTRACT_BOOL_BITFIELD, offsetof (LibHalDrive, cdrom_caps), _bit_}
+#define VOLUME_PROP(_property_, _kind_, _field_) \
+	{_property_, PROP_EXTRACT_##_kind_, offsetof (LibHalVolume, _field_), 0}
+
+static const PropExtract drive_properties[] = {
+	DRIVE_PROP ("block.minor",                         INT,     device_minor),
+	DRIVE_PROP ("block.major",                         INT,     device_major),
+	DRIVE_PROP ("block.device",                        STRING,  device_file),
+	DRIVE_PROP ("storage.bus",                         STRING,  bus_textual),
+	DRIVE_PROP ("storage.vendor",                      STRING,  vendor),
+	DRIVE_PROP ("storage.model",                       STRING,  model),
+	DRIVE_PROP ("storage.drive_type",                  STRING,  type_textual),
+	DRIVE_PROP ("storage.size",                        UINT64,  drive_size),
+
+	DRIVE_PROP ("storage.icon.drive",                  STRING,  dedicated_icon_drive),
+	DRIVE_PROP ("storage.icon.volume",                 STRING,  dedicated_icon_volume),
+
+	DRIVE_PROP ("storage.hotpluggable",                BOOL,    is_hotpluggable),
+	DRIVE_PROP ("storage.removable",                   BOOL,    is_removable),
+	DRIVE_PROP ("storage.removable.media_available",   BOOL,    is_media_detected),
+	DRIVE_PROP ("storage.media_check_enabled",         BOOL,    is_media_detection_automatic),
+	DRIVE_PROP ("storage.removable.media_size",        UINT64,  drive_media_size),
+	DRIVE_PROP ("storage.requires_eject",              BOOL,    requires_eject),
+
+	DRIVE_PROP ("storage.partitioning_scheme",         STRING,  partition_scheme),
+
+	DRIVE_PROP ("storage.originating_device",          STRING,  physical_device),
+	DRIVE_PROP ("storage.firmware_version",            STRING,  firmware_version),
+	DRIVE_PROP ("storage.serial",                      STRING,  serial),
+
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.cdr",         LIBHAL_DRIVE_CDROM_CAPS_CDR),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.cdrw",        LIBHAL_DRIVE_CDROM_CAPS_CDRW),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvd",         LIBHAL_DRIVE_CDROM_CAPS_DVDROM),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdplusr",    LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSR),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdplusrw",   LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRW),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdplusrwdl", LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRWDL),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdplusrdl",  LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRDL),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdr",        LIBHAL_DRIVE_CDROM_CAPS_DVDR),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdrw",       LIBHAL_DRIVE_CDROM_CAPS_DVDRW),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.dvdram",      LIBHAL_DRIVE_CDROM_CAPS_DVDRAM),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.bd",          LIBHAL_DRIVE_CDROM_CAPS_BDROM),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.bdr",         LIBHAL_DRIVE_CDROM_CAPS_BDR),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.bdre",        LIBHAL_DRIVE_CDROM_CAPS_BDRE),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.hddvd",       LIBHAL_DRIVE_CDROM_CAPS_HDDVDROM),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.hddvdr",      LIBHAL_DRIVE_CDROM_CAPS_HDDVDR),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.hddvdrw",     LIBHAL_DRIVE_CDROM_CAPS_HDDVDRW),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.mo",          LIBHAL_DRIVE_CDROM_CAPS_MO),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.mrw",         LIBHAL_DRIVE_CDROM_CAPS_MRW),
+	DRIVE_PROP_CDROM_CAP ("storage.cdrom.mrw_w",       LIBHAL_DRIVE_CDROM_CAPS_MRWW),
+
+	DRIVE_PROP ("storage.policy.should_mount",         BOOL,    should_mount),
+	DRIVE_PROP ("storage.policy.desired_mount_point",  STRING,  desired_mount_point),
+	DRIVE_PROP ("storage.policy.mount_filesystem",     STRING,  mount_filesystem),
+
+	DRIVE_PROP ("storage.no_partitions_hint",          BOOL,    no_partitions_hint),
+
+	DRIVE_PROP ("info.capabilities",                   STRLIST, capabilities)
+};
 
-/**  
- *  libhal_drive_from_udi:
- *  @hal_ctx:             libhal context
- *  @udi:                 HAL UDI
- *
- *  Returns:              LibHalDrive object or NULL if UDI is invalid
- *
- *  Given a UDI for a HAL device of capability 'storage', this
- *  function retrieves all the relevant properties into convenient
- *  in-process data structures.
- */
-LibHalDrive *
-libhal_drive_from_udi (LibHalContext *hal_ctx, const char *udi)
-{	
-	char *bus_textual;
-	LibHalDrive *drive;
-	LibHalPropertySet *properties;
-	LibHalPropertySetIterator it;
-	DBusError error;
+static const PropExtract volume_properties[] = {
+	VOLUME_PROP ("volume.is_partition",                     BOOL,    is_partition),
+	VOLUME_PROP ("volume.partition.number",                 INT,     partition_number),
+	VOLUME_PROP ("volume.partition.scheme",                 STRING,  partition_scheme),
+	VOLUME_PROP ("volume.partition.type",                   STRING,  partition_type),
+	VOLUME_PROP ("volume.partition.label",                  STRING,  partition_label),
+	VOLUME_PROP ("volume.partition.uuid",                   STRING,  partition_uuid),
+	VOLUME_PROP ("volume.partition.flags",                  STRLIST, partition_flags),
+
+	VOLUME_PROP ("volume.partition.start",                  UINT64,  partition_start_offset),
+	VOLUME_PROP ("volume.partition.media_size",             UINT64,  partition_media_size),
+	VOLUME_PROP ("volume.partition.msdos_part_table_type",  INT,     msdos_part_table_type),
+	VOLUME_PROP ("volume.partition.msdos_part_table_start", UINT64,  msdos_part_table_start),
+	VOLUME_PROP ("volume.partition.msdos_part_table_size",  UINT64,  msdos_part_table_size),
+
+	VOLUME_PROP ("block.minor",                             INT,     device_minor),
+	VOLUME_PROP ("block.major",                             INT,     device_major),
+	VOLUME_PROP ("block.device",                            STRING,  device_file),
+
+	VOLUME_PROP ("block.storage_device",                    STRING,  storage_device),
+
+	VOLUME_PROP ("volume.crypto_luks.clear.backing_volume", STRING,  crypto_backing_volume),
+
+	VOLUME_PROP ("volume.block_size",                       INT,     block_size),
+	VOLUME_PROP ("volume.num_blocks",                       UINT64,  num_blocks),
+	VOLUME_PROP ("volume.size",                             UINT64,  volume_size),
+	VOLUME_PROP ("volume.label",                            STRING,  volume_label),
+	VOLUME_PROP ("volume.mount_point",                      STRING,  mount_point),
+	VOLUME_PROP ("volume.fstype",                           STRING,  fstype),
+	VOLUME_PROP ("volume.fsversion",                        STRING,  fsversion),
+	VOLUME_PROP ("volume.is_mounted",                       BOOL,    is_mounted),
+	VOLUME_PROP ("volume.is_mounted_read_only",             BOOL,    is_mounted_read_only),
+	VOLUME_PROP ("volume.fsusage",                          STRING,  fsusage_textual),
+	VOLUME_PROP ("volume.uuid",                             STRING,  uuid),
+
+	VOLUME_PROP ("volume.ignore",                           BOOL,    ignore_volume),
+
+	VOLUME_PROP ("volume.is_disc",                          BOOL,    is_disc),
+	VOLUME_PROP ("volume.disc.type",                        STRING,  disc_type_textual),
+	VOLUME_PROP ("volume.disc.has_audio",                   BOOL,    disc_has_audio),
+	VOLUME_PROP ("volume.disc.has_data",                    BOOL,    disc_has_data),
+	VOLUME_PROP ("volume.disc.is_appendable",               BOOL,    disc_is_appendable),
+	VOLUME_PROP ("volume.disc.is_blank",                    BOOL,    disc_is_blank),
+	VOLUME_PROP ("volume.disc.is_rewritable",               BOOL,    disc_is_rewritable),
+	VOLUME_PROP ("volume.disc.capacity",                    UINT64,  disc_capacity),
+
+	VOLUME_PROP ("volume.policy.should_mount",              BOOL,    should_mount),
+	VOLUME_PROP ("volume.policy.desired_mount_point",       STRING,  desired_mount_point),
+	VOLUME_PROP ("volume.policy.mount_filesystem",          STRING,  mount_filesystem)
+};
+
+static void
+extract_properties (void *object, const PropExtract *table, unsigned int num_entries,
+		    const LibHalPropertySet *properties)
+{
 	unsigned int i;
 
-	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
+	for (i = 0; i < num_entries; i++) {
+		const PropExtract *p = &table[i];
+		char *where = (char *) object + p->offset;
+		const char *str;
+		const char * const *strlist;
 
-	drive = NULL;
-	properties = NULL;
-	bus_textual = NULL;
+		switch (libhal_ps_get_type (properties, p->key)) {
+		case LIBHAL_PROPERTY_TYPE_INT32:
+			if (p->kind == PROP_EXTRACT_INT)
+				*(int *) where = libhal_ps_get_int32 (properties, p->key);
+			break;
+		case LIBHAL_PROPERTY_TYPE_UINT64:
+			if (p->kind == PROP_EXTRACT_UINT64)
+				*(dbus_uint64_t *) where = libhal_ps_get_uint64 (properties, p->key);
+			break;
+		case LIBHAL_PROPERTY_TYPE_STRING:
+			if (p->kind == PROP_EXTRACT_STRING) {
+				str = libhal_ps_get_string (properties, p->key);
+				*(char **) where = (str != NULL && str[0] != '\0') ? strdup (str) : NULL;
+			}
+			break;
+		case LIBHAL_PROPERTY_TYPE_BOOLEAN:
+			if (p->kind == PROP_EXTRACT_BOOL)
+				*(dbus_bool_t *) where = libhal_ps_get_bool (properties, p->key);
+			else if (p->kind == PROP_EXTRACT_BOOL_BITFIELD && libhal_ps_get_bool (properties, p->key))
+				*(unsigned int *) where |= p->bit;
+			break;
+		case LIBHAL_PROPERTY_TYPE_STRLIST:
+			if (p->kind == PROP_EXTRACT_STRLIST) {
+				strlist = libhal_ps_get_strlist (properties, p->key);
+				*(char ***) where = my_strvdup ((char **) strlist);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
 
-	dbus_error_init (&error);
-	if (!libhal_device_query_capability (hal_ctx, udi, "storage", &error))
-		goto error;
+static dbus_bool_t
+property_set_has_capability (const LibHalPropertySet *properties, const char *capability)
+{
+	const char * const *caps;
+	unsigned int i;
+
+	caps = libhal_ps_get_strlist (properties, "info.capabilities");
+	if (caps == NULL)
+		return FALSE;
+
+	for (i = 0; caps[i] != NULL; i++) {
+		if (strcmp (caps[i], capability) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Build a drive from the properties hald returned for it */
+static LibHalDrive *
+drive_from_property_set (LibHalContext *hal_ctx, const char *udi, const LibHalPropertySet *properties)
+{
+	LibHalDrive *drive;
+	unsigned int i;
+
+	if (!property_set_has_capability (properties, "storage"))
+		return NULL;
 
 	drive = malloc (sizeof (LibHalDrive));
 	if (drive == NULL)
-		goto error;
+		return NULL;
 	memset (drive, 0x00, sizeof (LibHalDrive));
 
 	drive->hal_ctx = hal_ctx;
 
 	drive->udi = strdup (udi);
-	if (drive->udi == NULL)
-		goto error;
-
-	properties = libhal_device_get_all_properties (hal_ctx, udi, &error);
-	if (properties == NULL)
-		goto error;
+	if (drive->udi == NULL) {
+		free (drive);
+		return NULL;
+	}
 
 	/* we can count on hal to give us all these properties */
-	for (libhal_psi_init (&it, properties); libhal_psi_has_more (&it); libhal_psi_next (&it)) {
-		int type;
-		char *key;
-		
-		type = libhal_psi_get_type (&it);
-		key = libhal_psi_get_key (&it);
-
-		LIBHAL_PROP_EXTRACT_BEGIN;
-
-		LIBHAL_PROP_EXTRACT_INT    ("block.minor",               drive->device_minor);
-		LIBHAL_PROP_EXTRACT_INT    ("block.major",               drive->device_major);
-		LIBHAL_PROP_EXTRACT_STRING ("block.device",              drive->device_file);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.bus",               bus_textual);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.vendor",            drive->vendor);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.model",             drive->model);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.drive_type",        drive->type_textual);
-		LIBHAL_PROP_EXTRACT_UINT64 ("storage.size", 		 drive->drive_size); 
-
-		LIBHAL_PROP_EXTRACT_STRING ("storage.icon.drive",        drive->dedicated_icon_drive);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.icon.volume",       drive->dedicated_icon_volume);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.hotpluggable",      drive->is_hotpluggable);
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.removable",         drive->is_removable);
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.removable.media_available", drive->is_media_detected);
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.media_check_enabled", drive->is_media_detection_automatic);
-		LIBHAL_PROP_EXTRACT_UINT64 ("storage.removable.media_size", drive->drive_media_size); 
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.requires_eject",    drive->requires_eject);
-
-		LIBHAL_PROP_EXTRACT_STRING ("storage.partitioning_scheme", drive->partition_scheme); 
-
-		LIBHAL_PROP_EXTRACT_STRING ("storage.originating_device",   drive->physical_device);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.firmware_version",  drive->firmware_version);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.serial",            drive->serial);
-
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.cdr", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_CDR);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.cdrw", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_CDRW);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvd", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDROM);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdplusr", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSR);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdplusrw", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRW);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdplusrwdl", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRWDL);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdplusrdl", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDPLUSRDL);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdr", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDR);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdrw", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDRW);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.dvdram", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_DVDRAM);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.bd", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_BDROM);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.bdr", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_BDR);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.bdre", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_BDRE);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.hddvd", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_HDDVDROM);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.hddvdr", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_HDDVDR);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.hddvdrw", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_HDDVDRW);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.mo", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_MO);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.mrw", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_MRW);
-		LIBHAL_PROP_EXTRACT_BOOL_BITFIELD ("storage.cdrom.mrw_w", drive->cdrom_caps, LIBHAL_DRIVE_CDROM_CAPS_MRWW);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.policy.should_mount",        drive->should_mount);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.policy.desired_mount_point", drive->desired_mount_point);
-		LIBHAL_PROP_EXTRACT_STRING ("storage.policy.mount_filesystem",    drive->mount_filesystem);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("storage.no_partitions_hint",        drive->no_partitions_hint);
-
-		LIBHAL_PROP_EXTRACT_STRLIST ("info.capabilities",                drive->capabilities);
-
-		LIBHAL_PROP_EXTRACT_END;
-	}
+	extract_properties (drive, drive_properties,
+			    sizeof (drive_properties) / sizeof (drive_properties[0]),
+			    properties);
 
 	if (drive->type_textual != NULL) {
 		if (strcmp (drive->type_textual, "cdrom") == 0) {
@@ -1059,31 +1167,160 @@ libhal_drive_from_udi (LibHalContext *hal_ctx, const char *udi)
 		}
 	}
 
-	if (bus_textual != NULL) {
-		if (strcmp (bus_textual, "usb") == 0) {
+	if (drive->bus_textual != NULL) {
+		if (strcmp (drive->bus_textual, "usb") == 0) {
 			drive->bus = LIBHAL_DRIVE_BUS_USB;
-		} else if (strcmp (bus_textual, "ieee1394") == 0) {
+		} else if (strcmp (drive->bus_textual, "ieee1394") == 0) {
 			drive->bus = LIBHAL_DRIVE_BUS_IEEE1394;
-		} else if (strcmp (bus_textual, "ide") == 0) {
+		} else if (strcmp (drive->bus_textual, "ide") == 0) {
 			drive->bus = LIBHAL_DRIVE_BUS_IDE;
-		} else if (strcmp (bus_textual, "scsi") == 0) {
+		} else if (strcmp (drive->bus_textual, "scsi") == 0) {
 			drive->bus = LIBHAL_DRIVE_BUS_SCSI;
-		} else if (strcmp (bus_textual, "ccw") == 0) {
+		} else if (strcmp (drive->bus_textual, "ccw") == 0) {
 			drive->bus = LIBHAL_DRIVE_BUS_CCW;
 		}
 	}
 
-	libhal_free_string (bus_textual);
-	libhal_free_property_set (properties);
+	libhal_free_string (drive->bus_textual);
+	drive->bus_textual = NULL;
 
 	return drive;
+}
+
+/**  
+ *  libhal_drive_from_udi:
+ *  @hal_ctx:             libhal context
+ *  @udi:                 HAL UDI
+ *
+ *  Returns:              LibHalDrive object or NULL if UDI is invalid
+ *
+ *  Given a UDI for a HAL device of capability 'storage', this
+ *  function retrieves all the relevant properties into convenient
+ *  in-process data structures.
+ */
+LibHalDrive *
+libhal_drive_from_udi (LibHalContext *hal_ctx, const char *udi)
+{	
+	LibHalDrive *drive;
+	LibHalPropertySet *properties;
+	DBusError error;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
+
+	dbus_error_init (&error);
+	properties = libhal_device_get_all_properties (hal_ctx, udi, &error);
+	if (properties == NULL) {
+		LIBHAL_FREE_DBUS_ERROR(&error);
+		return NULL;
+	}
+
+	drive = drive_from_property_set (hal_ctx, udi, properties);
 
-error:
-	LIBHAL_FREE_DBUS_ERROR(&error);
-	libhal_free_string (bus_textual);
 	libhal_free_property_set (properties);
-	libhal_drive_free (drive);
-	return NULL;
+	return drive;
+}
+
+/* Fetch the properties of all devices with the given capability with
+ * two calls to hald, however many devices there are */
+static dbus_bool_t
+get_properties_by_capability (LibHalContext *hal_ctx, const char *capability, const char **keys,
+			      int *num_devices, char ***udis, LibHalPropertySet ***properties,
+			      DBusError *error)
+{
+	char **cap_udis;
+	int num_cap_udis;
+
+	*num_devices = 0;
+	*udis = NULL;
+	*properties = NULL;
+
+	cap_udis = libhal_find_device_by_capability (hal_ctx, capability, &num_cap_udis, error);
+	if (cap_udis == NULL)
+		return FALSE;
+
+	/* no UDIs would mean all devices to GetProperties */
+	if (num_cap_udis == 0) {
+		libhal_free_string_array (cap_udis);
+		*udis = calloc (1, sizeof (char *));
+		*properties = calloc (1, sizeof (LibHalPropertySet *));
+		if (*udis == NULL || *properties == NULL) {
+			free (*udis);
+			free (*properties);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	if (!libhal_get_properties (hal_ctx, (const char **) cap_udis, keys,
+				    num_devices, udis, properties, error)) {
+		libhal_free_string_array (cap_udis);
+		return FALSE;
+	}
+
+	libhal_free_string_array (cap_udis);
+	return TRUE;
+}
+
+static void
+free_properties (char **udis, LibHalPropertySet **properties)
+{
+	unsigned int i;
+
+	for (i = 0; properties[i] != NULL; i++)
+		libhal_free_property_set (properties[i]);
+	free (properties);
+	libhal_free_string_array (udis);
+}
+
+/**  
+ *  libhal_drive_enumerate_all:
+ *  @hal_ctx:             libhal context
+ *  @num_drives:          Return location for number of drives
+ *  @error:               pointer to an initialized dbus error object for returning errors or NULL
+ *
+ *  Returns:              NULL terminated array of LibHalDrive objects or NULL on error
+ *
+ *  Get all drives at once. This is the same as calling
+ *  libhal_drive_from_udi() for every device of capability 'storage'
+ *  but takes two calls to hald instead of two per drive. Free each
+ *  drive with libhal_drive_free() and the array with free().
+ */
+LibHalDrive **
+libhal_drive_enumerate_all (LibHalContext *hal_ctx, int *num_drives, DBusError *error)
+{
+	static const char *keys[] = {"block.*", "storage.*", "info.capabilities", NULL};
+	LibHalDrive **drives;
+	LibHalPropertySet **properties;
+	char **udis;
+	int num_devices;
+	int i;
+	int n;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
+
+	*num_drives = 0;
+
+	if (!get_properties_by_capability (hal_ctx, "storage", keys,
+					   &num_devices, &udis, &properties, error))
+		return NULL;
+
+	drives = calloc (num_devices + 1, sizeof (LibHalDrive *));
+	if (drives == NULL) {
+		free_properties (udis, properties);
+		return NULL;
+	}
+
+	for (i = 0, n = 0; i < num_devices; i++) {
+		drives[n] = drive_from_property_set (hal_ctx, udis[i], properties[i]);
+		if (drives[n] != NULL)
+			n++;
+	}
+	drives[n] = NULL;
+
+	free_properties (udis, properties);
+
+	*num_drives = n;
+	return drives;
 }
 
 const char *
@@ -1103,110 +1340,37 @@ libhal_drive_requires_eject (LibHalDrive *drive)
 	return drive->requires_eject;
 }
 
-/**  
- *  libhal_volume_from_udi:
- *  @hal_ctx:            libhal context
- *  @udi:                HAL UDI
- *
- *  Returns:             LibHalVolume object or NULL if UDI is invalid
- *
- *  Given a UDI for a LIBHAL device of capability 'volume', this
- *  function retrieves all the relevant properties into convenient
- *  in-process data structures.
- */
-LibHalVolume *
-libhal_volume_from_udi (LibHalContext *hal_ctx, const char *udi)
+/* Build a volume from the properties hald returned for it */
+static LibHalVolume *
+volume_from_property_set (const char *udi, const LibHalPropertySet *properties)
 {
+	LibHalVolume *vol;
 	char *disc_type_textual;
 	char *vol_fsusage_textual;
-	LibHalVolume *vol;
-	LibHalPropertySet *properties;
-	LibHalPropertySetIterator it;
-	DBusError error;
-
-	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
-
-	vol = NULL;
-	properties = NULL;
-	disc_type_textual = NULL;
-	vol_fsusage_textual = NULL;
 
-	dbus_error_init (&error);
-	if (!libhal_device_query_capability (hal_ctx, udi, "volume", &error))
-		goto error;
+	if (!property_set_has_capability (properties, "volume"))
+		return NULL;
 
 	vol = malloc (sizeof (LibHalVolume));
 	if (vol == NULL)
-		goto error;
+		return NULL;
 	memset (vol, 0x00, sizeof (LibHalVolume));
 
 	vol->udi = strdup (udi);
-
-	properties = libhal_device_get_all_properties (hal_ctx, udi, &error);
-	if (properties == NULL)
-		goto error;
+	if (vol->udi == NULL) {
+		free (vol);
+		return NULL;
+	}
 
 	/* we can count on hal to give us all these properties */
-	for (libhal_psi_init (&it, properties); libhal_psi_has_more (&it); libhal_psi_next (&it)) {
-		int type;
-		char *key;
-		
-		type = libhal_psi_get_type (&it);
-		key = libhal_psi_get_key (&it);
+	extract_properties (vol, volume_properties,
+			    sizeof (volume_properties) / sizeof (volume_properties[0]),
+			    properties);
 
-		LIBHAL_PROP_EXTRACT_BEGIN;
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.is_partition",                    vol->is_partition);
-		LIBHAL_PROP_EXTRACT_INT    ("volume.partition.number",                vol->partition_number);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.partition.scheme",                vol->partition_scheme);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.partition.type",                  vol->partition_type);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.partition.label",                 vol->partition_label);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.partition.uuid",                  vol->partition_uuid);
-		LIBHAL_PROP_EXTRACT_STRLIST ("volume.partition.flags",                vol->partition_flags);
-
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.partition.start", 		      vol->partition_start_offset); 
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.partition.media_size",            vol->partition_media_size); 
-		LIBHAL_PROP_EXTRACT_INT    ("volume.partition.msdos_part_table_type", vol->msdos_part_table_type);
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.partition.msdos_part_table_start", vol->msdos_part_table_start);
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.partition.msdos_part_table_size", vol->msdos_part_table_size);
-
-		LIBHAL_PROP_EXTRACT_INT    ("block.minor",               vol->device_minor);
-		LIBHAL_PROP_EXTRACT_INT    ("block.major",               vol->device_major);
-		LIBHAL_PROP_EXTRACT_STRING ("block.device",              vol->device_file);
-
-		LIBHAL_PROP_EXTRACT_STRING ("block.storage_device",      vol->storage_device);
-
-		LIBHAL_PROP_EXTRACT_STRING ("volume.crypto_luks.clear.backing_volume", vol->crypto_backing_volume);
-
-		LIBHAL_PROP_EXTRACT_INT    ("volume.block_size",         vol->block_size);
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.num_blocks",         vol->num_blocks);
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.size", 		 vol->volume_size); 
-		LIBHAL_PROP_EXTRACT_STRING ("volume.label",              vol->volume_label);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.mount_point",        vol->mount_point);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.fstype",             vol->fstype);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.fsversion",             vol->fsversion);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.is_mounted",         vol->is_mounted);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.is_mounted_read_only", vol->is_mounted_read_only);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.fsusage",            vol_fsusage_textual);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.uuid",               vol->uuid);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.ignore",             vol->ignore_volume);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.is_disc",            vol->is_disc);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.disc.type",          disc_type_textual);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.disc.has_audio",     vol->disc_has_audio);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.disc.has_data",      vol->disc_has_data);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.disc.is_appendable", vol->disc_is_appendable);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.disc.is_blank",      vol->disc_is_blank);
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.disc.is_rewritable", vol->disc_is_rewritable);
-		LIBHAL_PROP_EXTRACT_UINT64 ("volume.disc.capacity",      vol->disc_capacity);
-
-		LIBHAL_PROP_EXTRACT_BOOL   ("volume.policy.should_mount",        vol->should_mount);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.policy.desired_mount_point", vol->desired_mount_point);
-		LIBHAL_PROP_EXTRACT_STRING ("volume.policy.mount_filesystem",    vol->mount_filesystem);
-
-		LIBHAL_PROP_EXTRACT_END;
-	}
+	disc_type_textual = vol->disc_type_textual;
+	vol_fsusage_textual = vol->fsusage_textual;
+	vol->disc_type_textual = NULL;
+	vol->fsusage_textual = NULL;
 
 	if (disc_type_textual != NULL) {
 		if (strcmp (disc_type_textual, "cd_rom") == 0) {
@@ -1267,17 +1431,91 @@ libhal_volume_from_udi (LibHalContext *hal_ctx, const char *udi)
 
 	libhal_free_string (vol_fsusage_textual);
 	libhal_free_string (disc_type_textual);
-	libhal_free_property_set (properties);
 	return vol;
-error:
-	if (dbus_error_is_set (&error)) {
-		dbus_error_free (&error);
+}
+
+/**  
+ *  libhal_volume_from_udi:
+ *  @hal_ctx:            libhal context
+ *  @udi:                HAL UDI
+ *
+ *  Returns:             LibHalVolume object or NULL if UDI is invalid
+ *
+ *  Given a UDI for a LIBHAL device of capability 'volume', this
+ *  function retrieves all the relevant properties into convenient
+ *  in-process data structures.
+ */
+LibHalVolume *
+libhal_volume_from_udi (LibHalContext *hal_ctx, const char *udi)
+{
+	LibHalVolume *vol;
+	LibHalPropertySet *properties;
+	DBusError error;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
+
+	dbus_error_init (&error);
+	properties = libhal_device_get_all_properties (hal_ctx, udi, &error);
+	if (properties == NULL) {
+		LIBHAL_FREE_DBUS_ERROR(&error);
+		return NULL;
 	}
-	libhal_free_string (vol_fsusage_textual);
-	libhal_free_string (disc_type_textual);
+
+	vol = volume_from_property_set (udi, properties);
+
 	libhal_free_property_set (properties);
-	libhal_volume_free (vol);
-	return NULL;
+	return vol;
+}
+
+/**  
+ *  libhal_volume_enumerate_all:
+ *  @hal_ctx:            libhal context
+ *  @num_volumes:        Return location for number of volumes
+ *  @error:              pointer to an initialized dbus error object for returning errors or NULL
+ *
+ *  Returns:             NULL terminated array of LibHalVolume objects or NULL on error
+ *
+ *  Get all volumes at once. This is the same as calling
+ *  libhal_volume_from_udi() for every device of capability 'volume'
+ *  but takes two calls to hald instead of two per volume. Free each
+ *  volume with libhal_volume_free() and the array with free().
+ */
+LibHalVolume **
+libhal_volume_enumerate_all (LibHalContext *hal_ctx, int *num_volumes, DBusError *error)
+{
+	static const char *keys[] = {"block.*", "volume.*", "info.capabilities", NULL};
+	LibHalVolume **volumes;
+	LibHalPropertySet **properties;
+	char **udis;
+	int num_devices;
+	int i;
+	int n;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(hal_ctx, NULL);
+
+	*num_volumes = 0;
+
+	if (!get_properties_by_capability (hal_ctx, "volume", keys,
+					   &num_devices, &udis, &properties, error))
+		return NULL;
+
+	volumes = calloc (num_devices + 1, sizeof (LibHalVolume *));
+	if (volumes == NULL) {
+		free_properties (udis, properties);
+		return NULL;
+	}
+
+	for (i = 0, n = 0; i < num_devices; i++) {
+		volumes[n] = volume_from_property_set (udis[i], properties[i]);
+		if (volumes[n] != NULL)
+			n++;
+	}
+	volumes[n] = NULL;
+
+	free_properties (udis, properties);
+
+	*num_volumes = n;
+	return volumes;
 }
 
 
@@ -201,6 +201,9 @@ LibHalDrive         *libhal_drive_from_udi                    (LibHalContext *ha
 LibHalDrive         *libhal_drive_from_device_file            (LibHalContext *hal_ctx, 
 							       const char *device_file);
 void                 libhal_drive_free                        (LibHalDrive *drive);
+LibHalDrive        **libhal_drive_enumerate_all               (LibHalContext *hal_ctx,
+							       int *num_drives,
+							       DBusError *error);
 
 dbus_bool_t          libhal_drive_is_hotpluggable          (LibHalDrive      *drive);
 dbus_bool_t          libhal_drive_uses_removable_media     (LibHalDrive      *drive);
@@ -292,6 +295,9 @@ LibHalVolume     *libhal_volume_from_device_file              (LibHalContext *ha
 LibHalVolume     *libhal_volume_from_mount_point              (LibHalContext *hal_ctx, 
 							       const char *mount_point);
 void              libhal_volume_free                          (LibHalVolume     *volume);
+LibHalVolume    **libhal_volume_enumerate_all                 (LibHalContext *hal_ctx,
+							       int *num_volumes,
+							       DBusError *error);
 dbus_uint64_t     libhal_volume_get_size                      (LibHalVolume     *volume);
 dbus_uint64_t     libhal_volume_get_disc_capacity             (LibHalVolume     *volume);
 
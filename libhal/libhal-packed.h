@@ -0,0 +1,55 @@
+/***************************************************************************
+ *
+ * libhal-packed.h : Packed property sets sent from helpers to hald
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef LIBHAL_PACKED_H
+#define LIBHAL_PACKED_H
+
+/* Probers and addons talk to hald over its private socket. Instead of
+ * a dict of variants, libhal sends a changeset there as a single byte
+ * array to Device.SetPackedProperties:
+ *
+ *   u32 magic (LIBHAL_PACKED_MAGIC)
+ *   u32 number of entries
+ *   for each entry:
+ *     u8  type, one of LIBHAL_PACKED_TYPE_*
+ *     str key
+ *     value: 4 bytes for INT32, 8 bytes for UINT64 and DOUBLE, 1 byte
+ *            for BOOLEAN, a str for STRING, and a u32 count followed
+ *            by that many str for STRLIST
+ *
+ * where a str is a u32 length, including the terminating NUL, followed
+ * by the bytes. Numbers are in host byte order, as both ends are on the
+ * same machine, and are not aligned.
+ *
+ * This is private to libhal and hald; the header is not installed.
+ */
+
+#define LIBHAL_PACKED_MAGIC 0x68616c70
+
+#define LIBHAL_PACKED_TYPE_STRING  's'
+#define LIBHAL_PACKED_TYPE_INT32   'i'
+#define LIBHAL_PACKED_TYPE_UINT64  't'
+#define LIBHAL_PACKED_TYPE_DOUBLE  'd'
+#define LIBHAL_PACKED_TYPE_BOOLEAN 'b'
+#define LIBHAL_PACKED_TYPE_STRLIST 'l'
+
+#endif /* LIBHAL_PACKED_H */
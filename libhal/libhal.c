@@ -36,6 +36,7 @@
 
 #include "uthash.h"
 #include "libhal.h"
+#include "libhal-packed.h"
 
 #ifdef ENABLE_NLS
 # include <libintl.h>
@@ -253,6 +254,7 @@ struct LibHalContext_s {
 	dbus_bool_t is_shutdown;              /**< Have we been shutdown */
 	dbus_bool_t cache_enabled;            /**< Is the cache enabled */
 	dbus_bool_t is_direct;                /**< Whether the connection to hald is direct */
+	dbus_bool_t no_packed_properties;     /**< hald doesn't know SetPackedProperties */
 
 	/** Device added */
 	LibHalDeviceAdded device_added;
@@ -269,6 +271,9 @@ struct LibHalContext_s {
 	/** A property of a device changed  */
 	LibHalDevicePropertyModified device_property_modified;
 
+	/** Properties of a device changed, with the new values  */
+	LibHalDevicePropertiesChanged device_properties_changed;
+
 	/** A non-continous event on the device occured  */
 	LibHalDeviceCondition device_condition;
         
@@ -1165,6 +1170,35 @@ filter_func (DBusConnection * connection,
 			LIBHAL_FREE_DBUS_ERROR(&error);
 		}
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	} else if (dbus_message_is_signal (message, "org.freedesktop.Hal.Device.Properties", "PropertiesChanged")) {
+		if (ctx->device_properties_changed != NULL &&
+		    dbus_message_has_signature (message, "a{sv}asas")) {
+			LibHalPropertySet *changed;
+			char **removed;
+			char **added;
+			DBusMessageIter iter;
+			DBusMessageIter iter_array;
+
+			dbus_message_iter_init (message, &iter);
+			changed = get_property_set (&iter);
+			dbus_message_iter_next (&iter);
+			dbus_message_iter_recurse (&iter, &iter_array);
+			removed = libhal_get_string_array_from_iter (&iter_array, NULL);
+			dbus_message_iter_next (&iter);
+			dbus_message_iter_recurse (&iter, &iter_array);
+			added = libhal_get_string_array_from_iter (&iter_array, NULL);
+
+			if (changed != NULL && removed != NULL && added != NULL)
+				ctx->device_properties_changed (ctx, object_path, changed,
+								(const char **) removed,
+								(const char **) added);
+
+			if (changed != NULL)
+				libhal_free_property_set (changed);
+			libhal_free_string_array (removed);
+			libhal_free_string_array (added);
+		}
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	} else if (dbus_message_is_signal (message, "org.freedesktop.Hal.Device", "PropertyModified")) {
 		if (ctx->device_property_modified != NULL) {
 			int i;
@@ -3012,6 +3046,105 @@ libhal_manager_find_device_string_match (LibHalContext *ctx,
 }
 
 
+static char **
+libhal_manager_get_udis_below (LibHalContext *ctx, const char *method, const char *udi,
+			       int *num_devices, DBusError *error)
+{
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusMessageIter iter, iter_array, reply_iter;
+	char **hal_device_names;
+	DBusError _error;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						method);
+	if (message == NULL) {
+		fprintf (stderr,
+			 "%s %d : Couldn't allocate D-BUS message\n",
+			 __FILE__, __LINE__);
+		return NULL;
+	}
+
+	dbus_message_iter_init_append (message, &iter);
+	dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &udi);
+
+	dbus_error_init (&_error);
+	reply = dbus_connection_send_with_reply_and_block (ctx->connection,
+							   message, -1,
+							   &_error);
+
+	dbus_message_unref (message);
+
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return NULL;
+	}
+	if (reply == NULL) {
+		return NULL;
+	}
+	/* now analyse reply */
+	dbus_message_iter_init (reply, &reply_iter);
+
+	if (dbus_message_iter_get_arg_type (&reply_iter) != DBUS_TYPE_ARRAY) {
+		fprintf (stderr, "%s %d : wrong reply from hald.  Expecting an array.\n", __FILE__, __LINE__);
+		dbus_message_unref (reply);
+		return NULL;
+	}
+	
+	dbus_message_iter_recurse (&reply_iter, &iter_array);
+
+	hal_device_names = libhal_get_string_array_from_iter (&iter_array, num_devices);
+		      
+	dbus_message_unref (reply);
+	return hal_device_names;
+}
+
+/**
+ * libhal_manager_get_children:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique Device Id of the parent
+ * @num_devices: pointer to store number of devices
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Get the devices whose info.parent is @udi. Unlike matching on
+ * info.parent with libhal_manager_find_device_string_match() this
+ * doesn't make hald scan all devices.
+ *
+ * Returns: UDI of devices; free with libhal_free_string_array()
+ */
+char **
+libhal_manager_get_children (LibHalContext *ctx, const char *udi, int *num_devices, DBusError *error)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, NULL);
+	LIBHAL_CHECK_UDI_VALID(udi, NULL);
+
+	return libhal_manager_get_udis_below (ctx, "GetChildren", udi, num_devices, error);
+}
+
+/**
+ * libhal_manager_get_descendants:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique Device Id of the root of the subtree
+ * @num_devices: pointer to store number of devices
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Get all devices below @udi in the device tree. A device is always
+ * listed before its children.
+ *
+ * Returns: UDI of devices; free with libhal_free_string_array()
+ */
+char **
+libhal_manager_get_descendants (LibHalContext *ctx, const char *udi, int *num_devices, DBusError *error)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, NULL);
+	LIBHAL_CHECK_UDI_VALID(udi, NULL);
+
+	return libhal_manager_get_udis_below (ctx, "GetDescendants", udi, num_devices, error);
+}
+
+
 /**
  * libhal_device_add_capability:
  * @ctx: the context for the connection to hald
@@ -3282,148 +3415,406 @@ libhal_device_remove_property_watch (LibHalContext *ctx, const char *udi, DBusEr
 
 
 /**
- * libhal_ctx_new:
+ * libhal_device_properties_watch_all:
+ * @ctx: the context for the connection to hald
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Create a new LibHalContext
+ * Watch the values of all devices, ie. the device_properties_changed
+ * callback is invoked when the properties on any device change.
  *
- * Returns: a new uninitialized LibHalContext object
+ * Returns: TRUE only if the operation succeeded
  */
-LibHalContext *
-libhal_ctx_new (void)
+dbus_bool_t
+libhal_device_properties_watch_all (LibHalContext *ctx, DBusError *error)
 {
-	LibHalContext *ctx;
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
 
-	ctx = calloc (1, sizeof (LibHalContext));
-	if (ctx == NULL) {
-		fprintf (stderr, 
-			 "%s %d : Failed to allocate %lu bytes\n",
-			 __FILE__, __LINE__, (unsigned long) sizeof (LibHalContext));
-		return NULL;
+	dbus_bus_add_match (ctx->connection,
+			    "type='signal',"
+			    "interface='org.freedesktop.Hal.Device.Properties',"
+			    "sender='org.freedesktop.Hal'", error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
 	}
-
-	ctx->is_initialized = FALSE;
-	ctx->is_shutdown = FALSE;
-	ctx->connection = NULL;
-	ctx->is_direct = FALSE;
-
-	return ctx;
+	return TRUE;
 }
 
 /**
- * libhal_ctx_set_cache:
- * @ctx: context to enable/disable cache for
- * @use_cache: whether or not to use cache
+ * libhal_device_properties_remove_watch_all:
+ * @ctx: the context for the connection to hald
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Enable or disable caching. Note: Caching is not actually
- * implemented yet.
+ * Remove a watch added with libhal_device_properties_watch_all().
  *
- * Returns: TRUE if cache was successfully enabled/disabled, FALSE otherwise
+ * Returns: TRUE only if the operation succeeded
  */
 dbus_bool_t
-libhal_ctx_set_cache (LibHalContext *ctx, dbus_bool_t use_cache)
+libhal_device_properties_remove_watch_all (LibHalContext *ctx, DBusError *error)
 {
 	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
 
-	ctx->cache_enabled = use_cache;
+	dbus_bus_remove_match (ctx->connection,
+			       "type='signal',"
+			       "interface='org.freedesktop.Hal.Device.Properties',"
+			       "sender='org.freedesktop.Hal'", error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
 	return TRUE;
 }
 
 /**
- * libhal_ctx_set_dbus_connection:
- * @ctx: context to set connection for
- * @conn: DBus connection to use
+ * libhal_device_add_properties_watch:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique Device Id
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Set DBus connection to use to talk to hald.
+ * Add a watch on the values of a device, so the
+ * device_properties_changed callback is invoked when the properties
+ * on the given device change.
  *
- * Returns: TRUE if connection was successfully set, FALSE otherwise
+ * The application itself is responsible for deleting the watch, using
+ * libhal_device_remove_properties_watch, if the device is removed.
+ *
+ * Returns: TRUE only if the operation succeeded
  */
 dbus_bool_t
-libhal_ctx_set_dbus_connection (LibHalContext *ctx, DBusConnection *conn)
-{
+libhal_device_add_properties_watch (LibHalContext *ctx, const char *udi, DBusError *error)
+{	
+	char buf[512];
+	
 	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_UDI_VALID(udi, FALSE);
 
-	if (conn == NULL)
-		return FALSE;
+	snprintf (buf, 512,
+		  "type='signal',"
+		  "interface='org.freedesktop.Hal.Device.Properties',"
+		  "sender='org.freedesktop.Hal'," "path=%s", udi);
 
-	ctx->connection = conn;
+	dbus_bus_add_match (ctx->connection, buf, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
 	return TRUE;
 }
 
 /**
- * libhal_ctx_get_dbus_connection:
- * @ctx: context to get connection for
+ * libhal_device_remove_properties_watch:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique Device Id
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Get DBus connection used for talking to hald.
+ * Remove a watch added with libhal_device_add_properties_watch().
  *
- * Returns: DBus connection to use or NULL
+ * Returns: TRUE only if the operation succeeded
  */
-DBusConnection *
-libhal_ctx_get_dbus_connection (LibHalContext *ctx)
-{
-	LIBHAL_CHECK_LIBHALCONTEXT(ctx, NULL);
+dbus_bool_t
+libhal_device_remove_properties_watch (LibHalContext *ctx, const char *udi, DBusError *error)
+{	
+	char buf[512];
+	
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_UDI_VALID(udi, FALSE);
 
-	return ctx->connection;
+	snprintf (buf, 512,
+		  "type='signal',"
+		  "interface='org.freedesktop.Hal.Device.Properties',"
+		  "sender='org.freedesktop.Hal'," "path=%s", udi);
+
+	dbus_bus_remove_match (ctx->connection, buf, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
+	return TRUE;
 }
 
 
 /**
- * libhal_ctx_init:
- * @ctx: Context for connection to hald (D-BUS connection should be set with libhal_ctx_set_dbus_connection)
+ * libhal_device_subscribe_properties:
+ * @ctx: the context for the connection to hald
+ * @keys: NULL-terminated array of property names or globs like "battery.*"; NULL or empty for all properties
+ * @capability: only watch devices with this capability, or NULL for all devices
+ * @subscription: return location for the id of the subscription or NULL
  * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Initialize the connection to hald.
+ * Ask hald to invoke the device_properties_changed callback when
+ * properties matching @keys change on devices with @capability.
+ * Unlike libhal_device_properties_watch_all() hald sends the changes
+ * only to this connection and only with the matching properties, so
+ * no other client is woken up. The subscription ends with
+ * libhal_device_unsubscribe_properties() or when the connection is
+ * closed.
  *
- * Returns: TRUE if initialization succeeds, FALSE otherwise
+ * Returns: TRUE only if the operation succeeded
  */
-dbus_bool_t 
-libhal_ctx_init (LibHalContext *ctx, DBusError *error)
+dbus_bool_t
+libhal_device_subscribe_properties (LibHalContext *ctx,
+				    const char **keys,
+				    const char *capability,
+				    dbus_uint32_t *subscription,
+				    DBusError *error)
 {
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_array;
 	DBusError _error;
-	dbus_bool_t hald_exists;
+	dbus_uint32_t id;
+	int i;
 
 	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
 
-	if (ctx->connection == NULL)
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"SubscribeProperties");
+	if (message == NULL) {
+		fprintf (stderr,
+			 "%s %d : Couldn't allocate D-BUS message\n",
+			 __FILE__, __LINE__);
 		return FALSE;
+	}
+
+	if (capability == NULL)
+		capability = "";
+
+	dbus_message_iter_init_append (message, &iter);
+	dbus_message_iter_open_container (&iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_STRING_AS_STRING,
+					  &iter_array);
+	for (i = 0; keys != NULL && keys[i] != NULL; i++)
+		dbus_message_iter_append_basic (&iter_array, DBUS_TYPE_STRING, &keys[i]);
+	dbus_message_iter_close_container (&iter, &iter_array);
+	dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &capability);
 
 	dbus_error_init (&_error);
-	hald_exists = dbus_bus_name_has_owner (ctx->connection, "org.freedesktop.Hal", &_error);
+	reply = dbus_connection_send_with_reply_and_block (ctx->connection,
+							   message, -1,
+							   &_error);
+
+	dbus_message_unref (message);
+
 	dbus_move_error (&_error, error);
 	if (error != NULL && dbus_error_is_set (error)) {
 		return FALSE;
 	}
-
-	if (!hald_exists) {
-		return FALSE;
-	}
-
-	
-	if (!dbus_connection_add_filter (ctx->connection, filter_func, ctx, NULL)) {
+	if (reply == NULL) {
 		return FALSE;
 	}
 
-	dbus_bus_add_match (ctx->connection, 
-			    "type='signal',"
-			    "interface='org.freedesktop.Hal.Manager',"
-			    "sender='org.freedesktop.Hal',"
-			    "path='/org/freedesktop/Hal/Manager'", &_error);
-	dbus_move_error (&_error, error);
-	if (error != NULL && dbus_error_is_set (error)) {
+	dbus_error_init (&_error);
+	if (!dbus_message_get_args (reply, &_error,
+				    DBUS_TYPE_UINT32, &id,
+				    DBUS_TYPE_INVALID)) {
+		dbus_move_error (&_error, error);
+		dbus_message_unref (reply);
 		return FALSE;
 	}
-	ctx->is_initialized = TRUE;
-	ctx->is_direct = FALSE;
+	dbus_message_unref (reply);
 
+	if (subscription != NULL)
+		*subscription = id;
 	return TRUE;
 }
 
 /**
- * libhal_ctx_init_direct:
+ * libhal_device_unsubscribe_properties:
+ * @ctx: the context for the connection to hald
+ * @subscription: id returned by libhal_device_subscribe_properties()
  * @error: pointer to an initialized dbus error object for returning errors or NULL
  *
- * Create an already initialized connection to hald. This function should only be used by HAL helpers.
+ * End a subscription made with libhal_device_subscribe_properties().
  *
- * Returns: A pointer to an already initialized LibHalContext
+ * Returns: TRUE only if the operation succeeded
+ */
+dbus_bool_t
+libhal_device_unsubscribe_properties (LibHalContext *ctx,
+				      dbus_uint32_t subscription,
+				      DBusError *error)
+{
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusError _error;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"UnsubscribeProperties");
+	if (message == NULL) {
+		fprintf (stderr,
+			 "%s %d : Couldn't allocate D-BUS message\n",
+			 __FILE__, __LINE__);
+		return FALSE;
+	}
+
+	dbus_message_append_args (message, DBUS_TYPE_UINT32, &subscription, DBUS_TYPE_INVALID);
+
+	dbus_error_init (&_error);
+	reply = dbus_connection_send_with_reply_and_block (ctx->connection,
+							   message, -1,
+							   &_error);
+
+	dbus_message_unref (message);
+
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	dbus_message_unref (reply);
+	return TRUE;
+}
+
+
+/**
+ * libhal_ctx_new:
+ *
+ * Create a new LibHalContext
+ *
+ * Returns: a new uninitialized LibHalContext object
+ */
+LibHalContext *
+libhal_ctx_new (void)
+{
+	LibHalContext *ctx;
+
+	ctx = calloc (1, sizeof (LibHalContext));
+	if (ctx == NULL) {
+		fprintf (stderr, 
+			 "%s %d : Failed to allocate %lu bytes\n",
+			 __FILE__, __LINE__, (unsigned long) sizeof (LibHalContext));
+		return NULL;
+	}
+
+	ctx->is_initialized = FALSE;
+	ctx->is_shutdown = FALSE;
+	ctx->connection = NULL;
+	ctx->is_direct = FALSE;
+
+	return ctx;
+}
+
+/**
+ * libhal_ctx_set_cache:
+ * @ctx: context to enable/disable cache for
+ * @use_cache: whether or not to use cache
+ *
+ * Enable or disable caching. Note: Caching is not actually
+ * implemented yet.
+ *
+ * Returns: TRUE if cache was successfully enabled/disabled, FALSE otherwise
+ */
+dbus_bool_t
+libhal_ctx_set_cache (LibHalContext *ctx, dbus_bool_t use_cache)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	ctx->cache_enabled = use_cache;
+	return TRUE;
+}
+
+/**
+ * libhal_ctx_set_dbus_connection:
+ * @ctx: context to set connection for
+ * @conn: DBus connection to use
+ *
+ * Set DBus connection to use to talk to hald.
+ *
+ * Returns: TRUE if connection was successfully set, FALSE otherwise
+ */
+dbus_bool_t
+libhal_ctx_set_dbus_connection (LibHalContext *ctx, DBusConnection *conn)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	if (conn == NULL)
+		return FALSE;
+
+	ctx->connection = conn;
+	return TRUE;
+}
+
+/**
+ * libhal_ctx_get_dbus_connection:
+ * @ctx: context to get connection for
+ *
+ * Get DBus connection used for talking to hald.
+ *
+ * Returns: DBus connection to use or NULL
+ */
+DBusConnection *
+libhal_ctx_get_dbus_connection (LibHalContext *ctx)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, NULL);
+
+	return ctx->connection;
+}
+
+
+/**
+ * libhal_ctx_init:
+ * @ctx: Context for connection to hald (D-BUS connection should be set with libhal_ctx_set_dbus_connection)
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Initialize the connection to hald.
+ *
+ * Returns: TRUE if initialization succeeds, FALSE otherwise
+ */
+dbus_bool_t 
+libhal_ctx_init (LibHalContext *ctx, DBusError *error)
+{
+	DBusError _error;
+	dbus_bool_t hald_exists;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	if (ctx->connection == NULL)
+		return FALSE;
+
+	dbus_error_init (&_error);
+	hald_exists = dbus_bus_name_has_owner (ctx->connection, "org.freedesktop.Hal", &_error);
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
+
+	if (!hald_exists) {
+		return FALSE;
+	}
+
+	
+	if (!dbus_connection_add_filter (ctx->connection, filter_func, ctx, NULL)) {
+		return FALSE;
+	}
+
+	dbus_bus_add_match (ctx->connection, 
+			    "type='signal',"
+			    "interface='org.freedesktop.Hal.Manager',"
+			    "sender='org.freedesktop.Hal',"
+			    "path='/org/freedesktop/Hal/Manager'", &_error);
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
+	ctx->is_initialized = TRUE;
+	ctx->is_direct = FALSE;
+
+	return TRUE;
+}
+
+/**
+ * libhal_ctx_init_direct:
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Create an already initialized connection to hald. This function should only be used by HAL helpers.
+ *
+ * Returns: A pointer to an already initialized LibHalContext
  */
 LibHalContext *
 libhal_ctx_init_direct (DBusError *error)
@@ -3613,6 +4004,28 @@ libhal_ctx_set_device_property_modified (LibHalContext *ctx, LibHalDevicePropert
 	return TRUE;
 }
 
+/**
+ * libhal_ctx_set_device_properties_changed:
+ * @ctx: the context for the connection to hald
+ * @callback: the function to call with the new values when properties change on a device
+ *
+ * Set the callback for when properties change on a device. The
+ * callback gets the new values so no round trip to hald is needed to
+ * read them; it is only invoked for devices watched with
+ * libhal_device_add_properties_watch() or
+ * libhal_device_properties_watch_all().
+ *
+ * Returns: TRUE if callback was successfully set, FALSE otherwise
+ */
+dbus_bool_t
+libhal_ctx_set_device_properties_changed (LibHalContext *ctx, LibHalDevicePropertiesChanged callback)
+{
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	ctx->device_properties_changed = callback;
+	return TRUE;
+}
+
 /**
  * libhal_ctx_set_device_condition:
  * @ctx: the context for the connection to hald
@@ -4394,23 +4807,11 @@ out:
 	return elem != NULL;
 }
 
-/**
- * libhal_device_commit_changeset:
- * @ctx: the context for the connection to hald
- * @changeset: the changeset to commit
- * @error: pointer to an initialized dbus error object for returning errors or NULL
- * 
- * Commit a changeset to the daemon.
- * 
- * Returns: True if the changeset was committed on the daemon side
- */
-dbus_bool_t
-libhal_device_commit_changeset (LibHalContext *ctx, LibHalChangeSet *changeset, DBusError *error)
+static DBusMessage *
+changeset_new_message (LibHalChangeSet *changeset)
 {
 	LibHalChangeSetElement *elem;
 	DBusMessage *message;
-	DBusMessage *reply;
-	DBusError _error;
 	DBusMessageIter iter;
 	DBusMessageIter sub;
 	DBusMessageIter sub2;
@@ -4418,20 +4819,13 @@ libhal_device_commit_changeset (LibHalContext *ctx, LibHalChangeSet *changeset,
 	DBusMessageIter sub4;
 	int i;
 
-	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
-	LIBHAL_CHECK_UDI_VALID(changeset->udi, FALSE);
-
-	if (changeset->head == NULL) {
-		return TRUE;
-	}
-
 	message = dbus_message_new_method_call ("org.freedesktop.Hal", changeset->udi,
 						"org.freedesktop.Hal.Device",
 						"SetMultipleProperties");
 
 	if (message == NULL) {
 		fprintf (stderr, "%s %d : Couldn't allocate D-BUS message\n", __FILE__, __LINE__);
-		return FALSE;
+		return NULL;
 	}
 
 	dbus_message_iter_init_append (message, &iter);
@@ -4498,43 +4892,234 @@ libhal_device_commit_changeset (LibHalContext *ctx, LibHalChangeSet *changeset,
 
 	dbus_message_iter_close_container (&iter, &sub);
 
-	
-	dbus_error_init (&_error);
-	reply = dbus_connection_send_with_reply_and_block (ctx->connection,
-							   message, -1,
-							   &_error);
+	return message;
+}
 
-	dbus_message_unref (message);
+static size_t
+packed_str_size (const char *str)
+{
+	return sizeof (dbus_uint32_t) + strlen (str) + 1;
+}
 
-	dbus_move_error (&_error, error);
-	if (error != NULL && dbus_error_is_set (error)) {
-		fprintf (stderr,
-			 "%s %d : %s\n",
-			 __FILE__, __LINE__, error->message);
+static char *
+packed_put (char *p, const void *data, size_t len)
+{
+	memcpy (p, data, len);
+	return p + len;
+}
 
-		return FALSE;
-	}
-	if (reply == NULL) {
-		return FALSE;
-	}
+static char *
+packed_put_str (char *p, const char *str)
+{
+	dbus_uint32_t len;
 
-	dbus_message_unref (reply);
-	return TRUE;
+	len = strlen (str) + 1;
+	p = packed_put (p, &len, sizeof (len));
+	return packed_put (p, str, len);
 }
 
-/**
- * libhal_device_free_changeset:
- * @changeset: the changeset to free
- * 
- * Free a changeset.
- */
-void
-libhal_device_free_changeset (LibHalChangeSet *changeset)
+/* Build a Device.SetPackedProperties message, see libhal-packed.h */
+static DBusMessage *
+changeset_new_packed_message (LibHalChangeSet *changeset)
 {
 	LibHalChangeSetElement *elem;
-	LibHalChangeSetElement *elem2;
+	DBusMessage *message;
+	dbus_uint32_t header[2];
+	dbus_uint32_t count;
+	unsigned char type;
+	dbus_bool_t ok;
+	size_t size;
+	char *buf;
+	char *p;
+	int i;
 
-	for (elem = changeset->head; elem != NULL; elem = elem2) {
+	/* size it first so the buffer is allocated once */
+	header[0] = LIBHAL_PACKED_MAGIC;
+	header[1] = 0;
+	size = sizeof (header);
+	for (elem = changeset->head; elem != NULL; elem = elem->next) {
+		size += 1 + packed_str_size (elem->key);
+		switch (elem->change_type) {
+		case LIBHAL_PROPERTY_TYPE_STRING:
+			size += packed_str_size (elem->value.val_str);
+			break;
+		case LIBHAL_PROPERTY_TYPE_STRLIST:
+			size += sizeof (dbus_uint32_t);
+			for (i = 0; elem->value.val_strlist[i] != NULL; i++)
+				size += packed_str_size (elem->value.val_strlist[i]);
+			break;
+		case LIBHAL_PROPERTY_TYPE_INT32:
+			size += sizeof (dbus_int32_t);
+			break;
+		case LIBHAL_PROPERTY_TYPE_UINT64:
+			size += sizeof (dbus_uint64_t);
+			break;
+		case LIBHAL_PROPERTY_TYPE_DOUBLE:
+			size += sizeof (double);
+			break;
+		case LIBHAL_PROPERTY_TYPE_BOOLEAN:
+			size += 1;
+			break;
+		default:
+			fprintf (stderr, "%s %d : unknown change_type %d\n", __FILE__, __LINE__, elem->change_type);
+			return NULL;
+		}
+		header[1]++;
+	}
+
+	buf = malloc (size);
+	if (buf == NULL)
+		return NULL;
+
+	p = packed_put (buf, header, sizeof (header));
+	for (elem = changeset->head; elem != NULL; elem = elem->next) {
+		switch (elem->change_type) {
+		case LIBHAL_PROPERTY_TYPE_STRING:
+			type = LIBHAL_PACKED_TYPE_STRING;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			p = packed_put_str (p, elem->value.val_str);
+			break;
+		case LIBHAL_PROPERTY_TYPE_STRLIST:
+			type = LIBHAL_PACKED_TYPE_STRLIST;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			for (count = 0; elem->value.val_strlist[count] != NULL; count++)
+				;
+			p = packed_put (p, &count, sizeof (count));
+			for (i = 0; elem->value.val_strlist[i] != NULL; i++)
+				p = packed_put_str (p, elem->value.val_strlist[i]);
+			break;
+		case LIBHAL_PROPERTY_TYPE_INT32:
+			type = LIBHAL_PACKED_TYPE_INT32;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			p = packed_put (p, &elem->value.val_int, sizeof (dbus_int32_t));
+			break;
+		case LIBHAL_PROPERTY_TYPE_UINT64:
+			type = LIBHAL_PACKED_TYPE_UINT64;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			p = packed_put (p, &elem->value.val_uint64, sizeof (dbus_uint64_t));
+			break;
+		case LIBHAL_PROPERTY_TYPE_DOUBLE:
+			type = LIBHAL_PACKED_TYPE_DOUBLE;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			p = packed_put (p, &elem->value.val_double, sizeof (double));
+			break;
+		case LIBHAL_PROPERTY_TYPE_BOOLEAN:
+			type = LIBHAL_PACKED_TYPE_BOOLEAN;
+			p = packed_put (p, &type, 1);
+			p = packed_put_str (p, elem->key);
+			type = elem->value.val_bool ? 1 : 0;
+			p = packed_put (p, &type, 1);
+			break;
+		}
+	}
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal", changeset->udi,
+						"org.freedesktop.Hal.Device",
+						"SetPackedProperties");
+	if (message == NULL) {
+		fprintf (stderr, "%s %d : Couldn't allocate D-BUS message\n", __FILE__, __LINE__);
+		free (buf);
+		return NULL;
+	}
+
+	ok = dbus_message_append_args (message,
+				       DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &buf, (int) size,
+				       DBUS_TYPE_INVALID);
+	free (buf);
+	if (!ok) {
+		dbus_message_unref (message);
+		return NULL;
+	}
+
+	return message;
+}
+
+/**
+ * libhal_device_commit_changeset:
+ * @ctx: the context for the connection to hald
+ * @changeset: the changeset to commit
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ * 
+ * Commit a changeset to the daemon.
+ * 
+ * Returns: True if the changeset was committed on the daemon side
+ */
+dbus_bool_t
+libhal_device_commit_changeset (LibHalContext *ctx, LibHalChangeSet *changeset, DBusError *error)
+{
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusError _error;
+	dbus_bool_t packed;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_UDI_VALID(changeset->udi, FALSE);
+
+	if (changeset->head == NULL) {
+		return TRUE;
+	}
+
+	/* probers and addons on the private socket send the whole
+	 * changeset as one byte array that hald applies in one go */
+	packed = FALSE;
+	message = NULL;
+	if (ctx->is_direct && !ctx->no_packed_properties) {
+		message = changeset_new_packed_message (changeset);
+		packed = (message != NULL);
+	}
+	if (message == NULL)
+		message = changeset_new_message (changeset);
+	if (message == NULL)
+		return FALSE;
+
+	dbus_error_init (&_error);
+	reply = dbus_connection_send_with_reply_and_block (ctx->connection,
+							   message, -1,
+							   &_error);
+
+	dbus_message_unref (message);
+
+	if (packed && dbus_error_has_name (&_error, DBUS_ERROR_UNKNOWN_METHOD)) {
+		/* an older hald; don't try again */
+		dbus_error_free (&_error);
+		ctx->no_packed_properties = TRUE;
+		return libhal_device_commit_changeset (ctx, changeset, error);
+	}
+
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		fprintf (stderr,
+			 "%s %d : %s\n",
+			 __FILE__, __LINE__, error->message);
+
+		return FALSE;
+	}
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	dbus_message_unref (reply);
+	return TRUE;
+}
+
+/**
+ * libhal_device_free_changeset:
+ * @changeset: the changeset to free
+ * 
+ * Free a changeset.
+ */
+void
+libhal_device_free_changeset (LibHalChangeSet *changeset)
+{
+	LibHalChangeSetElement *elem;
+	LibHalChangeSetElement *elem2;
+
+	for (elem = changeset->head; elem != NULL; elem = elem2) {
 		elem2 = elem->next;
 
 		switch (elem->change_type) {
@@ -5229,3 +5814,588 @@ fail:
 
         return FALSE;
 }
+
+static void
+append_string_array (DBusMessageIter *iter, const char **strings)
+{
+	DBusMessageIter iter_array;
+	int i;
+
+	dbus_message_iter_open_container (iter,
+					  DBUS_TYPE_ARRAY,
+					  DBUS_TYPE_STRING_AS_STRING,
+					  &iter_array);
+	for (i = 0; strings != NULL && strings[i] != NULL; i++)
+		dbus_message_iter_append_basic (&iter_array, DBUS_TYPE_STRING, &strings[i]);
+	dbus_message_iter_close_container (iter, &iter_array);
+}
+
+/**
+ * libhal_get_properties:
+ * @ctx: the context for the connection to hald
+ * @udis: NULL-terminated array of UDIs; NULL or empty for all devices
+ * @keys: NULL-terminated array of property names; a name ending in '*', like "storage.*", selects all properties starting with the rest of it; NULL or empty for all properties
+ * @out_num_devices: Return location for number of devices
+ * @out_udi: Return location for array of of udi's. Caller should free this with libhal_free_string_array() when done with it.
+ * @out_properties: Return location for array of #LibHalPropertySet objects. Caller should free each one of them with libhal_free_property_set() when done with it
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Get the selected properties of many devices with a single call to
+ * hald instead of one call per device and property. Devices in @udis
+ * that don't exist are left out of the result, as are properties a
+ * device doesn't have, so check @out_udi for what was returned.
+ *
+ * Returns: TRUE if success; FALSE and @error will be set otherwise
+ */
+dbus_bool_t
+libhal_get_properties (LibHalContext *ctx,
+		       const char **udis,
+		       const char **keys,
+		       int *out_num_devices,
+		       char ***out_udi,
+		       LibHalPropertySet ***out_properties,
+		       DBusError *error)
+{
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_array;
+	DBusMessageIter reply_iter;
+	DBusError _error;
+	char **udi_array;
+	LibHalPropertySet **prop_array;
+	size_t count;
+	size_t size;
+	unsigned int n;
+
+	LIBHAL_CHECK_LIBHALCONTEXT (ctx, FALSE);
+	LIBHAL_CHECK_PARAM_VALID (out_num_devices, "*out_num_devices", FALSE);
+	LIBHAL_CHECK_PARAM_VALID (out_udi, "***out_udi", FALSE);
+	LIBHAL_CHECK_PARAM_VALID (out_properties, "***out_properties", FALSE);
+
+	*out_num_devices = 0;
+	*out_udi = NULL;
+	*out_properties = NULL;
+
+	count = 0;
+	size = 0;
+	udi_array = NULL;
+	prop_array = NULL;
+	reply = NULL;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"GetProperties");
+	if (message == NULL) {
+		fprintf (stderr, "%s %d : Could not allocate D-BUS message\n", __FILE__, __LINE__);
+		return FALSE;
+	}
+
+	dbus_message_iter_init_append (message, &iter);
+	append_string_array (&iter, udis);
+	append_string_array (&iter, keys);
+
+	dbus_error_init (&_error);
+	reply = dbus_connection_send_with_reply_and_block (ctx->connection, message, -1, &_error);
+
+	dbus_message_unref (message);
+
+	dbus_move_error (&_error, error);
+	if (error != NULL && dbus_error_is_set (error)) {
+		return FALSE;
+	}
+	if (reply == NULL) {
+		return FALSE;
+	}
+
+	dbus_message_iter_init (reply, &reply_iter);
+	if (dbus_message_iter_get_arg_type (&reply_iter) != DBUS_TYPE_ARRAY) {
+		fprintf (stderr, "%s %d : wrong reply from hald.  Expecting an array.\n", __FILE__, __LINE__);
+		goto fail;
+	}
+
+	dbus_message_iter_recurse (&reply_iter, &iter_array);
+	while (dbus_message_iter_get_arg_type (&iter_array) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter iter_entry;
+		const char *value;
+
+		/* always leave room for the terminating NULL */
+		if (count + 1 >= size) {
+			char **_udi_array;
+			LibHalPropertySet **_prop_array;
+
+			size = size == 0 ? 32 : size * 2;
+			_udi_array = (char **) realloc (udi_array, sizeof (char *) * size);
+			if (_udi_array == NULL)
+				goto fail;
+			udi_array = _udi_array;
+			_prop_array = (LibHalPropertySet **) realloc (prop_array, sizeof (LibHalPropertySet *) * size);
+			if (_prop_array == NULL)
+				goto fail;
+			prop_array = _prop_array;
+		}
+
+		dbus_message_iter_recurse (&iter_array, &iter_entry);
+		dbus_message_iter_get_basic (&iter_entry, &value);
+		dbus_message_iter_next (&iter_entry);
+
+		udi_array[count] = strdup (value);
+		if (udi_array[count] == NULL)
+			goto fail;
+		prop_array[count] = get_property_set (&iter_entry);
+		if (prop_array[count] == NULL) {
+			free (udi_array[count]);
+			goto fail;
+		}
+		count++;
+
+		dbus_message_iter_next (&iter_array);
+	}
+
+	if (count == 0) {
+		udi_array = (char **) malloc (sizeof (char *));
+		prop_array = (LibHalPropertySet **) malloc (sizeof (LibHalPropertySet *));
+		if (udi_array == NULL || prop_array == NULL)
+			goto fail;
+	}
+	udi_array[count] = NULL;
+	prop_array[count] = NULL;
+
+	*out_num_devices = count;
+	*out_udi = udi_array;
+	*out_properties = prop_array;
+
+	dbus_message_unref (reply);
+
+	return TRUE;
+
+fail:
+	for (n = 0; n < count; n++) {
+		free (udi_array[n]);
+		libhal_free_property_set (prop_array[n]);
+	}
+	free (udi_array);
+	free (prop_array);
+
+	dbus_message_unref (reply);
+
+	return FALSE;
+}
+
+
+/*
+ * Asynchronous API
+ *
+ * These send the method call and return right away; the callback is
+ * invoked from dbus_connection_dispatch(), i.e. from the main loop the
+ * connection is integrated into, once hald has replied. Any number of
+ * calls can be in flight at the same time.
+ */
+
+typedef struct LibHalAsyncCall_s LibHalAsyncCall;
+
+struct LibHalAsyncCall_s {
+	LibHalContext *ctx;
+	void (*handle_reply) (LibHalAsyncCall *call, DBusMessage *reply, DBusError *error);
+	LibHalPropertySetReply property_set_reply;
+	LibHalStringArrayReply string_array_reply;
+	LibHalVoidReply void_reply;
+	void *user_data;
+	char *udi;
+};
+
+static LibHalAsyncCall *
+async_call_new (LibHalContext *ctx, void *user_data)
+{
+	LibHalAsyncCall *call;
+
+	call = calloc (1, sizeof (LibHalAsyncCall));
+	if (call == NULL)
+		return NULL;
+	call->ctx = ctx;
+	call->user_data = user_data;
+	return call;
+}
+
+static void
+async_call_free (void *data)
+{
+	LibHalAsyncCall *call = (LibHalAsyncCall *) data;
+
+	free (call->udi);
+	free (call);
+}
+
+static void
+async_call_notify (DBusPendingCall *pending, void *user_data)
+{
+	LibHalAsyncCall *call = (LibHalAsyncCall *) user_data;
+	DBusMessage *reply;
+	DBusError error;
+
+	dbus_error_init (&error);
+	reply = dbus_pending_call_steal_reply (pending);
+	if (reply == NULL)
+		dbus_set_error (&error, DBUS_ERROR_NO_REPLY, "No reply from hald");
+	else
+		dbus_set_error_from_message (&error, reply);
+
+	call->handle_reply (call, dbus_error_is_set (&error) ? NULL : reply, &error);
+
+	dbus_error_free (&error);
+	if (reply != NULL)
+		dbus_message_unref (reply);
+}
+
+/* Takes ownership of both message and call */
+static dbus_bool_t
+async_call_send (LibHalAsyncCall *call, DBusMessage *message, DBusError *error)
+{
+	DBusPendingCall *pending;
+
+	if (!dbus_connection_send_with_reply (call->ctx->connection, message, &pending, -1)) {
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't send message to hald");
+		goto fail;
+	}
+	if (pending == NULL) {
+		dbus_set_error (error, DBUS_ERROR_DISCONNECTED, "Not connected to the bus");
+		goto fail;
+	}
+	if (!dbus_pending_call_set_notify (pending, async_call_notify, call, async_call_free)) {
+		dbus_pending_call_cancel (pending);
+		dbus_pending_call_unref (pending);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't set reply handler");
+		goto fail;
+	}
+
+	dbus_pending_call_unref (pending);
+	dbus_message_unref (message);
+	return TRUE;
+
+fail:
+	dbus_message_unref (message);
+	async_call_free (call);
+	return FALSE;
+}
+
+static void
+handle_property_set_reply (LibHalAsyncCall *call, DBusMessage *reply, DBusError *error)
+{
+	LibHalPropertySet *set;
+	DBusMessageIter reply_iter;
+
+	if (call->property_set_reply == NULL)
+		return;
+
+	set = NULL;
+	if (reply != NULL) {
+		dbus_message_iter_init (reply, &reply_iter);
+		set = get_property_set (&reply_iter);
+		if (set == NULL)
+			dbus_set_error (error, DBUS_ERROR_INVALID_ARGS, "Malformed reply from hald");
+	}
+
+	call->property_set_reply (call->ctx, call->udi, set,
+				  dbus_error_is_set (error) ? error : NULL,
+				  call->user_data);
+}
+
+static void
+handle_string_array_reply (LibHalAsyncCall *call, DBusMessage *reply, DBusError *error)
+{
+	DBusMessageIter reply_iter;
+	DBusMessageIter iter_array;
+	char **strings;
+	int num_strings;
+
+	if (call->string_array_reply == NULL)
+		return;
+
+	strings = NULL;
+	num_strings = 0;
+	if (reply != NULL) {
+		dbus_message_iter_init (reply, &reply_iter);
+		if (dbus_message_iter_get_arg_type (&reply_iter) != DBUS_TYPE_ARRAY) {
+			dbus_set_error (error, DBUS_ERROR_INVALID_ARGS, "Malformed reply from hald");
+		} else {
+			dbus_message_iter_recurse (&reply_iter, &iter_array);
+			strings = libhal_get_string_array_from_iter (&iter_array, &num_strings);
+			if (strings == NULL)
+				dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		}
+	}
+
+	call->string_array_reply (call->ctx, strings, num_strings,
+				  dbus_error_is_set (error) ? error : NULL,
+				  call->user_data);
+}
+
+static void
+handle_void_reply (LibHalAsyncCall *call, DBusMessage *reply, DBusError *error)
+{
+	if (call->void_reply == NULL)
+		return;
+
+	call->void_reply (call->ctx,
+			  dbus_error_is_set (error) ? error : NULL,
+			  call->user_data);
+}
+
+/**
+ * libhal_device_get_all_properties_async:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique id of device
+ * @callback: function to call with the properties
+ * @user_data: user data to pass to @callback
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Asynchronous version of libhal_device_get_all_properties(). The
+ * callback owns the property set it is given and must free it with
+ * libhal_free_property_set().
+ *
+ * Returns: TRUE if the request was sent; @callback will be invoked exactly once
+ */
+dbus_bool_t
+libhal_device_get_all_properties_async (LibHalContext *ctx,
+					const char *udi,
+					LibHalPropertySetReply callback,
+					void *user_data,
+					DBusError *error)
+{
+	DBusMessage *message;
+	LibHalAsyncCall *call;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_UDI_VALID(udi, FALSE);
+
+	call = async_call_new (ctx, user_data);
+	if (call == NULL || (call->udi = strdup (udi)) == NULL) {
+		free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		return FALSE;
+	}
+	call->handle_reply = handle_property_set_reply;
+	call->property_set_reply = callback;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal", udi,
+						"org.freedesktop.Hal.Device",
+						"GetAllProperties");
+	if (message == NULL) {
+		async_call_free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't allocate D-BUS message");
+		return FALSE;
+	}
+
+	return async_call_send (call, message, error);
+}
+
+/**
+ * libhal_get_all_devices_async:
+ * @ctx: the context for the connection to hald
+ * @callback: function to call with the UDIs
+ * @user_data: user data to pass to @callback
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Asynchronous version of libhal_get_all_devices(). The callback owns
+ * the array it is given and must free it with
+ * libhal_free_string_array().
+ *
+ * Returns: TRUE if the request was sent; @callback will be invoked exactly once
+ */
+dbus_bool_t
+libhal_get_all_devices_async (LibHalContext *ctx,
+			      LibHalStringArrayReply callback,
+			      void *user_data,
+			      DBusError *error)
+{
+	DBusMessage *message;
+	LibHalAsyncCall *call;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+
+	call = async_call_new (ctx, user_data);
+	if (call == NULL) {
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		return FALSE;
+	}
+	call->handle_reply = handle_string_array_reply;
+	call->string_array_reply = callback;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"GetAllDevices");
+	if (message == NULL) {
+		async_call_free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't allocate D-BUS message");
+		return FALSE;
+	}
+
+	return async_call_send (call, message, error);
+}
+
+/**
+ * libhal_manager_find_device_string_match_async:
+ * @ctx: the context for the connection to hald
+ * @key: name of the property
+ * @value: the value to match
+ * @callback: function to call with the UDIs
+ * @user_data: user data to pass to @callback
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Asynchronous version of libhal_manager_find_device_string_match().
+ * The callback owns the array it is given and must free it with
+ * libhal_free_string_array().
+ *
+ * Returns: TRUE if the request was sent; @callback will be invoked exactly once
+ */
+dbus_bool_t
+libhal_manager_find_device_string_match_async (LibHalContext *ctx,
+					       const char *key,
+					       const char *value,
+					       LibHalStringArrayReply callback,
+					       void *user_data,
+					       DBusError *error)
+{
+	DBusMessage *message;
+	LibHalAsyncCall *call;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_PARAM_VALID(key, "*key", FALSE);
+	LIBHAL_CHECK_PARAM_VALID(value, "*value", FALSE);
+
+	call = async_call_new (ctx, user_data);
+	if (call == NULL) {
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		return FALSE;
+	}
+	call->handle_reply = handle_string_array_reply;
+	call->string_array_reply = callback;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"FindDeviceStringMatch");
+	if (message == NULL) {
+		async_call_free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't allocate D-BUS message");
+		return FALSE;
+	}
+
+	dbus_message_append_args (message,
+				  DBUS_TYPE_STRING, &key,
+				  DBUS_TYPE_STRING, &value,
+				  DBUS_TYPE_INVALID);
+
+	return async_call_send (call, message, error);
+}
+
+/**
+ * libhal_device_commit_changeset_async:
+ * @ctx: the context for the connection to hald
+ * @changeset: the changeset to commit
+ * @callback: function to call when the changeset was committed, or NULL
+ * @user_data: user data to pass to @callback
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Asynchronous version of libhal_device_commit_changeset(). The
+ * changeset can be freed as soon as this returns.
+ *
+ * Returns: TRUE if the request was sent; @callback will be invoked exactly once
+ */
+dbus_bool_t
+libhal_device_commit_changeset_async (LibHalContext *ctx,
+				      LibHalChangeSet *changeset,
+				      LibHalVoidReply callback,
+				      void *user_data,
+				      DBusError *error)
+{
+	DBusMessage *message;
+	LibHalAsyncCall *call;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_PARAM_VALID(changeset, "*changeset", FALSE);
+	LIBHAL_CHECK_UDI_VALID(changeset->udi, FALSE);
+
+	call = async_call_new (ctx, user_data);
+	if (call == NULL) {
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		return FALSE;
+	}
+	call->handle_reply = handle_void_reply;
+	call->void_reply = callback;
+
+	/* nothing to do, but still report back from the main loop like
+	 * any other call would */
+	if (changeset->head == NULL)
+		message = dbus_message_new_method_call ("org.freedesktop.DBus", "/org/freedesktop/DBus",
+							"org.freedesktop.DBus.Peer", "Ping");
+	else
+		message = changeset_new_message (changeset);
+	if (message == NULL) {
+		async_call_free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't allocate D-BUS message");
+		return FALSE;
+	}
+
+	return async_call_send (call, message, error);
+}
+
+/**
+ * libhal_device_emit_condition_async:
+ * @ctx: the context for the connection to hald
+ * @udi: the Unique Device Id
+ * @condition_name: user-readable name of condition
+ * @condition_details: user-readable details of condition
+ * @callback: function to call when the condition was emitted, or NULL
+ * @user_data: user data to pass to @callback
+ * @error: pointer to an initialized dbus error object for returning errors or NULL
+ *
+ * Asynchronous version of libhal_device_emit_condition(). Can only be
+ * used from hald helpers.
+ *
+ * Returns: TRUE if the request was sent; @callback will be invoked exactly once
+ */
+dbus_bool_t
+libhal_device_emit_condition_async (LibHalContext *ctx,
+				    const char *udi,
+				    const char *condition_name,
+				    const char *condition_details,
+				    LibHalVoidReply callback,
+				    void *user_data,
+				    DBusError *error)
+{
+	DBusMessage *message;
+	LibHalAsyncCall *call;
+
+	LIBHAL_CHECK_LIBHALCONTEXT(ctx, FALSE);
+	LIBHAL_CHECK_UDI_VALID(udi, FALSE);
+	LIBHAL_CHECK_PARAM_VALID(condition_name, "*condition_name", FALSE);
+	LIBHAL_CHECK_PARAM_VALID(condition_details, "*condition_details", FALSE);
+
+	call = async_call_new (ctx, user_data);
+	if (call == NULL) {
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+		return FALSE;
+	}
+	call->handle_reply = handle_void_reply;
+	call->void_reply = callback;
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						udi,
+						"org.freedesktop.Hal.Device",
+						"EmitCondition");
+	if (message == NULL) {
+		async_call_free (call);
+		dbus_set_error (error, DBUS_ERROR_NO_MEMORY, "Couldn't allocate D-BUS message");
+		return FALSE;
+	}
+
+	dbus_message_append_args (message,
+				  DBUS_TYPE_STRING, &condition_name,
+				  DBUS_TYPE_STRING, &condition_details,
+				  DBUS_TYPE_INVALID);
+
+	return async_call_send (call, message, error);
+}
@@ -185,6 +185,27 @@ typedef void (*LibHalDevicePropertyModified) (LibHalContext *ctx,
 					      dbus_bool_t is_removed,
 					      dbus_bool_t is_added);
 
+/** 
+ * LibHalDevicePropertiesChanged:
+ * @ctx: context for connection to hald
+ * @udi: the Unique Device Id
+ * @changed: the new values of the properties that were added or changed
+ * @removed: NULL-terminated array of the names of removed properties
+ * @added: NULL-terminated array of the names of the properties in
+ * @changed that are new on the device
+ *
+ * Type for callback when properties of a device change; unlike
+ * #LibHalDevicePropertyModified it gets the new values. Only invoked
+ * for devices watched with libhal_device_add_properties_watch(),
+ * libhal_device_properties_watch_all() or
+ * libhal_device_subscribe_properties().
+ */
+typedef void (*LibHalDevicePropertiesChanged) (LibHalContext *ctx,
+					       const char *udi,
+					       const LibHalPropertySet *changed,
+					       const char **removed,
+					       const char **added);
+
 /** 
  * LibHalDeviceCondition:
  * @ctx: context for connection to hald
@@ -283,6 +304,50 @@ typedef void (*LibHalSingletonDeviceRemoved) (LibHalContext *ctx,
 					    const char *udi,
 					    const LibHalPropertySet *properties);
 
+/**
+ * LibHalPropertySetReply:
+ * @ctx: context for connection to hald
+ * @udi: the Unique Device Id the properties were requested for
+ * @properties: the properties or NULL on error; free with libhal_free_property_set()
+ * @error: what went wrong or NULL on success
+ * @user_data: user data passed when the call was made
+ *
+ * Type for callback for asynchronous calls returning a property set
+ */
+typedef void (*LibHalPropertySetReply) (LibHalContext *ctx,
+					const char *udi,
+					LibHalPropertySet *properties,
+					const DBusError *error,
+					void *user_data);
+
+/**
+ * LibHalStringArrayReply:
+ * @ctx: context for connection to hald
+ * @strings: NULL terminated array or NULL on error; free with libhal_free_string_array()
+ * @num_strings: number of elements in @strings
+ * @error: what went wrong or NULL on success
+ * @user_data: user data passed when the call was made
+ *
+ * Type for callback for asynchronous calls returning a list of strings
+ */
+typedef void (*LibHalStringArrayReply) (LibHalContext *ctx,
+					char **strings,
+					int num_strings,
+					const DBusError *error,
+					void *user_data);
+
+/**
+ * LibHalVoidReply:
+ * @ctx: context for connection to hald
+ * @error: what went wrong or NULL on success
+ * @user_data: user data passed when the call was made
+ *
+ * Type for callback for asynchronous calls not returning anything
+ */
+typedef void (*LibHalVoidReply) (LibHalContext *ctx,
+				 const DBusError *error,
+				 void *user_data);
+
 
 
 /* Create a new context for a connection with hald */
@@ -318,6 +383,9 @@ dbus_bool_t    libhal_ctx_set_device_lost_capability   (LibHalContext *ctx, LibH
 /* Set the callback for when a property is modified on a device */
 dbus_bool_t    libhal_ctx_set_device_property_modified (LibHalContext *ctx, LibHalDevicePropertyModified callback);
 
+/* Set the callback, with the new values, for when properties change on a device */
+dbus_bool_t    libhal_ctx_set_device_properties_changed (LibHalContext *ctx, LibHalDevicePropertiesChanged callback);
+
 /* Set the callback for when a device emits a condition */
 dbus_bool_t    libhal_ctx_set_device_condition         (LibHalContext *ctx, LibHalDeviceCondition callback);
 
@@ -525,6 +593,15 @@ dbus_bool_t libhal_get_all_devices_with_properties (LibHalContext       *ctx,
                                                     LibHalPropertySet ***out_properties, 
                                                     DBusError           *error);
 
+/* Get selected properties of many devices in one call */
+dbus_bool_t libhal_get_properties (LibHalContext       *ctx,
+				   const char         **udis,
+				   const char         **keys,
+				   int                 *out_num_devices,
+				   char              ***out_udi,
+				   LibHalPropertySet ***out_properties,
+				   DBusError           *error);
+
 /* sort all properties according to property name */
 void libhal_property_set_sort (LibHalPropertySet *set);
 
@@ -659,6 +736,18 @@ char **libhal_manager_find_device_string_match (LibHalContext *ctx,
 						int *num_devices,
 						DBusError *error);
 
+/* Get the devices whose info.parent is the given device. */
+char **libhal_manager_get_children (LibHalContext *ctx,
+				    const char *udi,
+				    int *num_devices,
+				    DBusError *error);
+
+/* Get all devices in the subtree below the given device. */
+char **libhal_manager_get_descendants (LibHalContext *ctx,
+				       const char *udi,
+				       int *num_devices,
+				       DBusError *error);
+
 /* Assign a capability to a device. */
 dbus_bool_t libhal_device_add_capability (LibHalContext *ctx,
 					  const char *udi,
@@ -702,6 +791,44 @@ dbus_bool_t libhal_device_remove_property_watch (LibHalContext *ctx,
 						 const char *udi,
 						 DBusError *error);
 
+/* Watch all devices, ie. the device_properties_changed callback is
+ * invoked with the new values when the properties on any device change.
+ */
+dbus_bool_t libhal_device_properties_watch_all (LibHalContext *ctx,
+						DBusError *error);
+
+/* Remove a watch of the values of all devices.
+ */
+dbus_bool_t libhal_device_properties_remove_watch_all (LibHalContext *ctx,
+						       DBusError *error);
+
+/* Add a watch on a device, so the device_properties_changed callback
+ * is invoked with the new values when the properties on the given
+ * device change.
+ */
+dbus_bool_t libhal_device_add_properties_watch (LibHalContext *ctx, 
+						const char *udi,
+						DBusError *error);
+
+/* Remove a watch on the values of a device */
+dbus_bool_t libhal_device_remove_properties_watch (LibHalContext *ctx, 
+						   const char *udi,
+						   DBusError *error);
+
+/* Ask hald to send changes of the given properties, on devices with
+ * the given capability, only to this connection.
+ */
+dbus_bool_t libhal_device_subscribe_properties (LibHalContext *ctx,
+						const char **keys,
+						const char *capability,
+						dbus_uint32_t *subscription,
+						DBusError *error);
+
+/* End a subscription made with libhal_device_subscribe_properties() */
+dbus_bool_t libhal_device_unsubscribe_properties (LibHalContext *ctx,
+						  dbus_uint32_t subscription,
+						  DBusError *error);
+
 /* Take an advisory lock on the device. */
 dbus_bool_t libhal_device_lock (LibHalContext *ctx,
 				const char *udi,
@@ -785,6 +912,48 @@ char* libhal_device_is_caller_privileged (LibHalContext *ctx,
                                           const char *caller,
                                           DBusError *error);
 
+/* Asynchronous versions of some of the calls above. They return as
+ * soon as the request is sent; the callback is invoked when the
+ * connection is dispatched and hald has replied.
+ */
+
+/* Retrieve all the properties on a device. */
+dbus_bool_t libhal_device_get_all_properties_async (LibHalContext *ctx,
+						    const char *udi,
+						    LibHalPropertySetReply callback,
+						    void *user_data,
+						    DBusError *error);
+
+/* Get all devices in the Global Device List (GDL). */
+dbus_bool_t libhal_get_all_devices_async (LibHalContext *ctx,
+					  LibHalStringArrayReply callback,
+					  void *user_data,
+					  DBusError *error);
+
+/* Find a device in the GDL where a single string property matches a given value. */
+dbus_bool_t libhal_manager_find_device_string_match_async (LibHalContext *ctx,
+							   const char *key,
+							   const char *value,
+							   LibHalStringArrayReply callback,
+							   void *user_data,
+							   DBusError *error);
+
+/* Commit a changeset to the daemon. */
+dbus_bool_t libhal_device_commit_changeset_async (LibHalContext *ctx,
+						  LibHalChangeSet *changeset,
+						  LibHalVoidReply callback,
+						  void *user_data,
+						  DBusError *error);
+
+/* Emit a condition from a device (for hald helpers only) */
+dbus_bool_t libhal_device_emit_condition_async (LibHalContext *ctx,
+						const char *udi,
+						const char *condition_name,
+						const char *condition_details,
+						LibHalVoidReply callback,
+						void *user_data,
+						DBusError *error);
+
 
 #if defined(__cplusplus)
 }
@@ -870,6 +870,11 @@ part_table_load_from_disk (char *device)
 		goto out;
 	}
 
+	/* The MBR, the GPT header and entries and the Apple partition
+	 * map all live in the first few sectors; have the kernel read
+	 * them in one request instead of one per sector we look at */
+	posix_fadvise (fd, 0, 64 * 1024, POSIX_FADV_WILLNEED);
+
 	p = part_table_parse_msdos (fd, 0, size, &found_gpt);
 	if (p != NULL) {
 		HAL_INFO (("MSDOS partition table detected"));
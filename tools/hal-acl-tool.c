@@ -1036,6 +1036,9 @@ acl_reconfigure_all (void)
 	int i;
 	int num_devices;
 	char **udis;
+	char **prop_udis;
+	LibHalPropertySet **prop_sets;
+	const char *keys[] = {"access_control.*", NULL};
 	DBusError error;
 	GSList *afd_list = NULL;
 
@@ -1050,20 +1053,29 @@ acl_reconfigure_all (void)
 		goto out;
 	}
 
-	for (i = 0; udis[i] != NULL; i++) {
-		LibHalPropertySet *props;
+	/* fetch the access_control.* properties of all of them at once;
+	 * no UDIs would mean every device */
+	if (num_devices == 0) {
+		libhal_free_string_array (udis);
+		goto out;
+	}
+	if (!libhal_get_properties (hal_ctx, (const char **) udis, keys,
+				    &num_devices, &prop_udis, &prop_sets, &error)) {
+		printf ("%d: Cannot get properties of devices of capability 'acl'\n", getpid ());
+		libhal_free_string_array (udis);
+		goto out;
+	}
+	libhal_free_string_array (udis);
+
+	for (i = 0; prop_udis[i] != NULL; i++) {
+		LibHalPropertySet *props = prop_sets[i];
 		LibHalPropertySetIterator psi;
 		char *device = NULL;
                 char *type = NULL;
 		ACLForDevice *afd;
 		char **sv;
 
-		if ((props = libhal_device_get_all_properties (hal_ctx, udis[i], &error)) == NULL) {
-			printf ("%d: Cannot get list properties for '%s'\n", getpid (), udis[1]);
-			goto out;
-		}
-
-		afd = acl_for_device_new (udis[i]);
+		afd = acl_for_device_new (prop_udis[i]);
 
 		libhal_psi_init (&psi, props);
 		while (libhal_psi_has_more (&psi)) {
@@ -1084,13 +1096,13 @@ acl_reconfigure_all (void)
 		}
 
 		if (device == NULL) {
-			printf ("%d: access_control.file not set for '%s'\n", getpid (), udis[i]);
+			printf ("%d: access_control.file not set for '%s'\n", getpid (), prop_udis[i]);
                         acl_for_device_free (afd);
                         goto skip;
 		}
 
 		if (type == NULL) {
-			printf ("%d: access_control.type not set for '%s'\n", getpid (), udis[i]);
+			printf ("%d: access_control.type not set for '%s'\n", getpid (), prop_udis[i]);
                         acl_for_device_free (afd);
                         goto skip;
 		}
@@ -1101,7 +1113,8 @@ acl_reconfigure_all (void)
         skip:
 		libhal_free_property_set (props);
 	}
-	libhal_free_string_array (udis);
+	libhal_free_string_array (prop_udis);
+	free (prop_sets);
 
 	if (g_slist_length (afd_list) > 0) {
 		if (!visit_seats_and_sessions (acl_device_added_visitor, (gpointer) afd_list)) {
@@ -0,0 +1,202 @@
+/***************************************************************************
+ *
+ * hal-stats.c : Show the statistics kept by the HAL daemon
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <glib.h>
+#include <dbus/dbus.h>
+
+typedef struct {
+	char *name;
+	dbus_uint64_t value;
+} Statistic;
+
+/**
+ *  usage:
+ *  @argc:                Number of arguments given to program
+ *  @argv:                Arguments given to program
+ *
+ *  Print out program usage.
+ */
+static void
+usage (int argc, char *argv[])
+{
+	fprintf (stderr,
+                 "\n"
+                 "usage : hal-stats [--filter <prefix>] [--help] [--version]\n");
+	fprintf (stderr,
+                 "\n"
+                 "        --filter         Only show statistics starting with prefix\n"
+                 "        --version        Show version and exit\n"
+                 "        --help           Show this information and exit\n"
+                 "\n"
+                 "This program shows the counters, gauges and latency histograms\n"
+                 "kept by the HAL daemon.\n"
+                 "\n");
+}
+
+static gint
+compare_statistic (gconstpointer a, gconstpointer b)
+{
+	return strcmp (((const Statistic *) a)->name, ((const Statistic *) b)->name);
+}
+
+/**
+ *  main:
+ *  @argc:                Number of arguments given to program
+ *  @argv:                Arguments given to program
+ *
+ *  Returns:              Return code
+ *
+ *  Main entry point
+ */
+int
+main (int argc, char *argv[])
+{
+	char *filter = NULL;
+	dbus_bool_t is_version = FALSE;
+	DBusError error;
+	DBusConnection *connection;
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter iter_dict;
+	GSList *stats;
+	GSList *i;
+
+	while (1) {
+		int c;
+		int option_index = 0;
+		const char *opt;
+		static struct option long_options[] = {
+			{"filter", 1, NULL, 0},
+			{"version", 0, NULL, 0},
+			{"help", 0, NULL, 0},
+			{NULL, 0, NULL, 0}
+		};
+
+		c = getopt_long (argc, argv, "",
+				 long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			opt = long_options[option_index].name;
+
+			if (strcmp (opt, "help") == 0) {
+				usage (argc, argv);
+				return 0;
+			} else if (strcmp (opt, "version") == 0) {
+				is_version = TRUE;
+			} else if (strcmp (opt, "filter") == 0) {
+				filter = strdup (optarg);
+			}
+			break;
+
+		default:
+			usage (argc, argv);
+			return 1;
+			break;
+		}
+	}
+
+	if (is_version) {
+		printf ("hal-stats " PACKAGE_VERSION "\n");
+		return 0;
+	}
+
+	dbus_error_init (&error);
+	connection = dbus_bus_get (DBUS_BUS_SYSTEM, &error);
+	if (connection == NULL) {
+		fprintf (stderr, "error: dbus_bus_get: %s: %s\n", error.name, error.message);
+		dbus_error_free (&error);
+		return 1;
+	}
+
+	message = dbus_message_new_method_call ("org.freedesktop.Hal",
+						"/org/freedesktop/Hal/Manager",
+						"org.freedesktop.Hal.Manager",
+						"GetStatistics");
+	if (message == NULL) {
+		fprintf (stderr, "error: out of memory\n");
+		return 1;
+	}
+
+	reply = dbus_connection_send_with_reply_and_block (connection, message, -1, &error);
+	dbus_message_unref (message);
+	if (reply == NULL) {
+		fprintf (stderr, "error: %s: %s\n", error.name, error.message);
+		dbus_error_free (&error);
+		return 1;
+	}
+
+	dbus_message_iter_init (reply, &iter);
+	if (dbus_message_iter_get_arg_type (&iter) != DBUS_TYPE_ARRAY) {
+		fprintf (stderr, "error: unexpected reply\n");
+		dbus_message_unref (reply);
+		return 1;
+	}
+
+	stats = NULL;
+	dbus_message_iter_recurse (&iter, &iter_dict);
+	while (dbus_message_iter_get_arg_type (&iter_dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter iter_entry;
+		const char *name;
+		Statistic *s;
+
+		dbus_message_iter_recurse (&iter_dict, &iter_entry);
+		dbus_message_iter_get_basic (&iter_entry, &name);
+		dbus_message_iter_next (&iter_entry);
+
+		if (filter == NULL || g_str_has_prefix (name, filter)) {
+			s = g_new0 (Statistic, 1);
+			s->name = g_strdup (name);
+			dbus_message_iter_get_basic (&iter_entry, &s->value);
+			stats = g_slist_prepend (stats, s);
+		}
+
+		dbus_message_iter_next (&iter_dict);
+	}
+	dbus_message_unref (reply);
+
+	stats = g_slist_sort (stats, compare_statistic);
+	for (i = stats; i != NULL; i = g_slist_next (i)) {
+		Statistic *s = i->data;
+
+		printf ("%s %" G_GUINT64_FORMAT "\n", s->name, (guint64) s->value);
+		g_free (s->name);
+		g_free (s);
+	}
+	g_slist_free (stats);
+
+	free (filter);
+
+	return 0;
+}
@@ -425,74 +425,65 @@ device_lost_capability (LibHalContext *ctx,
 
 /** 
  *  print_property:
- *  @udi:                 Universal Device Id
+ *  @set:                 New values of the changed properties
  *  @key:                 Key of property
  *
- *  Acquires and prints the value of of a property to stdout. 
+ *  Prints the value of of a property to stdout. 
  */
 static void
-print_property (const char *udi, const char *key)
+print_property (const LibHalPropertySet *set, const char *key)
 {
 	int type;
-	char *str;
-	DBusError error;
-
-	dbus_error_init (&error);
 
-	type = libhal_device_get_property_type (hal_ctx, udi, key, &error);
+	type = libhal_ps_get_type (set, key);
 
 	switch (type) {
 	case LIBHAL_PROPERTY_TYPE_STRING:
-		str = libhal_device_get_property_string (hal_ctx, udi, key, &error);
-		printf (long_list?"*** new value: '%s'  (string)\n":"'%s'", str);
-		libhal_free_string (str);
+		printf (long_list?"*** new value: '%s'  (string)\n":"'%s'",
+			libhal_ps_get_string (set, key));
 		break;
 	case LIBHAL_PROPERTY_TYPE_INT32:
 		{
-			dbus_int32_t value = libhal_device_get_property_int (hal_ctx, udi, key, &error);
+			dbus_int32_t value = libhal_ps_get_int32 (set, key);
 			printf (long_list?"*** new value: %d (0x%x)  (int)\n":"%d (0x%x)",
 				 value, value);
 		}
 		break;
 	case LIBHAL_PROPERTY_TYPE_UINT64:
 		{
-			dbus_uint64_t value = libhal_device_get_property_uint64 (hal_ctx, udi, key, &error);
+			dbus_uint64_t value = libhal_ps_get_uint64 (set, key);
 			printf (long_list?"*** new value: %llu (0x%llx)  (uint64)\n":"%llu (0x%llx)",
 				(long long unsigned int) value, (long long unsigned int) value);
 		}
 		break;
 	case LIBHAL_PROPERTY_TYPE_DOUBLE:
 		printf (long_list?"*** new value: %g  (double)\n":"%g",
-			libhal_device_get_property_double (hal_ctx, udi, key, &error));
+			libhal_ps_get_double (set, key));
 		break;
 	case LIBHAL_PROPERTY_TYPE_BOOLEAN:
 		printf (long_list?"*** new value: %s  (bool)\n":"%s",
-			libhal_device_get_property_bool (hal_ctx, udi, key, &error) ? "true" : "false");
+			libhal_ps_get_bool (set, key) ? "true" : "false");
 		break;
 	case LIBHAL_PROPERTY_TYPE_STRLIST:
 	{
 		unsigned int i;
-		char **strlist;
+		const char * const *strlist;
 
 		if (long_list)
 			printf ("*** new value: {");
 		else
 			printf ("{");
 
-		strlist = libhal_device_get_property_strlist (hal_ctx, udi, key, &error);
-                /* may be NULL because property may have been removed */
-                if (strlist != NULL) {
-                        for (i = 0; strlist[i] != NULL; i++) {
-                                printf ("'%s'", strlist[i]);
-                                if (strlist[i+1] != NULL)
-                                        printf (", ");
-                        }
-                        if (long_list)
-                                printf ("}  (string list)\n");
-                        else
-                                printf ("}");
-                        libhal_free_string_array (strlist);
-                }
+		strlist = libhal_ps_get_strlist (set, key);
+		for (i = 0; strlist != NULL && strlist[i] != NULL; i++) {
+			printf ("'%s'", strlist[i]);
+			if (strlist[i+1] != NULL)
+				printf (", ");
+		}
+		if (long_list)
+			printf ("}  (string list)\n");
+		else
+			printf ("}");
 		break;
 	}
 
@@ -500,53 +491,68 @@ print_property (const char *udi, const char *key)
 		fprintf (stderr, "Unknown type %d='%c'\n", type, type);
 		break;
 	}
-
-	if (dbus_error_is_set (&error))
-		dbus_error_free (&error);
 }
 
 /** 
- *  property_modified:
+ *  properties_changed:
  *  @ctx:		The HAL Context
  *  @udi:               Univerisal Device Id
- *  @key:               Key of property
- *  @is_removed:        if the property was removed
- *  @is_added:          if the property was added
+ *  @changed:           New values of the added or changed properties
+ *  @removed:           Keys of the removed properties
+ *  @added:             Keys of the properties in @changed that are new
  * 
- *  Invoked when a property of a device in the Global Device List is
+ *  Invoked when properties of a device in the Global Device List are
  *  changed, and we have we have subscribed to changes for that device. 
  */
 static void
-property_modified (LibHalContext *ctx,
-		   const char *udi,
-		   const char *key,
-		   dbus_bool_t is_removed,
-		   dbus_bool_t is_added)
+properties_changed (LibHalContext *ctx,
+		    const char *udi,
+		    const LibHalPropertySet *changed,
+		    const char **removed,
+		    const char **added)
 {
+	LibHalPropertySetIterator it;
+	unsigned int i;
+
 	if (show_device && strcmp(show_device, udi))
 		return;
 
-	if (long_list) {
-		printf ("*** %s: lshal: property_modified, udi=%s, key=%s\n",
-			get_time (), udi, key);
-		printf ("           is_removed=%s, is_added=%s\n",
-			is_removed ? "true" : "false",
-			is_added ? "true" : "false");
-		if (!is_removed)
-			print_property (udi, key);
-		printf ("\n");
-	} else {
-		printf ("%s: %s property %s ", get_time (), short_name (udi), key);
-		if (is_removed)
-			printf ("removed");
-		else {
-			printf ("= ");
-			print_property (udi, key);
+	for (libhal_psi_init (&it, (LibHalPropertySet *) changed); libhal_psi_has_more (&it); libhal_psi_next (&it)) {
+		const char *key = libhal_psi_get_key (&it);
+		dbus_bool_t is_added;
 
+		is_added = FALSE;
+		for (i = 0; added[i] != NULL; i++) {
+			if (strcmp (added[i], key) == 0) {
+				is_added = TRUE;
+				break;
+			}
+		}
+
+		if (long_list) {
+			printf ("*** %s: lshal: property_modified, udi=%s, key=%s\n",
+				get_time (), udi, key);
+			printf ("           is_removed=false, is_added=%s\n",
+				is_added ? "true" : "false");
+			print_property (changed, key);
+			printf ("\n");
+		} else {
+			printf ("%s: %s property %s = ", get_time (), short_name (udi), key);
+			print_property (changed, key);
 			if (is_added)
 				printf (" (new)");
+			printf ("\n");
+		}
+	}
+
+	for (i = 0; removed[i] != NULL; i++) {
+		if (long_list) {
+			printf ("*** %s: lshal: property_modified, udi=%s, key=%s\n",
+				get_time (), udi, removed[i]);
+			printf ("           is_removed=true, is_added=false\n\n");
+		} else {
+			printf ("%s: %s property %s removed\n", get_time (), short_name (udi), removed[i]);
 		}
-		printf ("\n");
 	}
 }
 
@@ -819,7 +825,7 @@ main (int argc, char *argv[])
 	libhal_ctx_set_device_removed (hal_ctx, device_removed);
 	libhal_ctx_set_device_new_capability (hal_ctx, device_new_capability);
 	libhal_ctx_set_device_lost_capability (hal_ctx, device_lost_capability);
-	libhal_ctx_set_device_property_modified (hal_ctx, property_modified);
+	libhal_ctx_set_device_properties_changed (hal_ctx, properties_changed);
 	libhal_ctx_set_device_condition (hal_ctx, device_condition);
 	libhal_ctx_set_global_interface_lock_acquired (hal_ctx, global_interface_lock_acquired);
 	libhal_ctx_set_global_interface_lock_released (hal_ctx, global_interface_lock_released);
@@ -844,6 +850,12 @@ main (int argc, char *argv[])
 			LIBHAL_FREE_DBUS_ERROR (&error);
 			return 1;
 		}
+		if ( libhal_device_properties_watch_all (hal_ctx, &error) == FALSE) {
+			fprintf (stderr, "error: monitoring devicelist - libhal_device_properties_watch_all: %s: %s\n",
+				 error.name, error.message);
+			LIBHAL_FREE_DBUS_ERROR (&error);
+			return 1;
+		}
 		printf ("\nStart monitoring devicelist:\n"
 			"-------------------------------------------------\n");
 		g_main_loop_run (loop);